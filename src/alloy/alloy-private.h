@@ -16,6 +16,21 @@ DECLARE_bool(debug);
 DECLARE_bool(always_disasm);
 
 DECLARE_bool(validate_hir);
+DECLARE_bool(log_compiler_stats);
+DECLARE_bool(log_compiler_pass_stats);
+DECLARE_bool(store_all_context_values);
+DECLARE_bool(drop_call_clobbered_context);
+DECLARE_bool(validate_memory_forwarding);
+DECLARE_int32(inline_max_instructions);
+
+DECLARE_bool(tiered_compilation);
+
+DECLARE_string(code_cache_path);
+DECLARE_bool(code_cache_guard_pages);
+DECLARE_bool(code_cache_wx);
+
+DECLARE_bool(ic_stats);
+DECLARE_bool(x64_baseline_isa);
 
 DECLARE_uint64(break_on_instruction);
 DECLARE_uint64(break_on_memory);
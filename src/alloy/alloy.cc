@@ -26,6 +26,32 @@ DEFINE_bool(
 
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.");
+DEFINE_bool(log_compiler_stats, false,
+            "Log per-function HIR instruction counts before and after "
+            "optimization.");
+DEFINE_bool(log_compiler_pass_stats, false,
+            "Log the time spent in and instructions removed by each compiler "
+            "pass, and the byte swaps removed in each module, at shutdown.");
+DEFINE_int32(inline_max_instructions, 24,
+             "Inline calls to straight-line leaf functions of up to this many "
+             "guest instructions. 0 disables inlining.");
+
+DEFINE_string(code_cache_path, "",
+              "Directory to persist translated code in between runs. Empty "
+              "disables the code cache.");
+DEFINE_bool(code_cache_guard_pages, false,
+            "Surround each chunk of JITed code with inaccessible pages.");
+DEFINE_bool(code_cache_wx, false,
+            "Never map JITed code writable and executable at once. Code is "
+            "written through a separate writable alias instead.");
+
+DEFINE_bool(ic_stats, false,
+            "Count indirect call inline cache hits in JITed code and log "
+            "per call site IC stats at shutdown.");
+DEFINE_bool(x64_baseline_isa, false,
+            "Only use the baseline instruction set (AVX) in JITed code, "
+            "ignoring any other extensions the host supports. Useful to A/B "
+            "the specialized sequences.");
 
 // Breakpoints:
 DEFINE_uint64(break_on_instruction, 0,
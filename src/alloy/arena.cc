@@ -35,16 +35,21 @@ void Arena::Reset() {
 }
 
 void Arena::DebugFill() {
+  // Only what has been handed out, as chunks are large and mostly unused.
   auto chunk = head_chunk_;
   while (chunk) {
-    memset(chunk->buffer, 0xCD, chunk->capacity);
+    memset(chunk->buffer, 0xCD, chunk->offset);
+    if (chunk == active_chunk_) {
+      break;
+    }
     chunk = chunk->next;
   }
 }
 
-void* Arena::Alloc(size_t size) {
+void* Arena::Alloc(size_t size, size_t alignment) {
   if (active_chunk_) {
-    if (active_chunk_->capacity - active_chunk_->offset < size + 4096) {
+    size_t offset = poly::round_up(active_chunk_->offset, alignment);
+    if (active_chunk_->capacity - offset < size + 4096) {
       Chunk* next = active_chunk_->next;
       if (!next) {
         assert_true(size < chunk_size_, "need to support larger chunks");
@@ -53,6 +58,8 @@ void* Arena::Alloc(size_t size) {
       }
       next->offset = 0;
       active_chunk_ = next;
+    } else {
+      active_chunk_->offset = offset;
     }
   } else {
     head_chunk_ = active_chunk_ = new Chunk(chunk_size_);
@@ -63,7 +70,7 @@ void* Arena::Alloc(size_t size) {
   return p;
 }
 
-void* Arena::CloneContents() {
+size_t Arena::used_size() const {
   size_t total_length = 0;
   Chunk* chunk = head_chunk_;
   while (chunk) {
@@ -73,9 +80,14 @@ void* Arena::CloneContents() {
     }
     chunk = chunk->next;
   }
+  return total_length;
+}
+
+void* Arena::CloneContents() {
+  size_t total_length = used_size();
   void* result = malloc(total_length);
   uint8_t* p = (uint8_t*)result;
-  chunk = head_chunk_;
+  Chunk* chunk = head_chunk_;
   while (chunk) {
     memcpy(p, chunk->buffer, chunk->offset);
     p += chunk->offset;
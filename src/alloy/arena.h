@@ -20,15 +20,21 @@ class Arena {
   Arena(size_t chunk_size = 4 * 1024 * 1024);
   ~Arena();
 
+  // Rewinds to the first chunk. Chunks are kept around so that reuse of the
+  // arena (across translations, etc) doesn't touch the system allocator.
   void Reset();
+  // Fills the memory allocated since the last Reset.
   void DebugFill();
 
-  void* Alloc(size_t size);
+  void* Alloc(size_t size, size_t alignment = 1);
   template <typename T>
   T* Alloc() {
-    return reinterpret_cast<T*>(Alloc(sizeof(T)));
+    return reinterpret_cast<T*>(Alloc(sizeof(T), alignof(T)));
   }
 
+  // Bytes allocated since the last Reset, including alignment padding.
+  size_t used_size() const;
+
   void* CloneContents();
 
  private:
@@ -12,13 +12,14 @@
 
 #include <memory>
 
+#include "alloy/runtime/function.h"
+
 namespace alloy {
 namespace hir {
 class HIRBuilder;
 }  // namespace hir
 namespace runtime {
 class DebugInfo;
-class Function;
 class FunctionInfo;
 class Runtime;
 }  // namespace runtime
@@ -41,7 +42,7 @@ class Assembler {
   virtual int Assemble(runtime::FunctionInfo* symbol_info,
                        hir::HIRBuilder* builder, uint32_t debug_info_flags,
                        std::unique_ptr<runtime::DebugInfo> debug_info,
-                       uint32_t trace_flags,
+                       uint32_t trace_flags, runtime::FunctionTier tier,
                        runtime::Function** out_function) = 0;
 
  protected:
@@ -26,5 +26,28 @@ void* Backend::AllocThreadData() { return nullptr; }
 
 void Backend::FreeThreadData(void* thread_data) {}
 
+int Backend::OpenCodeCache(runtime::Module* module,
+                           const std::string& cache_key) {
+  return 1;
+}
+
+int Backend::LoadCachedFunction(runtime::FunctionInfo* symbol_info,
+                                runtime::Function** out_function) {
+  *out_function = nullptr;
+  return 1;
+}
+
+int Backend::ReplaceFunction(runtime::Function* old_function,
+                             runtime::Function* new_function) {
+  return 1;
+}
+
+int Backend::InvalidateFunction(runtime::Function* function) { return 1; }
+
+size_t Backend::ReclaimCode(uint64_t epoch,
+                            const std::vector<void*>& pinned_code) {
+  return 0;
+}
+
 }  // namespace backend
 }  // namespace alloy
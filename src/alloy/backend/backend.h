@@ -11,11 +11,16 @@
 #define ALLOY_BACKEND_BACKEND_H_
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "alloy/backend/machine_info.h"
 
 namespace alloy {
 namespace runtime {
+class Function;
+class FunctionInfo;
+class Module;
 class Runtime;
 }  // namespace runtime
 }  // namespace alloy
@@ -40,6 +45,31 @@ class Backend {
 
   virtual std::unique_ptr<Assembler> CreateAssembler() = 0;
 
+  // Opens the persistent code cache for the given module, if supported.
+  // cache_key must uniquely identify the guest code of the module.
+  virtual int OpenCodeCache(runtime::Module* module,
+                            const std::string& cache_key);
+  // Attempts to load a previously translated function from the code cache.
+  // Returns non-zero if the function is not cached and must be translated.
+  virtual int LoadCachedFunction(runtime::FunctionInfo* symbol_info,
+                                 runtime::Function** out_function);
+
+  // Redirects all future execution of old_function to new_function and
+  // retires the old code. Both must be for the same guest function.
+  virtual int ReplaceFunction(runtime::Function* old_function,
+                              runtime::Function* new_function);
+
+  // Makes everything that may still hold the code of function regenerate it
+  // (by resolving the guest address again) before running it, and retires
+  // the code.
+  virtual int InvalidateFunction(runtime::Function* function);
+
+  // Releases the code of functions invalidated or replaced before the given
+  // epoch (see Runtime::epoch), except for pinned_code, and returns the
+  // number of bytes freed. No thread holds any of it anymore.
+  virtual size_t ReclaimCode(uint64_t epoch,
+                             const std::vector<void*>& pinned_code);
+
  protected:
   runtime::Runtime* runtime_;
   MachineInfo machine_info_;
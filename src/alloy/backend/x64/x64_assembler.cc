@@ -11,6 +11,7 @@
 
 #include "alloy/reset_scope.h"
 #include "alloy/backend/x64/x64_backend.h"
+#include "alloy/backend/x64/x64_code_cache_file.h"
 #include "alloy/backend/x64/x64_emitter.h"
 #include "alloy/backend/x64/x64_function.h"
 #include "alloy/hir/hir_builder.h"
@@ -63,21 +64,39 @@ void X64Assembler::Reset() {
 int X64Assembler::Assemble(FunctionInfo* symbol_info, HIRBuilder* builder,
                            uint32_t debug_info_flags,
                            std::unique_ptr<DebugInfo> debug_info,
-                           uint32_t trace_flags, Function** out_function) {
+                           uint32_t trace_flags, FunctionTier tier,
+                           Function** out_function) {
   SCOPE_profile_cpu_f("alloy");
 
   // Reset when we leave.
   make_reset_scope(this);
 
+  // Only persist code that doesn't embed per-run debugging state. Baseline
+  // code isn't worth keeping as it will be replaced if it matters. Neither is
+  // code with other functions inlined, as the file only checks that the
+  // guest code of the function itself is unchanged.
+  X64CodeCacheFile* cache_file = nullptr;
+  if (!debug_info_flags && !trace_flags && tier != FUNCTION_TIER_BASELINE &&
+      !symbol_info->HasInlinedCode()) {
+    cache_file = x64_backend_->LookupCodeCacheFile(symbol_info->module());
+  }
+
   // Lower HIR -> x64.
   void* machine_code = 0;
   size_t code_size = 0;
-  int result = emitter_->Emit(builder, debug_info_flags, debug_info.get(),
-                              trace_flags, machine_code, code_size);
+  int result = emitter_->Emit(symbol_info, builder, debug_info_flags,
+                              debug_info.get(), trace_flags, tier,
+                              cache_file != nullptr, machine_code, code_size);
   if (result) {
     return result;
   }
 
+  // Stash the code before anything has a chance to run (and patch) it.
+  if (cache_file) {
+    cache_file->AddFunction(symbol_info, machine_code, code_size,
+                            emitter_->stack_size(), emitter_->relocations());
+  }
+
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::DEBUG_INFO_MACHINE_CODE_DISASM) {
     DumpMachineCode(debug_info.get(), machine_code, code_size, &string_buffer_);
@@ -87,6 +106,7 @@ int X64Assembler::Assemble(FunctionInfo* symbol_info, HIRBuilder* builder,
 
   {
     X64Function* fn = new X64Function(symbol_info);
+    fn->set_tier(tier);
     fn->set_debug_info(std::move(debug_info));
     fn->Setup(machine_code, code_size);
 
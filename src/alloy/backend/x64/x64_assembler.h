@@ -35,7 +35,8 @@ class X64Assembler : public Assembler {
   int Assemble(runtime::FunctionInfo* symbol_info, hir::HIRBuilder* builder,
                uint32_t debug_info_flags,
                std::unique_ptr<runtime::DebugInfo> debug_info,
-               uint32_t trace_flags, runtime::Function** out_function) override;
+               uint32_t trace_flags, runtime::FunctionTier tier,
+               runtime::Function** out_function) override;
 
  private:
   void DumpMachineCode(runtime::DebugInfo* debug_info, void* machine_code,
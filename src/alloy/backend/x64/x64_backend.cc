@@ -9,20 +9,114 @@
 
 #include "alloy/backend/x64/x64_backend.h"
 
+#include <algorithm>
+#include <unordered_set>
+
+#include "alloy/alloy-private.h"
 #include "alloy/backend/x64/x64_assembler.h"
+#include "alloy/backend/x64/x64_call_site_ic.h"
 #include "alloy/backend/x64/x64_code_cache.h"
+#include "alloy/backend/x64/x64_code_cache_file.h"
+#include "alloy/backend/x64/x64_dispatch_table.h"
+#include "alloy/backend/x64/x64_emitter.h"
+#include "alloy/backend/x64/x64_function.h"
 #include "alloy/backend/x64/x64_sequences.h"
 #include "alloy/backend/x64/x64_thunk_emitter.h"
+#include "alloy/backend/x64/x64_tracers.h"
+#include "alloy/runtime/module.h"
+#include "alloy/runtime/runtime.h"
+#include "alloy/runtime/symbol_info.h"
+#include "alloy/runtime/thread_state.h"
+#include "poly/poly.h"
+#include "third_party/xbyak/xbyak/xbyak_util.h"
 
 namespace alloy {
 namespace backend {
 namespace x64 {
 
+using alloy::runtime::Function;
+using alloy::runtime::FunctionInfo;
+using alloy::runtime::Module;
 using alloy::runtime::Runtime;
+using alloy::runtime::ThreadState;
+
+namespace {
+
+uint64_t ResolveInvalidatedFunction(void* raw_context, uint64_t code_address) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto runtime = thread_state->runtime();
+  auto backend = static_cast<X64Backend*>(runtime->backend());
+
+  // The thread came here from the invalidated code and hasn't quiesced since,
+  // so the code is still around.
+  auto symbol_info = backend->code_cache()->LookupFunction(
+      reinterpret_cast<void*>(code_address));
+  assert_not_null(symbol_info);
+
+  // Regenerates the function if this is the first use since invalidation.
+  Function* fn = nullptr;
+  runtime->ResolveFunction(symbol_info->address(), &fn);
+  assert_not_null(fn);
+  return reinterpret_cast<uint64_t>(
+      static_cast<X64Function*>(fn)->machine_code());
+}
+
+uint64_t ResolveCallLink(void* raw_context, uint64_t symbol_info_ptr,
+                         uint64_t stub_address) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto backend = static_cast<X64Backend*>(thread_state->runtime()->backend());
+  auto symbol_info = reinterpret_cast<FunctionInfo*>(symbol_info_ptr);
+
+  // Resolve function. This will demand compile as required.
+  Function* fn = nullptr;
+  thread_state->runtime()->ResolveFunction(symbol_info->address(), &fn);
+  assert_not_null(fn);
+
+  auto stub = reinterpret_cast<void*>(stub_address);
+  backend->LinkCallSite(X64Emitter::GetCallLinkSite(stub), stub, fn);
+  return reinterpret_cast<uint64_t>(
+      static_cast<X64Function*>(fn)->machine_code());
+}
+
+void QuiesceThread(void* raw_context, uint64_t slot) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto runtime = thread_state->runtime();
+  if (!runtime->ShouldQuiesce(thread_state)) {
+    return;
+  }
+  auto backend = static_cast<X64Backend*>(runtime->backend());
 
-X64Backend::X64Backend(Runtime* runtime) : Backend(runtime), code_cache_(0) {}
+  // Anything retired from here on may not have been marked yet when the
+  // frames are looked at.
+  uint64_t epoch = runtime->epoch();
+  std::vector<void*> pinned_code;
+  if (!backend->code_cache()->FindInvalidatedFrames(
+          reinterpret_cast<void* const*>(slot),
+          reinterpret_cast<void*>(backend->host_to_guest_thunk()),
+          &pinned_code)) {
+    return;
+  }
+  runtime->Quiesce(thread_state, epoch, std::move(pinned_code));
+}
+
+}  // namespace
 
-X64Backend::~X64Backend() { delete code_cache_; }
+X64Backend::X64Backend(Runtime* runtime)
+    : Backend(runtime),
+      code_cache_(0),
+      emitter_feature_flags_(0),
+      invalidated_code_thunk_(nullptr),
+      call_link_thunk_(nullptr) {}
+
+X64Backend::~X64Backend() {
+  if (FLAGS_ic_stats) {
+    LogICStats();
+  }
+  call_site_ics_.clear();
+  code_cache_files_.clear();
+  dispatch_tables_.clear();
+  delete code_cache_;
+}
 
 int X64Backend::Initialize() {
   int result = Backend::Initialize();
@@ -30,6 +124,35 @@ int X64Backend::Initialize() {
     return result;
   }
 
+  // Probe the host for the instruction set extensions sequences can use.
+  // Anything older than AVX isn't supported at all.
+  Xbyak::util::Cpu cpu;
+  if (!cpu.has(Xbyak::util::Cpu::tAVX)) {
+    PLOGE("X64Backend: host CPU does not support AVX");
+    return 1;
+  }
+  emitter_feature_flags_ = 0;
+  if (!FLAGS_x64_baseline_isa) {
+    if (cpu.has(Xbyak::util::Cpu::tAVX2)) {
+      emitter_feature_flags_ |= kX64EmitAVX2;
+    }
+    if (cpu.has(Xbyak::util::Cpu::tFMA)) {
+      emitter_feature_flags_ |= kX64EmitFMA;
+    }
+    if (cpu.has(Xbyak::util::Cpu::tLZCNT)) {
+      emitter_feature_flags_ |= kX64EmitLZCNT;
+    }
+    if (cpu.has(Xbyak::util::Cpu::tBMI2)) {
+      emitter_feature_flags_ |= kX64EmitBMI2;
+    }
+    if (cpu.has(Xbyak::util::Cpu::tF16C)) {
+      emitter_feature_flags_ |= kX64EmitF16C;
+    }
+    if (cpu.has(Xbyak::util::Cpu::tMOVBE)) {
+      emitter_feature_flags_ |= kX64EmitMovbe;
+    }
+  }
+
   RegisterSequences();
 
   machine_info_.register_sets[0] = {
@@ -51,7 +174,12 @@ int X64Backend::Initialize() {
   auto allocator = std::make_unique<XbyakAllocator>();
   auto thunk_emitter = std::make_unique<X64ThunkEmitter>(this, allocator.get());
   host_to_guest_thunk_ = thunk_emitter->EmitHostToGuestThunk();
-  guest_to_host_thunk_ = thunk_emitter->EmitGuestToHostThunk();
+  guest_to_host_thunk_ = thunk_emitter->EmitGuestToHostThunk(
+      reinterpret_cast<void*>(QuiesceThread));
+  invalidated_code_thunk_ = thunk_emitter->EmitResolveThunk(
+      reinterpret_cast<void*>(ResolveInvalidatedFunction));
+  call_link_thunk_ = thunk_emitter->EmitResolveThunk(
+      reinterpret_cast<void*>(ResolveCallLink));
 
   return result;
 }
@@ -60,6 +188,358 @@ std::unique_ptr<Assembler> X64Backend::CreateAssembler() {
   return std::make_unique<X64Assembler>(this);
 }
 
+int X64Backend::OpenCodeCache(Module* module, const std::string& cache_key) {
+  if (FLAGS_code_cache_path.empty()) {
+    return 1;
+  }
+  // Traced/debug code embeds things we can't persist.
+  if (GetTracingMode() || FLAGS_always_disasm) {
+    return 1;
+  }
+
+  std::string path = FLAGS_code_cache_path;
+  if (path.back() != poly::path_separator) {
+    path += poly::path_separator;
+  }
+  path += cache_key + ".xcc";
+
+  auto cache_file = std::make_unique<X64CodeCacheFile>(this, module);
+  int result = cache_file->Initialize(path);
+  if (result) {
+    return result;
+  }
+
+  std::lock_guard<std::mutex> guard(code_cache_files_lock_);
+  code_cache_files_.push_back(std::move(cache_file));
+  return 0;
+}
+
+X64CodeCacheFile* X64Backend::LookupCodeCacheFile(Module* module) {
+  std::lock_guard<std::mutex> guard(code_cache_files_lock_);
+  for (const auto& cache_file : code_cache_files_) {
+    if (cache_file->module() == module) {
+      return cache_file.get();
+    }
+  }
+  return nullptr;
+}
+
+X64DispatchTable* X64Backend::GetDispatchTable(Module* module) {
+  std::lock_guard<std::mutex> guard(dispatch_tables_lock_);
+  auto it = dispatch_tables_.find(module);
+  if (it != dispatch_tables_.end()) {
+    return it->second.get();
+  }
+  std::unique_ptr<X64DispatchTable> dispatch_table(
+      new X64DispatchTable(module));
+  if (dispatch_table->Initialize()) {
+    // Remember the failure so we don't try again.
+    dispatch_table.reset();
+  }
+  auto result = dispatch_table.get();
+  dispatch_tables_[module] = std::move(dispatch_table);
+  return result;
+}
+
+int X64Backend::ReplaceFunction(Function* old_function,
+                                Function* new_function) {
+  auto old_fn = static_cast<X64Function*>(old_function);
+  auto new_fn = static_cast<X64Function*>(new_function);
+  if (old_fn->tier() != runtime::FUNCTION_TIER_BASELINE) {
+    // Optimized code is final.
+    return 1;
+  }
+  X64Emitter::RedirectEntryStub(
+      code_cache_->GetWritableAddress(old_fn->machine_code()),
+      new_fn->machine_code());
+  // From here on nothing new links to the old code, see IsCodeRetired.
+  code_cache_->InvalidateCode(old_fn->machine_code());
+
+  // Relink direct calls to the new code.
+  {
+    std::lock_guard<std::mutex> guard(call_links_lock_);
+    auto range = call_links_.equal_range(old_function->address());
+    for (auto it = range.first; it != range.second; ++it) {
+      X64Emitter::PatchCallSite(
+          code_cache_->GetWritableAddress(it->second.site), it->second.site,
+          new_fn->machine_code());
+    }
+  }
+
+  // Indirect calls find the new code on their next miss. After that only
+  // frames still in the old code and threads about to enter it can reach it,
+  // and the runtime waits for both.
+  std::lock_guard<std::mutex> guard(ic_lock_);
+  UnlinkICTargets(old_function);
+  retired_code_.push_back({runtime_->epoch(), old_fn->machine_code()});
+  return 0;
+}
+
+int X64Backend::InvalidateFunction(Function* function) {
+  auto fn = static_cast<X64Function*>(function);
+
+  // Threads may be about to enter the code from a stale pointer, and frames
+  // already in it finish running it. Either way the code itself now jumps to
+  // the resolver, which regenerates the function and continues into it.
+  // Direct calls don't pass the code they called in rax as the thunk wants,
+  // so go through a trampoline that does:
+  //   mov rax, code
+  //   jmp [rip + 0]
+  //   dq invalidated_code_thunk
+  uint8_t trampoline[24] = {0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0,
+                            0xFF, 0x25, 0, 0, 0, 0};
+  poly::store<uint64_t>(trampoline + 2,
+                        reinterpret_cast<uint64_t>(fn->machine_code()));
+  poly::store<uint64_t>(trampoline + 16,
+                        reinterpret_cast<uint64_t>(invalidated_code_thunk_));
+  void* trampoline_code =
+      code_cache_->PlaceCode(nullptr, trampoline, sizeof(trampoline), 0);
+  X64Emitter::RedirectEntryStub(
+      code_cache_->GetWritableAddress(fn->machine_code()), trampoline_code);
+  // Only reachable through the old code, so it's retired along with it.
+  code_cache_->InvalidateCode(trampoline_code);
+  // From here on nothing new links to the old code, see IsCodeRetired.
+  code_cache_->InvalidateCode(fn->machine_code());
+
+  // Send direct calls back through their stubs so that they relink to the
+  // new code once there is some.
+  {
+    std::lock_guard<std::mutex> guard(call_links_lock_);
+    auto range = call_links_.equal_range(function->address());
+    for (auto it = range.first; it != range.second; ++it) {
+      X64Emitter::PatchCallSite(
+          code_cache_->GetWritableAddress(it->second.site), it->second.site,
+          it->second.stub);
+    }
+    call_links_.erase(range.first, range.second);
+  }
+
+  // Make indirect calls miss so they find the new code without the detour.
+  // Now only frames still running the code and threads about to enter it can
+  // reach it, and the runtime waits for both.
+  std::lock_guard<std::mutex> guard(ic_lock_);
+  UnlinkICTargets(function);
+  uint64_t epoch = runtime_->epoch();
+  retired_code_.push_back({epoch, fn->machine_code()});
+  retired_code_.push_back({epoch, trampoline_code});
+  return 0;
+}
+
+void X64Backend::UnlinkICTargets(Function* function) {
+  // NOTE: we assume the IC lock.
+  auto dispatch_table = GetDispatchTable(function->symbol_info()->module());
+  if (dispatch_table) {
+    dispatch_table->Set(function->address(), nullptr);
+  }
+  auto range = ic_slots_.equal_range(function->address());
+  for (auto it = range.first; it != range.second; ++it) {
+    X64Emitter::RetireICSlot(code_cache_->GetWritableAddress(it->second.slot));
+  }
+  ic_slots_.erase(range.first, range.second);
+  // Invalidation is rare enough that walking every call site is fine.
+  for (auto& ic : call_site_ics_) {
+    ic->RetireTarget(function->address());
+  }
+}
+
+bool X64Backend::IsCodeRetired(void* machine_code) {
+  return code_cache_->IsInvalidated(machine_code);
+}
+
+size_t X64Backend::ReclaimCode(uint64_t epoch,
+                               const std::vector<void*>& pinned_code) {
+  if (!code_cache_->has_code_window()) {
+    // Calls outside of a window have the addresses of their targets baked in
+    // (see X64Emitter::Call), so none of it can ever go.
+    return 0;
+  }
+
+  // No thread uses the ICs of the reclaimed code or its inline slots anymore.
+  // Those must go before the memory is reused.
+  std::vector<void*> reclaimed;
+  {
+    std::lock_guard<std::mutex> guard(ic_lock_);
+    std::unordered_set<void*> pinned(pinned_code.begin(), pinned_code.end());
+    auto it = std::remove_if(retired_code_.begin(), retired_code_.end(),
+                             [&](const RetiredCode& retired) {
+                               if (retired.epoch >= epoch ||
+                                   pinned.count(retired.code)) {
+                                 return false;
+                               }
+                               reclaimed.push_back(retired.code);
+                               return true;
+                             });
+    retired_code_.erase(it, retired_code_.end());
+    if (reclaimed.empty()) {
+      return 0;
+    }
+    std::unordered_set<void*> reclaimed_set(reclaimed.begin(),
+                                            reclaimed.end());
+    std::unordered_set<X64CallSiteIC*> freed;
+    for (auto& ic : call_site_ics_) {
+      if (reclaimed_set.count(ic->code)) {
+        freed.insert(ic.get());
+      }
+    }
+    for (auto it = ic_slots_.begin(); it != ic_slots_.end();) {
+      if (freed.count(it->second.ic)) {
+        it = ic_slots_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    call_site_ics_.erase(
+        std::remove_if(call_site_ics_.begin(), call_site_ics_.end(),
+                       [&](const std::unique_ptr<X64CallSiteIC>& ic) {
+                         return freed.count(ic.get()) != 0;
+                       }),
+        call_site_ics_.end());
+  }
+  return code_cache_->ReclaimCode(reclaimed);
+}
+
+void X64Backend::LinkCallSite(void* site, void* stub, Function* function) {
+  auto fn = static_cast<X64Function*>(function);
+  std::lock_guard<std::mutex> guard(call_links_lock_);
+  if (IsCodeRetired(fn->machine_code())) {
+    // Replaced or invalidated since it was resolved. The next call resolves
+    // it again.
+    return;
+  }
+  if (!X64Emitter::PatchCallSite(code_cache_->GetWritableAddress(site), site,
+                                 fn->machine_code())) {
+    // Code outside of the window; keep going through the stub.
+    return;
+  }
+  call_links_.emplace(function->address(), CallSiteLink{site, stub});
+}
+
+X64CallSiteIC* X64Backend::CreateCallSiteIC(uint64_t call_address) {
+  auto ic = std::make_unique<X64CallSiteIC>(call_address);
+  auto result = ic.get();
+  std::lock_guard<std::mutex> guard(ic_lock_);
+  call_site_ics_.push_back(std::move(ic));
+  return result;
+}
+
+void X64Backend::SetCallSiteICsCode(const std::vector<X64CallSiteIC*>& ics,
+                                    void* code) {
+  std::lock_guard<std::mutex> guard(ic_lock_);
+  for (auto ic : ics) {
+    ic->code = code;
+  }
+}
+
+void X64Backend::FreeCallSiteICs(const std::vector<X64CallSiteIC*>& ics) {
+  if (ics.empty()) {
+    return;
+  }
+  std::unordered_set<X64CallSiteIC*> freed(ics.begin(), ics.end());
+  std::lock_guard<std::mutex> guard(ic_lock_);
+  call_site_ics_.erase(
+      std::remove_if(call_site_ics_.begin(), call_site_ics_.end(),
+                     [&](const std::unique_ptr<X64CallSiteIC>& ic) {
+                       return freed.count(ic.get()) != 0;
+                     }),
+      call_site_ics_.end());
+}
+
+void X64Backend::AddICTarget(X64CallSiteIC* ic, void* inline_slots,
+                             Function* function) {
+  auto fn = static_cast<X64Function*>(function);
+  std::lock_guard<std::mutex> guard(ic_lock_);
+  ++ic->miss_count;
+  if (IsCodeRetired(fn->machine_code())) {
+    // Replaced or invalidated since it was resolved.
+    return;
+  }
+  // Publish to the dispatch table so future lookups from anywhere skip the
+  // resolver.
+  uint64_t target_address = function->address();
+  void* machine_code = fn->machine_code();
+  auto dispatch_table = GetDispatchTable(function->symbol_info()->module());
+  if (dispatch_table) {
+    dispatch_table->Set(target_address, machine_code);
+  }
+  if (ic->is_megamorphic) {
+    return;
+  }
+  size_t slot_offset;
+  if (X64Emitter::FillICSlot(code_cache_->GetWritableAddress(inline_slots),
+                             target_address, machine_code, &slot_offset)) {
+    ic_slots_.emplace(
+        target_address,
+        ICSlot{reinterpret_cast<uint8_t*>(inline_slots) + slot_offset, ic});
+    return;
+  }
+  ic->AddTarget(target_address, machine_code);
+}
+
+X64ICStats X64Backend::GetICStats() {
+  std::lock_guard<std::mutex> guard(ic_lock_);
+  X64ICStats stats = {0};
+  stats.call_site_count = call_site_ics_.size();
+  for (auto& ic : call_site_ics_) {
+    if (ic->is_megamorphic) {
+      ++stats.megamorphic_count;
+    } else if (ic->table) {
+      ++stats.polymorphic_count;
+    }
+    stats.inline_hit_count += ic->inline_hit_count;
+    stats.table_hit_count += ic->table_hit_count;
+    stats.dispatch_hit_count += ic->dispatch_hit_count;
+    stats.miss_count += ic->miss_count;
+  }
+  return stats;
+}
+
+void X64Backend::LogICStats() {
+  auto stats = GetICStats();
+  uint64_t total_count = stats.inline_hit_count + stats.table_hit_count +
+                         stats.dispatch_hit_count + stats.miss_count;
+  if (!total_count) {
+    return;
+  }
+  PLOGI("Indirect call ICs: %zu call sites, %zu polymorphic, %zu megamorphic",
+        stats.call_site_count, stats.polymorphic_count,
+        stats.megamorphic_count);
+  PLOGI("  %llu calls: %.2f%% inline, %.2f%% table, %.2f%% dispatch, "
+        "%.2f%% resolver",
+        total_count, 100.0 * stats.inline_hit_count / total_count,
+        100.0 * stats.table_hit_count / total_count,
+        100.0 * stats.dispatch_hit_count / total_count,
+        100.0 * stats.miss_count / total_count);
+
+  std::lock_guard<std::mutex> guard(ic_lock_);
+  std::vector<X64CallSiteIC*> ics;
+  for (auto& ic : call_site_ics_) {
+    if (ic->miss_count) {
+      ics.push_back(ic.get());
+    }
+  }
+  size_t count = std::min(ics.size(), size_t(10));
+  std::partial_sort(ics.begin(), ics.begin() + count, ics.end(),
+                    [](X64CallSiteIC* a, X64CallSiteIC* b) {
+                      return a->miss_count > b->miss_count;
+                    });
+  for (size_t n = 0; n < count; ++n) {
+    auto ic = ics[n];
+    PLOGI("  %.8llX: %llu misses, %u cached targets%s", ic->call_address,
+          ic->miss_count, ic->target_count,
+          ic->is_megamorphic ? ", megamorphic" : "");
+  }
+}
+
+int X64Backend::LoadCachedFunction(FunctionInfo* symbol_info,
+                                   Function** out_function) {
+  *out_function = nullptr;
+  auto cache_file = LookupCodeCacheFile(symbol_info->module());
+  if (!cache_file) {
+    return 1;
+  }
+  return cache_file->LoadFunction(symbol_info, out_function);
+}
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace alloy
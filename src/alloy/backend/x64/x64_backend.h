@@ -10,13 +10,22 @@
 #ifndef ALLOY_BACKEND_X64_X64_BACKEND_H_
 #define ALLOY_BACKEND_X64_X64_BACKEND_H_
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include "alloy/backend/backend.h"
 
 namespace alloy {
 namespace backend {
 namespace x64 {
 
+class X64CallSiteIC;
 class X64CodeCache;
+class X64CodeCacheFile;
+class X64DispatchTable;
+struct X64ICStats;
 
 #define ALLOY_HAS_X64_BACKEND 1
 
@@ -31,15 +40,98 @@ class X64Backend : public Backend {
   X64CodeCache* code_cache() const { return code_cache_; }
   HostToGuestThunk host_to_guest_thunk() const { return host_to_guest_thunk_; }
   GuestToHostThunk guest_to_host_thunk() const { return guest_to_host_thunk_; }
+  void* call_link_thunk() const { return call_link_thunk_; }
+  // X64EmitterFeatureFlags generated code may use on this host.
+  uint32_t emitter_feature_flags() const { return emitter_feature_flags_; }
 
   int Initialize() override;
 
   std::unique_ptr<Assembler> CreateAssembler() override;
 
+  int OpenCodeCache(runtime::Module* module,
+                    const std::string& cache_key) override;
+  int LoadCachedFunction(runtime::FunctionInfo* symbol_info,
+                         runtime::Function** out_function) override;
+  X64CodeCacheFile* LookupCodeCacheFile(runtime::Module* module);
+
+  // Gets the dispatch table covering the code of the given module, creating
+  // it on first use. Returns null if the module has no known code range.
+  X64DispatchTable* GetDispatchTable(runtime::Module* module);
+
+  int ReplaceFunction(runtime::Function* old_function,
+                      runtime::Function* new_function) override;
+  int InvalidateFunction(runtime::Function* function) override;
+  size_t ReclaimCode(uint64_t epoch,
+                     const std::vector<void*>& pinned_code) override;
+
+  // Links the direct call with the rel32 at site to the code of function,
+  // relinking it whenever the function is replaced and going back through
+  // stub (its call link stub) once the function is invalidated. Does nothing
+  // if the code is out of reach or no longer current.
+  void LinkCallSite(void* site, void* stub, runtime::Function* function);
+
+  // Creates the inline cache state of an indirect call. It lives until the
+  // code containing the call (see SetCallSiteICsCode) is reclaimed.
+  X64CallSiteIC* CreateCallSiteIC(uint64_t call_address);
+  // Records the code the ICs were created for once it has been placed.
+  void SetCallSiteICsCode(const std::vector<X64CallSiteIC*>& ics, void* code);
+  // Frees ICs of code that was never placed.
+  void FreeCallSiteICs(const std::vector<X64CallSiteIC*>& ics);
+  // Caches a function resolved for an indirect call in the dispatch table and
+  // in the first free inline slot, or in the out-of-line table of the call
+  // site once those are full. inline_slots is the executable address of the
+  // first slot. Does nothing if the code is no longer current.
+  void AddICTarget(X64CallSiteIC* ic, void* inline_slots,
+                   runtime::Function* function);
+  X64ICStats GetICStats();
+  // Logs the totals and the call sites missing the most.
+  void LogICStats();
+
  private:
+  // Makes indirect calls to the function miss. Requires the IC lock.
+  void UnlinkICTargets(runtime::Function* function);
+  // Whether the code was replaced or invalidated. Once it is, nothing may
+  // link to it anymore: whatever caches code addresses checks this under the
+  // lock that retiring the code takes to unlink it again.
+  bool IsCodeRetired(void* machine_code);
+
   X64CodeCache* code_cache_;
+  uint32_t emitter_feature_flags_;
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
+  void* invalidated_code_thunk_;
+  void* call_link_thunk_;
+
+  std::mutex code_cache_files_lock_;
+  std::vector<std::unique_ptr<X64CodeCacheFile>> code_cache_files_;
+
+  std::mutex dispatch_tables_lock_;
+  std::unordered_map<runtime::Module*, std::unique_ptr<X64DispatchTable>>
+      dispatch_tables_;
+
+  std::mutex ic_lock_;
+  std::vector<std::unique_ptr<X64CallSiteIC>> call_site_ics_;
+  struct ICSlot {
+    void* slot;
+    X64CallSiteIC* ic;
+  };
+  // Filled inline slots by the guest address they call.
+  std::unordered_multimap<uint64_t, ICSlot> ic_slots_;
+  struct RetiredCode {
+    uint64_t epoch;
+    void* code;
+  };
+  // Replaced and invalidated code, including trampolines, with the runtime
+  // epoch it was retired in. Its ICs go along with it.
+  std::vector<RetiredCode> retired_code_;
+
+  struct CallSiteLink {
+    void* site;
+    void* stub;
+  };
+  std::mutex call_links_lock_;
+  // Linked direct calls by the guest address they call.
+  std::unordered_multimap<uint64_t, CallSiteLink> call_links_;
 };
 
 }  // namespace x64
@@ -0,0 +1,151 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/backend/x64/x64_call_site_ic.h"
+
+#include <atomic>
+#include <cstdlib>
+
+#include "poly/poly.h"
+
+namespace alloy {
+namespace backend {
+namespace x64 {
+
+X64CallSiteIC::X64CallSiteIC(uint64_t call_address)
+    : table(nullptr),
+      inline_hit_count(0),
+      table_hit_count(0),
+      dispatch_hit_count(0),
+      miss_count(0),
+      call_address(call_address),
+      code(nullptr),
+      is_megamorphic(false),
+      target_count(0) {}
+
+X64CallSiteIC::~X64CallSiteIC() {
+  free(table);
+  for (auto retired_table : retired_tables) {
+    free(retired_table);
+  }
+}
+
+X64CallSiteIC::Table* X64CallSiteIC::AllocateTable(uint32_t size) {
+  assert_zero(size & (size - 1));
+  auto new_table = reinterpret_cast<Table*>(
+      calloc(1, sizeof(Table) + (size - 1) * sizeof(Entry)));
+  new_table->mask = size - 1;
+  new_table->offset_mask = (size - 1) * sizeof(Entry);
+  return new_table;
+}
+
+X64CallSiteIC::Entry* X64CallSiteIC::FindEntry(Table* table,
+                                               uint64_t guest_address) {
+  uint32_t index = (guest_address >> 2) & table->mask;
+  for (uint32_t n = 0; n < kMaxProbeCount; ++n) {
+    auto& entry = table->entries[index];
+    if (entry.guest_address == static_cast<uint32_t>(guest_address)) {
+      return &entry;
+    }
+    if (!entry.guest_address) {
+      break;
+    }
+    index = (index + 1) & table->mask;
+  }
+  return nullptr;
+}
+
+bool X64CallSiteIC::InsertEntry(Table* table, uint64_t guest_address,
+                                uint64_t host_address) {
+  uint32_t index = (guest_address >> 2) & table->mask;
+  for (uint32_t n = 0; n < kMaxProbeCount; ++n) {
+    auto& entry = table->entries[index];
+    if (!entry.guest_address) {
+      // The host address must be visible before the entry can match.
+      *reinterpret_cast<volatile uint64_t*>(&entry.host_address) =
+          host_address;
+      *reinterpret_cast<volatile uint32_t*>(&entry.guest_address) =
+          static_cast<uint32_t>(guest_address);
+      return true;
+    }
+    index = (index + 1) & table->mask;
+  }
+  return false;
+}
+
+bool X64CallSiteIC::AddTarget(uint64_t guest_address, void* host_address) {
+  if (is_megamorphic) {
+    return false;
+  }
+  uint64_t host_value = reinterpret_cast<uint64_t>(host_address);
+  if (!table) {
+    auto new_table = AllocateTable(kInitialTableSize);
+    std::atomic_thread_fence(std::memory_order_release);
+    table = new_table;
+  }
+  if (FindEntry(table, guest_address)) {
+    // Another thread got here first.
+    return true;
+  }
+  if (InsertEntry(table, guest_address, host_value)) {
+    ++target_count;
+    return true;
+  }
+
+  // No empty entry within reach. Grow until the live entries and the new one
+  // all get a place within kMaxProbeCount of their own, dropping retired
+  // entries on the way.
+  for (uint32_t size = (table->mask + 1) * 2; size <= kMaxTableSize;
+       size *= 2) {
+    auto new_table = AllocateTable(size);
+    bool fits = InsertEntry(new_table, guest_address, host_value);
+    uint32_t new_count = 1;
+    for (uint32_t n = 0; fits && n <= table->mask; ++n) {
+      auto& old_entry = table->entries[n];
+      if (!old_entry.guest_address ||
+          old_entry.guest_address == kRetiredAddress) {
+        continue;
+      }
+      fits = InsertEntry(new_table, old_entry.guest_address,
+                         old_entry.host_address);
+      ++new_count;
+    }
+    if (fits) {
+      retired_tables.push_back(table);
+      std::atomic_thread_fence(std::memory_order_release);
+      table = new_table;
+      target_count = new_count;
+      return true;
+    }
+    free(new_table);
+  }
+
+  // Too many targets (or too unlucky a set of them) to cache. The current
+  // table keeps serving what's in it.
+  is_megamorphic = true;
+  return false;
+}
+
+void X64CallSiteIC::RetireTarget(uint64_t guest_address) {
+  if (!table) {
+    return;
+  }
+  auto entry = FindEntry(table, guest_address);
+  if (entry) {
+    // The host address is left alone as a thread may be just past the
+    // compare. The entry stays non-empty so later probes continue past it.
+    *reinterpret_cast<volatile uint32_t*>(&entry->guest_address) =
+        kRetiredAddress;
+    --target_count;
+  }
+}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace alloy
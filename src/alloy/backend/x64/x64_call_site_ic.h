@@ -0,0 +1,118 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_BACKEND_X64_X64_CALL_SITE_IC_H_
+#define ALLOY_BACKEND_X64_X64_CALL_SITE_IC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace alloy {
+namespace backend {
+namespace x64 {
+
+// Per call site state of an indirect call inline cache.
+//
+// Generated code (see X64Emitter::CallIndirect) checks the targets cached in
+// a few inline slots first, then probes the table here, then the dispatch
+// table of the calling module and only then calls the resolver. Once a call
+// site has seen more targets than the table can hold it's megamorphic and
+// stops caching; the dispatch table handles it from then on.
+//
+// The table is open addressed: a target goes in the first empty entry of the
+// kMaxProbeCount entries starting at (guest_address >> 2) & mask, wrapping
+// around. Lookups stop at the first empty entry.
+//
+// Generated code reads the table without locking. Entries are written once
+// (the host address before the guest address that makes it match) and are
+// only ever retired, never reused, so a reader can't pair a guest address with
+// the wrong code and probe chains never get holes. Growing publishes a new
+// table; the old one is kept around as threads may still be probing it.
+//
+// Fields are read and counted in generated code, so the layout matters.
+class X64CallSiteIC {
+ public:
+  struct Entry {
+    // Zero if empty, kRetiredAddress if retired.
+    uint32_t guest_address;
+    uint32_t padding;
+    uint64_t host_address;
+  };
+  struct Table {
+    // Entry count - 1.
+    uint32_t mask;
+    // mask scaled to entry offsets, for wrapping in generated code.
+    uint32_t offset_mask;
+    Entry entries[1];
+  };
+
+  // Never matches as guest code is 4b aligned.
+  static const uint32_t kRetiredAddress = 0x0F0F0F0F;
+  static const uint32_t kInitialTableSize = 8;
+  static const uint32_t kMaxTableSize = 256;
+  // Entries looked at per lookup. Generated code unrolls the probes.
+  static const uint32_t kMaxProbeCount = 4;
+
+  X64CallSiteIC(uint64_t call_address);
+  ~X64CallSiteIC();
+
+  // NOTE: all methods assume the backend IC lock.
+
+  // Caches a target that missed in the inline slots. Returns false if the
+  // call site is (now) megamorphic and the target wasn't cached.
+  bool AddTarget(uint64_t guest_address, void* host_address);
+  // Stops the given target from matching.
+  void RetireTarget(uint64_t guest_address);
+
+ private:
+  Table* AllocateTable(uint32_t size);
+  // Returns the live entry for the guest address, or null.
+  static Entry* FindEntry(Table* table, uint64_t guest_address);
+  static bool InsertEntry(Table* table, uint64_t guest_address,
+                          uint64_t host_address);
+
+ public:
+  // Current table, or null until the inline slots have overflowed.
+  Table* table;
+  // Hit counts are only maintained by generated code with --ic_stats.
+  uint64_t inline_hit_count;
+  uint64_t table_hit_count;
+  uint64_t dispatch_hit_count;
+  // Calls that went to the resolver.
+  uint64_t miss_count;
+
+  // Address of the guest call instruction.
+  uint64_t call_address;
+  // Code containing the call site, or null while it's being generated. The
+  // IC is freed along with it.
+  void* code;
+  bool is_megamorphic;
+  // Live entries in the current table.
+  uint32_t target_count;
+  // Replaced tables that may still be in use.
+  std::vector<Table*> retired_tables;
+};
+
+// Totals across all call sites.
+struct X64ICStats {
+  size_t call_site_count;
+  size_t polymorphic_count;
+  size_t megamorphic_count;
+  uint64_t inline_hit_count;
+  uint64_t table_hit_count;
+  uint64_t dispatch_hit_count;
+  uint64_t miss_count;
+};
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace alloy
+
+#endif  // ALLOY_BACKEND_X64_X64_CALL_SITE_IC_H_
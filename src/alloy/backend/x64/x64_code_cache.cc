@@ -0,0 +1,429 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/backend/x64/x64_code_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "alloy/alloy-private.h"
+#include "poly/poly.h"
+#include "xenia/profiling.h"
+
+namespace alloy {
+namespace backend {
+namespace x64 {
+
+using alloy::runtime::FunctionInfo;
+
+namespace {
+// Dedicated chunks for functions larger than the chunk size are rounded up to
+// this, which is a multiple of the page size (and allocation granularity)
+// everywhere we run.
+const size_t kOversizedChunkAlignment = 64 * 1024;
+// Anything in a window this size can reach anything else with a rel32.
+const size_t kWindowSize = 2ull * 1024 * 1024 * 1024;
+// Chunks are carved from the window at allocation granularity.
+const size_t kWindowAlignment = 64 * 1024;
+// Dead code is filled with int3 so that stray jumps into it trap.
+const uint8_t kFillByte = 0xCC;
+}  // namespace
+
+X64CodeCache::X64CodeCache(size_t chunk_size)
+    : chunk_size_(chunk_size),
+      use_guard_pages_(FLAGS_code_cache_guard_pages),
+      use_wx_(FLAGS_code_cache_wx),
+      active_chunk_(nullptr),
+      window_base_(nullptr),
+      window_offset_(0),
+      invalidated_size_(0) {}
+
+X64CodeCache::~X64CodeCache() {
+  std::lock_guard<std::mutex> guard(lock_);
+  for (auto chunk : chunks_) {
+    delete chunk;
+  }
+  chunks_.clear();
+  active_chunk_ = nullptr;
+  blocks_.clear();
+  free_ranges_.clear();
+  if (window_base_) {
+    ReleaseAddressSpace(window_base_, kWindowSize);
+    window_base_ = nullptr;
+  }
+}
+
+int X64CodeCache::Initialize() {
+#if XE_LIKE_WIN32
+  if (use_wx_) {
+    PLOGW("X64CodeCache: --code_cache_wx is not supported on this platform");
+    use_wx_ = false;
+  }
+#endif  // XE_LIKE_WIN32
+
+  // Only address space is reserved; chunks are committed as needed. Without
+  // it everything still works, just without direct calls between functions.
+  window_base_ = ReserveAddressSpace(kWindowSize);
+  if (!window_base_) {
+    PLOGW("X64CodeCache: unable to reserve a %zu byte code window",
+          kWindowSize);
+  }
+  return 0;
+}
+
+void* X64CodeCache::PlaceCode(FunctionInfo* symbol_info,
+                              const void* machine_code, size_t code_size,
+                              size_t stack_size) {
+  SCOPE_profile_cpu_f("alloy");
+
+  // Always move the code to land on 16b alignment. We do this by rounding up
+  // to 16b so that all offsets are aligned.
+  size_t alloc_size = poly::round_up(code_size + kPlatformOverhead, 16);
+
+  std::lock_guard<std::mutex> guard(lock_);
+
+  X64CodeChunk* chunk = nullptr;
+  uint8_t* code = AllocateCode(alloc_size, &chunk);
+  assert_not_null(code);
+  if (!code) {
+    return nullptr;
+  }
+  blocks_[code] = {chunk, alloc_size, stack_size, symbol_info, false};
+  ++chunk->block_count;
+
+  // Copy code. Reused space still holds whatever was there before, so pad
+  // out the rest of the allocation.
+  uint8_t* write_address = chunk->write_buffer + (code - chunk->buffer);
+  std::memcpy(write_address, machine_code, code_size);
+  std::memset(write_address + code_size, kFillByte, alloc_size - code_size);
+
+  OnCodePlaced(chunk, code, alloc_size, stack_size);
+  return code;
+}
+
+uint8_t* X64CodeCache::AllocateCode(size_t alloc_size,
+                                    X64CodeChunk** out_chunk) {
+  // NOTE: we assume the cache lock.
+
+  // First fit from reclaimed space. There's usually little of it, and it's
+  // ordered by address so that we keep packing the low end of chunks.
+  if (kReusesFreedSpace) {
+    for (auto it = free_ranges_.begin(); it != free_ranges_.end(); ++it) {
+      if (it->second.size < alloc_size) {
+        continue;
+      }
+      uint8_t* code = it->first;
+      FreeRange range = it->second;
+      free_ranges_.erase(it);
+      if (range.size > alloc_size) {
+        free_ranges_[code + alloc_size] = {range.chunk,
+                                           range.size - alloc_size};
+      }
+      *out_chunk = range.chunk;
+      return code;
+    }
+  }
+
+  // Functions that don't fit in a chunk get one to themselves. It's never
+  // made active so it can be released as soon as the function is.
+  if (alloc_size > chunk_size_) {
+    auto chunk =
+        CreateChunk(poly::round_up(alloc_size, kOversizedChunkAlignment));
+    if (!chunk) {
+      return nullptr;
+    }
+    chunks_.push_back(chunk);
+    chunk->offset = alloc_size;
+    *out_chunk = chunk;
+    return chunk->buffer;
+  }
+
+  if (!active_chunk_ ||
+      active_chunk_->capacity - active_chunk_->offset < alloc_size) {
+    auto chunk = CreateChunk(chunk_size_);
+    if (!chunk) {
+      return nullptr;
+    }
+    chunks_.push_back(chunk);
+    if (active_chunk_ && kReusesFreedSpace) {
+      // Don't lose the tail of the old chunk.
+      size_t remaining = active_chunk_->capacity - active_chunk_->offset;
+      if (remaining) {
+        AddFreeRange(active_chunk_,
+                     active_chunk_->buffer + active_chunk_->offset, remaining);
+        active_chunk_->offset = active_chunk_->capacity;
+      }
+    }
+    active_chunk_ = chunk;
+  }
+
+  uint8_t* code = active_chunk_->buffer + active_chunk_->offset;
+  active_chunk_->offset += alloc_size;
+  *out_chunk = active_chunk_;
+  return code;
+}
+
+void X64CodeCache::AddFreeRange(X64CodeChunk* chunk, uint8_t* address,
+                                size_t size) {
+  // NOTE: we assume the cache lock.
+  // Chunks may happen to be adjacent in memory, so only merge within one.
+  auto next = free_ranges_.lower_bound(address);
+  if (next != free_ranges_.end() && next->second.chunk == chunk &&
+      address + size == next->first) {
+    size += next->second.size;
+    next = free_ranges_.erase(next);
+  }
+  if (next != free_ranges_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->second.chunk == chunk &&
+        prev->first + prev->second.size == address) {
+      prev->second.size += size;
+      return;
+    }
+  }
+  free_ranges_.emplace_hint(next, address, FreeRange{chunk, size});
+}
+
+X64CodeChunk* X64CodeCache::CreateChunk(size_t capacity) {
+  // NOTE: we assume the cache lock.
+  size_t guard_size = use_guard_pages_ ? poly::page_size() : 0;
+  size_t reservation_size =
+      poly::round_up(capacity + guard_size * 2, kWindowAlignment);
+  uint8_t* reservation = AllocateWindowRange(reservation_size);
+  if (!reservation && window_base_) {
+    PLOGW("X64CodeCache: code window exhausted");
+  }
+  auto chunk = AllocateChunk(capacity, reservation, reservation_size);
+  if (!chunk && reservation) {
+    FreeWindowRange(reservation, reservation_size);
+  }
+  return chunk;
+}
+
+void X64CodeCache::DeleteChunk(X64CodeChunk* chunk) {
+  // NOTE: we assume the cache lock.
+  uint8_t* reservation = chunk->owns_reservation ? nullptr : chunk->reservation;
+  size_t reservation_size = chunk->reservation_size;
+  delete chunk;
+  if (reservation) {
+    FreeWindowRange(reservation, reservation_size);
+  }
+}
+
+uint8_t* X64CodeCache::AllocateWindowRange(size_t size) {
+  // NOTE: we assume the cache lock.
+  if (!window_base_) {
+    return nullptr;
+  }
+  // Chunks are mostly the same size, so first fit does fine.
+  for (auto it = free_window_ranges_.begin(); it != free_window_ranges_.end();
+       ++it) {
+    if (it->second < size) {
+      continue;
+    }
+    uint8_t* address = it->first;
+    size_t remaining = it->second - size;
+    free_window_ranges_.erase(it);
+    if (remaining) {
+      free_window_ranges_[address + size] = remaining;
+    }
+    return address;
+  }
+  if (kWindowSize - window_offset_ < size) {
+    return nullptr;
+  }
+  uint8_t* address = window_base_ + window_offset_;
+  window_offset_ += size;
+  return address;
+}
+
+void X64CodeCache::FreeWindowRange(uint8_t* address, size_t size) {
+  // NOTE: we assume the cache lock.
+  // Merge with the neighbors so that chunks of different sizes can reuse the
+  // space of several smaller ones.
+  auto next = free_window_ranges_.lower_bound(address);
+  if (next != free_window_ranges_.end() && address + size == next->first) {
+    size += next->second;
+    next = free_window_ranges_.erase(next);
+  }
+  if (next != free_window_ranges_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == address) {
+      address = prev->first;
+      size += prev->second;
+      free_window_ranges_.erase(prev);
+    }
+  }
+  if (address + size == window_base_ + window_offset_) {
+    // Back to the untouched end of the window.
+    window_offset_ = address - window_base_;
+    return;
+  }
+  free_window_ranges_[address] = size;
+}
+
+X64CodeChunk* X64CodeCache::FindChunk(const void* address) {
+  // NOTE: we assume the cache lock.
+  auto p = reinterpret_cast<const uint8_t*>(address);
+  for (auto chunk : chunks_) {
+    if (p >= chunk->buffer && p < chunk->buffer + chunk->capacity) {
+      return chunk;
+    }
+  }
+  return nullptr;
+}
+
+FunctionInfo* X64CodeCache::LookupFunction(const void* host_address,
+                                           void** out_code_address) {
+  auto p = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(host_address));
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = blocks_.upper_bound(p);
+  if (it == blocks_.begin()) {
+    return nullptr;
+  }
+  --it;
+  if (p >= it->first + it->second.size) {
+    return nullptr;
+  }
+  if (out_code_address) {
+    *out_code_address = it->first;
+  }
+  return it->second.symbol_info;
+}
+
+void* X64CodeCache::GetWritableAddress(void* code_address) {
+  if (!use_wx_) {
+    return code_address;
+  }
+  std::lock_guard<std::mutex> guard(lock_);
+  auto chunk = FindChunk(code_address);
+  assert_not_null(chunk);
+  if (!chunk) {
+    return nullptr;
+  }
+  return chunk->write_buffer +
+         (reinterpret_cast<uint8_t*>(code_address) - chunk->buffer);
+}
+
+void X64CodeCache::InvalidateCode(void* code_address) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = blocks_.find(reinterpret_cast<uint8_t*>(code_address));
+  assert_true(it != blocks_.end());
+  if (it == blocks_.end() || it->second.invalidated) {
+    return;
+  }
+  it->second.invalidated = true;
+  invalidated_size_ += it->second.size;
+}
+
+bool X64CodeCache::IsInvalidated(void* code_address) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = blocks_.find(reinterpret_cast<uint8_t*>(code_address));
+  return it != blocks_.end() && it->second.invalidated;
+}
+
+bool X64CodeCache::FindInvalidatedFrames(
+    void* const* slot, const void* stop_code,
+    std::vector<void*>* out_code_addresses) {
+  // Guest functions set up their whole frame in the prolog and only call out
+  // from there, so each return address is followed by the frame of the
+  // function it returns into and then by that function's own return address.
+  // Anything deeper than this is more likely garbage than a real stack.
+  const size_t kMaxFrameCount = 4096;
+  std::lock_guard<std::mutex> guard(lock_);
+  for (size_t n = 0; n < kMaxFrameCount; ++n) {
+    auto p = reinterpret_cast<uint8_t*>(*slot);
+    auto it = blocks_.upper_bound(p);
+    if (it == blocks_.begin()) {
+      return false;
+    }
+    --it;
+    if (p >= it->first + it->second.size) {
+      return false;
+    }
+    if (it->first == stop_code) {
+      return true;
+    }
+    if (!it->second.symbol_info) {
+      // A thunk or trampoline, none of which have guest frames above them.
+      return false;
+    }
+    if (it->second.invalidated) {
+      out_code_addresses->push_back(it->first);
+    }
+    slot += 1 + it->second.stack_size / sizeof(void*);
+  }
+  return false;
+}
+
+size_t X64CodeCache::ReclaimCode(const std::vector<void*>& code_addresses) {
+  SCOPE_profile_cpu_f("alloy");
+
+  std::lock_guard<std::mutex> guard(lock_);
+  size_t reclaimed_size = 0;
+  for (auto code_address : code_addresses) {
+    auto it = blocks_.find(reinterpret_cast<uint8_t*>(code_address));
+    assert_true(it != blocks_.end() && it->second.invalidated);
+    if (it == blocks_.end() || !it->second.invalidated) {
+      continue;
+    }
+    auto chunk = it->second.chunk;
+    size_t size = it->second.size;
+    std::memset(chunk->write_buffer + (it->first - chunk->buffer), kFillByte,
+                size);
+    if (kReusesFreedSpace) {
+      AddFreeRange(chunk, it->first, size);
+    }
+    --chunk->block_count;
+    reclaimed_size += size;
+    invalidated_size_ -= size;
+    blocks_.erase(it);
+  }
+  if (!reclaimed_size) {
+    return 0;
+  }
+
+  // Give empty chunks back to the system.
+  for (auto it = chunks_.begin(); it != chunks_.end();) {
+    auto chunk = *it;
+    if (chunk->block_count || chunk == active_chunk_) {
+      ++it;
+      continue;
+    }
+    auto range = free_ranges_.lower_bound(chunk->buffer);
+    while (range != free_ranges_.end() && range->second.chunk == chunk) {
+      range = free_ranges_.erase(range);
+    }
+    DeleteChunk(chunk);
+    it = chunks_.erase(it);
+  }
+
+  return reclaimed_size;
+}
+
+X64CodeCache::Stats X64CodeCache::stats() {
+  std::lock_guard<std::mutex> guard(lock_);
+  Stats stats = {0};
+  stats.chunk_count = chunks_.size();
+  for (auto chunk : chunks_) {
+    stats.committed_size += chunk->capacity;
+  }
+  for (auto& it : blocks_) {
+    stats.used_size += it.second.size;
+  }
+  stats.invalidated_size = invalidated_size_;
+  for (auto& it : free_ranges_) {
+    stats.free_size += it.second.size;
+  }
+  return stats;
+}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace alloy
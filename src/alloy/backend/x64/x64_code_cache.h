@@ -10,33 +10,171 @@
 #ifndef ALLOY_BACKEND_X64_X64_CODE_CACHE_H_
 #define ALLOY_BACKEND_X64_X64_CODE_CACHE_H_
 
+#include <cstdint>
+#include <map>
 #include <mutex>
+#include <vector>
+
+namespace alloy {
+namespace runtime {
+class FunctionInfo;
+}  // namespace runtime
+}  // namespace alloy
 
 namespace alloy {
 namespace backend {
 namespace x64 {
 
-class X64CodeChunk;
+// A contiguous range of executable memory code is placed into.
+// Platforms subclass this to hang their own bookkeeping off of it.
+class X64CodeChunk {
+ public:
+  X64CodeChunk(size_t capacity)
+      : capacity(capacity),
+        reservation(nullptr),
+        reservation_size(0),
+        owns_reservation(false),
+        buffer(nullptr),
+        write_buffer(nullptr),
+        offset(0),
+        block_count(0) {}
+  virtual ~X64CodeChunk() = default;
+
+ public:
+  size_t capacity;
+  // Address space the chunk was placed in, including guard pages. Unless the
+  // chunk owns it, it's part of the code window and is only decommitted when
+  // the chunk is deleted.
+  uint8_t* reservation;
+  size_t reservation_size;
+  bool owns_reservation;
+  // Where the code runs from.
+  uint8_t* buffer;
+  // Where the code is written through. Same as buffer unless W^X is on.
+  uint8_t* write_buffer;
+  // Bump allocation offset.
+  size_t offset;
+  // Blocks placed in the chunk that have not been reclaimed.
+  size_t block_count;
+};
 
 class X64CodeCache {
  public:
+  struct Stats {
+    size_t chunk_count;
+    // Total size of all chunks.
+    size_t committed_size;
+    // Placed code, including code invalidated but not yet reclaimed.
+    size_t used_size;
+    size_t invalidated_size;
+    // Reclaimed space available for reuse.
+    size_t free_size;
+  };
+
   X64CodeCache(size_t chunk_size = DEFAULT_CHUNK_SIZE);
   virtual ~X64CodeCache();
 
   int Initialize();
 
-  // TODO(benvanik): ELF serialization/etc
-  // TODO(benvanik): keep track of code blocks
-  // TODO(benvanik): padding/guards/etc
+  // Whether code is placed within a single 2GB window, so that generated
+  // code can reach other generated code with rel32 calls and jumps.
+  // Code may still end up outside of it if the window is exhausted.
+  bool has_code_window() const { return window_base_ != nullptr; }
+
+  // Copies code into the cache and returns its executable address.
+  // symbol_info is what LookupFunction returns for the code, and may be null
+  // for thunks.
+  void* PlaceCode(runtime::FunctionInfo* symbol_info, const void* machine_code,
+                  size_t code_size, size_t stack_size);
+
+  // Finds the function containing the given host address, or null.
+  // Invalidated code is still found until it has been reclaimed.
+  runtime::FunctionInfo* LookupFunction(const void* host_address,
+                                        void** out_code_address = nullptr);
+
+  // Returns the address writes to placed code must go through. This is only
+  // different from code_address when W^X is enabled.
+  void* GetWritableAddress(void* code_address);
+
+  // Marks code returned from PlaceCode as dead. Threads may still be running
+  // it, so the memory is only released by ReclaimCode.
+  void InvalidateCode(void* code_address);
+
+  // Whether InvalidateCode was called on the code.
+  bool IsInvalidated(void* code_address);
+
+  // Walks the guest frames from the return address at slot (pushed by a call
+  // out of guest code) up to the one returning into stop_code, and collects
+  // the invalidated code any of them will return into. Returns false if a
+  // frame isn't that of a function placed here.
+  bool FindInvalidatedFrames(void* const* slot, const void* stop_code,
+                             std::vector<void*>* out_code_addresses);
+
+  // Releases the given invalidated code and returns the number of bytes
+  // freed. Callers must ensure no thread is running (or will return into) any
+  // of it. Empty chunks are returned to the system and space in the others is
+  // reused by PlaceCode where the platform allows.
+  size_t ReclaimCode(const std::vector<void*>& code_addresses);
+
+  Stats stats();
+
+ private:
+  struct CodeBlock {
+    X64CodeChunk* chunk;
+    size_t size;
+    // Bytes the prolog allocates below the return address.
+    size_t stack_size;
+    runtime::FunctionInfo* symbol_info;
+    bool invalidated;
+  };
+  struct FreeRange {
+    X64CodeChunk* chunk;
+    size_t size;
+  };
+
+  uint8_t* AllocateCode(size_t alloc_size, X64CodeChunk** out_chunk);
+  void AddFreeRange(X64CodeChunk* chunk, uint8_t* address, size_t size);
+  X64CodeChunk* FindChunk(const void* address);
+  X64CodeChunk* CreateChunk(size_t capacity);
+  void DeleteChunk(X64CodeChunk* chunk);
+  uint8_t* AllocateWindowRange(size_t size);
+  void FreeWindowRange(uint8_t* address, size_t size);
 
-  void* PlaceCode(void* machine_code, size_t code_size, size_t stack_size);
+  // Implemented per platform in x64_code_cache_posix.cc/x64_code_cache_win.cc.
+  // Reserves inaccessible address space, returning null on failure.
+  static uint8_t* ReserveAddressSpace(size_t size);
+  static void ReleaseAddressSpace(uint8_t* address, size_t size);
+  // Commits a chunk after the leading guard page (if any) of the given range
+  // of reserved address space. Reserves its own if reservation is null.
+  X64CodeChunk* AllocateChunk(size_t capacity, uint8_t* reservation,
+                              size_t reservation_size);
+  void OnCodePlaced(X64CodeChunk* chunk, uint8_t* code, size_t alloc_size,
+                    size_t stack_size);
+  // Extra bytes PlaceCode reserves after each function for the platform.
+  static const size_t kPlatformOverhead;
+  // Whether space freed within a chunk can be handed out again.
+  static const bool kReusesFreedSpace;
 
  private:
   const static size_t DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024;
   std::mutex lock_;
   size_t chunk_size_;
-  X64CodeChunk* head_chunk_;
+  bool use_guard_pages_;
+  bool use_wx_;
+  std::vector<X64CodeChunk*> chunks_;
   X64CodeChunk* active_chunk_;
+  // Address space all chunks are carved from, if it could be reserved.
+  uint8_t* window_base_;
+  size_t window_offset_;
+  // Ranges of the window given back by deleted chunks. Adjacent ranges are
+  // merged.
+  std::map<uint8_t*, size_t> free_window_ranges_;
+  // Placed code by executable address.
+  std::map<uint8_t*, CodeBlock> blocks_;
+  // Reclaimed space by executable address. Adjacent ranges within a chunk
+  // are merged.
+  std::map<uint8_t*, FreeRange> free_ranges_;
+  size_t invalidated_size_;
 };
 
 }  // namespace x64
@@ -0,0 +1,432 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/backend/x64/x64_code_cache_file.h"
+
+#include "alloy/alloy-private.h"
+#include "alloy/backend/x64/x64_backend.h"
+#include "alloy/backend/x64/x64_call_site_ic.h"
+#include "alloy/backend/x64/x64_code_cache.h"
+#include "alloy/backend/x64/x64_dispatch_table.h"
+#include "alloy/backend/x64/x64_function.h"
+#include "alloy/runtime/module.h"
+#include "alloy/runtime/runtime.h"
+#include "poly/mapped_memory.h"
+#include "poly/poly.h"
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/profiling.h"
+
+#if !XE_LIKE_WIN32
+#include <dlfcn.h>
+#include <unistd.h>
+#endif  // !XE_LIKE_WIN32
+
+namespace alloy {
+namespace backend {
+namespace x64 {
+
+using alloy::runtime::Function;
+using alloy::runtime::FunctionInfo;
+using alloy::runtime::Module;
+using alloy::runtime::Runtime;
+
+namespace {
+
+// Bump whenever the layout of the file or the emitted code changes.
+const uint32_t kFileMagic = 0x30434358;  // 'XCC0'
+const uint32_t kFileFormatVersion = 6;
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t format_version;
+  uint64_t backend_version;
+};
+
+struct FunctionHeader {
+  uint64_t guest_address;
+  uint64_t guest_end_address;
+  // Hash of the guest instructions the code was translated from.
+  uint64_t guest_hash;
+  uint32_t code_size;
+  uint32_t stack_size;
+  uint32_t relocation_count;
+  uint32_t reserved;
+  // X64Relocation relocations[relocation_count];
+  // uint8_t code[code_size] padded to 8b;
+};
+
+static_assert_size(X64Relocation, 16);
+
+size_t GetEntrySize(const FunctionHeader* header) {
+  // In 64 bits so that sizes from a corrupt file can't wrap.
+  return sizeof(FunctionHeader) +
+         header->relocation_count * sizeof(X64Relocation) +
+         poly::round_up(static_cast<size_t>(header->code_size), size_t(8));
+}
+
+// Path of the host binary containing the backend.
+std::wstring GetImagePath() {
+  auto anchor = reinterpret_cast<void*>(X64Emitter::image_anchor());
+#if XE_LIKE_WIN32
+  HMODULE module = nullptr;
+  if (!GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                             GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                         reinterpret_cast<LPCWSTR>(anchor), &module)) {
+    return L"";
+  }
+  wchar_t path[MAX_PATH];
+  DWORD length = GetModuleFileNameW(module, path, MAX_PATH);
+  if (!length || length == MAX_PATH) {
+    return L"";
+  }
+  return std::wstring(path, length);
+#else
+  // dladdr reports the main executable by the name it was started with, which
+  // may be relative to a directory we've since left.
+  char path[4096];
+  ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  Dl_info info;
+  if (dladdr(anchor, &info) && info.dli_fname && info.dli_fname[0] == '/') {
+    return poly::to_wstring(info.dli_fname);
+  } else if (length > 0) {
+    path[length] = 0;
+    return poly::to_wstring(path);
+  }
+  return L"";
+#endif  // XE_LIKE_WIN32
+}
+
+// Hash of the entire host binary. Any rebuild changes it, whatever changed in
+// code generation, and it is stable across runs of the same binary.
+uint64_t GetImageHash() {
+  static const uint64_t image_hash = []() -> uint64_t {
+    auto path = GetImagePath();
+    std::unique_ptr<poly::MappedMemory> image;
+    if (!path.empty()) {
+      image = poly::MappedMemory::Open(path, poly::MappedMemory::Mode::kRead);
+    }
+    if (!image) {
+      // Nothing to tell builds apart by; never match an existing file.
+      PLOGW("Unable to read the host image, code cache files won't be reused");
+      return 0;
+    }
+    return XXH64(image->data(), image->size(), 0);
+  }();
+  return image_hash;
+}
+
+}  // namespace
+
+X64CodeCacheFile::X64CodeCacheFile(X64Backend* backend, Module* module)
+    : backend_(backend), module_(module), file_(nullptr), loaded_count_(0) {}
+
+X64CodeCacheFile::~X64CodeCacheFile() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+uint64_t X64CodeCacheFile::backend_version(uint32_t emitter_feature_flags) {
+  // Relocations against the host image, and the code itself, are only valid
+  // for the exact binary that produced them. The flags below change what a
+  // given binary emits for the same guest code.
+  uint64_t image_hash = GetImageHash();
+  if (!image_hash) {
+    return 0;
+  }
+  uint64_t samples[] = {
+      kFileFormatVersion,
+      image_hash,
+      emitter_feature_flags,
+      FLAGS_store_all_context_values ? 1ull : 0ull,
+      FLAGS_drop_call_clobbered_context ? 1ull : 0ull,
+      static_cast<uint64_t>(FLAGS_inline_max_instructions),
+      FLAGS_validate_memory_forwarding ? 1ull : 0ull,
+      FLAGS_ic_stats ? 1ull : 0ull,
+      FLAGS_break_on_instruction,
+      FLAGS_break_on_debugbreak ? 1ull : 0ull,
+  };
+  return XXH64(samples, sizeof(samples), 0);
+}
+
+int X64CodeCacheFile::Initialize(const std::string& path) {
+  SCOPE_profile_cpu_f("alloy");
+
+  // Slurp the existing file, if any.
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file) {
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (file_size > 0) {
+      data_.resize(file_size);
+      if (fread(data_.data(), 1, data_.size(), file) != data_.size()) {
+        data_.clear();
+      }
+    }
+    fclose(file);
+  }
+
+  // Validate the header and index all complete entries. A trailing partial
+  // entry (from a crash mid-write) is ignored.
+  bool valid = false;
+  bool truncated = false;
+  if (data_.size() >= sizeof(FileHeader)) {
+    auto file_header = reinterpret_cast<const FileHeader*>(data_.data());
+    valid = file_header->magic == kFileMagic &&
+            file_header->format_version == kFileFormatVersion &&
+            file_header->backend_version ==
+                backend_version(backend_->emitter_feature_flags()) &&
+            file_header->backend_version != 0;
+  }
+  if (valid) {
+    size_t offset = sizeof(FileHeader);
+    while (offset + sizeof(FunctionHeader) <= data_.size()) {
+      auto header =
+          reinterpret_cast<const FunctionHeader*>(data_.data() + offset);
+      size_t entry_size = GetEntrySize(header);
+      if (offset + entry_size > data_.size()) {
+        break;
+      }
+      // Later entries replace earlier ones for the same function.
+      entries_[header->guest_address] = offset;
+      offset += entry_size;
+    }
+    // Drop any partial entry so that appends land on an entry boundary.
+    truncated = offset != data_.size();
+    data_.resize(offset);
+  } else {
+    data_.clear();
+    entries_.clear();
+  }
+
+  if (valid && !truncated) {
+    file_ = fopen(path.c_str(), "ab");
+  } else if (valid) {
+    // Rewrite without the partial entry.
+    file_ = fopen(path.c_str(), "wb");
+    if (file_) {
+      fwrite(data_.data(), 1, data_.size(), file_);
+      fflush(file_);
+    }
+  } else {
+    file_ = fopen(path.c_str(), "wb");
+    if (file_) {
+      FileHeader file_header;
+      file_header.magic = kFileMagic;
+      file_header.format_version = kFileFormatVersion;
+      file_header.backend_version =
+          backend_version(backend_->emitter_feature_flags());
+      fwrite(&file_header, sizeof(file_header), 1, file_);
+      fflush(file_);
+    }
+  }
+  if (!file_) {
+    PLOGW("Unable to open code cache file %s", path.c_str());
+    return 1;
+  }
+
+  return 0;
+}
+
+uint64_t X64CodeCacheFile::HashGuestCode(uint64_t address,
+                                         uint64_t end_address) {
+  const uint8_t* p = backend_->runtime()->memory()->Translate(address);
+  return XXH64(p, static_cast<size_t>(end_address + 4 - address), 0);
+}
+
+int X64CodeCacheFile::ApplyRelocations(
+    uint8_t* code, const X64Relocation* relocations, uint32_t relocation_count,
+    std::vector<X64CallSiteIC*>* call_site_ics) {
+  Runtime* runtime = backend_->runtime();
+  std::unordered_map<uint64_t, X64CallSiteIC*> ics_by_address;
+  for (uint32_t n = 0; n < relocation_count; ++n) {
+    const auto& relocation = relocations[n];
+    uint64_t value = 0;
+    switch (relocation.type) {
+      case X64RelocationType::kImage:
+        value = X64Emitter::image_anchor() + relocation.key;
+        break;
+      case X64RelocationType::kGuestToHostThunk:
+        value = reinterpret_cast<uint64_t>(backend_->guest_to_host_thunk());
+        break;
+      case X64RelocationType::kDispatchTable: {
+        auto dispatch_table = backend_->GetDispatchTable(module_);
+        if (!dispatch_table) {
+          return 1;
+        }
+        value = reinterpret_cast<uint64_t>(dispatch_table->entries());
+        break;
+      }
+      case X64RelocationType::kCallLinkThunk:
+        value = reinterpret_cast<uint64_t>(backend_->call_link_thunk());
+        break;
+      case X64RelocationType::kCallSiteIC: {
+        auto& ic = ics_by_address[relocation.key];
+        if (!ic) {
+          ic = backend_->CreateCallSiteIC(relocation.key);
+          call_site_ics->push_back(ic);
+        }
+        value = reinterpret_cast<uint64_t>(ic);
+        break;
+      }
+      case X64RelocationType::kFunctionInfo:
+      case X64RelocationType::kExternHandler:
+      case X64RelocationType::kExternArg0:
+      case X64RelocationType::kExternArg1: {
+        FunctionInfo* target_info;
+        if (runtime->LookupFunctionInfo(relocation.key, &target_info)) {
+          return 1;
+        }
+        if (relocation.type == X64RelocationType::kFunctionInfo) {
+          value = reinterpret_cast<uint64_t>(target_info);
+          break;
+        }
+        if (target_info->behavior() != FunctionInfo::BEHAVIOR_EXTERN) {
+          // Extern changed since the code was cached.
+          return 1;
+        }
+        if (relocation.type == X64RelocationType::kExternHandler) {
+          value = reinterpret_cast<uint64_t>(target_info->extern_handler());
+        } else if (relocation.type == X64RelocationType::kExternArg0) {
+          value = reinterpret_cast<uint64_t>(target_info->extern_arg0());
+        } else {
+          value = reinterpret_cast<uint64_t>(target_info->extern_arg1());
+        }
+        break;
+      }
+      case X64RelocationType::kCode:
+        // Only known once the code is placed.
+        continue;
+      default:
+        return 1;
+    }
+    poly::store<uint64_t>(code + relocation.code_offset, value);
+  }
+  return 0;
+}
+
+int X64CodeCacheFile::LoadFunction(FunctionInfo* symbol_info,
+                                   Function** out_function) {
+  SCOPE_profile_cpu_f("alloy");
+  *out_function = nullptr;
+
+  // data_ and entries_ are immutable after Initialize, so no lock is needed.
+  auto it = entries_.find(symbol_info->address());
+  if (it == entries_.end()) {
+    return 1;
+  }
+  auto header = reinterpret_cast<const FunctionHeader*>(data_.data() +
+                                                        it->second);
+  if (symbol_info->has_end_address() &&
+      symbol_info->end_address() != header->guest_end_address) {
+    return 1;
+  }
+  // The range is hashed straight out of guest memory, so it must be sane even
+  // if the file is corrupt. end_address is that of the last instruction.
+  if (header->guest_end_address < header->guest_address ||
+      !module_->ContainsAddress(header->guest_address) ||
+      !module_->ContainsAddress(header->guest_end_address)) {
+    return 1;
+  }
+  if (HashGuestCode(header->guest_address, header->guest_end_address) !=
+      header->guest_hash) {
+    // Guest code changed (patched/etc) - must retranslate.
+    return 1;
+  }
+
+  auto relocations = reinterpret_cast<const X64Relocation*>(header + 1);
+  auto code =
+      reinterpret_cast<const uint8_t*>(relocations + header->relocation_count);
+  for (uint32_t n = 0; n < header->relocation_count; ++n) {
+    // Written so that it can't wrap for offsets near 4GB.
+    if (relocations[n].code_offset > header->code_size ||
+        header->code_size - relocations[n].code_offset < 8) {
+      return 1;
+    }
+    if (relocations[n].type == X64RelocationType::kCode &&
+        relocations[n].key >= header->code_size) {
+      return 1;
+    }
+  }
+
+  // Relocate into a scratch copy then place.
+  std::vector<uint8_t> scratch(code, code + header->code_size);
+  std::vector<X64CallSiteIC*> call_site_ics;
+  if (ApplyRelocations(scratch.data(), relocations, header->relocation_count,
+                       &call_site_ics)) {
+    backend_->FreeCallSiteICs(call_site_ics);
+    return 1;
+  }
+
+  if (!symbol_info->has_end_address()) {
+    symbol_info->set_end_address(header->guest_end_address);
+  }
+
+  auto code_cache = backend_->code_cache();
+  void* machine_code = code_cache->PlaceCode(
+      symbol_info, scratch.data(), header->code_size, header->stack_size);
+  backend_->SetCallSiteICsCode(call_site_ics, machine_code);
+  auto writable_code =
+      reinterpret_cast<uint8_t*>(code_cache->GetWritableAddress(machine_code));
+  for (uint32_t n = 0; n < header->relocation_count; ++n) {
+    if (relocations[n].type == X64RelocationType::kCode) {
+      poly::store<uint64_t>(
+          writable_code + relocations[n].code_offset,
+          reinterpret_cast<uint64_t>(machine_code) + relocations[n].key);
+    }
+  }
+  X64Emitter::InitializeEntryStub(writable_code, machine_code);
+  X64Function* fn = new X64Function(symbol_info);
+  fn->Setup(machine_code, header->code_size);
+  *out_function = fn;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  ++loaded_count_;
+  return 0;
+}
+
+int X64CodeCacheFile::AddFunction(
+    FunctionInfo* symbol_info, const void* machine_code, size_t code_size,
+    size_t stack_size, const std::vector<X64Relocation>& relocations) {
+  SCOPE_profile_cpu_f("alloy");
+
+  FunctionHeader header;
+  header.guest_address = symbol_info->address();
+  header.guest_end_address = symbol_info->end_address();
+  header.guest_hash = HashGuestCode(symbol_info->address(),
+                                    symbol_info->end_address());
+  header.code_size = static_cast<uint32_t>(code_size);
+  header.stack_size = static_cast<uint32_t>(stack_size);
+  header.relocation_count = static_cast<uint32_t>(relocations.size());
+  header.reserved = 0;
+
+  static const uint8_t padding[8] = {0};
+  size_t padding_size = poly::round_up(code_size, 8) - code_size;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!file_) {
+    return 1;
+  }
+  fwrite(&header, sizeof(header), 1, file_);
+  if (!relocations.empty()) {
+    fwrite(relocations.data(), sizeof(X64Relocation), relocations.size(),
+           file_);
+  }
+  fwrite(machine_code, 1, code_size, file_);
+  if (padding_size) {
+    fwrite(padding, 1, padding_size, file_);
+  }
+  fflush(file_);
+  return 0;
+}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace alloy
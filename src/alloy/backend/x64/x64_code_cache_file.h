@@ -0,0 +1,92 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_BACKEND_X64_X64_CODE_CACHE_FILE_H_
+#define ALLOY_BACKEND_X64_X64_CODE_CACHE_FILE_H_
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "alloy/backend/x64/x64_emitter.h"
+
+namespace alloy {
+namespace runtime {
+class Function;
+class FunctionInfo;
+class Module;
+}  // namespace runtime
+}  // namespace alloy
+
+namespace alloy {
+namespace backend {
+namespace x64 {
+
+class X64Backend;
+
+// Persistent on-disk cache of translated functions for a single module.
+// The file is keyed by the module contents (the cache_key, which is part of the
+// file name) and the backend version (in the header). Each entry holds the
+// relocatable machine code of a function as it was emitted along with its
+// relocations and guest extents. Entries are appended as functions are
+// translated so a partially written file is still usable.
+class X64CodeCacheFile {
+ public:
+  X64CodeCacheFile(X64Backend* backend, runtime::Module* module);
+  ~X64CodeCacheFile();
+
+  runtime::Module* module() const { return module_; }
+
+  // Loads all valid entries from the given file and opens it for appending.
+  // The file is created (or truncated, if stale) as needed.
+  int Initialize(const std::string& path);
+
+  // Places the cached code for the function, if present and still valid.
+  int LoadFunction(runtime::FunctionInfo* symbol_info,
+                   runtime::Function** out_function);
+
+  // Appends a freshly emitted function to the file.
+  // machine_code must still be pristine (never executed).
+  int AddFunction(runtime::FunctionInfo* symbol_info, const void* machine_code,
+                  size_t code_size, size_t stack_size,
+                  const std::vector<X64Relocation>& relocations);
+
+  size_t loaded_count() const { return loaded_count_; }
+
+  // Version of the emitted code. Changes whenever the host binary is rebuilt
+  // or a flag or host feature that affects code generation changes.
+  // 0 if the host binary can't be identified.
+  static uint64_t backend_version(uint32_t emitter_feature_flags);
+
+ private:
+  // Call site ICs created for the code are added to call_site_ics.
+  int ApplyRelocations(uint8_t* code, const X64Relocation* relocations,
+                       uint32_t relocation_count,
+                       std::vector<X64CallSiteIC*>* call_site_ics);
+  uint64_t HashGuestCode(uint64_t address, uint64_t end_address);
+
+ private:
+  X64Backend* backend_;
+  runtime::Module* module_;
+
+  std::mutex lock_;
+  FILE* file_;
+  // Raw file contents and the offset of each function entry in it.
+  std::vector<uint8_t> data_;
+  std::unordered_map<uint64_t, size_t> entries_;
+  size_t loaded_count_;
+};
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace alloy
+
+#endif  // ALLOY_BACKEND_X64_X64_CODE_CACHE_FILE_H_
@@ -7,93 +7,147 @@
  ******************************************************************************
  */
 
-#include <alloy/backend/x64/x64_code_cache.h>
+#include "alloy/backend/x64/x64_code_cache.h"
 
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-#include <poly/assert.h>
-#include <poly/math.h>
-#include <xenia/profiling.h>
+#include <cstdio>
+
+#include "poly/poly.h"
+#include "xenia/profiling.h"
 
 namespace alloy {
 namespace backend {
 namespace x64 {
 
-class X64CodeChunk {
- public:
-  X64CodeChunk(size_t chunk_size);
-  ~X64CodeChunk();
-
- public:
-  X64CodeChunk* next;
-  size_t capacity;
-  uint8_t* buffer;
-  size_t offset;
-};
-
-X64CodeCache::X64CodeCache(size_t chunk_size)
-    : chunk_size_(chunk_size), head_chunk_(NULL), active_chunk_(NULL) {}
-
-X64CodeCache::~X64CodeCache() {
-  std::lock_guard<std::mutex> guard(lock_);
-  auto chunk = head_chunk_;
-  while (chunk) {
-    auto next = chunk->next;
-    delete chunk;
-    chunk = next;
+const size_t X64CodeCache::kPlatformOverhead = 0;
+const bool X64CodeCache::kReusesFreedSpace = true;
+
+namespace {
+
+// Creates an anonymous shared memory object that can be mapped twice.
+int CreateSharedMemory(size_t size) {
+#if defined(SYS_memfd_create)
+  // Called directly as older libcs lack the wrapper.
+  int fd = static_cast<int>(syscall(SYS_memfd_create, "xenia-code", 0));
+#else
+  char name[64];
+  snprintf(name, sizeof(name), "/xenia-code-%d-%p", getpid(), &name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd != -1) {
+    shm_unlink(name);
   }
-  head_chunk_ = NULL;
+#endif  // SYS_memfd_create
+  if (fd == -1) {
+    return -1;
+  }
+  if (ftruncate(fd, size) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
 }
 
-int X64CodeCache::Initialize() { return 0; }
-
-void* X64CodeCache::PlaceCode(void* machine_code, size_t code_size,
-                              size_t stack_size) {
-  SCOPE_profile_cpu_f("alloy");
-
-  // Always move the code to land on 16b alignment. We do this by rounding up
-  // to 16b so that all offsets are aligned.
-  code_size = poly::round_up(code_size, 16);
+}  // namespace
 
-  lock_.lock();
-
-  if (active_chunk_) {
-    if (active_chunk_->capacity - active_chunk_->offset < code_size) {
-      auto next = active_chunk_->next;
-      if (!next) {
-        assert_true(code_size < chunk_size_, "need to support larger chunks");
-        next = new X64CodeChunk(chunk_size_);
-        active_chunk_->next = next;
-      }
-      active_chunk_ = next;
+class X64CodeChunkPosix : public X64CodeChunk {
+ public:
+  X64CodeChunkPosix(size_t capacity) : X64CodeChunk(capacity) {}
+  ~X64CodeChunkPosix() override {
+    if (write_buffer && write_buffer != buffer) {
+      munmap(write_buffer, capacity);
+    }
+    if (!reservation) {
+      return;
+    }
+    if (owns_reservation) {
+      munmap(reservation, reservation_size);
+    } else {
+      // Drop the pages but keep the range reserved for the next chunk.
+      mmap(reservation, reservation_size, PROT_NONE,
+           MAP_ANON | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, -1, 0);
     }
-  } else {
-    head_chunk_ = active_chunk_ = new X64CodeChunk(chunk_size_);
   }
+};
 
-  uint8_t* final_address = active_chunk_->buffer + active_chunk_->offset;
-  active_chunk_->offset += code_size;
-
-  lock_.unlock();
-
-  // Copy code.
-  memcpy(final_address, machine_code, code_size);
-
-  return final_address;
+uint8_t* X64CodeCache::ReserveAddressSpace(size_t size) {
+  auto address = mmap(nullptr, size, PROT_NONE,
+                      MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  if (address == MAP_FAILED) {
+    return nullptr;
+  }
+  return reinterpret_cast<uint8_t*>(address);
 }
 
-X64CodeChunk::X64CodeChunk(size_t chunk_size)
-    : next(NULL), capacity(chunk_size), buffer(0), offset(0) {
-  buffer = (uint8_t*)mmap(nullptr, chunk_size, PROT_WRITE | PROT_EXEC,
-                          MAP_ANON | MAP_PRIVATE, -1, 0);
+void X64CodeCache::ReleaseAddressSpace(uint8_t* address, size_t size) {
+  munmap(address, size);
 }
 
-X64CodeChunk::~X64CodeChunk() {
-  if (buffer) {
-    munmap(buffer, capacity);
+X64CodeChunk* X64CodeCache::AllocateChunk(size_t capacity,
+                                          uint8_t* reservation,
+                                          size_t reservation_size) {
+  auto chunk = new X64CodeChunkPosix(capacity);
+
+  // The chunk is mapped over the reserved (inaccessible) range, after a
+  // guard page if enabled. Whatever is left at either end is a guard page.
+  size_t guard_size = use_guard_pages_ ? poly::page_size() : 0;
+  if (!reservation) {
+    reservation_size = capacity + guard_size * 2;
+    reservation = ReserveAddressSpace(reservation_size);
+    if (!reservation) {
+      PLOGE("X64CodeCache: unable to reserve %zu bytes", reservation_size);
+      delete chunk;
+      return nullptr;
+    }
+    chunk->owns_reservation = true;
+  }
+  chunk->reservation = reservation;
+  chunk->reservation_size = reservation_size;
+  uint8_t* base = chunk->reservation + guard_size;
+
+  if (!use_wx_) {
+    if (mprotect(base, capacity, PROT_READ | PROT_WRITE | PROT_EXEC) == -1) {
+      PLOGE("X64CodeCache: unable to commit %zu bytes", capacity);
+      delete chunk;
+      return nullptr;
+    }
+    chunk->buffer = chunk->write_buffer = base;
+    return chunk;
   }
+
+  // W^X: the code is never writable and executable through the same
+  // mapping. It runs from a read+exec view and is written through a
+  // read+write alias of the same memory.
+  int fd = CreateSharedMemory(capacity);
+  if (fd == -1) {
+    PLOGE("X64CodeCache: unable to create shared memory for W^X");
+    delete chunk;
+    return nullptr;
+  }
+  auto exec_view = mmap(base, capacity, PROT_READ | PROT_EXEC,
+                        MAP_SHARED | MAP_FIXED, fd, 0);
+  auto write_view =
+      mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (exec_view == MAP_FAILED || write_view == MAP_FAILED) {
+    PLOGE("X64CodeCache: unable to map W^X views");
+    if (write_view != MAP_FAILED) {
+      munmap(write_view, capacity);
+    }
+    delete chunk;
+    return nullptr;
+  }
+  chunk->buffer = reinterpret_cast<uint8_t*>(exec_view);
+  chunk->write_buffer = reinterpret_cast<uint8_t*>(write_view);
+  return chunk;
 }
 
+void X64CodeCache::OnCodePlaced(X64CodeChunk* chunk, uint8_t* code,
+                                size_t alloc_size, size_t stack_size) {}
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace alloy
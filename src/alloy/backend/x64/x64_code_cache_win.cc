@@ -16,17 +16,12 @@ namespace alloy {
 namespace backend {
 namespace x64 {
 
-class X64CodeChunk {
+class X64CodeChunkWin : public X64CodeChunk {
  public:
-  X64CodeChunk(size_t chunk_size);
-  ~X64CodeChunk();
+  X64CodeChunkWin(size_t capacity);
+  ~X64CodeChunkWin() override;
 
  public:
-  X64CodeChunk* next;
-  size_t capacity;
-  uint8_t* buffer;
-  size_t offset;
-
   // Estimate of function sized use to determine initial table capacity.
   const static uint32_t ESTIMATED_FN_SIZE = 512;
   // Size of unwind info per function.
@@ -41,89 +36,91 @@ class X64CodeChunk {
   void AddTableEntry(uint8_t* code, size_t code_size, size_t stack_size);
 };
 
-X64CodeCache::X64CodeCache(size_t chunk_size)
-    : chunk_size_(chunk_size), head_chunk_(NULL), active_chunk_(NULL) {}
+// Unwind info is placed at the end of each function.
+const size_t X64CodeCache::kPlatformOverhead =
+    poly::round_up(X64CodeChunkWin::UNWIND_INFO_SIZE, 16);
+// Function tables must stay sorted and can only be appended to, so space is
+// only given back when a whole chunk is.
+const bool X64CodeCache::kReusesFreedSpace = false;
 
-X64CodeCache::~X64CodeCache() {
-  std::lock_guard<std::mutex> guard(lock_);
-  auto chunk = head_chunk_;
-  while (chunk) {
-    auto next = chunk->next;
-    delete chunk;
-    chunk = next;
-  }
-  head_chunk_ = NULL;
+uint8_t* X64CodeCache::ReserveAddressSpace(size_t size) {
+  return reinterpret_cast<uint8_t*>(
+      VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS));
 }
 
-int X64CodeCache::Initialize() { return 0; }
-
-void* X64CodeCache::PlaceCode(void* machine_code, size_t code_size,
-                              size_t stack_size) {
-  SCOPE_profile_cpu_f("alloy");
-
-  size_t alloc_size = code_size;
-
-  // Add unwind info into the allocation size. Keep things 16b aligned.
-  alloc_size += poly::round_up(X64CodeChunk::UNWIND_INFO_SIZE, 16);
-
-  // Always move the code to land on 16b alignment. We do this by rounding up
-  // to 16b so that all offsets are aligned.
-  alloc_size = poly::round_up(alloc_size, 16);
-
-  lock_.lock();
+void X64CodeCache::ReleaseAddressSpace(uint8_t* address, size_t size) {
+  VirtualFree(address, 0, MEM_RELEASE);
+}
 
-  if (active_chunk_) {
-    if (active_chunk_->capacity - active_chunk_->offset < alloc_size) {
-      auto next = active_chunk_->next;
-      if (!next) {
-        assert_true(alloc_size < chunk_size_, "need to support larger chunks");
-        next = new X64CodeChunk(chunk_size_);
-        active_chunk_->next = next;
-      }
-      active_chunk_ = next;
+X64CodeChunk* X64CodeCache::AllocateChunk(size_t capacity,
+                                          uint8_t* reservation,
+                                          size_t reservation_size) {
+  auto chunk = new X64CodeChunkWin(capacity);
+
+  // Only commit the chunk, after a guard page if enabled. Whatever is left
+  // reserved at either end is a guard page.
+  size_t guard_size = use_guard_pages_ ? poly::page_size() : 0;
+  if (!reservation) {
+    reservation_size = capacity + guard_size * 2;
+    reservation = ReserveAddressSpace(reservation_size);
+    if (!reservation) {
+      PLOGE("X64CodeCache: unable to reserve %zu bytes", reservation_size);
+      delete chunk;
+      return nullptr;
     }
-  } else {
-    head_chunk_ = active_chunk_ = new X64CodeChunk(chunk_size_);
+    chunk->owns_reservation = true;
   }
+  chunk->reservation = reservation;
+  chunk->reservation_size = reservation_size;
+  chunk->buffer = reinterpret_cast<uint8_t*>(
+      VirtualAlloc(chunk->reservation + guard_size, capacity, MEM_COMMIT,
+                   PAGE_EXECUTE_READWRITE));
+  if (!chunk->buffer) {
+    PLOGE("X64CodeCache: unable to commit %zu bytes", capacity);
+    delete chunk;
+    return nullptr;
+  }
+  chunk->write_buffer = chunk->buffer;
 
-  uint8_t* final_address = active_chunk_->buffer + active_chunk_->offset;
-  active_chunk_->offset += alloc_size;
+  chunk->fn_table_capacity =
+      static_cast<uint32_t>(poly::round_up(capacity / ESTIMATED_FN_SIZE, 16));
+  size_t table_size = chunk->fn_table_capacity * sizeof(RUNTIME_FUNCTION);
+  chunk->fn_table = (RUNTIME_FUNCTION*)malloc(table_size);
+  chunk->fn_table_count = 0;
+  RtlAddGrowableFunctionTable(
+      &chunk->fn_table_handle, chunk->fn_table, chunk->fn_table_count,
+      chunk->fn_table_capacity, (ULONG_PTR)chunk->buffer,
+      (ULONG_PTR)chunk->buffer + capacity);
+  return chunk;
+}
 
+void X64CodeCache::OnCodePlaced(X64CodeChunk* chunk, uint8_t* code,
+                                size_t alloc_size, size_t stack_size) {
   // Add entry to fn table.
-  active_chunk_->AddTableEntry(final_address, alloc_size, stack_size);
-
-  lock_.unlock();
-
-  // Copy code.
-  memcpy(final_address, machine_code, code_size);
+  static_cast<X64CodeChunkWin*>(chunk)
+      ->AddTableEntry(code, alloc_size, stack_size);
 
   // This isn't needed on x64 (probably), but is convention.
-  FlushInstructionCache(GetCurrentProcess(), final_address, alloc_size);
-  return final_address;
+  FlushInstructionCache(GetCurrentProcess(), code, alloc_size);
 }
 
-X64CodeChunk::X64CodeChunk(size_t chunk_size)
-    : next(NULL), capacity(chunk_size), buffer(0), offset(0) {
-  buffer = (uint8_t*)VirtualAlloc(NULL, capacity, MEM_RESERVE | MEM_COMMIT,
-                                  PAGE_EXECUTE_READWRITE);
-
-  fn_table_capacity =
-      static_cast<uint32_t>(poly::round_up(capacity / ESTIMATED_FN_SIZE, 16));
-  size_t table_size = fn_table_capacity * sizeof(RUNTIME_FUNCTION);
-  fn_table = (RUNTIME_FUNCTION*)malloc(table_size);
-  fn_table_count = 0;
-  fn_table_handle = 0;
-  RtlAddGrowableFunctionTable(&fn_table_handle, fn_table, fn_table_count,
-                              fn_table_capacity, (ULONG_PTR)buffer,
-                              (ULONG_PTR)buffer + capacity);
-}
+X64CodeChunkWin::X64CodeChunkWin(size_t capacity)
+    : X64CodeChunk(capacity),
+      fn_table_handle(0),
+      fn_table(nullptr),
+      fn_table_count(0),
+      fn_table_capacity(0) {}
 
-X64CodeChunk::~X64CodeChunk() {
+X64CodeChunkWin::~X64CodeChunkWin() {
   if (fn_table_handle) {
     RtlDeleteGrowableFunctionTable(fn_table_handle);
   }
-  if (buffer) {
-    VirtualFree(buffer, 0, MEM_RELEASE);
+  free(fn_table);
+  if (owns_reservation) {
+    VirtualFree(reservation, 0, MEM_RELEASE);
+  } else if (buffer) {
+    // Keep the range reserved for the next chunk.
+    VirtualFree(buffer, capacity, MEM_DECOMMIT);
   }
 }
 
@@ -188,8 +185,8 @@ typedef struct _UNWIND_INFO {
 } UNWIND_INFO, *PUNWIND_INFO;
 }  // namespace
 
-void X64CodeChunk::AddTableEntry(uint8_t* code, size_t code_size,
-                                 size_t stack_size) {
+void X64CodeChunkWin::AddTableEntry(uint8_t* code, size_t code_size,
+                                    size_t stack_size) {
   // NOTE: we assume a chunk lock.
 
   if (fn_table_count + 1 > fn_table_capacity) {
@@ -213,7 +210,7 @@ void X64CodeChunk::AddTableEntry(uint8_t* code, size_t code_size,
 
   // Allocate unwind data. We know we have space because we overallocated.
   // This should be the tailing 16b with 16b alignment.
-  size_t unwind_info_offset = offset - UNWIND_INFO_SIZE;
+  size_t unwind_info_offset = (code - buffer) + code_size - UNWIND_INFO_SIZE;
 
   if (!stack_size) {
     // http://msdn.microsoft.com/en-us/library/ddssxxy8.aspx
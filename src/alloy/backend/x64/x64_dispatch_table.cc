@@ -0,0 +1,80 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/backend/x64/x64_dispatch_table.h"
+
+#include <cstdlib>
+
+#include "alloy/runtime/module.h"
+#include "poly/poly.h"
+
+namespace alloy {
+namespace backend {
+namespace x64 {
+
+using alloy::runtime::Module;
+
+X64DispatchTable::X64DispatchTable(Module* module)
+    : module_(module), base_address_(0), range_size_(0), entries_(nullptr) {}
+
+X64DispatchTable::~X64DispatchTable() {
+  free(const_cast<int64_t*>(entries_));
+}
+
+int X64DispatchTable::Initialize() {
+  uint64_t low_address;
+  uint64_t high_address;
+  if (!module_->GetCodeRange(&low_address, &high_address) ||
+      high_address <= low_address) {
+    return 1;
+  }
+  // Generated code does 32-bit math on the offset.
+  if (high_address - low_address > UINT32_MAX) {
+    return 1;
+  }
+  // Entries are indexed by address >> 2, which needs an aligned base.
+  if (low_address & 3) {
+    return 1;
+  }
+  base_address_ = low_address;
+  range_size_ = static_cast<uint32_t>(high_address - low_address);
+
+  // Large callocs come straight from the OS as zero pages, so only the parts
+  // of the table that get used are ever committed.
+  size_t entry_count = (range_size_ + 3) / 4;
+  entries_ =
+      reinterpret_cast<int64_t*>(calloc(entry_count, sizeof(int64_t)));
+  if (!entries_) {
+    return 1;
+  }
+  return 0;
+}
+
+void* X64DispatchTable::Lookup(uint64_t address) const {
+  // Branches to registers ignore the low 2 bits, as does generated code.
+  address &= ~3ull;
+  if (!Contains(address)) {
+    return nullptr;
+  }
+  return reinterpret_cast<void*>(entries_[(address - base_address_) >> 2]);
+}
+
+void X64DispatchTable::Set(uint64_t address, void* machine_code) {
+  // No function starts on an unaligned address, and the entry belongs to the
+  // aligned one.
+  if ((address & 3) || !Contains(address)) {
+    return;
+  }
+  poly::atomic_exchange(reinterpret_cast<int64_t>(machine_code),
+                        &entries_[(address - base_address_) >> 2]);
+}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace alloy
@@ -0,0 +1,63 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_BACKEND_X64_X64_DISPATCH_TABLE_H_
+#define ALLOY_BACKEND_X64_X64_DISPATCH_TABLE_H_
+
+#include <cstdint>
+
+namespace alloy {
+namespace runtime {
+class Module;
+}  // namespace runtime
+}  // namespace alloy
+
+namespace alloy {
+namespace backend {
+namespace x64 {
+
+// Flat table mapping every instruction address in a module's code range to the
+// host code of the function starting there, or null if there isn't one (yet).
+// Indexed by (address - base_address) >> 2 so that generated code can dispatch
+// indirect calls with a range check and a single load. The low 2 bits of
+// looked up addresses are ignored, like bcctr/bclr do. Lookups never lock;
+// entries are written with atomic 8b stores.
+class X64DispatchTable {
+ public:
+  X64DispatchTable(runtime::Module* module);
+  ~X64DispatchTable();
+
+  runtime::Module* module() const { return module_; }
+  uint64_t base_address() const { return base_address_; }
+  // Size of the covered guest range, in bytes.
+  uint32_t range_size() const { return range_size_; }
+  const volatile int64_t* entries() const { return entries_; }
+
+  int Initialize();
+
+  bool Contains(uint64_t address) const {
+    return address - base_address_ < range_size_;
+  }
+
+  void* Lookup(uint64_t address) const;
+  void Set(uint64_t address, void* machine_code);
+  void Clear(uint64_t address) { Set(address, nullptr); }
+
+ private:
+  runtime::Module* module_;
+  uint64_t base_address_;
+  uint32_t range_size_;
+  volatile int64_t* entries_;
+};
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace alloy
+
+#endif  // ALLOY_BACKEND_X64_X64_DISPATCH_TABLE_H_
@@ -9,9 +9,14 @@
 
 #include "alloy/backend/x64/x64_emitter.h"
 
+#include <bitset>
+#include <unordered_set>
+
 #include "alloy/alloy-private.h"
 #include "alloy/backend/x64/x64_backend.h"
+#include "alloy/backend/x64/x64_call_site_ic.h"
 #include "alloy/backend/x64/x64_code_cache.h"
+#include "alloy/backend/x64/x64_dispatch_table.h"
 #include "alloy/backend/x64/x64_function.h"
 #include "alloy/backend/x64/x64_sequences.h"
 #include "alloy/backend/x64/x64_thunk_emitter.h"
@@ -44,6 +49,13 @@ static const size_t MAX_CODE_SIZE = 1 * 1024 * 1024;
 static const size_t STASH_OFFSET = 32;
 static const size_t STASH_OFFSET_HIGH = 32 + 32;
 
+// Entry stub at the start of all function code. See X64Emitter::Emit.
+static const size_t kEntryStubSlotOffset = 8;
+static const size_t kEntryStubSize = 16;
+// Out-of-line stub of a direct call site that isn't linked. See
+// X64Emitter::EmitCallLinkStubs.
+static const size_t kCallLinkStubSiteOffset = 30;
+
 // If we are running with tracing on we have to store the EFLAGS in the stack,
 // otherwise our calls out to C to print will clear it before DID_CARRY/etc
 // can get the value.
@@ -51,27 +63,50 @@ static const size_t STASH_OFFSET_HIGH = 32 + 32;
 
 const uint32_t X64Emitter::gpr_reg_map_[X64Emitter::GPR_COUNT] = {
     Operand::RBX, Operand::R12, Operand::R13, Operand::R14, Operand::R15,
+    Operand::RBP, Operand::RSI, Operand::RDI, Operand::R11,
 };
 
 const uint32_t X64Emitter::xmm_reg_map_[X64Emitter::XMM_COUNT] = {
-    6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 3, 4, 5,
 };
 
+#if XE_LIKE_WIN32
+// r11, xmm3-xmm5
+const uint32_t X64Emitter::gpr_volatile_mask_ = 0x100;
+const uint32_t X64Emitter::xmm_volatile_mask_ = 0x1C00;
+#else
+// rsi, rdi, r11, all xmm
+const uint32_t X64Emitter::gpr_volatile_mask_ = 0x1C0;
+const uint32_t X64Emitter::xmm_volatile_mask_ = 0x1FFF;
+#endif  // XE_LIKE_WIN32
+
 X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
     : CodeGenerator(MAX_CODE_SIZE, AutoGrow, allocator),
       runtime_(backend->runtime()),
       backend_(backend),
       code_cache_(backend->code_cache()),
       allocator_(allocator),
-      current_instr_(0) {}
+      feature_flags_(backend->emitter_feature_flags()),
+      symbol_info_(nullptr),
+      tier_(FUNCTION_TIER_OPTIMIZED),
+      current_instr_(0),
+      source_address_(0),
+      dispatch_table_(nullptr),
+      saved_gpr_mask_(0),
+      saved_xmm_mask_(0),
+      saved_regs_offset_(0),
+      membase_high_valid_(false),
+      relocatable_(false) {}
 
 X64Emitter::~X64Emitter() {}
 
 int X64Emitter::Initialize() { return 0; }
 
-int X64Emitter::Emit(HIRBuilder* builder, uint32_t debug_info_flags,
-                     runtime::DebugInfo* debug_info, uint32_t trace_flags,
-                     void*& out_code_address, size_t& out_code_size) {
+int X64Emitter::Emit(FunctionInfo* symbol_info, HIRBuilder* builder,
+                     uint32_t debug_info_flags, runtime::DebugInfo* debug_info,
+                     uint32_t trace_flags, FunctionTier tier,
+                     bool relocatable, void*& out_code_address,
+                     size_t& out_code_size) {
   SCOPE_profile_cpu_f("alloy");
 
   // Reset.
@@ -80,17 +115,64 @@ int X64Emitter::Emit(HIRBuilder* builder, uint32_t debug_info_flags,
     source_map_arena_.Reset();
   }
   trace_flags_ = trace_flags;
+  membase_high_valid_ = false;
+  symbol_info_ = symbol_info;
+  tier_ = tier;
+  // Baseline code embeds its counter address and is never persisted.
+  assert_false(relocatable && tier == FUNCTION_TIER_BASELINE);
+  relocatable_ = relocatable;
+  relocations_.clear();
+  call_links_.clear();
+  call_site_ics_.clear();
+  label_addresses_.clear();
+  source_address_ = 0;
+  dispatch_table_ = backend_->GetDispatchTable(symbol_info->module());
 
   // Fill the generator with code.
   size_t stack_size = 0;
   int result = Emit(builder, stack_size);
   if (result) {
+    backend_->FreeCallSiteICs(call_site_ics_);
     return result;
   }
 
   // Copy the final code to the cache and relocate it.
   out_code_size = getSize();
   out_code_address = Emplace(stack_size);
+  backend_->SetCallSiteICsCode(call_site_ics_, out_code_address);
+  call_site_ics_.clear();
+
+  auto writable_code = reinterpret_cast<uint8_t*>(
+      code_cache_->GetWritableAddress(out_code_address));
+  InitializeEntryStub(writable_code, out_code_address);
+
+  // Labels are only known by name to xbyak, so their addresses are filled in
+  // here rather than being relocated by it.
+  for (auto& label_address : label_addresses_) {
+    size_t label_offset = block_offsets_[label_address.label->block->ordinal];
+    poly::store<uint64_t>(
+        writable_code + label_address.slot_offset,
+        reinterpret_cast<uint64_t>(out_code_address) + label_offset);
+    if (relocatable_) {
+      X64Relocation relocation;
+      relocation.code_offset = static_cast<uint32_t>(label_address.slot_offset);
+      relocation.type = X64RelocationType::kCode;
+      relocation.key = label_offset;
+      relocations_.push_back(relocation);
+    }
+  }
+  label_addresses_.clear();
+
+  // Link direct calls to functions that already have code. The rest link
+  // themselves on first use.
+  auto code = reinterpret_cast<uint8_t*>(out_code_address);
+  for (auto& call_link : call_links_) {
+    if (call_link.target) {
+      backend_->LinkCallSite(code + call_link.site_offset,
+                             code + call_link.stub_offset, call_link.target);
+    }
+  }
+  call_links_.clear();
 
   // Stash source map.
   if (debug_info_flags & DEBUG_INFO_SOURCE_MAP) {
@@ -101,14 +183,35 @@ int X64Emitter::Emit(HIRBuilder* builder, uint32_t debug_info_flags,
   return 0;
 }
 
+void X64Emitter::InitializeEntryStub(void* writable_code, void* code) {
+  // Point the slot at the body until the function is redirected.
+  poly::store<uint64_t>(
+      reinterpret_cast<uint8_t*>(writable_code) + kEntryStubSlotOffset,
+      reinterpret_cast<uint64_t>(code) + kEntryStubSize);
+}
+
+void X64Emitter::RedirectEntryStub(void* writable_code, void* target) {
+  auto code = reinterpret_cast<uint8_t*>(writable_code);
+  // Publish the new target before switching the short jump over to the
+  // indirect one. Code is 16b aligned so both stores are atomic.
+  poly::atomic_exchange(
+      static_cast<int64_t>(reinterpret_cast<uint64_t>(target)),
+      reinterpret_cast<volatile int64_t*>(code + kEntryStubSlotOffset));
+  // jmp short +0, falling through to the indirect jmp.
+  *reinterpret_cast<volatile uint16_t*>(code) = 0x00EB;
+}
+
 void* X64Emitter::Emplace(size_t stack_size) {
   // To avoid changing xbyak, we do a switcharoo here.
   // top_ points to the Xbyak buffer, and since we are in AutoGrow mode
   // it has pending relocations. We copy the top_ to our buffer, swap the
   // pointer, relocate, then return the original scratch pointer for use.
+  // Relocations are all relative to the code itself, so they can be applied
+  // through the writable alias of the code when W^X is enabled.
   uint8_t* old_address = top_;
-  void* new_address = code_cache_->PlaceCode(top_, size_, stack_size);
-  top_ = (uint8_t*)new_address;
+  void* new_address =
+      code_cache_->PlaceCode(symbol_info_, top_, size_, stack_size);
+  top_ = (uint8_t*)code_cache_->GetWritableAddress(new_address);
   ready();
   top_ = old_address;
   reset();
@@ -128,6 +231,28 @@ int X64Emitter::Emit(HIRBuilder* builder, size_t& out_stack_size) {
     slot->set_constant((uint32_t)stack_offset);
     stack_offset += type_size;
   }
+  // Space to preserve the caller-saved registers this function uses around
+  // host calls. Each gets a 16b slot.
+  saved_gpr_mask_ = 0;
+  saved_xmm_mask_ = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      if (!instr->dest || !instr->dest->reg.set) {
+        continue;
+      }
+      if (instr->dest->reg.set->types & MachineInfo::RegisterSet::INT_TYPES) {
+        saved_gpr_mask_ |= 1 << instr->dest->reg.index;
+      } else {
+        saved_xmm_mask_ |= 1 << instr->dest->reg.index;
+      }
+    }
+  }
+  saved_gpr_mask_ &= gpr_volatile_mask_;
+  saved_xmm_mask_ &= xmm_volatile_mask_;
+  stack_offset = poly::align(stack_offset, static_cast<size_t>(16));
+  saved_regs_offset_ = stack_offset;
+  stack_offset += 16 * (std::bitset<32>(saved_gpr_mask_).count() +
+                        std::bitset<32>(saved_xmm_mask_).count());
   // Ensure 16b alignment.
   stack_offset -= StackLayout::GUEST_STACK_SIZE;
   stack_offset = poly::align(stack_offset, static_cast<size_t>(16));
@@ -148,6 +273,25 @@ int X64Emitter::Emit(HIRBuilder* builder, size_t& out_stack_size) {
   assert_true((stack_size + 8) % 16 == 0);
   out_stack_size = stack_size;
   stack_size_ = stack_size;
+  // Functions start with a stub that can be switched over to jump
+  // elsewhere (see RedirectEntryStub): baseline code to the optimized
+  // version of the function and invalidated code back to the resolver.
+  // Everything that may still hold the old code address (call sites, IC
+  // slots, dispatch tables) then ends up in the right place. It doesn't
+  // touch the stack, so the unwind info X64CodeCache generates for the
+  // prolog is still valid for it.
+  // 00 EB 0E                jmp         body
+  // 02 FF 25 00 00 00 00    jmp         qword ptr [slot]
+  // 08 XXXXXXXXXXXXXXXX     slot
+  assert_zero(getSize());
+  db(0xEB);
+  db(kEntryStubSize - 2);
+  db(0xFF);
+  db(0x25);
+  dd(0);
+  assert_true(getSize() == kEntryStubSlotOffset);
+  dq(0);
+  assert_true(getSize() == kEntryStubSize);
   if (emit_prolog) {
     sub(rsp, (uint32_t)stack_size);
     mov(qword[rsp + StackLayout::GUEST_RCX_HOME], rcx);
@@ -169,16 +313,54 @@ int X64Emitter::Emit(HIRBuilder* builder, size_t& out_stack_size) {
     mov(word[r8 + 2], ax);
   }
 
+  // Baseline code counts entries and loop iterations. Any block that is the
+  // target of a branch from itself or a later block is a loop header.
+  std::unordered_set<const hir::Block*> loop_headers;
+  if (tier_ == FUNCTION_TIER_BASELINE) {
+    EmitTierUpCounter();
+    for (auto block = builder->first_block(); block; block = block->next) {
+      for (auto instr = block->instr_head; instr; instr = instr->next) {
+        const hir::Label* target = nullptr;
+        if (instr->opcode == &OPCODE_BRANCH_info) {
+          target = instr->src1.label;
+        } else if (instr->opcode == &OPCODE_BRANCH_TRUE_info ||
+                   instr->opcode == &OPCODE_BRANCH_FALSE_info) {
+          target = instr->src2.label;
+        } else if (instr->opcode == &OPCODE_BRANCH_TABLE_info) {
+          auto table = instr->src2.table;
+          for (uint32_t n = 0; n < table->count; ++n) {
+            auto table_target = table->labels[n];
+            if (table_target->block->ordinal <= block->ordinal) {
+              loop_headers.insert(table_target->block);
+            }
+          }
+        }
+        if (target && target->block->ordinal <= block->ordinal) {
+          loop_headers.insert(target->block);
+        }
+      }
+    }
+  }
+
   // Body.
+  block_offsets_.resize(
+      builder->last_block() ? builder->last_block()->ordinal + 1 : 0);
   auto block = builder->first_block();
   while (block) {
     // Mark block labels.
+    membase_high_valid_ = false;
+    block_offsets_[block->ordinal] = getSize();
     auto label = block->label_head;
     while (label) {
       L(label->name);
       label = label->next;
     }
 
+    // No values are live across blocks, so this is free to clobber anything.
+    if (loop_headers.count(block)) {
+      EmitTierUpCounter();
+    }
+
     // Process instructions.
     const Instr* instr = block->instr_head;
     while (instr) {
@@ -214,6 +396,8 @@ int X64Emitter::Emit(HIRBuilder* builder, size_t& out_stack_size) {
   }
   ret();
 
+  EmitCallLinkStubs();
+
 #if XE_DEBUG
   nop();
   nop();
@@ -226,6 +410,7 @@ int X64Emitter::Emit(HIRBuilder* builder, size_t& out_stack_size) {
 }
 
 void X64Emitter::MarkSourceOffset(const Instr* i) {
+  source_address_ = i->src1.offset;
   auto entry = source_map_arena_.Alloc<SourceMapEntry>();
   entry->source_offset = i->src1.offset;
   entry->hir_offset = uint32_t(i->block->ordinal << 16) | i->ordinal;
@@ -425,7 +610,9 @@ uint64_t ResolveFunctionSymbol(void* raw_context, uint64_t symbol_info_ptr) {
   };
 #pragma pack(pop)
   static_assert_size(Asm, TOTAL_RESOLVE_SIZE);
-  Asm* code = reinterpret_cast<Asm*>(return_address - ASM_OFFSET);
+  auto backend = static_cast<X64Backend*>(thread_state->runtime()->backend());
+  Asm* code = reinterpret_cast<Asm*>(backend->code_cache()->GetWritableAddress(
+      reinterpret_cast<void*>(return_address - ASM_OFFSET)));
   code->rax_constant = addr;
   code->call_rax = 0x9066;
 
@@ -436,15 +623,55 @@ uint64_t ResolveFunctionSymbol(void* raw_context, uint64_t symbol_info_ptr) {
 void X64Emitter::Call(const hir::Instr* instr,
                       runtime::FunctionInfo* symbol_info) {
   auto fn = reinterpret_cast<X64Function*>(symbol_info->function());
+  // Guest code leaves membase in rdx but may clobber r10.
+  membase_high_valid_ = false;
+  if (code_cache_->has_code_window()) {
+    // All code is within rel32 reach of each other, so call directly. The call
+    // starts out going to a stub that links it on first use.
+    if (instr->flags & CALL_TAIL) {
+      // Since we skip the prolog we need to mark the return here.
+      EmitTraceUserCallReturn();
+
+      // Pass the callers return address over.
+      mov(rdx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+      add(rsp, static_cast<uint32_t>(stack_size()));
+    } else {
+      // Return address is from the previous SET_RETURN_ADDRESS.
+      mov(rdx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+    }
+    // Align the rel32 so that it can be patched atomically.
+    while ((getSize() + 1) % 4) {
+      nop();
+    }
+    CallLink call_link;
+    call_link.stub.reset(new Xbyak::Label());
+    if (instr->flags & CALL_TAIL) {
+      jmp(*call_link.stub, T_NEAR);
+    } else {
+      call(*call_link.stub);
+    }
+    call_link.site_offset = getSize() - 4;
+    call_link.stub_offset = 0;
+    call_link.symbol_info = symbol_info;
+    // Relocatable code is copied out after Emit, so it must stay unlinked.
+    call_link.target = relocatable_ ? nullptr : fn;
+    call_links_.push_back(std::move(call_link));
+    return;
+  }
+
   // Resolve address to the function to call and store in rax.
-  if (fn) {
+  // Relocatable code can't reference other generated functions directly, so
+  // it always goes through the resolver (which patches the site on first use).
+  if (fn && !relocatable_) {
     mov(rax, reinterpret_cast<uint64_t>(fn->machine_code()));
   } else {
     size_t start = getSize();
     // 2b + 8b constant
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunctionSymbol));
+    MovRelocatable(rax, reinterpret_cast<void*>(ResolveFunctionSymbol));
     // 2b + 8b constant
-    mov(rdx, reinterpret_cast<uint64_t>(symbol_info));
+    MovRelocatable(rdx, reinterpret_cast<uint64_t>(symbol_info),
+                   X64RelocationType::kFunctionInfo, symbol_info->address());
     // 2b
     call(rax);
     // 5b
@@ -471,17 +698,93 @@ void X64Emitter::Call(const hir::Instr* instr,
   }
 }
 
+void X64Emitter::EmitCallLinkStubs() {
+  // Each stub hands its own address and the callee to the call link thunk,
+  // which resolves the callee and links the call site to it:
+  //   lea r8, [rip - 7]          ; this stub
+  //   mov rax, symbol_info
+  //   mov r9, call_link_thunk
+  //   jmp r9
+  //   dd site - stub
+  for (auto& call_link : call_links_) {
+    L(*call_link.stub);
+    call_link.stub_offset = getSize();
+    db(0x4C);
+    db(0x8D);
+    db(0x05);
+    dd(static_cast<uint32_t>(-7));
+    MovRelocatable(rax, reinterpret_cast<uint64_t>(call_link.symbol_info),
+                   X64RelocationType::kFunctionInfo,
+                   call_link.symbol_info->address());
+    MovRelocatable(r9, reinterpret_cast<uint64_t>(backend_->call_link_thunk()),
+                   X64RelocationType::kCallLinkThunk);
+    jmp(r9);
+    assert_true(getSize() - call_link.stub_offset == kCallLinkStubSiteOffset);
+    dd(static_cast<uint32_t>(call_link.site_offset - call_link.stub_offset));
+  }
+}
+
+void* X64Emitter::GetCallLinkSite(const void* stub) {
+  auto p = reinterpret_cast<const uint8_t*>(stub);
+  return const_cast<uint8_t*>(p) +
+         poly::load<int32_t>(p + kCallLinkStubSiteOffset);
+}
+
+bool X64Emitter::PatchCallSite(void* writable_site, const void* site,
+                               const void* target) {
+  int64_t displacement = reinterpret_cast<int64_t>(target) -
+                         (reinterpret_cast<int64_t>(site) + 4);
+  if (displacement != static_cast<int32_t>(displacement)) {
+    return false;
+  }
+  // The rel32 is 4b aligned (see Call), so this is a single atomic store.
+  poly::atomic_exchange(static_cast<int32_t>(displacement),
+                        reinterpret_cast<volatile int32_t*>(writable_site));
+  return true;
+}
+
+uint64_t TierUpFunction(void* raw_context, uint64_t symbol_info_ptr) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto symbol_info = reinterpret_cast<FunctionInfo*>(symbol_info_ptr);
+
+  // Only the first thread to see the counter go negative queues the function.
+  if (poly::atomic_exchange(INT32_MAX, symbol_info->tier_up_counter()) >= 0) {
+    return 0;
+  }
+  thread_state->runtime()->compile_queue()->EnqueueOptimize(
+      symbol_info->address());
+  return 0;
+}
+
+void X64Emitter::EmitTierUpCounter() {
+  Xbyak::Label skip;
+  mov(rax, reinterpret_cast<uint64_t>(symbol_info_->tier_up_counter()));
+  sub(dword[rax], 1);
+  jns(skip, T_NEAR);
+  CallNative(TierUpFunction, reinterpret_cast<uint64_t>(symbol_info_));
+  L(skip);
+}
+
 // NOTE: slot count limited by short jump size.
 const int kICSlotCount = 4;
 const int kICSlotSize = 23;
+const size_t kICSlotAddressOffset = 2;
+const uint32_t kICSlotInvalidAddress = 0x0F0F0F0F;
 const uint64_t kICSlotInvalidTargetAddress = 0x0F0F0F0F0F0F0F0F;
+// From the end of the IC slots to the return address of the resolver call:
+// jmp lookup, mov rax, imm64, call rax.
+const size_t kICResolveCallEnd = 5 + 10 + 2;
 
-uint64_t ResolveFunctionAddress(void* raw_context, uint64_t target_address) {
+uint64_t ResolveFunctionAddress(void* raw_context, uint64_t target_address,
+                                uint64_t ic_ptr) {
   // TODO(benvanik): generate this thunk at runtime? or a shim?
   auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto ic = reinterpret_cast<X64CallSiteIC*>(ic_ptr);
 
   // TODO(benvanik): required?
   target_address &= 0xFFFFFFFF;
+  // bcctr/bclr ignore the low 2 bits, as does the dispatch table lookup.
+  target_address &= ~3ull;
   assert_not_zero(target_address);
 
   Function* fn = NULL;
@@ -489,14 +792,25 @@ uint64_t ResolveFunctionAddress(void* raw_context, uint64_t target_address) {
   assert_not_null(fn);
   auto x64_fn = static_cast<X64Function*>(fn);
   uint64_t addr = reinterpret_cast<uint64_t>(x64_fn->machine_code());
+  auto backend = static_cast<X64Backend*>(thread_state->runtime()->backend());
 
-// Add an IC slot, if there is room.
 #if XE_LIKE_WIN32
   uint64_t return_address = reinterpret_cast<uint64_t>(_ReturnAddress());
 #else
   uint64_t return_address =
       reinterpret_cast<uint64_t>(__builtin_return_address(0));
 #endif  // XE_LIKE_WIN32
+  // The IC slots are at a fixed distance before the call.
+  uint64_t table_start =
+      return_address - kICResolveCallEnd - kICSlotSize * kICSlotCount;
+  backend->AddICTarget(ic, reinterpret_cast<void*>(table_start), fn);
+
+  // We need to return the target in rax so that it gets called.
+  return addr;
+}
+
+bool X64Emitter::FillICSlot(void* writable_slots, uint64_t target_address,
+                            void* machine_code, size_t* out_slot_offset) {
 #pragma pack(push, 1)
   struct Asm {
     uint16_t cmp_rdx;
@@ -508,33 +822,34 @@ uint64_t ResolveFunctionAddress(void* raw_context, uint64_t target_address) {
   };
 #pragma pack(pop)
   static_assert_size(Asm, kICSlotSize);
-  // TODO(benvanik): quick check table is full (so we don't have to enum slots)
-  // The return address points to ReloadRCX work after the call.
-  // To get the top of the table, look back a ways.
-  uint64_t table_start = return_address - 12 - kICSlotSize * kICSlotCount;
   // NOTE: order matters here - we update the address BEFORE we switch the code
   // over to passing the compare.
-  Asm* table_slot = reinterpret_cast<Asm*>(table_start);
-  bool wrote_ic = false;
+  auto table_slot = reinterpret_cast<Asm*>(writable_slots);
+  uint64_t addr = reinterpret_cast<uint64_t>(machine_code);
   for (int i = 0; i < kICSlotCount; ++i) {
     if (poly::atomic_cas(kICSlotInvalidTargetAddress, addr,
                          &table_slot->target_constant)) {
       // Got slot! Just write the compare and we're done.
       table_slot->address_constant = static_cast<uint32_t>(target_address);
-      wrote_ic = true;
-      break;
+      *out_slot_offset = i * kICSlotSize;
+      return true;
     }
     ++table_slot;
   }
-  if (!wrote_ic) {
-    // TODO(benvanik): log that IC table is full.
-  }
+  return false;
+}
 
-  // We need to return the target in rax so that it gets called.
-  return addr;
+void X64Emitter::RetireICSlot(void* writable_slot) {
+  // Only the compare is reset. A thread may be just past it, so the target
+  // is left pointing at the old code (whose entry stub has been redirected)
+  // and the slot is never handed out again.
+  *reinterpret_cast<volatile uint32_t*>(
+      reinterpret_cast<uint8_t*>(writable_slot) + kICSlotAddressOffset) =
+      kICSlotInvalidAddress;
 }
 
 void X64Emitter::CallIndirect(const hir::Instr* instr, const Reg64& reg) {
+  membase_high_valid_ = false;
   // Check if return.
   if (instr->flags & CALL_POSSIBLE_RETURN) {
     cmp(reg.cvt32(), dword[rsp + StackLayout::GUEST_RET_ADDR]);
@@ -547,14 +862,22 @@ void X64Emitter::CallIndirect(const hir::Instr* instr, const Reg64& reg) {
 
   inLocalLabel();
   Xbyak::Label skip_resolve;
+  Xbyak::Label inline_hit;
+  Xbyak::Label lookup;
+  Xbyak::Label resolve;
+
+  // State of this call site, shared by all the lookups below.
+  uint64_t call_address =
+      source_address_ ? source_address_ : symbol_info_->address();
+  auto ic = backend_->CreateCallSiteIC(call_address);
+  call_site_ics_.push_back(ic);
+  const bool count_hits = FLAGS_ic_stats;
 
   // TODO(benvanik): make empty tables skippable (cmp, jump right to resolve).
 
   // IC table, initially empty.
-  // This will get filled in as functions are resolved.
-  // Note that we only have a limited cache, and once it's full all calls
-  // will fall through.
-  // TODO(benvanik): check miss rate when full and add a 2nd-level table?
+  // This will get filled in as functions are resolved. Once it's full
+  // targets go in the out-of-line table of the call site instead.
   // 0000000264BD4DC3 81 FA 0F0F0F0F         cmp         edx,0F0F0F0Fh
   // 0000000264BD4DC9 75 0C                  jne         0000000264BD4DD7
   // 0000000264BD4DCB 48 B8 0F0F0F0F0F0F0F0F mov         rax,0F0F0F0F0F0F0F0Fh
@@ -564,7 +887,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr, const Reg64& reg) {
     // Compare target address with constant, if matches jump there.
     // Otherwise, fall through.
     // 6b
-    cmp(edx, 0x0F0F0F0F);
+    cmp(edx, kICSlotInvalidAddress);
     Xbyak::Label next_slot;
     // 2b
     jne(next_slot, T_SHORT);
@@ -572,15 +895,121 @@ void X64Emitter::CallIndirect(const hir::Instr* instr, const Reg64& reg) {
     // 10b
     mov(rax, kICSlotInvalidTargetAddress);
     // 5b
-    jmp(skip_resolve, T_NEAR);
+    jmp(count_hits ? inline_hit : skip_resolve, T_NEAR);
     L(next_slot);
   }
   size_t table_size = getSize() - table_start;
   assert_true(table_size == kICSlotSize * kICSlotCount);
+  jmp(lookup, T_NEAR);
 
   // Resolve address to the function to call and store in rax.
-  // We fall through to this when there are no hits in the IC table.
-  CallNative(ResolveFunctionAddress);
+  // We get here when nothing else knows the target, with the call site in r8.
+  // Called directly (nothing is live at a call) as ResolveFunctionAddress
+  // finds the IC table relative to the return address.
+  L(resolve);
+  MovRelocatable(rax, reinterpret_cast<void*>(ResolveFunctionAddress));
+  call(rax);
+  assert_true(getSize() - table_start == table_size + kICResolveCallEnd);
+  ReloadECX();
+  ReloadEDX();
+  jmp(skip_resolve, T_NEAR);
+
+  // Probe the out-of-line table of the call site, up to kMaxProbeCount
+  // entries from where the target hashes to (unrolled, this is the first).
+  // An empty entry ends the probe early.
+  // 0000000264BD4E00 49 B8 XXXXXXXXXXXXXXXX mov         r8,ic
+  // 0000000264BD4E0A 4D 8B 08               mov         r9,qword ptr [r8]
+  // 0000000264BD4E0D 4D 85 C9               test        r9,r9
+  // 0000000264BD4E10 74 XX                  je          dispatch
+  // 0000000264BD4E12 8B C2                  mov         eax,edx
+  // 0000000264BD4E14 C1 E8 02               shr         eax,2
+  // 0000000264BD4E17 41 23 01               and         eax,dword ptr [r9]
+  // 0000000264BD4E1A C1 E0 04               shl         eax,4
+  // 0000000264BD4E1D 41 3B 54 01 08         cmp         edx,dword ptr [r9+rax+8]
+  // 0000000264BD4E22 74 XX                  je          table_hit
+  // 0000000264BD4E24 41 83 7C 01 08 00      cmp         dword ptr [r9+rax+8],0
+  // 0000000264BD4E2A 74 XX                  je          dispatch
+  // 0000000264BD4E2C 83 C0 10               add         eax,10h
+  // 0000000264BD4E2F 41 23 41 04            and         eax,dword ptr [r9+4]
+  // ...
+  // table_hit:
+  // 0000000264BD4EXX 49 8B 44 01 10         mov         rax,qword ptr [r9+rax+10h]
+  // 0000000264BD4EXX E9 XXXXXXXX            jmp         skip_resolve
+  L(lookup);
+  MovRelocatable(r8, reinterpret_cast<uint64_t>(ic),
+                 X64RelocationType::kCallSiteIC, call_address);
+  Xbyak::Label dispatch;
+  Xbyak::Label table_hit;
+  mov(r9, qword[r8 + offsetof(X64CallSiteIC, table)]);
+  test(r9, r9);
+  jz(dispatch, T_NEAR);
+  mov(eax, edx);
+  shr(eax, 2);
+  and(eax, dword[r9 + offsetof(X64CallSiteIC::Table, mask)]);
+  shl(eax, 4);
+  const size_t guest_address_offset =
+      offsetof(X64CallSiteIC::Table, entries) +
+      offsetof(X64CallSiteIC::Entry, guest_address);
+  for (uint32_t n = 0; n < X64CallSiteIC::kMaxProbeCount; ++n) {
+    cmp(edx, dword[r9 + rax + guest_address_offset]);
+    je(table_hit, T_NEAR);
+    cmp(dword[r9 + rax + guest_address_offset], 0);
+    je(dispatch, T_NEAR);
+    if (n + 1 < X64CallSiteIC::kMaxProbeCount) {
+      add(eax, static_cast<uint32_t>(sizeof(X64CallSiteIC::Entry)));
+      and(eax, dword[r9 + offsetof(X64CallSiteIC::Table, offset_mask)]);
+    }
+  }
+  jmp(dispatch, T_NEAR);
+  L(table_hit);
+  mov(rax, qword[r9 + rax + offsetof(X64CallSiteIC::Table, entries) +
+                 offsetof(X64CallSiteIC::Entry, host_address)]);
+  if (count_hits) {
+    inc(qword[r8 + offsetof(X64CallSiteIC, table_hit_count)]);
+  }
+  jmp(skip_resolve, T_NEAR);
+
+  // Look the target up in the dispatch table of this module. Targets outside
+  // of the module or without code yet fall through to the resolver. This is
+  // all megamorphic call sites have.
+  // 0000000264BD4E2E 8B C2                  mov         eax,edx
+  // 0000000264BD4E30 2D 00 00 00 82         sub         eax,82000000h
+  // 0000000264BD4E35 3D 00 00 40 00         cmp         eax,400000h
+  // 0000000264BD4E3A 73 XX                  jae         resolve
+  // 0000000264BD4E3C 83 E0 FC               and         eax,0FFFFFFFCh
+  // 0000000264BD4E3F 49 B9 XXXXXXXXXXXXXXXX mov         r9,table
+  // 0000000264BD4E49 49 8B 04 41            mov         rax,qword ptr [r9+rax*2]
+  // 0000000264BD4E4D 48 85 C0               test        rax,rax
+  // 0000000264BD4E50 0F 85 XXXXXXXX         jne         skip_resolve
+  L(dispatch);
+  if (dispatch_table_) {
+    mov(eax, edx);
+    sub(eax, static_cast<uint32_t>(dispatch_table_->base_address()));
+    cmp(eax, dispatch_table_->range_size());
+    jae(resolve, T_NEAR);
+    // Index is (address - base) >> 2, scaled by 8b entries. bcctr/bclr
+    // ignore the low 2 bits of the target, and without clearing them the
+    // load would straddle two entries.
+    and(eax, ~3u);
+    MovRelocatable(r9, reinterpret_cast<uint64_t>(dispatch_table_->entries()),
+                   X64RelocationType::kDispatchTable);
+    mov(rax, qword[r9 + rax * 2]);
+    test(rax, rax);
+    jz(resolve, T_NEAR);
+    if (count_hits) {
+      inc(qword[r8 + offsetof(X64CallSiteIC, dispatch_hit_count)]);
+    }
+    jmp(skip_resolve, T_NEAR);
+  } else {
+    jmp(resolve, T_NEAR);
+  }
+
+  if (count_hits) {
+    L(inline_hit);
+    MovRelocatable(r8, reinterpret_cast<uint64_t>(ic),
+                   X64RelocationType::kCallSiteIC, call_address);
+    inc(qword[r8 + offsetof(X64CallSiteIC, inline_hit_count)]);
+  }
 
   // Actually jump/call to rax.
   L(skip_resolve);
@@ -630,17 +1059,24 @@ void X64Emitter::CallExtern(const hir::Instr* instr,
   }
 
   if (!symbol_info->extern_handler()) {
-    CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(symbol_info));
+    MovRelocatable(rdx, reinterpret_cast<uint64_t>(symbol_info),
+                   X64RelocationType::kFunctionInfo, symbol_info->address());
+    CallNative(UndefinedCallExtern);
   } else {
     // rcx = context
     // rdx = target host function
     // r8  = arg0
     // r9  = arg1
-    mov(rdx, reinterpret_cast<uint64_t>(symbol_info->extern_handler()));
-    mov(r8, reinterpret_cast<uint64_t>(symbol_info->extern_arg0()));
-    mov(r9, reinterpret_cast<uint64_t>(symbol_info->extern_arg1()));
+    MovRelocatable(rdx,
+                   reinterpret_cast<uint64_t>(symbol_info->extern_handler()),
+                   X64RelocationType::kExternHandler, symbol_info->address());
+    MovRelocatable(r8, reinterpret_cast<uint64_t>(symbol_info->extern_arg0()),
+                   X64RelocationType::kExternArg0, symbol_info->address());
+    MovRelocatable(r9, reinterpret_cast<uint64_t>(symbol_info->extern_arg1()),
+                   X64RelocationType::kExternArg1, symbol_info->address());
     auto thunk = backend()->guest_to_host_thunk();
-    mov(rax, reinterpret_cast<uint64_t>(thunk));
+    MovRelocatable(rax, reinterpret_cast<uint64_t>(thunk),
+                   X64RelocationType::kGuestToHostThunk);
     call(rax);
     ReloadECX();
     ReloadEDX();
@@ -662,33 +1098,41 @@ void X64Emitter::CallExtern(const hir::Instr* instr,
 }
 
 void X64Emitter::CallNative(void* fn) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  SaveVolatileRegs();
+  MovRelocatable(rax, fn);
   call(rax);
   ReloadECX();
   ReloadEDX();
+  RestoreVolatileRegs();
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context)) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  SaveVolatileRegs();
+  MovRelocatable(rax, reinterpret_cast<void*>(fn));
   call(rax);
   ReloadECX();
   ReloadEDX();
+  RestoreVolatileRegs();
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0)) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  SaveVolatileRegs();
+  MovRelocatable(rax, reinterpret_cast<void*>(fn));
   call(rax);
   ReloadECX();
   ReloadEDX();
+  RestoreVolatileRegs();
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0),
                             uint64_t arg0) {
+  SaveVolatileRegs();
   mov(rdx, arg0);
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovRelocatable(rax, reinterpret_cast<void*>(fn));
   call(rax);
   ReloadECX();
   ReloadEDX();
+  RestoreVolatileRegs();
 }
 
 void X64Emitter::CallNativeSafe(void* fn) {
@@ -696,25 +1140,104 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // rdx = target host function
   // r8  = arg0
   // r9  = arg1
-  mov(rdx, reinterpret_cast<uint64_t>(fn));
+  SaveVolatileRegs();
+  MovRelocatable(rdx, fn);
   auto thunk = backend()->guest_to_host_thunk();
-  mov(rax, reinterpret_cast<uint64_t>(thunk));
+  MovRelocatable(rax, reinterpret_cast<uint64_t>(thunk),
+                 X64RelocationType::kGuestToHostThunk);
   call(rax);
   ReloadECX();
   ReloadEDX();
+  RestoreVolatileRegs();
   // rax = host return
 }
 
+void X64Emitter::SaveVolatileRegs() {
+  // Only touches memory, so arguments already in rdx/r8/r9 are preserved.
+  size_t offset = saved_regs_offset_;
+  for (int n = 0; n < GPR_COUNT; ++n) {
+    if (saved_gpr_mask_ & (1 << n)) {
+      mov(qword[rsp + offset], Reg64(gpr_reg_map_[n]));
+      offset += 16;
+    }
+  }
+  for (int n = 0; n < XMM_COUNT; ++n) {
+    if (saved_xmm_mask_ & (1 << n)) {
+      vmovaps(ptr[rsp + offset], Xmm(xmm_reg_map_[n]));
+      offset += 16;
+    }
+  }
+}
+
+void X64Emitter::RestoreVolatileRegs() {
+  // Must not touch rax, which holds the return value.
+  size_t offset = saved_regs_offset_;
+  for (int n = 0; n < GPR_COUNT; ++n) {
+    if (saved_gpr_mask_ & (1 << n)) {
+      mov(Reg64(gpr_reg_map_[n]), qword[rsp + offset]);
+      offset += 16;
+    }
+  }
+  for (int n = 0; n < XMM_COUNT; ++n) {
+    if (saved_xmm_mask_ & (1 << n)) {
+      vmovaps(Xmm(xmm_reg_map_[n]), ptr[rsp + offset]);
+      offset += 16;
+    }
+  }
+}
+
 void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], value);
 }
 
+uint64_t X64Emitter::image_anchor() {
+  // Any symbol in the host image works; everything in the image moves
+  // together when it is rebased.
+  return reinterpret_cast<uint64_t>(ResolveFunctionSymbol);
+}
+
+void X64Emitter::MovRelocatable(const Reg64& reg, uint64_t value,
+                                X64RelocationType type, uint64_t key) {
+  // Always use the 10b REX.W B8+r imm64 form so that the immediate can be
+  // rewritten regardless of its value.
+  db(0x48 | (reg.getIdx() >= 8 ? 0x01 : 0x00));
+  db(0xB8 | (reg.getIdx() & 0x7));
+  X64Relocation relocation;
+  relocation.code_offset = static_cast<uint32_t>(getSize());
+  relocation.type = type;
+  relocation.key =
+      type == X64RelocationType::kImage ? value - image_anchor() : key;
+  relocations_.push_back(relocation);
+  dq(value);
+}
+
+void X64Emitter::EmitLabelAddress(const hir::Label* label) {
+  LabelAddress label_address;
+  label_address.slot_offset = getSize();
+  label_address.label = label;
+  label_addresses_.push_back(label_address);
+  dq(0);
+}
+
 void X64Emitter::ReloadECX() {
   mov(rcx, qword[rsp + StackLayout::GUEST_RCX_HOME]);
 }
 
 void X64Emitter::ReloadEDX() {
   mov(rdx, qword[rcx + 8]);  // membase
+  // Anything that clobbers rdx (host calls, mostly) may clobber r10 too.
+  membase_high_valid_ = false;
+}
+
+Xbyak::Reg64 X64Emitter::GetMembaseHighReg() {
+  // r10 isn't allocated, so it's set up on first use in a block and then
+  // reused until something clobbers it.
+  if (!membase_high_valid_) {
+    mov(r10d, 0x80000000u);
+    add(r10, rdx);
+    membase_high_valid_ = true;
+  }
+  return r10;
 }
 
 // Len Assembly                                   Byte Sequence
@@ -864,7 +1387,7 @@ Address X64Emitter::GetXmmConstPtr(XmmConst id) {
   // prevent this move.
   // TODO(benvanik): move to predictable location in PPCContext? could then
   // just do rcx relative addression with no rax overwriting.
-  mov(rax, (uint64_t)&xmm_consts[id]);
+  MovRelocatable(rax, &xmm_consts[id]);
   return ptr[rax];
 }
 
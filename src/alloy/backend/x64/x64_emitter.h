@@ -10,13 +10,18 @@
 #ifndef ALLOY_BACKEND_X64_X64_EMITTER_H_
 #define ALLOY_BACKEND_X64_X64_EMITTER_H_
 
+#include <memory>
+#include <vector>
+
 #include "alloy/hir/value.h"
+#include "alloy/runtime/function.h"
 #include "third_party/xbyak/xbyak/xbyak.h"
 
 namespace alloy {
 namespace hir {
 class HIRBuilder;
 class Instr;
+class Label;
 }  // namespace hir
 namespace runtime {
 class DebugInfo;
@@ -31,13 +36,26 @@ namespace backend {
 namespace x64 {
 
 class X64Backend;
+class X64CallSiteIC;
 class X64CodeCache;
+class X64DispatchTable;
 
 enum RegisterFlags {
   REG_DEST = (1 << 0),
   REG_ABCD = (1 << 1),
 };
 
+// Optional host instruction set extensions sequences may use. AVX is the
+// baseline and always assumed. See X64Backend::Initialize for the probe.
+enum X64EmitterFeatureFlags {
+  kX64EmitAVX2 = 1 << 0,
+  kX64EmitFMA = 1 << 1,
+  kX64EmitLZCNT = 1 << 2,
+  kX64EmitBMI2 = 1 << 3,
+  kX64EmitF16C = 1 << 4,
+  kX64EmitMovbe = 1 << 5,
+};
+
 enum XmmConst {
   XMMZero = 0,
   XMMOne,
@@ -86,6 +104,40 @@ enum XmmConst {
   XMMShortMaxPS,
 };
 
+// Kinds of host addresses embedded in generated code.
+// Every 64bit host address the emitter writes is recorded as a relocation so
+// that the code can be persisted and rebased in another process.
+enum class X64RelocationType : uint32_t {
+  // Address within the host executable image (helpers, constant tables).
+  // Key is the offset from the image anchor.
+  kImage = 0,
+  // The runtime-generated guest-to-host thunk. Key unused.
+  kGuestToHostThunk = 1,
+  // FunctionInfo* of the guest function at the guest address in key.
+  kFunctionInfo = 2,
+  // Extern handler/arguments of the guest function at the address in key.
+  kExternHandler = 3,
+  kExternArg0 = 4,
+  kExternArg1 = 5,
+  // Entries of the dispatch table of the module being emitted.
+  kDispatchTable = 6,
+  // X64CallSiteIC of the indirect call at the guest address in key. All
+  // relocations with the same key in a function share one.
+  kCallSiteIC = 7,
+  // The backend thunk unlinked direct calls go through. Key unused.
+  kCallLinkThunk = 8,
+  // Address within the function itself, such as a jump table entry. Key is
+  // the offset from the start of the function.
+  kCode = 9,
+};
+
+struct X64Relocation {
+  // Offset of the 8b immediate from the start of the function.
+  uint32_t code_offset;
+  X64RelocationType type;
+  uint64_t key;
+};
+
 // Unfortunately due to the design of xbyak we have to pass this to the ctor.
 class XbyakAllocator : public Xbyak::Allocator {
  public:
@@ -102,22 +154,58 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   int Initialize();
 
-  int Emit(hir::HIRBuilder* builder, uint32_t debug_info_flags,
-           runtime::DebugInfo* debug_info, uint32_t trace_flags,
+  // Whether sequences may use the given X64EmitterFeatureFlags extension.
+  bool IsFeatureEnabled(uint32_t feature_flag) const {
+    return (feature_flags_ & feature_flag) != 0;
+  }
+
+  int Emit(runtime::FunctionInfo* symbol_info, hir::HIRBuilder* builder,
+           uint32_t debug_info_flags, runtime::DebugInfo* debug_info,
+           uint32_t trace_flags, runtime::FunctionTier tier, bool relocatable,
            void*& out_code_address, size_t& out_code_size);
 
+  // Relocations recorded during the last Emit.
+  const std::vector<X64Relocation>& relocations() const {
+    return relocations_;
+  }
+  // Base address kImage relocations are relative to.
+  static uint64_t image_anchor();
+
+  // Sets up the entry stub of freshly placed code to run the function body.
+  // writable_code is the function's code as returned from
+  // X64CodeCache::GetWritableAddress.
+  static void InitializeEntryStub(void* writable_code, void* code);
+  // Atomically redirects all calls to the given function to target.
+  static void RedirectEntryStub(void* writable_code, void* target);
+  // Caches a target in a free inline slot of an indirect call, if there is
+  // one. writable_slots is the writable address of the first slot.
+  static bool FillICSlot(void* writable_slots, uint64_t target_address,
+                         void* machine_code, size_t* out_slot_offset);
+  // Stops an inline slot filled by FillICSlot from matching.
+  static void RetireICSlot(void* writable_slot);
+  // Returns the rel32 of the direct call the given call link stub belongs to.
+  static void* GetCallLinkSite(const void* stub);
+  // Atomically points the rel32 of a direct call at target. writable_site is
+  // the writable address of site. Returns false if target is out of reach.
+  static bool PatchCallSite(void* writable_site, const void* site,
+                            const void* target);
+
  public:
   // Reserved:  rsp
-  // Scratch:   rax/rcx/rdx
+  // Scratch:   rax/rcx/rdx, r8-r10
   //            xmm0-2 (could be only xmm0 with some trickery)
-  // Available: rbx, r12-r15 (save to get r8-r11, rbp, rsi, rdi?)
-  //            xmm6-xmm15 (save to get xmm3-xmm5)
-  static const int GPR_COUNT = 5;
-  static const int XMM_COUNT = 10;
+  // Available: rbx, r12-r15, rbp, rsi, rdi, r11
+  //            xmm6-xmm15, xmm3-xmm5
+  // Callee-saved registers are saved by the host-to-guest thunk and come
+  // first so that they're preferred by the allocator. Registers that host
+  // code may clobber are saved around CallNative only if used.
+  static const int GPR_COUNT = 9;
+  static const int XMM_COUNT = 13;
 
   static void SetupReg(const hir::Value* v, Xbyak::Reg8& r) {
     auto idx = gpr_reg_map_[v->reg.index];
-    r = Xbyak::Reg8(idx);
+    // spl/bpl/sil/dil need a REX prefix, otherwise they encode as ah/ch/etc.
+    r = Xbyak::Reg8(idx, idx >= 4 && idx < 8);
   }
   static void SetupReg(const hir::Value* v, Xbyak::Reg16& r) {
     auto idx = gpr_reg_map_[v->reg.index];
@@ -156,6 +244,22 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void SetReturnAddress(uint64_t value);
   void ReloadECX();
   void ReloadEDX();
+  // Returns a register holding membase + 2GB, for constant guest addresses
+  // that don't fit in a (sign extended) displacement off of membase.
+  Xbyak::Reg64 GetMembaseHighReg();
+
+  // Moves a 64bit host address into the register using the full imm64 form
+  // and records a relocation for it.
+  void MovRelocatable(const Xbyak::Reg64& reg, uint64_t value,
+                      X64RelocationType type, uint64_t key = 0);
+  void MovRelocatable(const Xbyak::Reg64& reg, const void* value) {
+    MovRelocatable(reg, reinterpret_cast<uint64_t>(value),
+                   X64RelocationType::kImage);
+  }
+
+  // Emits the 8b address of the block the label marks, filled in once the
+  // code is placed.
+  void EmitLabelAddress(const hir::Label* label);
 
   void nop(size_t length = 1);
 
@@ -183,24 +287,77 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void EmitTraceSourceAppendValue(const hir::Value* value, size_t r8_offset);
   void EmitGetCurrentThreadId();
   void EmitTraceUserCallReturn();
+  void EmitTierUpCounter();
+  void EmitCallLinkStubs();
+  void SaveVolatileRegs();
+  void RestoreVolatileRegs();
 
  protected:
   runtime::Runtime* runtime_;
   X64Backend* backend_;
   X64CodeCache* code_cache_;
   XbyakAllocator* allocator_;
+  // X64EmitterFeatureFlags of the host.
+  uint32_t feature_flags_;
 
+  runtime::FunctionInfo* symbol_info_;
+  runtime::FunctionTier tier_;
   hir::Instr* current_instr_;
+  // Guest address of the instruction being emitted, if known.
+  uint64_t source_address_;
+  // Dispatch table of the module being emitted, if it has one.
+  X64DispatchTable* dispatch_table_;
 
   size_t source_map_count_;
   Arena source_map_arena_;
 
   size_t stack_size_;
+  // Caller-saved registers (by allocator index) used by the function being
+  // emitted and where they are saved around host calls.
+  uint32_t saved_gpr_mask_;
+  uint32_t saved_xmm_mask_;
+  size_t saved_regs_offset_;
 
   uint32_t trace_flags_;
 
+  // Whether r10 still holds what GetMembaseHighReg put in it.
+  bool membase_high_valid_;
+
+  // When set all code is emitted in a form that can be persisted and no
+  // addresses of other generated functions are embedded.
+  bool relocatable_;
+  std::vector<X64Relocation> relocations_;
+
+  // Direct calls of the function being emitted. Each gets a stub at the end
+  // of the function that links it on first use.
+  struct CallLink {
+    std::unique_ptr<Xbyak::Label> stub;
+    // Offsets of the rel32 and the stub from the start of the function.
+    size_t site_offset;
+    size_t stub_offset;
+    runtime::FunctionInfo* symbol_info;
+    // Function to link to right away, if any.
+    runtime::Function* target;
+  };
+  std::vector<CallLink> call_links_;
+  // Inline caches of the indirect calls of the function being emitted.
+  std::vector<X64CallSiteIC*> call_site_ics_;
+
+  // Offsets of the blocks of the function being emitted, by ordinal.
+  std::vector<size_t> block_offsets_;
+  // Label addresses to fill in once the code is placed.
+  struct LabelAddress {
+    // Offset of the 8b slot from the start of the function.
+    size_t slot_offset;
+    const hir::Label* label;
+  };
+  std::vector<LabelAddress> label_addresses_;
+
   static const uint32_t gpr_reg_map_[GPR_COUNT];
   static const uint32_t xmm_reg_map_[XMM_COUNT];
+  // Registers (by allocator index) that host code is free to clobber.
+  static const uint32_t gpr_volatile_mask_;
+  static const uint32_t xmm_volatile_mask_;
 };
 
 }  // namespace x64
@@ -531,11 +531,156 @@ EMITTER_OPCODE_TABLE(
     BRANCH);
 
 
+// ============================================================================
+// Compare + branch fusion
+// ============================================================================
+// Integer compares are a cmp followed by a setcc of the result. When the only
+// use of the result is a branch and nothing emitted in between touches the
+// host flags, the branch jumps on the flags of the cmp directly and the setcc
+// is skipped.
+enum CompareCondition {
+  kCompareE,
+  kCompareNE,
+  kCompareL,
+  kCompareLE,
+  kCompareG,
+  kCompareGE,
+  kCompareB,
+  kCompareBE,
+  kCompareA,
+  kCompareAE,
+};
+bool IsIntegerCompare(const Instr* i) {
+  if (i->opcode != &OPCODE_COMPARE_EQ_info &&
+      i->opcode != &OPCODE_COMPARE_NE_info &&
+      i->opcode != &OPCODE_COMPARE_SLT_info &&
+      i->opcode != &OPCODE_COMPARE_SLE_info &&
+      i->opcode != &OPCODE_COMPARE_SGT_info &&
+      i->opcode != &OPCODE_COMPARE_SGE_info &&
+      i->opcode != &OPCODE_COMPARE_ULT_info &&
+      i->opcode != &OPCODE_COMPARE_ULE_info &&
+      i->opcode != &OPCODE_COMPARE_UGT_info &&
+      i->opcode != &OPCODE_COMPARE_UGE_info) {
+    return false;
+  }
+  return i->src1.value->type <= INT64_TYPE;
+}
+CompareCondition GetCompareCondition(const Instr* i) {
+  // A constant first operand is compared as the second one (see
+  // EmitAssociativeCompareOp), which mirrors the ordered conditions.
+  bool swapped = i->src1.value->IsConstant();
+  if (i->opcode == &OPCODE_COMPARE_EQ_info) {
+    return kCompareE;
+  } else if (i->opcode == &OPCODE_COMPARE_NE_info) {
+    return kCompareNE;
+  } else if (i->opcode == &OPCODE_COMPARE_SLT_info) {
+    return swapped ? kCompareG : kCompareL;
+  } else if (i->opcode == &OPCODE_COMPARE_SLE_info) {
+    return swapped ? kCompareGE : kCompareLE;
+  } else if (i->opcode == &OPCODE_COMPARE_SGT_info) {
+    return swapped ? kCompareL : kCompareG;
+  } else if (i->opcode == &OPCODE_COMPARE_SGE_info) {
+    return swapped ? kCompareLE : kCompareGE;
+  } else if (i->opcode == &OPCODE_COMPARE_ULT_info) {
+    return swapped ? kCompareA : kCompareB;
+  } else if (i->opcode == &OPCODE_COMPARE_ULE_info) {
+    return swapped ? kCompareAE : kCompareBE;
+  } else if (i->opcode == &OPCODE_COMPARE_UGT_info) {
+    return swapped ? kCompareB : kCompareA;
+  } else {
+    assert_true(i->opcode == &OPCODE_COMPARE_UGE_info);
+    return swapped ? kCompareBE : kCompareAE;
+  }
+}
+CompareCondition NegateCompareCondition(CompareCondition cond) {
+  switch (cond) {
+    case kCompareE: return kCompareNE;
+    case kCompareNE: return kCompareE;
+    case kCompareL: return kCompareGE;
+    case kCompareLE: return kCompareG;
+    case kCompareG: return kCompareLE;
+    case kCompareGE: return kCompareL;
+    case kCompareB: return kCompareAE;
+    case kCompareBE: return kCompareA;
+    case kCompareA: return kCompareBE;
+    default: assert_true(cond == kCompareAE); return kCompareB;
+  }
+}
+// Gets the compare whose result the branch tests if the flags it set are
+// still intact at the branch.
+const Instr* GetFlagsCompare(const Instr* branch) {
+  auto i = branch->prev;
+  while (i) {
+    if (i->opcode == &OPCODE_SOURCE_OFFSET_info ||
+        (i->opcode == &OPCODE_COMMENT_info && !IsTracingInstr())) {
+      // No code.
+    } else if (i->opcode == &OPCODE_STORE_CONTEXT_info && !IsTracingData() &&
+               i->src2.value->type <= INT32_TYPE) {
+      // Just a mov. Usually the CR bits of the compare itself.
+    } else {
+      break;
+    }
+    i = i->prev;
+  }
+  if (i && i->dest == branch->src1.value && IsIntegerCompare(i)) {
+    return i;
+  }
+  return nullptr;
+}
+// Sets dest to the result of the compare, unless only a fused branch uses it.
+void EmitCompareResult(X64Emitter& e, const Instr* compare, const Reg8& dest) {
+  auto use = compare->dest->use_head;
+  if (use && !use->next &&
+      (use->instr->opcode == &OPCODE_BRANCH_TRUE_info ||
+       use->instr->opcode == &OPCODE_BRANCH_FALSE_info) &&
+      GetFlagsCompare(use->instr) == compare) {
+    return;
+  }
+  switch (GetCompareCondition(compare)) {
+    case kCompareE: e.sete(dest); break;
+    case kCompareNE: e.setne(dest); break;
+    case kCompareL: e.setl(dest); break;
+    case kCompareLE: e.setle(dest); break;
+    case kCompareG: e.setg(dest); break;
+    case kCompareGE: e.setge(dest); break;
+    case kCompareB: e.setb(dest); break;
+    case kCompareBE: e.setbe(dest); break;
+    case kCompareA: e.seta(dest); break;
+    case kCompareAE: e.setae(dest); break;
+  }
+}
+// Jumps to the label of the branch on the flags of the compare.
+void EmitFlagsBranch(X64Emitter& e, const Instr* compare, bool expect_true,
+                     const char* label) {
+  auto cond = GetCompareCondition(compare);
+  if (!expect_true) {
+    cond = NegateCompareCondition(cond);
+  }
+  switch (cond) {
+    case kCompareE: e.je(label, e.T_NEAR); break;
+    case kCompareNE: e.jne(label, e.T_NEAR); break;
+    case kCompareL: e.jl(label, e.T_NEAR); break;
+    case kCompareLE: e.jle(label, e.T_NEAR); break;
+    case kCompareG: e.jg(label, e.T_NEAR); break;
+    case kCompareGE: e.jge(label, e.T_NEAR); break;
+    case kCompareB: e.jb(label, e.T_NEAR); break;
+    case kCompareBE: e.jbe(label, e.T_NEAR); break;
+    case kCompareA: e.ja(label, e.T_NEAR); break;
+    case kCompareAE: e.jae(label, e.T_NEAR); break;
+  }
+}
+
+
 // ============================================================================
 // OPCODE_BRANCH_TRUE
 // ============================================================================
 EMITTER(BRANCH_TRUE_I8, MATCH(I<OPCODE_BRANCH_TRUE, VoidOp, I8<>, LabelOp>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    auto compare = GetFlagsCompare(i.instr);
+    if (compare) {
+      EmitFlagsBranch(e, compare, true, i.src2.value->name);
+      return;
+    }
     e.test(i.src1, i.src1);
     e.jnz(i.src2.value->name, e.T_NEAR);
   }
@@ -585,6 +730,11 @@ EMITTER_OPCODE_TABLE(
 // ============================================================================
 EMITTER(BRANCH_FALSE_I8, MATCH(I<OPCODE_BRANCH_FALSE, VoidOp, I8<>, LabelOp>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    auto compare = GetFlagsCompare(i.instr);
+    if (compare) {
+      EmitFlagsBranch(e, compare, false, i.src2.value->name);
+      return;
+    }
     e.test(i.src1, i.src1);
     e.jz(i.src2.value->name, e.T_NEAR);
   }
@@ -629,6 +779,53 @@ EMITTER_OPCODE_TABLE(
     BRANCH_FALSE_F64);
 
 
+// ============================================================================
+// OPCODE_BRANCH_TABLE
+// ============================================================================
+// Indices in range jump through a table of absolute label addresses placed
+// right after the jump; the rest fall through:
+//   cmp index, count
+//   jae fall_through
+//   mov eax, index
+//   lea r9, [rip + table]
+//   jmp [r9 + rax * 8]
+//   table: dq label0, label1, ...
+EMITTER(BRANCH_TABLE, MATCH(I<OPCODE_BRANCH_TABLE, VoidOp, I32<>, OffsetOp>)) {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    auto table = i.instr->src2.table;
+    Xbyak::Label fall_through;
+    if (i.src1.is_constant) {
+      e.mov(e.eax, i.src1.constant());
+    } else {
+      e.mov(e.eax, i.src1);
+    }
+    e.cmp(e.eax, table->count);
+    e.jae(fall_through, CodeGenerator::T_NEAR);
+    // lea r9, [rip + disp32], where the table follows the 4b jmp 8b aligned.
+    e.db(0x4C);
+    e.db(0x8D);
+    e.db(0x0D);
+    size_t lea_end = e.getSize() + 4;
+    e.dd(static_cast<uint32_t>(poly::align<size_t>(lea_end + 4, 8) - lea_end));
+    // jmp qword [r9 + rax * 8]
+    e.db(0x41);
+    e.db(0xFF);
+    e.db(0x24);
+    e.db(0xC1);
+    while (e.getSize() % 8) {
+      e.db(0xCC);
+    }
+    for (uint32_t n = 0; n < table->count; ++n) {
+      e.EmitLabelAddress(table->labels[n]);
+    }
+    e.L(fall_through);
+  }
+};
+EMITTER_OPCODE_TABLE(
+    OPCODE_BRANCH_TABLE,
+    BRANCH_TABLE);
+
+
 // ============================================================================
 // OPCODE_ASSIGN
 // ============================================================================
@@ -1434,14 +1631,20 @@ EMITTER_OPCODE_TABLE(
 template <typename T>
 RegExp ComputeMemoryAddress(X64Emitter& e, const T& guest) {
   if (guest.is_constant) {
-    // TODO(benvanik): figure out how to do this without a temp.
-    // Since the constant is often 0x8... if we tried to use that as a
-    // displacement it would be sign extended and mess things up.
-    e.mov(e.eax, static_cast<uint32_t>(guest.constant()));
-    return e.rdx + e.rax;
+    // Displacements are sign extended, so addresses with the high bit set
+    // (which are common) go off of a base 2GB into memory instead.
+    uint32_t address = static_cast<uint32_t>(guest.constant());
+    if (address < 0x80000000) {
+      return e.rdx + address;
+    }
+    return e.GetMembaseHighReg() + (address - 0x80000000);
+  } else if ((guest.value->flags & VALUE_IS_ZERO_EXTENDED) &&
+             !IsTracingData()) {
+    // Top 32 bits are known to be clear (see AddressNarrowingPass).
+    // Tracing reuses the address after the destination may have replaced it.
+    return e.rdx + guest.reg();
   } else {
     // Clear the top 32 bits, as they are likely garbage.
-    // TODO(benvanik): find a way to avoid doing this.
     e.mov(e.eax, guest.reg().cvt32());
     return e.rdx + e.rax;
   }
@@ -1460,7 +1663,16 @@ EMITTER(LOAD_I8, MATCH(I<OPCODE_LOAD, I8<>, I64<>>)) {
 EMITTER(LOAD_I16, MATCH(I<OPCODE_LOAD, I16<>, I64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
-    e.mov(i.dest, e.word[addr]);
+    if (i.instr->flags & LOAD_BYTE_SWAP) {
+      if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(i.dest, e.word[addr]);
+      } else {
+        e.mov(i.dest, e.word[addr]);
+        e.ror(i.dest, 8);
+      }
+    } else {
+      e.mov(i.dest, e.word[addr]);
+    }
     if (IsTracingData()) {
       e.mov(e.r8w, i.dest);
       e.lea(e.rdx, e.ptr[addr]);
@@ -1471,7 +1683,16 @@ EMITTER(LOAD_I16, MATCH(I<OPCODE_LOAD, I16<>, I64<>>)) {
 EMITTER(LOAD_I32, MATCH(I<OPCODE_LOAD, I32<>, I64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
-    e.mov(i.dest, e.dword[addr]);
+    if (i.instr->flags & LOAD_BYTE_SWAP) {
+      if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(i.dest, e.dword[addr]);
+      } else {
+        e.mov(i.dest, e.dword[addr]);
+        e.bswap(i.dest);
+      }
+    } else {
+      e.mov(i.dest, e.dword[addr]);
+    }
     if (IsTracingData()) {
       e.mov(e.r8d, i.dest);
       e.lea(e.rdx, e.ptr[addr]);
@@ -1482,7 +1703,16 @@ EMITTER(LOAD_I32, MATCH(I<OPCODE_LOAD, I32<>, I64<>>)) {
 EMITTER(LOAD_I64, MATCH(I<OPCODE_LOAD, I64<>, I64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
-    e.mov(i.dest, e.qword[addr]);
+    if (i.instr->flags & LOAD_BYTE_SWAP) {
+      if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(i.dest, e.qword[addr]);
+      } else {
+        e.mov(i.dest, e.qword[addr]);
+        e.bswap(i.dest);
+      }
+    } else {
+      e.mov(i.dest, e.qword[addr]);
+    }
     if (IsTracingData()) {
       e.mov(e.r8, i.dest);
       e.lea(e.rdx, e.ptr[addr]);
@@ -1517,6 +1747,9 @@ EMITTER(LOAD_V128, MATCH(I<OPCODE_LOAD, V128<>, I64<>>)) {
     auto addr = ComputeMemoryAddress(e, i.src1);
     // TODO(benvanik): we should try to stick to movaps if possible.
     e.vmovups(i.dest, e.ptr[addr]);
+    if (i.instr->flags & LOAD_BYTE_SWAP) {
+      e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMByteSwapMask));
+    }
     if (IsTracingData()) {
       e.lea(e.r8, e.ptr[addr]);
       e.lea(e.rdx, e.ptr[addr]);
@@ -1558,7 +1791,18 @@ EMITTER(STORE_I8, MATCH(I<OPCODE_STORE, VoidOp, I64<>, I8<>>)) {
 EMITTER(STORE_I16, MATCH(I<OPCODE_STORE, VoidOp, I64<>, I16<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
-    if (i.src2.is_constant) {
+    if (i.instr->flags & STORE_BYTE_SWAP) {
+      if (i.src2.is_constant) {
+        e.mov(e.word[addr], poly::byte_swap(i.src2.constant()));
+      } else if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(e.word[addr], i.src2);
+      } else {
+        // The address may be using rax.
+        e.mov(e.r8w, i.src2);
+        e.ror(e.r8w, 8);
+        e.mov(e.word[addr], e.r8w);
+      }
+    } else if (i.src2.is_constant) {
       e.mov(e.word[addr], i.src2.constant());
     } else {
       e.mov(e.word[addr], i.src2);
@@ -1574,7 +1818,18 @@ EMITTER(STORE_I16, MATCH(I<OPCODE_STORE, VoidOp, I64<>, I16<>>)) {
 EMITTER(STORE_I32, MATCH(I<OPCODE_STORE, VoidOp, I64<>, I32<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
-    if (i.src2.is_constant) {
+    if (i.instr->flags & STORE_BYTE_SWAP) {
+      if (i.src2.is_constant) {
+        e.mov(e.dword[addr], poly::byte_swap(i.src2.constant()));
+      } else if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(e.dword[addr], i.src2);
+      } else {
+        // The address may be using rax.
+        e.mov(e.r8d, i.src2);
+        e.bswap(e.r8d);
+        e.mov(e.dword[addr], e.r8d);
+      }
+    } else if (i.src2.is_constant) {
       e.mov(e.dword[addr], i.src2.constant());
     } else {
       e.mov(e.dword[addr], i.src2);
@@ -1590,7 +1845,18 @@ EMITTER(STORE_I32, MATCH(I<OPCODE_STORE, VoidOp, I64<>, I32<>>)) {
 EMITTER(STORE_I64, MATCH(I<OPCODE_STORE, VoidOp, I64<>, I64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
-    if (i.src2.is_constant) {
+    if (i.instr->flags & STORE_BYTE_SWAP) {
+      if (i.src2.is_constant) {
+        e.MovMem64(addr, poly::byte_swap(i.src2.constant()));
+      } else if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(e.qword[addr], i.src2);
+      } else {
+        // The address may be using rax.
+        e.mov(e.r8, i.src2);
+        e.bswap(e.r8);
+        e.mov(e.qword[addr], e.r8);
+      }
+    } else if (i.src2.is_constant) {
       e.MovMem64(addr, i.src2.constant());
     } else {
       e.mov(e.qword[addr], i.src2);
@@ -1638,7 +1904,15 @@ EMITTER(STORE_F64, MATCH(I<OPCODE_STORE, VoidOp, I64<>, F64<>>)) {
 EMITTER(STORE_V128, MATCH(I<OPCODE_STORE, VoidOp, I64<>, V128<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
-    if (i.src2.is_constant) {
+    if (i.instr->flags & STORE_BYTE_SWAP) {
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(e.xmm0, i.src2.constant());
+        e.vpshufb(e.xmm0, e.xmm0, e.GetXmmConstPtr(XMMByteSwapMask));
+      } else {
+        e.vpshufb(e.xmm0, i.src2, e.GetXmmConstPtr(XMMByteSwapMask));
+      }
+      e.vmovaps(e.ptr[addr], e.xmm0);
+    } else if (i.src2.is_constant) {
       e.LoadConstantXmm(e.xmm0, i.src2.constant());
       e.vmovaps(e.ptr[addr], e.xmm0);
     } else {
@@ -1676,6 +1950,21 @@ EMITTER_OPCODE_TABLE(
     PREFETCH);
 
 
+// ============================================================================
+// OPCODE_MEMORY_BARRIER
+// ============================================================================
+EMITTER(MEMORY_BARRIER, MATCH(I<OPCODE_MEMORY_BARRIER, VoidOp>)) {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    // Only constrains the compiler. x64 already keeps the ordering eieio and
+    // lwsync ask for; the store->load ordering of a full sync isn't (and
+    // wasn't, as a nop) enforced with an mfence.
+  }
+};
+EMITTER_OPCODE_TABLE(
+    OPCODE_MEMORY_BARRIER,
+    MEMORY_BARRIER);
+
+
 // ============================================================================
 // OPCODE_MAX
 // ============================================================================
@@ -1991,7 +2280,7 @@ EMITTER(SELECT_V128_I8, MATCH(I<OPCODE_SELECT, V128<>, I8<>, V128<>, V128<>>)) {
     // xmm0 = src1 != 0 ? 1111... : 0000....
     e.movzx(e.eax, i.src1);
     e.vmovd(e.xmm1, e.eax);
-    e.vpbroadcastd(e.xmm1, e.xmm1);
+    e.vpshufd(e.xmm1, e.xmm1, 0);
     e.vxorps(e.xmm0, e.xmm0);
     e.vcmpneqps(e.xmm0, e.xmm1);
     e.vpand(e.xmm1, e.xmm0, i.src2);
@@ -2156,7 +2445,7 @@ EMITTER(COMPARE_EQ_I8, MATCH(I<OPCODE_COMPARE_EQ, I8<>, I8<>, I8<>>)) {
         e, i,
         [](X64Emitter& e, const Reg8& src1, const Reg8& src2) { e.cmp(src1, src2); },
         [](X64Emitter& e, const Reg8& src1, int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    EmitCompareResult(e, i.instr, i.dest);
   }
 };
 EMITTER(COMPARE_EQ_I16, MATCH(I<OPCODE_COMPARE_EQ, I8<>, I16<>, I16<>>)) {
@@ -2165,7 +2454,7 @@ EMITTER(COMPARE_EQ_I16, MATCH(I<OPCODE_COMPARE_EQ, I8<>, I16<>, I16<>>)) {
         e, i,
         [](X64Emitter& e, const Reg16& src1, const Reg16& src2) { e.cmp(src1, src2); },
         [](X64Emitter& e, const Reg16& src1, int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    EmitCompareResult(e, i.instr, i.dest);
   }
 };
 EMITTER(COMPARE_EQ_I32, MATCH(I<OPCODE_COMPARE_EQ, I8<>, I32<>, I32<>>)) {
@@ -2174,7 +2463,7 @@ EMITTER(COMPARE_EQ_I32, MATCH(I<OPCODE_COMPARE_EQ, I8<>, I32<>, I32<>>)) {
         e, i,
         [](X64Emitter& e, const Reg32& src1, const Reg32& src2) { e.cmp(src1, src2); },
         [](X64Emitter& e, const Reg32& src1, int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    EmitCompareResult(e, i.instr, i.dest);
   }
 };
 EMITTER(COMPARE_EQ_I64, MATCH(I<OPCODE_COMPARE_EQ, I8<>, I64<>, I64<>>)) {
@@ -2183,7 +2472,7 @@ EMITTER(COMPARE_EQ_I64, MATCH(I<OPCODE_COMPARE_EQ, I8<>, I64<>, I64<>>)) {
         e, i,
         [](X64Emitter& e, const Reg64& src1, const Reg64& src2) { e.cmp(src1, src2); },
         [](X64Emitter& e, const Reg64& src1, int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    EmitCompareResult(e, i.instr, i.dest);
   }
 };
 EMITTER(COMPARE_EQ_F32, MATCH(I<OPCODE_COMPARE_EQ, I8<>, F32<>, F32<>>)) {
@@ -2217,7 +2506,7 @@ EMITTER(COMPARE_NE_I8, MATCH(I<OPCODE_COMPARE_NE, I8<>, I8<>, I8<>>)) {
         e, i,
         [](X64Emitter& e, const Reg8& src1, const Reg8& src2) { e.cmp(src1, src2); },
         [](X64Emitter& e, const Reg8& src1, int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    EmitCompareResult(e, i.instr, i.dest);
   }
 };
 EMITTER(COMPARE_NE_I16, MATCH(I<OPCODE_COMPARE_NE, I8<>, I16<>, I16<>>)) {
@@ -2226,7 +2515,7 @@ EMITTER(COMPARE_NE_I16, MATCH(I<OPCODE_COMPARE_NE, I8<>, I16<>, I16<>>)) {
         e, i,
         [](X64Emitter& e, const Reg16& src1, const Reg16& src2) { e.cmp(src1, src2); },
         [](X64Emitter& e, const Reg16& src1, int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    EmitCompareResult(e, i.instr, i.dest);
   }
 };
 EMITTER(COMPARE_NE_I32, MATCH(I<OPCODE_COMPARE_NE, I8<>, I32<>, I32<>>)) {
@@ -2235,7 +2524,7 @@ EMITTER(COMPARE_NE_I32, MATCH(I<OPCODE_COMPARE_NE, I8<>, I32<>, I32<>>)) {
         e, i,
         [](X64Emitter& e, const Reg32& src1, const Reg32& src2) { e.cmp(src1, src2); },
         [](X64Emitter& e, const Reg32& src1, int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    EmitCompareResult(e, i.instr, i.dest);
   }
 };
 EMITTER(COMPARE_NE_I64, MATCH(I<OPCODE_COMPARE_NE, I8<>, I64<>, I64<>>)) {
@@ -2244,7 +2533,7 @@ EMITTER(COMPARE_NE_I64, MATCH(I<OPCODE_COMPARE_NE, I8<>, I64<>, I64<>>)) {
         e, i,
         [](X64Emitter& e, const Reg64& src1, const Reg64& src2) { e.cmp(src1, src2); },
         [](X64Emitter& e, const Reg64& src1, int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    EmitCompareResult(e, i.instr, i.dest);
   }
 };
 EMITTER(COMPARE_NE_F32, MATCH(I<OPCODE_COMPARE_NE, I8<>, F32<>, F32<>>)) {
@@ -2272,40 +2561,39 @@ EMITTER_OPCODE_TABLE(
 // ============================================================================
 // OPCODE_COMPARE_*
 // ============================================================================
-#define EMITTER_ASSOCIATIVE_COMPARE_INT(op, instr, inverse_instr, type, reg_type) \
+#define EMITTER_ASSOCIATIVE_COMPARE_INT(op, type, reg_type) \
     EMITTER(COMPARE_##op##_##type, MATCH(I<OPCODE_COMPARE_##op, I8<>, type<>, type<>>)) { \
         static void Emit(X64Emitter& e, const EmitArgType& i) { \
           EmitAssociativeCompareOp( \
               e, i, \
               [](X64Emitter& e, const Reg8& dest, const reg_type& src1, const reg_type& src2, bool inverse) { \
                   e.cmp(src1, src2); \
-                  if (!inverse) { e.instr(dest); } else { e.inverse_instr(dest); } \
               }, \
               [](X64Emitter& e, const Reg8& dest, const reg_type& src1, int32_t constant, bool inverse) { \
                   e.cmp(src1, constant); \
-                  if (!inverse) { e.instr(dest); } else { e.inverse_instr(dest); } \
               }); \
+          EmitCompareResult(e, i.instr, i.dest); \
         } \
     };
-#define EMITTER_ASSOCIATIVE_COMPARE_XX(op, instr, inverse_instr) \
-    EMITTER_ASSOCIATIVE_COMPARE_INT(op, instr, inverse_instr, I8, Reg8); \
-    EMITTER_ASSOCIATIVE_COMPARE_INT(op, instr, inverse_instr, I16, Reg16); \
-    EMITTER_ASSOCIATIVE_COMPARE_INT(op, instr, inverse_instr, I32, Reg32); \
-    EMITTER_ASSOCIATIVE_COMPARE_INT(op, instr, inverse_instr, I64, Reg64); \
+#define EMITTER_ASSOCIATIVE_COMPARE_XX(op) \
+    EMITTER_ASSOCIATIVE_COMPARE_INT(op, I8, Reg8); \
+    EMITTER_ASSOCIATIVE_COMPARE_INT(op, I16, Reg16); \
+    EMITTER_ASSOCIATIVE_COMPARE_INT(op, I32, Reg32); \
+    EMITTER_ASSOCIATIVE_COMPARE_INT(op, I64, Reg64); \
     EMITTER_OPCODE_TABLE( \
         OPCODE_COMPARE_##op, \
         COMPARE_##op##_I8, \
         COMPARE_##op##_I16, \
         COMPARE_##op##_I32, \
         COMPARE_##op##_I64);
-EMITTER_ASSOCIATIVE_COMPARE_XX(SLT, setl, setge);
-EMITTER_ASSOCIATIVE_COMPARE_XX(SLE, setle, setg);
-EMITTER_ASSOCIATIVE_COMPARE_XX(SGT, setg, setle);
-EMITTER_ASSOCIATIVE_COMPARE_XX(SGE, setge, setl);
-EMITTER_ASSOCIATIVE_COMPARE_XX(ULT, setb, setae);
-EMITTER_ASSOCIATIVE_COMPARE_XX(ULE, setbe, seta);
-EMITTER_ASSOCIATIVE_COMPARE_XX(UGT, seta, setbe);
-EMITTER_ASSOCIATIVE_COMPARE_XX(UGE, setae, setb);
+EMITTER_ASSOCIATIVE_COMPARE_XX(SLT);
+EMITTER_ASSOCIATIVE_COMPARE_XX(SLE);
+EMITTER_ASSOCIATIVE_COMPARE_XX(SGT);
+EMITTER_ASSOCIATIVE_COMPARE_XX(SGE);
+EMITTER_ASSOCIATIVE_COMPARE_XX(ULT);
+EMITTER_ASSOCIATIVE_COMPARE_XX(ULE);
+EMITTER_ASSOCIATIVE_COMPARE_XX(UGT);
+EMITTER_ASSOCIATIVE_COMPARE_XX(UGE);
 
 // http://x86.renejeschke.de/html/file_module_x86_id_288.html
 #define EMITTER_ASSOCIATIVE_COMPARE_FLT_XX(op, instr) \
@@ -2533,7 +2821,7 @@ EMITTER(VECTOR_COMPARE_UGT_V128, MATCH(I<OPCODE_VECTOR_COMPARE_UGT, V128<>, V128
     }
     if (i.src2.is_constant) {
       // TODO(benvanik): make this constant.
-      e.LoadConstantXmm(e.xmm1, i.src1.constant());
+      e.LoadConstantXmm(e.xmm1, i.src2.constant());
       e.vpxor(e.xmm1, sign_addr);
     } else {
       e.vpxor(e.xmm1, i.src2, sign_addr);
@@ -2588,7 +2876,7 @@ EMITTER(VECTOR_COMPARE_UGE_V128, MATCH(I<OPCODE_VECTOR_COMPARE_UGE, V128<>, V128
     }
     if (i.src2.is_constant) {
       // TODO(benvanik): make this constant.
-      e.LoadConstantXmm(e.xmm1, i.src1.constant());
+      e.LoadConstantXmm(e.xmm1, i.src2.constant());
       e.vpxor(e.xmm1, sign_addr);
     } else {
       e.vpxor(e.xmm1, i.src2, sign_addr);
@@ -2652,6 +2940,21 @@ EMITTER(ADD_I32, MATCH(I<OPCODE_ADD, I32<>, I32<>, I32<>>)) {
 };
 EMITTER(ADD_I64, MATCH(I<OPCODE_ADD, I64<>, I64<>, I64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.dest.value->flags & VALUE_IS_ZERO_EXTENDED) {
+      // Guest address; only the low 32 bits matter and writing those clears
+      // the rest. lea also leaves the sources alone.
+      auto dest = i.dest.reg().cvt32();
+      if (i.src1.is_constant) {
+        e.lea(dest, e.ptr[i.src2.reg() +
+                          static_cast<int32_t>(i.src1.constant())]);
+      } else if (i.src2.is_constant) {
+        e.lea(dest, e.ptr[i.src1.reg() +
+                          static_cast<int32_t>(i.src2.constant())]);
+      } else {
+        e.lea(dest, e.ptr[i.src1.reg() + i.src2.reg()]);
+      }
+      return;
+    }
     EmitAddXX<ADD_I64, Reg64>(e, i);
   }
 };
@@ -3068,8 +3371,29 @@ EMITTER_OPCODE_TABLE(
 // ============================================================================
 // Sign doesn't matter here, as we don't use the high bits.
 // We exploit mulx here to avoid creating too much register pressure.
+// Without BMI2 the two operand imul is used instead. 8/16bit multiplies are
+// done at 32bit, which gives the same low bits.
+inline Reg32 GetMulReg(const Reg8& r) { return r.cvt32(); }
+inline Reg32 GetMulReg(const Reg16& r) { return r.cvt32(); }
+inline Reg32 GetMulReg(const Reg32& r) { return r; }
+inline Reg64 GetMulReg(const Reg64& r) { return r; }
+template <typename SEQ, typename REG, typename ARGS>
+void EmitMulImulXX(X64Emitter& e, const ARGS& i) {
+  SEQ::EmitCommutativeBinaryOp(
+      e, i,
+      [](X64Emitter& e, const REG& dest_src, const REG& src) {
+        e.imul(GetMulReg(dest_src), GetMulReg(src));
+      },
+      [](X64Emitter& e, const REG& dest_src, int32_t constant) {
+        e.imul(GetMulReg(dest_src), GetMulReg(dest_src), constant);
+      });
+}
 EMITTER(MUL_I8, MATCH(I<OPCODE_MUL, I8<>, I8<>, I8<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (!e.IsFeatureEnabled(kX64EmitBMI2)) {
+      EmitMulImulXX<MUL_I8, Reg8>(e, i);
+      return;
+    }
     // dest hi, dest low = src * edx
     // TODO(benvanik): place src2 in edx?
     if (i.src1.is_constant) {
@@ -3085,10 +3409,15 @@ EMITTER(MUL_I8, MATCH(I<OPCODE_MUL, I8<>, I8<>, I8<>>)) {
       e.movzx(e.edx, i.src2);
       e.mulx(e.edx, i.dest.reg().cvt32(), i.src1.reg().cvt32());
     }
+    e.ReloadEDX();
   }
 };
 EMITTER(MUL_I16, MATCH(I<OPCODE_MUL, I16<>, I16<>, I16<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (!e.IsFeatureEnabled(kX64EmitBMI2)) {
+      EmitMulImulXX<MUL_I16, Reg16>(e, i);
+      return;
+    }
     // dest hi, dest low = src * edx
     // TODO(benvanik): place src2 in edx?
     if (i.src1.is_constant) {
@@ -3109,6 +3438,10 @@ EMITTER(MUL_I16, MATCH(I<OPCODE_MUL, I16<>, I16<>, I16<>>)) {
 };
 EMITTER(MUL_I32, MATCH(I<OPCODE_MUL, I32<>, I32<>, I32<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (!e.IsFeatureEnabled(kX64EmitBMI2)) {
+      EmitMulImulXX<MUL_I32, Reg32>(e, i);
+      return;
+    }
     // dest hi, dest low = src * edx
     // TODO(benvanik): place src2 in edx?
     if (i.src1.is_constant) {
@@ -3129,6 +3462,10 @@ EMITTER(MUL_I32, MATCH(I<OPCODE_MUL, I32<>, I32<>, I32<>>)) {
 };
 EMITTER(MUL_I64, MATCH(I<OPCODE_MUL, I64<>, I64<>, I64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (!e.IsFeatureEnabled(kX64EmitBMI2)) {
+      EmitMulImulXX<MUL_I64, Reg64>(e, i);
+      return;
+    }
     // dest hi, dest low = src * rdx
     // TODO(benvanik): place src2 in edx?
     if (i.src1.is_constant) {
@@ -3191,9 +3528,16 @@ EMITTER_OPCODE_TABLE(
 EMITTER(MUL_HI_I8, MATCH(I<OPCODE_MUL_HI, I8<>, I8<>, I8<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     if (i.instr->flags & ARITHMETIC_UNSIGNED) {
-      // TODO(benvanik): place src1 in eax? still need to sign extend
-      e.movzx(e.edx, i.src1);
-      e.mulx(i.dest.reg().cvt32(), e.eax, i.src2.reg().cvt32());
+      // The whole product fits in 32bits, so there's no need for mulx.
+      e.movzx(e.eax, i.src1);
+      if (i.src2.is_constant) {
+        e.imul(e.eax, e.eax, static_cast<uint8_t>(i.src2.constant()));
+      } else {
+        e.movzx(e.r8d, i.src2);
+        e.imul(e.eax, e.r8d);
+      }
+      e.shr(e.eax, 8);
+      e.mov(i.dest, e.al);
     } else {
       e.mov(e.al, i.src1);
       if (i.src2.is_constant) {
@@ -3210,9 +3554,16 @@ EMITTER(MUL_HI_I8, MATCH(I<OPCODE_MUL_HI, I8<>, I8<>, I8<>>)) {
 EMITTER(MUL_HI_I16, MATCH(I<OPCODE_MUL_HI, I16<>, I16<>, I16<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     if (i.instr->flags & ARITHMETIC_UNSIGNED) {
-      // TODO(benvanik): place src1 in eax? still need to sign extend
-      e.movzx(e.edx, i.src1);
-      e.mulx(i.dest.reg().cvt32(), e.eax, i.src2.reg().cvt32());
+      // The whole product fits in 32bits, so there's no need for mulx.
+      e.movzx(e.eax, i.src1);
+      if (i.src2.is_constant) {
+        e.imul(e.eax, e.eax, static_cast<uint16_t>(i.src2.constant()));
+      } else {
+        e.movzx(e.r8d, i.src2);
+        e.imul(e.eax, e.r8d);
+      }
+      e.shr(e.eax, 16);
+      e.mov(i.dest, e.ax);
     } else {
       e.mov(e.ax, i.src1);
       if (i.src2.is_constant) {
@@ -3228,7 +3579,8 @@ EMITTER(MUL_HI_I16, MATCH(I<OPCODE_MUL_HI, I16<>, I16<>, I16<>>)) {
 };
 EMITTER(MUL_HI_I32, MATCH(I<OPCODE_MUL_HI, I32<>, I32<>, I32<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (i.instr->flags & ARITHMETIC_UNSIGNED) {
+    if ((i.instr->flags & ARITHMETIC_UNSIGNED) &&
+        e.IsFeatureEnabled(kX64EmitBMI2)) {
       // TODO(benvanik): place src1 in eax? still need to sign extend
       e.mov(e.edx, i.src1);
       if (i.src2.is_constant) {
@@ -3237,6 +3589,15 @@ EMITTER(MUL_HI_I32, MATCH(I<OPCODE_MUL_HI, I32<>, I32<>, I32<>>)) {
       } else {
         e.mulx(i.dest, e.edx, i.src2);
       }
+    } else if (i.instr->flags & ARITHMETIC_UNSIGNED) {
+      e.mov(e.eax, i.src1);
+      if (i.src2.is_constant) {
+        e.mov(e.edx, i.src2.constant());
+        e.mul(e.edx);
+      } else {
+        e.mul(i.src2);
+      }
+      e.mov(i.dest, e.edx);
     } else {
       e.mov(e.eax, i.src1);
       if (i.src2.is_constant) {
@@ -3252,7 +3613,8 @@ EMITTER(MUL_HI_I32, MATCH(I<OPCODE_MUL_HI, I32<>, I32<>, I32<>>)) {
 };
 EMITTER(MUL_HI_I64, MATCH(I<OPCODE_MUL_HI, I64<>, I64<>, I64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (i.instr->flags & ARITHMETIC_UNSIGNED) {
+    if ((i.instr->flags & ARITHMETIC_UNSIGNED) &&
+        e.IsFeatureEnabled(kX64EmitBMI2)) {
       // TODO(benvanik): place src1 in eax? still need to sign extend
       e.mov(e.rdx, i.src1);
       if (i.src2.is_constant) {
@@ -3261,6 +3623,15 @@ EMITTER(MUL_HI_I64, MATCH(I<OPCODE_MUL_HI, I64<>, I64<>, I64<>>)) {
       } else {
         e.mulx(i.dest, e.rax, i.src2);
       }
+    } else if (i.instr->flags & ARITHMETIC_UNSIGNED) {
+      e.mov(e.rax, i.src1);
+      if (i.src2.is_constant) {
+        e.mov(e.rdx, i.src2.constant());
+        e.mul(e.rdx);
+      } else {
+        e.mul(i.src2);
+      }
+      e.mov(i.dest, e.rdx);
     } else {
       e.mov(e.rax, i.src1);
       if (i.src2.is_constant) {
@@ -3555,56 +3926,73 @@ EMITTER_OPCODE_TABLE(
 // OPCODE_MUL_ADD
 // ============================================================================
 // d = 1 * 2 + 3
-// $0 = $1x$0 + $2
-// TODO(benvanik): use other forms (132/213/etc) to avoid register shuffling.
-// dest could be src2 or src3 - need to ensure it's not before overwriting dest
-// perhaps use other 132/213/etc
+// Without FMA the product is rounded before the add, so results may differ
+// from the guest in the last bit.
+// FMA3 overwrites one of its sources: the 213 forms compute d = d * 1 + 2 and
+// the 231 forms d = 1 * 2 + d. Picking the form whose overwritten operand is
+// already in dest leaves a copy only when dest is none of the sources.
+template <typename ARGS, typename FN213, typename FN231>
+void EmitFusedMulAddXX(X64Emitter& e, const ARGS& i, const FN213& fn213,
+                       const FN231& fn231) {
+  if (i.dest == i.src1) {
+    fn213(e, i.dest, i.src2, i.src3);
+  } else if (i.dest == i.src2) {
+    fn213(e, i.dest, i.src1, i.src3);
+  } else if (i.dest == i.src3) {
+    fn231(e, i.dest, i.src1, i.src2);
+  } else {
+    // A full register copy doesn't depend on the old value of dest, unlike
+    // the merging vmovss/vmovsd.
+    e.vmovaps(i.dest, i.src1);
+    fn213(e, i.dest, i.src2, i.src3);
+  }
+}
 EMITTER(MUL_ADD_F32, MATCH(I<OPCODE_MUL_ADD, F32<>, F32<>, F32<>, F32<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (i.dest == i.src1) {
-      e.vfmadd213ss(i.dest, i.src2, i.src3);
-    } else {
-      if (i.dest != i.src2 && i.dest != i.src3) {
-        e.vmovss(i.dest, i.src1);
-        e.vfmadd213ss(i.dest, i.src2, i.src3);
-      } else {
-        e.vmovss(e.xmm0, i.src1);
-        e.vfmadd213ss(e.xmm0, i.src2, i.src3);
-        e.vmovss(i.dest, e.xmm0);
-      }
+    if (!e.IsFeatureEnabled(kX64EmitFMA)) {
+      e.vmulss(e.xmm0, i.src1, i.src2);
+      e.vaddss(i.dest, e.xmm0, i.src3);
+      return;
     }
+    EmitFusedMulAddXX(e, i,
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmadd213ss(dest, src1, src2);
+        },
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmadd231ss(dest, src1, src2);
+        });
   }
 };
 EMITTER(MUL_ADD_F64, MATCH(I<OPCODE_MUL_ADD, F64<>, F64<>, F64<>, F64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (i.dest == i.src1) {
-      e.vfmadd213sd(i.dest, i.src2, i.src3);
-    } else {
-      if (i.dest != i.src2 && i.dest != i.src3) {
-        e.vmovsd(i.dest, i.src1);
-        e.vfmadd213sd(i.dest, i.src2, i.src3);
-      } else {
-        e.vmovsd(e.xmm0, i.src1);
-        e.vfmadd213sd(e.xmm0, i.src2, i.src3);
-        e.vmovsd(i.dest, e.xmm0);
-      }
+    if (!e.IsFeatureEnabled(kX64EmitFMA)) {
+      e.vmulsd(e.xmm0, i.src1, i.src2);
+      e.vaddsd(i.dest, e.xmm0, i.src3);
+      return;
     }
+    EmitFusedMulAddXX(e, i,
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmadd213sd(dest, src1, src2);
+        },
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmadd231sd(dest, src1, src2);
+        });
   }
 };
 EMITTER(MUL_ADD_V128, MATCH(I<OPCODE_MUL_ADD, V128<>, V128<>, V128<>, V128<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (i.dest == i.src1) {
-      e.vfmadd213ps(i.dest, i.src2, i.src3);
-    } else {
-      if (i.dest != i.src2 && i.dest != i.src3) {
-        e.vmovdqa(i.dest, i.src1);
-        e.vfmadd213ps(i.dest, i.src2, i.src3);
-      } else {
-        e.vmovdqa(e.xmm0, i.src1);
-        e.vfmadd213ps(e.xmm0, i.src2, i.src3);
-        e.vmovdqa(i.dest, e.xmm0);
-      }
+    if (!e.IsFeatureEnabled(kX64EmitFMA)) {
+      e.vmulps(e.xmm0, i.src1, i.src2);
+      e.vaddps(i.dest, e.xmm0, i.src3);
+      return;
     }
+    EmitFusedMulAddXX(e, i,
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmadd213ps(dest, src1, src2);
+        },
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmadd231ps(dest, src1, src2);
+        });
   }
 };
 EMITTER_OPCODE_TABLE(
@@ -3618,56 +4006,53 @@ EMITTER_OPCODE_TABLE(
 // OPCODE_MUL_SUB
 // ============================================================================
 // d = 1 * 2 - 3
-// $0 = $2x$0 - $3
-// TODO(benvanik): use other forms (132/213/etc) to avoid register shuffling.
-// dest could be src2 or src3 - need to ensure it's not before overwriting dest
-// perhaps use other 132/213/etc
+// See OPCODE_MUL_ADD for the choice of FMA form.
 EMITTER(MUL_SUB_F32, MATCH(I<OPCODE_MUL_SUB, F32<>, F32<>, F32<>, F32<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (i.dest == i.src1) {
-      e.vfmsub213ss(i.dest, i.src2, i.src3);
-    } else {
-      if (i.dest != i.src2 && i.dest != i.src3) {
-        e.vmovss(i.dest, i.src1);
-        e.vfmsub213ss(i.dest, i.src2, i.src3);
-      } else {
-        e.vmovss(e.xmm0, i.src1);
-        e.vfmsub213ss(e.xmm0, i.src2, i.src3);
-        e.vmovss(i.dest, e.xmm0);
-      }
+    if (!e.IsFeatureEnabled(kX64EmitFMA)) {
+      e.vmulss(e.xmm0, i.src1, i.src2);
+      e.vsubss(i.dest, e.xmm0, i.src3);
+      return;
     }
+    EmitFusedMulAddXX(e, i,
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmsub213ss(dest, src1, src2);
+        },
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmsub231ss(dest, src1, src2);
+        });
   }
 };
 EMITTER(MUL_SUB_F64, MATCH(I<OPCODE_MUL_SUB, F64<>, F64<>, F64<>, F64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (i.dest == i.src1) {
-      e.vfmsub213sd(i.dest, i.src2, i.src3);
-    } else {
-      if (i.dest != i.src2 && i.dest != i.src3) {
-        e.vmovsd(i.dest, i.src1);
-        e.vfmsub213sd(i.dest, i.src2, i.src3);
-      } else {
-        e.vmovsd(e.xmm0, i.src1);
-        e.vfmsub213sd(e.xmm0, i.src2, i.src3);
-        e.vmovsd(i.dest, e.xmm0);
-      }
+    if (!e.IsFeatureEnabled(kX64EmitFMA)) {
+      e.vmulsd(e.xmm0, i.src1, i.src2);
+      e.vsubsd(i.dest, e.xmm0, i.src3);
+      return;
     }
+    EmitFusedMulAddXX(e, i,
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmsub213sd(dest, src1, src2);
+        },
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmsub231sd(dest, src1, src2);
+        });
   }
 };
 EMITTER(MUL_SUB_V128, MATCH(I<OPCODE_MUL_SUB, V128<>, V128<>, V128<>, V128<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (i.dest == i.src1) {
-      e.vfmsub213ps(i.dest, i.src2, i.src3);
-    } else {
-      if (i.dest != i.src2 && i.dest != i.src3) {
-        e.vmovdqa(i.dest, i.src1);
-        e.vfmsub213ps(i.dest, i.src2, i.src3);
-      } else {
-        e.vmovdqa(e.xmm0, i.src1);
-        e.vfmsub213ps(e.xmm0, i.src2, i.src3);
-        e.vmovdqa(i.dest, e.xmm0);
-      }
+    if (!e.IsFeatureEnabled(kX64EmitFMA)) {
+      e.vmulps(e.xmm0, i.src1, i.src2);
+      e.vsubps(i.dest, e.xmm0, i.src3);
+      return;
     }
+    EmitFusedMulAddXX(e, i,
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmsub213ps(dest, src1, src2);
+        },
+        [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+          e.vfmsub231ps(dest, src1, src2);
+        });
   }
 };
 EMITTER_OPCODE_TABLE(
@@ -4156,7 +4541,11 @@ void EmitShlXX(X64Emitter& e, const ARGS& i) {
   SEQ::EmitAssociativeBinaryOp(
         e, i,
         [](X64Emitter& e, const REG& dest_src, const Reg8& src) {
-          if (dest_src.getBit() == 64) {
+          if (!e.IsFeatureEnabled(kX64EmitBMI2)) {
+            e.mov(e.cl, src);
+            e.shl(dest_src, e.cl);
+            e.ReloadECX();
+          } else if (dest_src.getBit() == 64) {
             e.shlx(dest_src.cvt64(), dest_src.cvt64(), src.cvt64());
           } else {
             e.shlx(dest_src.cvt32(), dest_src.cvt32(), src.cvt32());
@@ -4202,7 +4591,12 @@ void EmitShrXX(X64Emitter& e, const ARGS& i) {
   SEQ::EmitAssociativeBinaryOp(
         e, i,
         [](X64Emitter& e, const REG& dest_src, const Reg8& src) {
-          if (dest_src.getBit() == 64) {
+          if (!e.IsFeatureEnabled(kX64EmitBMI2)) {
+            // Unlike shrx this works on the narrow register directly.
+            e.mov(e.cl, src);
+            e.shr(dest_src, e.cl);
+            e.ReloadECX();
+          } else if (dest_src.getBit() == 64) {
             e.shrx(dest_src.cvt64(), dest_src.cvt64(), src.cvt64());
           } else if (dest_src.getBit() == 32) {
             e.shrx(dest_src.cvt32(), dest_src.cvt32(), src.cvt32());
@@ -4278,7 +4672,11 @@ void EmitSarXX(X64Emitter& e, const ARGS& i) {
   SEQ::EmitAssociativeBinaryOp(
         e, i,
         [](X64Emitter& e, const REG& dest_src, const Reg8& src) {
-          if (dest_src.getBit() == 64) {
+          if (!e.IsFeatureEnabled(kX64EmitBMI2)) {
+            e.mov(e.cl, src);
+            e.sar(dest_src, e.cl);
+            e.ReloadECX();
+          } else if (dest_src.getBit() == 64) {
             e.sarx(dest_src.cvt64(), dest_src.cvt64(), src.cvt64());
           } else if (dest_src.getBit() == 32) {
             e.sarx(dest_src.cvt32(), dest_src.cvt32(), src.cvt32());
@@ -4321,6 +4719,20 @@ EMITTER_OPCODE_TABLE(
 // ============================================================================
 // OPCODE_VECTOR_SHL
 // ============================================================================
+// Calls fn(void*, __m128i src1, __m128i src2) on the sources, for when
+// there's no native sequence on the host.
+template <typename ARGS>
+void EmitVectorBinaryOpNative(X64Emitter& e, const ARGS& i, void* fn) {
+  if (i.src2.is_constant) {
+    e.LoadConstantXmm(e.xmm0, i.src2.constant());
+    e.lea(e.r9, e.StashXmm(1, e.xmm0));
+  } else {
+    e.lea(e.r9, e.StashXmm(1, i.src2));
+  }
+  e.lea(e.r8, e.StashXmm(0, i.src1));
+  e.CallNativeSafe(fn);
+  e.vmovaps(i.dest, e.xmm0);
+}
 EMITTER(VECTOR_SHL_V128, MATCH(I<OPCODE_VECTOR_SHL, V128<>, V128<>, V128<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     switch (i.instr->flags) {
@@ -4397,6 +4809,16 @@ EMITTER(VECTOR_SHL_V128, MATCH(I<OPCODE_VECTOR_SHL, V128<>, V128<>, V128<>>)) {
     e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShlI16));
     e.vmovaps(i.dest, e.xmm0);
   }
+  static __m128i EmulateVectorShlI32(void*, __m128i src1, __m128i src2) {
+    alignas(16) uint32_t value[4];
+    alignas(16) uint32_t shamt[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
+    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
+    for (size_t i = 0; i < 4; ++i) {
+      value[i] = value[i] << (shamt[i] & 0x1F);
+    }
+    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
+  }
   static void EmitInt32(X64Emitter& e, const EmitArgType& i) {
     if (i.src2.is_constant) {
       const auto& shamt = i.src2.constant();
@@ -4410,6 +4832,9 @@ EMITTER(VECTOR_SHL_V128, MATCH(I<OPCODE_VECTOR_SHL, V128<>, V128<>, V128<>>)) {
       if (all_same) {
         // Every count is the same, so we can use vpslld.
         e.vpslld(i.dest, i.src1, shamt.u8[0] & 0x1F);
+      } else if (!e.IsFeatureEnabled(kX64EmitAVX2)) {
+        EmitVectorBinaryOpNative(
+            e, i, reinterpret_cast<void*>(EmulateVectorShlI32));
       } else {
         // Counts differ, so pre-mask and load constant.
         vec128_t masked = i.src2.constant();
@@ -4419,12 +4844,15 @@ EMITTER(VECTOR_SHL_V128, MATCH(I<OPCODE_VECTOR_SHL, V128<>, V128<>, V128<>>)) {
         e.LoadConstantXmm(e.xmm0, masked);
         e.vpsllvd(i.dest, i.src1, e.xmm0);
       }
-    } else {
+    } else if (e.IsFeatureEnabled(kX64EmitAVX2)) {
       // Fully variable shift.
       // src shift mask may have values >31, and x86 sets to zero when
       // that happens so we mask.
       e.vandps(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPS));
       e.vpsllvd(i.dest, i.src1, e.xmm0);
+    } else {
+      EmitVectorBinaryOpNative(
+          e, i, reinterpret_cast<void*>(EmulateVectorShlI32));
     }
   }
 };
@@ -4512,6 +4940,16 @@ EMITTER(VECTOR_SHR_V128, MATCH(I<OPCODE_VECTOR_SHR, V128<>, V128<>, V128<>>)) {
     e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShrI16));
     e.vmovaps(i.dest, e.xmm0);
   }
+  static __m128i EmulateVectorShrI32(void*, __m128i src1, __m128i src2) {
+    alignas(16) uint32_t value[4];
+    alignas(16) uint32_t shamt[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
+    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
+    for (size_t i = 0; i < 4; ++i) {
+      value[i] = value[i] >> (shamt[i] & 0x1F);
+    }
+    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
+  }
   static void EmitInt32(X64Emitter& e, const EmitArgType& i) {
     if (i.src2.is_constant) {
       const auto& shamt = i.src2.constant();
@@ -4525,6 +4963,9 @@ EMITTER(VECTOR_SHR_V128, MATCH(I<OPCODE_VECTOR_SHR, V128<>, V128<>, V128<>>)) {
       if (all_same) {
         // Every count is the same, so we can use vpslld.
         e.vpsrld(i.dest, i.src1, shamt.u8[0] & 0x1F);
+      } else if (!e.IsFeatureEnabled(kX64EmitAVX2)) {
+        EmitVectorBinaryOpNative(
+            e, i, reinterpret_cast<void*>(EmulateVectorShrI32));
       } else {
         // Counts differ, so pre-mask and load constant.
         vec128_t masked = i.src2.constant();
@@ -4534,12 +4975,15 @@ EMITTER(VECTOR_SHR_V128, MATCH(I<OPCODE_VECTOR_SHR, V128<>, V128<>, V128<>>)) {
         e.LoadConstantXmm(e.xmm0, masked);
         e.vpsrlvd(i.dest, i.src1, e.xmm0);
       }
-    } else {
+    } else if (e.IsFeatureEnabled(kX64EmitAVX2)) {
       // Fully variable shift.
       // src shift mask may have values >31, and x86 sets to zero when
       // that happens so we mask.
       e.vandps(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPS));
       e.vpsrlvd(i.dest, i.src1, e.xmm0);
+    } else {
+      EmitVectorBinaryOpNative(
+          e, i, reinterpret_cast<void*>(EmulateVectorShrI32));
     }
   }
 };
@@ -4572,6 +5016,16 @@ EMITTER(VECTOR_SHA_V128, MATCH(I<OPCODE_VECTOR_SHA, V128<>, V128<>, V128<>>)) {
     }
     return _mm_load_si128(reinterpret_cast<__m128i*>(value));
   }
+  static __m128i EmulateVectorShaI32(void*, __m128i src1, __m128i src2) {
+    alignas(16) int32_t value[4];
+    alignas(16) int32_t shamt[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
+    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
+    for (size_t i = 0; i < 4; ++i) {
+      value[i] = value[i] >> (shamt[i] & 0x1F);
+    }
+    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
+  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     switch (i.instr->flags) {
     case INT8_TYPE:
@@ -4599,6 +5053,11 @@ EMITTER(VECTOR_SHA_V128, MATCH(I<OPCODE_VECTOR_SHA, V128<>, V128<>, V128<>>)) {
       e.vmovaps(i.dest, e.xmm0);
       break;
     case INT32_TYPE:
+      if (!e.IsFeatureEnabled(kX64EmitAVX2)) {
+        EmitVectorBinaryOpNative(
+            e, i, reinterpret_cast<void*>(EmulateVectorShaI32));
+        break;
+      }
       // src shift mask may have values >31, and x86 sets to zero when
       // that happens so we mask.
       if (i.src2.is_constant) {
@@ -4626,7 +5085,14 @@ EMITTER_OPCODE_TABLE(
 // TODO(benvanik): put dest/src1 together, src2 in cl.
 template <typename SEQ, typename REG, typename ARGS>
 void EmitRotateLeftXX(X64Emitter& e, const ARGS& i) {
-  if (i.src2.is_constant) {
+  if (i.src2.is_constant && !i.src1.is_constant &&
+      i.dest.reg().getBit() >= 32 && e.IsFeatureEnabled(kX64EmitBMI2)) {
+    // rorx doesn't touch the flags and needs no copy to dest.
+    int bits = i.dest.reg().getBit();
+    uint8_t shamt = (bits - (i.src2.constant() & (bits - 1))) & (bits - 1);
+    e.rorx(Reg32e(i.dest.reg().getIdx(), bits),
+           Reg32e(i.src1.reg().getIdx(), bits), shamt);
+  } else if (i.src2.is_constant) {
     // Constant rotate.
     if (i.dest != i.src1) {
       if (i.src1.is_constant) {
@@ -4705,6 +5171,16 @@ EMITTER(VECTOR_ROTATE_LEFT_V128, MATCH(I<OPCODE_VECTOR_ROTATE_LEFT, V128<>, V128
     }
     return _mm_load_si128(reinterpret_cast<__m128i*>(value));
   }
+  static __m128i EmulateVectorRotateLeftI32(void*, __m128i src1, __m128i src2) {
+    alignas(16) uint32_t value[4];
+    alignas(16) uint32_t shamt[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
+    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
+    for (size_t i = 0; i < 4; ++i) {
+      value[i] = poly::rotate_left<uint32_t>(value[i], shamt[i] & 0x1F);
+    }
+    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
+  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     switch (i.instr->flags) {
     case INT8_TYPE:
@@ -4722,6 +5198,13 @@ EMITTER(VECTOR_ROTATE_LEFT_V128, MATCH(I<OPCODE_VECTOR_ROTATE_LEFT, V128<>, V128
       e.vmovaps(i.dest, e.xmm0);
       break;
     case INT32_TYPE: {
+      if (!e.IsFeatureEnabled(kX64EmitAVX2)) {
+        e.lea(e.r8, e.StashXmm(0, i.src1));
+        e.lea(e.r9, e.StashXmm(1, i.src2));
+        e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorRotateLeftI32));
+        e.vmovaps(i.dest, e.xmm0);
+        break;
+      }
       Xmm temp = i.dest;
       if (i.dest == i.src1 || i.dest == i.src2) {
         temp = e.xmm2;
@@ -4867,8 +5350,30 @@ EMITTER_OPCODE_TABLE(
 // ============================================================================
 // OPCODE_CNTLZ
 // ============================================================================
+// Without lzcnt the count is derived from the index of the highest set bit.
+// bsr leaves the dest undefined for zero, which must give bit_count.
+template <typename ARGS>
+void EmitCountLeadingZerosBsr(X64Emitter& e, const ARGS& i, int bit_count) {
+  if (bit_count < 32) {
+    e.movzx(e.eax, i.src1);
+    e.bsr(e.eax, e.eax);
+  } else if (bit_count == 32) {
+    e.bsr(e.eax, i.src1);
+  } else {
+    e.bsr(e.rax, i.src1);
+  }
+  e.mov(e.r8d, -1);
+  e.cmovz(e.eax, e.r8d);
+  // (bit_count - 1) - index, with -1 for zero.
+  e.mov(i.dest, bit_count - 1);
+  e.sub(i.dest, e.al);
+}
 EMITTER(CNTLZ_I8, MATCH(I<OPCODE_CNTLZ, I8<>, I8<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (!e.IsFeatureEnabled(kX64EmitLZCNT)) {
+      EmitCountLeadingZerosBsr(e, i, 8);
+      return;
+    }
     // No 8bit lzcnt, so do 16 and sub 8.
     e.movzx(i.dest.reg().cvt16(), i.src1);
     e.lzcnt(i.dest.reg().cvt16(), i.dest.reg().cvt16());
@@ -4877,16 +5382,28 @@ EMITTER(CNTLZ_I8, MATCH(I<OPCODE_CNTLZ, I8<>, I8<>>)) {
 };
 EMITTER(CNTLZ_I16, MATCH(I<OPCODE_CNTLZ, I8<>, I16<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (!e.IsFeatureEnabled(kX64EmitLZCNT)) {
+      EmitCountLeadingZerosBsr(e, i, 16);
+      return;
+    }
     e.lzcnt(i.dest.reg().cvt32(), i.src1);
   }
 };
 EMITTER(CNTLZ_I32, MATCH(I<OPCODE_CNTLZ, I8<>, I32<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (!e.IsFeatureEnabled(kX64EmitLZCNT)) {
+      EmitCountLeadingZerosBsr(e, i, 32);
+      return;
+    }
     e.lzcnt(i.dest.reg().cvt32(), i.src1);
   }
 };
 EMITTER(CNTLZ_I64, MATCH(I<OPCODE_CNTLZ, I8<>, I64<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (!e.IsFeatureEnabled(kX64EmitLZCNT)) {
+      EmitCountLeadingZerosBsr(e, i, 64);
+      return;
+    }
     e.lzcnt(i.dest.reg().cvt64(), i.src1);
   }
 };
@@ -4993,7 +5510,7 @@ EMITTER(EXTRACT_I32, MATCH(I<OPCODE_EXTRACT, I32<>, V128<>, I8<>>)) {
       e.mov(e.al, i.src2);
       e.and(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
+      e.MovRelocatable(e.rdx, extract_table_32);
       e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
       e.vpshufb(e.xmm0, i.src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
@@ -5011,16 +5528,34 @@ EMITTER_OPCODE_TABLE(
 // ============================================================================
 // OPCODE_SPLAT
 // ============================================================================
+// vpbroadcastb/w need AVX2. Without it the value is spread with shuffles.
+void EmitSplatI8(X64Emitter& e, const Xmm& dest, const Xmm& src) {
+  if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+    e.vpbroadcastb(dest, src);
+  } else {
+    // A zero control selects byte 0 everywhere.
+    e.vpxor(e.xmm1, e.xmm1);
+    e.vpshufb(dest, src, e.xmm1);
+  }
+}
+void EmitSplatI16(X64Emitter& e, const Xmm& dest, const Xmm& src) {
+  if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+    e.vpbroadcastw(dest, src);
+  } else {
+    e.vpshuflw(dest, src, 0);
+    e.vpshufd(dest, dest, 0);
+  }
+}
 EMITTER(SPLAT_I8, MATCH(I<OPCODE_SPLAT, V128<>, I8<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     if (i.src1.is_constant) {
       // TODO(benvanik): faster constant splats.
       e.mov(e.al, i.src1.constant());
       e.vmovd(e.xmm0, e.eax);
-      e.vpbroadcastb(i.dest, e.xmm0);
+      EmitSplatI8(e, i.dest, e.xmm0);
     } else {
       e.vmovd(e.xmm0, i.src1.reg().cvt32());
-      e.vpbroadcastb(i.dest, e.xmm0);
+      EmitSplatI8(e, i.dest, e.xmm0);
     }
   }
 };
@@ -5030,23 +5565,24 @@ EMITTER(SPLAT_I16, MATCH(I<OPCODE_SPLAT, V128<>, I16<>>)) {
       // TODO(benvanik): faster constant splats.
       e.mov(e.ax, i.src1.constant());
       e.vmovd(e.xmm0, e.eax);
-      e.vpbroadcastw(i.dest, e.xmm0);
+      EmitSplatI16(e, i.dest, e.xmm0);
     } else {
       e.vmovd(e.xmm0, i.src1.reg().cvt32());
-      e.vpbroadcastw(i.dest, e.xmm0);
+      EmitSplatI16(e, i.dest, e.xmm0);
     }
   }
 };
 EMITTER(SPLAT_I32, MATCH(I<OPCODE_SPLAT, V128<>, I32<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    // vpshufd is as fast as vpbroadcastd and needs no AVX2.
     if (i.src1.is_constant) {
       // TODO(benvanik): faster constant splats.
       e.mov(e.eax, i.src1.constant());
       e.vmovd(e.xmm0, e.eax);
-      e.vpbroadcastd(i.dest, e.xmm0);
+      e.vpshufd(i.dest, e.xmm0, 0);
     } else {
       e.vmovd(e.xmm0, i.src1);
-      e.vpbroadcastd(i.dest, e.xmm0);
+      e.vpshufd(i.dest, e.xmm0, 0);
     }
   }
 };
@@ -5073,6 +5609,15 @@ EMITTER_OPCODE_TABLE(
 // ============================================================================
 // OPCODE_PERMUTE
 // ============================================================================
+// vpblendd needs AVX2, vblendps does the same in the float domain.
+void EmitBlendI32(X64Emitter& e, const Xmm& dest_src, const Xmm& src,
+                  uint8_t control) {
+  if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+    e.vpblendd(dest_src, src, control);
+  } else {
+    e.vblendps(dest_src, dest_src, src, control);
+  }
+}
 EMITTER(PERMUTE_I32, MATCH(I<OPCODE_PERMUTE, V128<>, I32<>, V128<>, V128<>>)) {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     assert_true(i.instr->flags == INT32_TYPE);
@@ -5107,15 +5652,19 @@ EMITTER(PERMUTE_I32, MATCH(I<OPCODE_PERMUTE, V128<>, I32<>, V128<>, V128<>>)) {
       } else {
         src3 = i.src3;
       }
-      if (i.dest != src3) {
+      if (blend_control == 0) {
+        e.vpshufd(i.dest, src2, src_control);
+      } else if (blend_control == 0xF) {
+        e.vpshufd(i.dest, src3, src_control);
+      } else if (i.dest != src3) {
         e.vpshufd(i.dest, src2, src_control);
         e.vpshufd(e.xmm0, src3, src_control);
-        e.vpblendd(i.dest, e.xmm0, blend_control);
+        EmitBlendI32(e, i.dest, e.xmm0, blend_control);
       } else {
         e.vmovaps(e.xmm0, src3);
         e.vpshufd(i.dest, src2, src_control);
         e.vpshufd(e.xmm0, e.xmm0, src_control);
-        e.vpblendd(i.dest, e.xmm0, blend_control);
+        EmitBlendI32(e, i.dest, e.xmm0, blend_control);
       }
     } else {
       // Permute by non-constant.
@@ -5127,6 +5676,20 @@ EMITTER(PERMUTE_V128, MATCH(I<OPCODE_PERMUTE, V128<>, V128<>, V128<>, V128<>>))
   static void EmitByInt8(X64Emitter& e, const EmitArgType& i) {
     // TODO(benvanik): find out how to do this with only one temp register!
     // Permute bytes between src2 and src3.
+    if (i.src1.is_constant && !i.src2.is_constant &&
+        i.src3.value->IsConstantZero()) {
+      // Bake the whole thing into a single pshufb, with bytes taken from the
+      // zero src3 cleared by the high bit of the mask.
+      vec128_t control = i.src1.constant();
+      vec128_t shuffle;
+      for (size_t n = 0; n < 16; ++n) {
+        uint8_t sel = (control.u8[n] ^ 0x3) & 0x1F;
+        shuffle.u8[n] = sel < 16 ? sel : 0x80;
+      }
+      e.LoadConstantXmm(e.xmm0, shuffle);
+      e.vpshufb(i.dest, i.src2, e.xmm0);
+      return;
+    }
     if (i.src3.value->IsConstantZero()) {
       // Permuting with src2/zero, so just shuffle/mask.
       if (i.src2.value->IsConstantZero()) {
@@ -5154,14 +5717,16 @@ EMITTER(PERMUTE_V128, MATCH(I<OPCODE_PERMUTE, V128<>, V128<>, V128<>, V128<>>))
     } else {
       // General permute.
       // Control mask needs to be shuffled.
-      // TODO(benvanik): do constants here instead of in generated code.
       if (i.src1.is_constant) {
-        e.LoadConstantXmm(e.xmm2, i.src1.constant());
-        e.vxorps(e.xmm2, e.xmm2, e.GetXmmConstPtr(XMMSwapWordMask));
+        vec128_t control = i.src1.constant();
+        for (size_t n = 0; n < 16; ++n) {
+          control.u8[n] = (control.u8[n] ^ 0x3) & 0x1F;
+        }
+        e.LoadConstantXmm(e.xmm2, control);
       } else {
         e.vxorps(e.xmm2, i.src1, e.GetXmmConstPtr(XMMSwapWordMask));
+        e.vpand(e.xmm2, e.GetXmmConstPtr(XMMPermuteByteMask));
       }
-      e.vpand(e.xmm2, e.GetXmmConstPtr(XMMPermuteByteMask));
       Xmm src2_shuf = e.xmm0;
       if (i.src2.value->IsConstantZero()) {
         e.vpxor(src2_shuf, src2_shuf);
@@ -5320,12 +5885,33 @@ EMITTER(PACK, MATCH(I<OPCODE_PACK, V128<>, V128<>, V128<>>)) {
     //     ((src1.uy & 0xFF) << 8) | (src1.uz & 0xFF)
     e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMPackD3DCOLOR));
   }
+  static __m128i EmulateFloatToHalf(void*, __m128 src) {
+    // Not bit exact with vcvtps2ph: this rounds to nearest (not towards
+    // zero) and values too large for a half saturate.
+    alignas(16) float values[4];
+    alignas(16) uint16_t results[8] = {0};
+    _mm_store_ps(values, src);
+    for (size_t i = 0; i < 4; ++i) {
+      results[i] = poly::float_to_half(values[i]);
+    }
+    return _mm_load_si128(reinterpret_cast<__m128i*>(results));
+  }
+  // Converts the 4 floats in src to halves in the low 64 bits of dest.
+  static void EmitFloatToHalf(X64Emitter& e, const Xmm& dest, const Xmm& src) {
+    if (e.IsFeatureEnabled(kX64EmitF16C)) {
+      e.vcvtps2ph(dest, src, B00000011);
+    } else {
+      e.lea(e.r8, e.StashXmm(0, src));
+      e.CallNativeSafe(reinterpret_cast<void*>(EmulateFloatToHalf));
+      e.vmovaps(dest, e.xmm0);
+    }
+  }
   static void EmitFLOAT16_2(X64Emitter& e, const EmitArgType& i) {
     assert_true(i.src2.value->IsConstantZero());
     // http://blogs.msdn.com/b/chuckw/archive/2012/09/11/directxmath-f16c-and-fma.aspx
     // dest = [(src1.x | src1.y), 0, 0, 0]
     // 0|0|0|0|W|Z|Y|X
-    e.vcvtps2ph(i.dest, i.dest, B00000011);
+    EmitFloatToHalf(e, i.dest, i.src1);
     // Shuffle to X|Y|0|0|0|0|0|0
     e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMPackFLOAT16_2));
   }
@@ -5333,7 +5919,7 @@ EMITTER(PACK, MATCH(I<OPCODE_PACK, V128<>, V128<>, V128<>>)) {
     assert_true(i.src2.value->IsConstantZero());
     // dest = [(src1.x | src1.y), (src1.z | src1.w), 0, 0]
     // 0|0|0|0|W|Z|Y|X
-    e.vcvtps2ph(i.dest, i.src1, B00000011);
+    EmitFloatToHalf(e, i.dest, i.src1);
     // Shuffle to X|Y|Z|W|0|0|0|0
     e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMPackFLOAT16_4));
   }
@@ -5509,6 +6095,25 @@ EMITTER(UNPACK, MATCH(I<OPCODE_UNPACK, V128<>, V128<>>)) {
     // Add 1.0f to each.
     e.vpor(i.dest, e.GetXmmConstPtr(XMMOne));
   }
+  static __m128 EmulateHalfToFloat(void*, __m128i src) {
+    alignas(16) uint16_t values[8];
+    alignas(16) float results[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(values), src);
+    for (size_t i = 0; i < 4; ++i) {
+      results[i] = poly::half_to_float(values[i]);
+    }
+    return _mm_load_ps(results);
+  }
+  // Converts the 4 halves in the low 64 bits of src to floats in dest.
+  static void EmitHalfToFloat(X64Emitter& e, const Xmm& dest, const Xmm& src) {
+    if (e.IsFeatureEnabled(kX64EmitF16C)) {
+      e.vcvtph2ps(dest, src);
+    } else {
+      e.lea(e.r8, e.StashXmm(0, src));
+      e.CallNativeSafe(reinterpret_cast<void*>(EmulateHalfToFloat));
+      e.vmovaps(dest, e.xmm0);
+    }
+  }
   static void EmitFLOAT16_2(X64Emitter& e, const EmitArgType& i) {
     // 1 bit sign, 5 bit exponent, 10 bit mantissa
     // D3D10 half float format
@@ -5528,7 +6133,7 @@ EMITTER(UNPACK, MATCH(I<OPCODE_UNPACK, V128<>, V128<>>)) {
     //          1.0 };
     // Shuffle to 0|0|0|0|0|0|Y|X
     e.vpshufb(i.dest, i.src1, e.GetXmmConstPtr(XMMUnpackFLOAT16_2));
-    e.vcvtph2ps(i.dest, i.dest);
+    EmitHalfToFloat(e, i.dest, i.dest);
     e.vpshufd(i.dest, i.dest, B10100100);
     e.vpor(i.dest, e.GetXmmConstPtr(XMM0001));
   }
@@ -5536,7 +6141,7 @@ EMITTER(UNPACK, MATCH(I<OPCODE_UNPACK, V128<>, V128<>>)) {
     // src = [(dest.x | dest.y), (dest.z | dest.w), 0, 0]
     // Shuffle to 0|0|0|0|W|Z|Y|X
     e.vpshufb(i.dest, i.src1, e.GetXmmConstPtr(XMMUnpackFLOAT16_4));
-    e.vcvtph2ps(i.dest, i.dest);
+    EmitHalfToFloat(e, i.dest, i.dest);
   }
   static void EmitSHORT_2(X64Emitter& e, const EmitArgType& i) {
     // (VD.x) = 3.0 + (VB.x>>16)*2^-22
@@ -5768,6 +6373,7 @@ void RegisterSequences() {
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_BRANCH);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_BRANCH_TRUE);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_BRANCH_FALSE);
+  REGISTER_EMITTER_OPCODE_TABLE(OPCODE_BRANCH_TABLE);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_ASSIGN);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_CAST);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_ZERO_EXTEND);
@@ -5787,6 +6393,7 @@ void RegisterSequences() {
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_LOAD);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_STORE);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_PREFETCH);
+  REGISTER_EMITTER_OPCODE_TABLE(OPCODE_MEMORY_BARRIER);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_MAX);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_VECTOR_MAX);
   REGISTER_EMITTER_OPCODE_TABLE(OPCODE_MIN);
@@ -55,6 +55,11 @@ HostToGuestThunk X64ThunkEmitter::EmitHostToGuestThunk() {
   movaps(ptr[rsp + 256], xmm14);
   movaps(ptr[rsp + 272], xmm15);*/
 
+  // Generated code only uses VEX encodings and never dirties the upper YMM
+  // state. Clear whatever the host left so that legacy SSE host code called
+  // back from the guest doesn't pay the SSE/AVX transition penalty.
+  vzeroupper();
+
   mov(rax, rcx);
   mov(rcx, rdx);
   mov(rdx, r8);
@@ -91,7 +96,7 @@ HostToGuestThunk X64ThunkEmitter::EmitHostToGuestThunk() {
   return (HostToGuestThunk)fn;
 }
 
-GuestToHostThunk X64ThunkEmitter::EmitGuestToHostThunk() {
+GuestToHostThunk X64ThunkEmitter::EmitGuestToHostThunk(void* quiesce_fn) {
   // rcx = context
   // rdx = target function
   // r8  = arg0
@@ -115,10 +120,25 @@ GuestToHostThunk X64ThunkEmitter::EmitGuestToHostThunk() {
 
   // TODO(benvanik): save things? XMM0-5?
 
-  mov(rax, rdx);
-  mov(rdx, r8);
-  mov(r8, r9);
-  mov(r9, r10);
+  // Host code may be built without VEX encodings; make sure it starts with
+  // clean upper YMM state. The low 128 bits of all registers are preserved.
+  vzeroupper();
+
+  // The arguments wait in callee-saved registers (saved above) while the
+  // runtime gets a chance to see what's on the guest stack.
+  mov(rbx, rdx);
+  mov(r12, r8);
+  mov(r13, r9);
+  mov(r14, r10);
+  lea(rdx, qword[rsp + stack_size]);
+  mov(rax, reinterpret_cast<uint64_t>(quiesce_fn));
+  call(rax);
+  mov(rcx, qword[rsp + 56]);
+
+  mov(rax, rbx);
+  mov(rdx, r12);
+  mov(r8, r13);
+  mov(r9, r14);
   call(rax);
 
   mov(rbx, qword[rsp + 48]);
@@ -140,6 +160,32 @@ GuestToHostThunk X64ThunkEmitter::EmitGuestToHostThunk() {
   return (HostToGuestThunk)fn;
 }
 
+void* X64ThunkEmitter::EmitResolveThunk(void* resolve_fn) {
+  // rax = arg1
+  // rcx = context
+  // rdx = guest return address
+  // r8 = arg2
+
+  // Just enough for the callee home space while keeping 16b alignment.
+  const size_t stack_size = 40;
+  // rsp + 0 = return address
+  mov(qword[rsp + 8 * 2], rdx);
+  mov(qword[rsp + 8 * 1], rcx);
+  sub(rsp, stack_size);
+
+  mov(rdx, rax);
+  mov(rax, reinterpret_cast<uint64_t>(resolve_fn));
+  call(rax);
+
+  add(rsp, stack_size);
+  mov(rcx, qword[rsp + 8 * 1]);
+  mov(rdx, qword[rsp + 8 * 2]);
+  // Tail into the new code as if it had been called directly.
+  jmp(rax);
+
+  return Emplace(stack_size);
+}
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace alloy
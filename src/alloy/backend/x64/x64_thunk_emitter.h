@@ -130,8 +130,16 @@ class X64ThunkEmitter : public X64Emitter {
   // Call a generated function, saving all stack parameters.
   HostToGuestThunk EmitHostToGuestThunk();
 
-  // Function that guest code can call to transition into host code.
-  GuestToHostThunk EmitGuestToHostThunk();
+  // Function that guest code can call to transition into host code. Calls
+  // quiesce_fn(context, slot) first, slot being where the return address
+  // into guest code is.
+  GuestToHostThunk EmitGuestToHostThunk(void* quiesce_fn);
+
+  // Entered in place of a guest function that has to be looked up first
+  // (invalidated code, unlinked direct calls). Calls
+  // resolve_fn(context, rax, r8) and jumps to the code it returns as if that
+  // had been called directly.
+  void* EmitResolveThunk(void* resolve_fn);
 };
 
 }  // namespace x64
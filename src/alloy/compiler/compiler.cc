@@ -9,7 +9,12 @@
 
 #include "alloy/compiler/compiler.h"
 
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
 #include "alloy/compiler/compiler_pass.h"
+#include "poly/poly.h"
 #include "xenia/profiling.h"
 
 namespace alloy {
@@ -18,32 +23,146 @@ namespace compiler {
 using alloy::hir::HIRBuilder;
 using alloy::runtime::Runtime;
 
-Compiler::Compiler(Runtime* runtime) : runtime_(runtime) {}
+namespace {
+// Pass stats of all destroyed compilers, merged by pass name.
+std::mutex total_pass_stats_lock_;
+std::vector<Compiler::PassStats> total_pass_stats_;
+}  // namespace
+
+Compiler::Compiler(Runtime* runtime)
+    : runtime_(runtime), in_pass_group_(false) {
+  stats_ = Stats();
+}
+
+Compiler::~Compiler() {
+  Reset();
 
-Compiler::~Compiler() { Reset(); }
+  std::lock_guard<std::mutex> guard(total_pass_stats_lock_);
+  for (auto& pass_stats : pass_stats_) {
+    if (!pass_stats.run_count) {
+      continue;
+    }
+    auto it = std::find_if(total_pass_stats_.begin(), total_pass_stats_.end(),
+                           [&](const PassStats& total) {
+      return std::strcmp(total.name, pass_stats.name) == 0;
+    });
+    if (it == total_pass_stats_.end()) {
+      total_pass_stats_.push_back(pass_stats);
+      continue;
+    }
+    it->run_count += pass_stats.run_count;
+    it->changed_count += pass_stats.changed_count;
+    it->ticks += pass_stats.ticks;
+    it->instr_delta += pass_stats.instr_delta;
+  }
+}
 
 void Compiler::AddPass(std::unique_ptr<CompilerPass> pass) {
   pass->Initialize(this);
+  PassStats pass_stats = {0};
+  pass_stats.name = pass->name();
+  pass_stats_.push_back(pass_stats);
+  if (in_pass_group_) {
+    ++stages_.back().pass_count;
+  } else {
+    stages_.push_back({passes_.size(), 1, 1});
+  }
   passes_.push_back(std::move(pass));
 }
 
+void Compiler::BeginPassGroup(size_t max_iterations) {
+  assert_false(in_pass_group_);
+  stages_.push_back({passes_.size(), 0, max_iterations});
+  in_pass_group_ = true;
+}
+
+void Compiler::EndPassGroup() {
+  assert_true(in_pass_group_);
+  in_pass_group_ = false;
+}
+
 void Compiler::Reset() {}
 
 int Compiler::Compile(HIRBuilder* builder) {
   SCOPE_profile_cpu_f("alloy");
 
-  // TODO(benvanik): sophisticated stuff. Run passes in parallel, run until they
-  //                 stop changing things, etc.
-  for (size_t i = 0; i < passes_.size(); ++i) {
-    auto& pass = passes_[i];
-    scratch_arena_.Reset();
-    if (pass->Run(builder)) {
-      return 1;
+  stats_ = Stats();
+  size_t instr_count = CountInstrs(builder);
+  stats_.instr_count_in = instr_count;
+
+  // TODO(benvanik): run passes in parallel.
+  for (auto& stage : stages_) {
+    for (size_t iteration = 0; iteration < stage.max_iterations; ++iteration) {
+      bool changed = false;
+      for (size_t n = 0; n < stage.pass_count; ++n) {
+        size_t index = stage.first_pass + n;
+        if (RunPass(index, builder, &instr_count)) {
+          return 1;
+        }
+        changed |= passes_[index]->changed();
+      }
+      if (!changed) {
+        break;
+      }
     }
   }
 
+  stats_.instr_count_out = instr_count;
+  COUNT_profile_cpu("HIR instrs in", stats_.instr_count_in);
+  COUNT_profile_cpu("HIR instrs out", stats_.instr_count_out);
+  COUNT_profile_cpu("Pass runs", stats_.pass_run_count);
+
   return 0;
 }
 
+int Compiler::RunPass(size_t index, HIRBuilder* builder, size_t* instr_count) {
+  auto& pass = passes_[index];
+  scratch_arena_.Reset();
+  pass->changed_ = false;
+
+  uint64_t start_ticks = poly::threading::ticks();
+  if (pass->Run(builder)) {
+    return 1;
+  }
+  uint64_t end_ticks = poly::threading::ticks();
+
+  // Counting here (and not inside the timed region) keeps the walk out of the
+  // per-pass times.
+  size_t new_instr_count = CountInstrs(builder);
+  auto& pass_stats = pass_stats_[index];
+  ++pass_stats.run_count;
+  if (pass->changed()) {
+    ++pass_stats.changed_count;
+  }
+  pass_stats.ticks += end_ticks - start_ticks;
+  pass_stats.instr_delta += static_cast<int64_t>(new_instr_count) -
+                            static_cast<int64_t>(*instr_count);
+  *instr_count = new_instr_count;
+  ++stats_.pass_run_count;
+  return 0;
+}
+
+void Compiler::LogTotalPassStats() {
+  std::lock_guard<std::mutex> guard(total_pass_stats_lock_);
+  double ticks_per_ms = poly::threading::ticks_per_second() / 1000.0;
+  PLOGI("%-26s %10s %10s %12s %12s", "pass", "runs", "changed", "time (ms)",
+        "instrs");
+  for (auto& total : total_pass_stats_) {
+    PLOGI("%-26s %10zu %10zu %12.2f %12lld", total.name, total.run_count,
+          total.changed_count, total.ticks / ticks_per_ms,
+          static_cast<long long>(total.instr_delta));
+  }
+}
+
+size_t Compiler::CountInstrs(HIRBuilder* builder) {
+  size_t count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      ++count;
+    }
+  }
+  return count;
+}
+
 }  // namespace compiler
 }  // namespace alloy
@@ -28,23 +28,78 @@ class CompilerPass;
 
 class Compiler {
  public:
+  // Counters for the last Compile call.
+  struct Stats {
+    size_t instr_count_in;
+    size_t instr_count_out;
+    // Redundant instructions replaced by ValueNumberingPass.
+    size_t value_numbering_removed_count;
+    // BYTE_SWAPs seen by ByteSwapEliminationPass, how many of those it
+    // removed and how many loads/stores it fused a swap into.
+    size_t byte_swap_count;
+    size_t byte_swap_removed_count;
+    size_t byte_swap_fused_count;
+    // Loads MemoryRedundancyEliminationPass replaced with a value stored to
+    // the same address and with one loaded from it before.
+    size_t memory_forwarded_count;
+    size_t memory_reused_count;
+    // Includes reruns of pass groups.
+    size_t pass_run_count;
+  };
+
+  // Totals for one pass over every Compile call.
+  struct PassStats {
+    const char* name;
+    size_t run_count;
+    // Runs that reported modifying the HIR.
+    size_t changed_count;
+    uint64_t ticks;
+    // Net change in instruction count; negative when removing code.
+    int64_t instr_delta;
+  };
+
   Compiler(runtime::Runtime* runtime);
   ~Compiler();
 
   runtime::Runtime* runtime() const { return runtime_; }
   Arena* scratch_arena() { return &scratch_arena_; }
+  const Stats& stats() const { return stats_; }
+  Stats* mutable_stats() { return &stats_; }
+  const std::vector<PassStats>& pass_stats() const { return pass_stats_; }
 
   void AddPass(std::unique_ptr<CompilerPass> pass);
+  // Passes added until EndPassGroup are run in order, over and over, until
+  // none of them reports a change or max_iterations is reached.
+  void BeginPassGroup(size_t max_iterations);
+  void EndPassGroup();
 
   void Reset();
 
   int Compile(hir::HIRBuilder* builder);
 
+  // Logs pass_stats summed over every Compiler destroyed so far.
+  static void LogTotalPassStats();
+
+ private:
+  // A single pass or a pass group.
+  struct Stage {
+    size_t first_pass;
+    size_t pass_count;
+    size_t max_iterations;
+  };
+
+  int RunPass(size_t index, hir::HIRBuilder* builder, size_t* instr_count);
+  static size_t CountInstrs(hir::HIRBuilder* builder);
+
  private:
   runtime::Runtime* runtime_;
   Arena scratch_arena_;
+  Stats stats_;
 
   std::vector<std::unique_ptr<CompilerPass>> passes_;
+  std::vector<PassStats> pass_stats_;
+  std::vector<Stage> stages_;
+  bool in_pass_group_;
 };
 
 }  // namespace compiler
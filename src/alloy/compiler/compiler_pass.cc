@@ -14,7 +14,8 @@
 namespace alloy {
 namespace compiler {
 
-CompilerPass::CompilerPass() : runtime_(0), compiler_(0) {}
+CompilerPass::CompilerPass(const char* name)
+    : runtime_(0), compiler_(0), name_(name), changed_(false) {}
 
 CompilerPass::~CompilerPass() = default;
 
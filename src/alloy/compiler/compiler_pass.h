@@ -25,19 +25,32 @@ class Compiler;
 
 class CompilerPass {
  public:
-  CompilerPass();
+  CompilerPass(const char* name);
   virtual ~CompilerPass();
 
+  const char* name() const { return name_; }
+  // Whether the last Run reported modifying the HIR.
+  bool changed() const { return changed_; }
+
   virtual int Initialize(Compiler* compiler);
 
   virtual int Run(hir::HIRBuilder* builder) = 0;
 
  protected:
   Arena* scratch_arena() const;
+  // Passes that can tell call this when they modify the HIR so that pass
+  // groups know to run again. Passes that never do are treated as leaving
+  // the HIR as it was.
+  void set_changed() { changed_ = true; }
 
  protected:
   runtime::Runtime* runtime_;
   Compiler* compiler_;
+
+ private:
+  friend class Compiler;
+  const char* name_;
+  bool changed_;
 };
 
 }  // namespace compiler
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/compiler/compiler_pipelines.h"
+
+#include "alloy/compiler/compiler_passes.h"
+
+namespace alloy {
+namespace compiler {
+
+using alloy::backend::MachineInfo;
+
+namespace {
+
+// Cap on runs of the simplification group. Later iterations rarely find
+// anything and this bounds compile time on pathological functions.
+const size_t kMaxPassGroupIterations = 4;
+
+}  // namespace
+
+void AddOptimizingPasses(
+    Compiler* compiler, const MachineInfo* machine_info, bool validate,
+    const passes::RegisterAllocationPass::Options& allocation_options) {
+  // Merge blocks early. This will let us use more context in other passes.
+  // The CFG is required for simplification and dirtied by it.
+  compiler->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler->AddPass(std::make_unique<passes::ControlFlowSimplificationPass>());
+  compiler->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+
+  // Passes are executed in the order they are added. Multiple of the same
+  // pass type may be used.
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::ContextPromotionPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  // Each of these exposes more work for the others, so rerun them until they
+  // stop finding any.
+  compiler->BeginPassGroup(kMaxPassGroupIterations);
+  compiler->AddPass(std::make_unique<passes::SimplificationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::ConstantPropagationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::SimplificationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::ValueNumberingPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->EndPassGroup();
+  // Runs once the addresses have been simplified by the group. Forwarded
+  // stores often leave swaps of swaps behind for the pass below.
+  compiler->AddPass(
+      std::make_unique<passes::MemoryRedundancyEliminationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  // Swaps are easiest to see through once the group has cleaned up around
+  // them. This leaves dead code for the DCE pass below.
+  compiler->AddPass(std::make_unique<passes::ByteSwapEliminationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  // Constant propagation may have removed branches, so refresh the CFG.
+  compiler->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler->AddPass(std::make_unique<passes::LoopInvariantCodeMotionPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+
+  //// Removes all unneeded variables. Try not to add new ones after this.
+  // compiler->AddPass(new passes::ValueReductionPass());
+  // if (validate) compiler->AddPass(new passes::ValidationPass());
+
+  // Lets the backend skip zero extending addresses.
+  compiler->AddPass(std::make_unique<passes::AddressNarrowingPass>());
+
+  // Register allocation for the target backend.
+  // Will modify the HIR to add loads/stores.
+  // This should be the last pass before finalization, as after this all
+  // registers are assigned and ready to be emitted.
+  compiler->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      machine_info, allocation_options));
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+
+  // Must come last. The HIR is not really HIR after this.
+  compiler->AddPass(std::make_unique<passes::FinalizationPass>());
+}
+
+void AddBaselinePasses(Compiler* compiler, const MachineInfo* machine_info,
+                       bool validate) {
+  // Constant folding is required as sequences don't handle all-constant
+  // operands. A cheap DCE pass keeps register pressure down, and address
+  // narrowing is about as cheap and saves an instruction per access.
+  compiler->AddPass(std::make_unique<passes::ConstantPropagationPass>());
+  compiler->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::AddressNarrowingPass>());
+  compiler->AddPass(
+      std::make_unique<passes::RegisterAllocationPass>(machine_info));
+  compiler->AddPass(std::make_unique<passes::FinalizationPass>());
+}
+
+}  // namespace compiler
+}  // namespace alloy
@@ -0,0 +1,39 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_COMPILER_COMPILER_PIPELINES_H_
+#define ALLOY_COMPILER_COMPILER_PIPELINES_H_
+
+#include "alloy/backend/machine_info.h"
+#include "alloy/compiler/compiler.h"
+#include "alloy/compiler/passes/register_allocation_pass.h"
+
+namespace alloy {
+namespace compiler {
+
+// Adds the passes of optimized (FUNCTION_TIER_OPTIMIZED) code, in order.
+// Shared by the translator, TestModule and the benchmarks so that they all
+// measure and test what ships. With validate the HIR is checked after each
+// pass that may break it.
+void AddOptimizingPasses(
+    Compiler* compiler, const backend::MachineInfo* machine_info,
+    bool validate,
+    const passes::RegisterAllocationPass::Options& allocation_options =
+        passes::RegisterAllocationPass::Options());
+
+// Adds the passes of baseline (FUNCTION_TIER_BASELINE) code: only what the
+// backend needs to generate correct code, plus the cheapest wins.
+void AddBaselinePasses(Compiler* compiler,
+                       const backend::MachineInfo* machine_info,
+                       bool validate);
+
+}  // namespace compiler
+}  // namespace alloy
+
+#endif  // ALLOY_COMPILER_COMPILER_PIPELINES_H_
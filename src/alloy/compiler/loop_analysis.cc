@@ -0,0 +1,240 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/compiler/loop_analysis.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "xenia/profiling.h"
+
+namespace alloy {
+namespace compiler {
+
+using alloy::hir::Block;
+using alloy::hir::Edge;
+using alloy::hir::HIRBuilder;
+
+namespace {
+const size_t kNone = static_cast<size_t>(-1);
+}  // namespace
+
+LoopAnalysis::LoopAnalysis() = default;
+
+LoopAnalysis::~LoopAnalysis() = default;
+
+int LoopAnalysis::Analyze(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("alloy");
+
+  blocks_.clear();
+  order_.clear();
+  loops_.clear();
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = static_cast<uint16_t>(blocks_.size());
+    blocks_.push_back(block);
+  }
+  size_t count = blocks_.size();
+  postorder_.assign(count, kNone);
+  idoms_.assign(count, kNone);
+  block_loops_.assign(count, nullptr);
+  if (!count) {
+    return 0;
+  }
+
+  // Number blocks in postorder with an iterative DFS from the entry block.
+  std::vector<bool> visited(count, false);
+  std::vector<std::pair<size_t, Edge*>> stack;
+  visited[0] = true;
+  stack.emplace_back(0, blocks_[0]->outgoing_edge_head);
+  while (!stack.empty()) {
+    auto edge = stack.back().second;
+    if (edge) {
+      stack.back().second = edge->outgoing_next;
+      size_t n = edge->dest->ordinal;
+      if (!visited[n]) {
+        visited[n] = true;
+        stack.emplace_back(n, blocks_[n]->outgoing_edge_head);
+      }
+    } else {
+      size_t n = stack.back().first;
+      postorder_[n] = order_.size();
+      order_.push_back(n);
+      stack.pop_back();
+    }
+  }
+
+  // Cooper, Harvey & Kennedy, "A Simple, Fast Dominance Algorithm".
+  // Iterate in reverse postorder until the dominators stop changing.
+  idoms_[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto it = order_.rbegin(); it != order_.rend(); ++it) {
+      size_t n = *it;
+      if (n == 0) {
+        continue;
+      }
+      size_t new_idom = kNone;
+      for (auto edge = blocks_[n]->incoming_edge_head; edge;
+           edge = edge->incoming_next) {
+        size_t p = edge->src->ordinal;
+        if (idoms_[p] == kNone) {
+          // Unreachable or not yet processed.
+          continue;
+        }
+        new_idom = new_idom == kNone ? p : Intersect(p, new_idom);
+      }
+      if (idoms_[n] != new_idom) {
+        idoms_[n] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  FindLoops();
+  return 0;
+}
+
+size_t LoopAnalysis::Intersect(size_t a, size_t b) const {
+  while (a != b) {
+    while (postorder_[a] < postorder_[b]) {
+      a = idoms_[a];
+    }
+    while (postorder_[b] < postorder_[a]) {
+      b = idoms_[b];
+    }
+  }
+  return a;
+}
+
+void LoopAnalysis::FindLoops() {
+  size_t count = blocks_.size();
+  std::vector<bool> in_loop(count);
+  std::vector<size_t> worklist;
+  for (auto it = order_.rbegin(); it != order_.rend(); ++it) {
+    size_t n = *it;
+    Block* header = blocks_[n];
+
+    // Any edge from a block the header dominates is a back edge. All back
+    // edges to the same header form a single loop.
+    worklist.clear();
+    for (auto edge = header->incoming_edge_head; edge;
+         edge = edge->incoming_next) {
+      if (Dominates(header, edge->src)) {
+        worklist.push_back(edge->src->ordinal);
+      }
+    }
+    if (worklist.empty()) {
+      continue;
+    }
+
+    auto loop = std::make_unique<Loop>();
+    loop->header = header;
+    loop->parent = nullptr;
+    loop->depth = 1;
+    loop->is_innermost = true;
+    loop->blocks.push_back(header);
+
+    // The body is everything that reaches a back edge without passing
+    // through the header.
+    std::fill(in_loop.begin(), in_loop.end(), false);
+    in_loop[n] = true;
+    while (!worklist.empty()) {
+      size_t m = worklist.back();
+      worklist.pop_back();
+      if (in_loop[m]) {
+        continue;
+      }
+      in_loop[m] = true;
+      loop->blocks.push_back(blocks_[m]);
+      for (auto edge = blocks_[m]->incoming_edge_head; edge;
+           edge = edge->incoming_next) {
+        size_t p = edge->src->ordinal;
+        if (!in_loop[p] && postorder_[p] != kNone) {
+          worklist.push_back(p);
+        }
+      }
+    }
+    loops_.push_back(std::move(loop));
+  }
+
+  // Natural loops with distinct headers are either disjoint or nested, so
+  // walking them largest first finds each loop's parent as the innermost loop
+  // already covering its header.
+  std::stable_sort(loops_.begin(), loops_.end(),
+                   [](const std::unique_ptr<Loop>& a,
+                      const std::unique_ptr<Loop>& b) {
+    return a->blocks.size() > b->blocks.size();
+  });
+  for (auto& loop : loops_) {
+    loop->parent = block_loops_[loop->header->ordinal];
+    if (loop->parent) {
+      loop->depth = loop->parent->depth + 1;
+      loop->parent->is_innermost = false;
+    }
+    for (auto block : loop->blocks) {
+      block_loops_[block->ordinal] = loop.get();
+    }
+  }
+}
+
+size_t LoopAnalysis::IndexOf(Block* block) const {
+  size_t n = block->ordinal;
+  if (n < blocks_.size() && blocks_[n] == block) {
+    return n;
+  }
+  // Added after the analysis ran.
+  return kNone;
+}
+
+bool LoopAnalysis::IsReachable(Block* block) const {
+  size_t n = IndexOf(block);
+  return n != kNone && postorder_[n] != kNone;
+}
+
+Block* LoopAnalysis::immediate_dominator(Block* block) const {
+  size_t n = IndexOf(block);
+  if (n == kNone || n == 0 || idoms_[n] == kNone) {
+    return nullptr;
+  }
+  return blocks_[idoms_[n]];
+}
+
+bool LoopAnalysis::Dominates(Block* a, Block* b) const {
+  size_t na = IndexOf(a);
+  size_t nb = IndexOf(b);
+  if (na == kNone || nb == kNone || idoms_[na] == kNone ||
+      idoms_[nb] == kNone) {
+    return false;
+  }
+  while (nb != na) {
+    if (nb == 0) {
+      return false;
+    }
+    nb = idoms_[nb];
+  }
+  return true;
+}
+
+LoopAnalysis::Loop* LoopAnalysis::GetLoop(Block* block) const {
+  size_t n = IndexOf(block);
+  return n == kNone ? nullptr : block_loops_[n];
+}
+
+bool LoopAnalysis::Contains(const Loop* loop, Block* block) const {
+  for (auto l = GetLoop(block); l; l = l->parent) {
+    if (l == loop) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace compiler
+}  // namespace alloy
@@ -0,0 +1,77 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_COMPILER_LOOP_ANALYSIS_H_
+#define ALLOY_COMPILER_LOOP_ANALYSIS_H_
+
+#include <memory>
+#include <vector>
+
+#include "alloy/hir/hir_builder.h"
+
+namespace alloy {
+namespace compiler {
+
+// Dominator tree and natural loops of a function.
+// Built from the block edges, so ControlFlowAnalysisPass must have been run
+// (and re-run after anything that changes branches). Block ordinals are
+// overwritten. Results are invalidated by any change to the CFG.
+class LoopAnalysis {
+ public:
+  struct Loop {
+    hir::Block* header;
+    // Every block in the loop, header first. Includes nested loop blocks.
+    std::vector<hir::Block*> blocks;
+    // Innermost enclosing loop, if any.
+    Loop* parent;
+    // 1 for outermost loops.
+    uint32_t depth;
+    bool is_innermost;
+  };
+
+  LoopAnalysis();
+  ~LoopAnalysis();
+
+  // All loops, outermost first.
+  const std::vector<std::unique_ptr<Loop>>& loops() const { return loops_; }
+
+  int Analyze(hir::HIRBuilder* builder);
+
+  bool IsReachable(hir::Block* block) const;
+  // nullptr for the entry block and unreachable blocks.
+  hir::Block* immediate_dominator(hir::Block* block) const;
+  bool Dominates(hir::Block* a, hir::Block* b) const;
+
+  // Innermost loop containing the block, if any.
+  Loop* GetLoop(hir::Block* block) const;
+  bool Contains(const Loop* loop, hir::Block* block) const;
+
+ private:
+  size_t IndexOf(hir::Block* block) const;
+  size_t Intersect(size_t a, size_t b) const;
+  void FindLoops();
+
+ private:
+  // Blocks by ordinal.
+  std::vector<hir::Block*> blocks_;
+  // Postorder number of each block, kNone if unreachable.
+  std::vector<size_t> postorder_;
+  // Reachable blocks in postorder.
+  std::vector<size_t> order_;
+  // Ordinal of the immediate dominator of each block. The entry block is its
+  // own dominator.
+  std::vector<size_t> idoms_;
+  std::vector<Loop*> block_loops_;
+  std::vector<std::unique_ptr<Loop>> loops_;
+};
+
+}  // namespace compiler
+}  // namespace alloy
+
+#endif  // ALLOY_COMPILER_LOOP_ANALYSIS_H_
@@ -0,0 +1,109 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/compiler/memory_alias_analysis.h"
+
+namespace alloy {
+namespace compiler {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace alloy::hir;
+
+using alloy::frontend::ContextInfo;
+using alloy::hir::Value;
+
+namespace {
+
+// Bounds how far GetAddress follows chains of adds.
+const size_t kMaxAddressDepth = 8;
+
+}  // namespace
+
+MemoryAliasAnalysis::MemoryAliasAnalysis()
+    : has_stack_pointer_(false), stack_pointer_offset_(0) {}
+
+void MemoryAliasAnalysis::Initialize(ContextInfo* context_info) {
+  has_stack_pointer_ = context_info->has_stack_pointer();
+  stack_pointer_offset_ = context_info->stack_pointer_offset();
+}
+
+MemoryAliasAnalysis::Address MemoryAliasAnalysis::GetAddress(
+    Value* address) const {
+  // Peel constant adds off of the address, so that
+  //   v1 = add v0, 8
+  //   v2 = add v1, 4
+  // is seen as v0 + 12.
+  uint32_t offset = 0;
+  for (size_t depth = 0; depth < kMaxAddressDepth; ++depth) {
+    if (address->IsConstant()) {
+      return {nullptr, offset + static_cast<uint32_t>(address->AsUint64())};
+    }
+    auto def = address->def;
+    if (!def) {
+      break;
+    }
+    if (def->opcode == &OPCODE_ASSIGN_info) {
+      address = def->src1.value;
+    } else if (def->opcode == &OPCODE_ADD_info &&
+               def->src2.value->IsConstant()) {
+      offset += static_cast<uint32_t>(def->src2.value->AsUint64());
+      address = def->src1.value;
+    } else if (def->opcode == &OPCODE_ADD_info &&
+               def->src1.value->IsConstant()) {
+      offset += static_cast<uint32_t>(def->src1.value->AsUint64());
+      address = def->src2.value;
+    } else if (def->opcode == &OPCODE_SUB_info &&
+               def->src2.value->IsConstant()) {
+      offset -= static_cast<uint32_t>(def->src2.value->AsUint64());
+      address = def->src1.value;
+    } else {
+      break;
+    }
+  }
+  return {address, offset};
+}
+
+bool MemoryAliasAnalysis::IsStackBase(Value* base) const {
+  // Anything else written to the stack pointer in the block shows up as an
+  // add to this, or as an unknown base.
+  if (!base || !has_stack_pointer_) {
+    return false;
+  }
+  auto def = base->def;
+  return def && def->opcode == &OPCODE_LOAD_CONTEXT_info &&
+         def->src1.offset == stack_pointer_offset_;
+}
+
+bool MemoryAliasAnalysis::IsPlainMemory(const Address& address) const {
+  if (address.base) {
+    return IsStackBase(address.base);
+  }
+  // Constant addresses are mostly the data sections of the image, but are
+  // also how MMIO, GPU writeback and physical memory are usually reached.
+  uint32_t offset = address.offset;
+  return !((offset >= 0x7F000000 && offset < 0x80000000) ||
+           offset >= 0xA0000000);
+}
+
+bool MemoryAliasAnalysis::MayAlias(const Address& a, size_t a_size,
+                                   const Address& b, size_t b_size) const {
+  if (a.base == b.base) {
+    // Same base (or both constant): overlap if either starts within the
+    // other. Distances wrap, so this works across the 4GB boundary too.
+    return b.offset - a.offset < a_size || a.offset - b.offset < b_size;
+  }
+  // The stack is assumed to never be reached through an absolute address.
+  if ((!a.base && IsStackBase(b.base)) || (!b.base && IsStackBase(a.base))) {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace compiler
+}  // namespace alloy
@@ -0,0 +1,60 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_COMPILER_MEMORY_ALIAS_ANALYSIS_H_
+#define ALLOY_COMPILER_MEMORY_ALIAS_ANALYSIS_H_
+
+#include <cstdint>
+
+#include "alloy/frontend/context_info.h"
+#include "alloy/hir/hir_builder.h"
+
+namespace alloy {
+namespace compiler {
+
+// Answers which guest memory accesses may touch the same bytes, and which
+// addresses hold memory only this thread's code changes between barriers.
+// Shared by the passes that forward or remove loads and stores.
+class MemoryAliasAnalysis {
+ public:
+  // base + offset, with a null base for constant addresses. Offsets wrap at
+  // 32 bits like guest addresses do.
+  struct Address {
+    hir::Value* base;
+    uint32_t offset;
+  };
+
+  MemoryAliasAnalysis();
+
+  void Initialize(frontend::ContextInfo* context_info);
+
+  // Splits an address into a base and the constant adds on top of it.
+  Address GetAddress(hir::Value* address) const;
+
+  // Whether the base is the stack pointer as loaded on block entry.
+  bool IsStackBase(hir::Value* base) const;
+
+  // Whether the address is known to be plain memory: a stack slot, or a
+  // constant address outside of MMIO, GPU writeback and physical memory.
+  // Any other pointer may well be a device register, where every access
+  // counts and values may change under us.
+  bool IsPlainMemory(const Address& address) const;
+
+  bool MayAlias(const Address& a, size_t a_size, const Address& b,
+                size_t b_size) const;
+
+ private:
+  bool has_stack_pointer_;
+  uintptr_t stack_pointer_offset_;
+};
+
+}  // namespace compiler
+}  // namespace alloy
+
+#endif  // ALLOY_COMPILER_MEMORY_ALIAS_ANALYSIS_H_
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/compiler/passes/address_narrowing_pass.h"
+
+#include "xenia/profiling.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace alloy::hir;
+
+using alloy::hir::HIRBuilder;
+using alloy::hir::Instr;
+using alloy::hir::Value;
+
+AddressNarrowingPass::AddressNarrowingPass()
+    : CompilerPass("AddressNarrowing") {}
+
+AddressNarrowingPass::~AddressNarrowingPass() {}
+
+int AddressNarrowingPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("alloy");
+
+  // Guest addresses are 32bit, and loads/stores only look at the low 32 bits
+  // of their address. Values are block-local and defined before use, so a
+  // single walk in order sees the sources of each instruction first.
+  auto block = builder->first_block();
+  while (block) {
+    auto i = block->instr_head;
+    while (i) {
+      auto dest = i->dest;
+      if (dest && dest->type == INT64_TYPE && !dest->IsConstant()) {
+        if (IsZeroExtended(i)) {
+          dest->flags |= VALUE_IS_ZERO_EXTENDED;
+        } else {
+          dest->flags &= ~VALUE_IS_ZERO_EXTENDED;
+        }
+      }
+      i = i->next;
+    }
+    block = block->next;
+  }
+
+  return 0;
+}
+
+bool AddressNarrowingPass::IsZeroExtended(const Instr* i) {
+  if (i->opcode == &OPCODE_ZERO_EXTEND_info) {
+    return i->src1.value->type != INT64_TYPE;
+  } else if (i->opcode == &OPCODE_ASSIGN_info) {
+    return IsZeroExtended(i->src1.value);
+  } else if (i->opcode == &OPCODE_AND_info) {
+    return IsZeroExtended(i->src1.value) || IsZeroExtended(i->src2.value);
+  } else if (i->opcode == &OPCODE_OR_info || i->opcode == &OPCODE_XOR_info) {
+    return IsZeroExtended(i->src1.value) && IsZeroExtended(i->src2.value);
+  } else if (i->opcode == &OPCODE_SHR_info) {
+    return IsZeroExtended(i->src1.value) ||
+           (i->src2.value->IsConstant() &&
+            (i->src2.value->constant.i8 & 0x3F) >= 32);
+  } else if (i->opcode == &OPCODE_ADD_info) {
+    // The upper bits of an address computation are never looked at, so it
+    // can be done in 32 bits (which zero extends for free on most hosts).
+    return !i->flags && IsOnlyUsedAsAddress(i->dest);
+  }
+  return false;
+}
+
+bool AddressNarrowingPass::IsZeroExtended(const Value* value) {
+  if (value->IsConstant()) {
+    return !(value->constant.i64 >> 32);
+  }
+  return !!(value->flags & VALUE_IS_ZERO_EXTENDED);
+}
+
+bool AddressNarrowingPass::IsOnlyUsedAsAddress(const Value* value) {
+  auto use = value->use_head;
+  if (!use) {
+    return false;
+  }
+  while (use) {
+    auto i = use->instr;
+    if (i->opcode == &OPCODE_LOAD_info) {
+      // Only source is the address.
+    } else if (i->opcode == &OPCODE_STORE_info) {
+      if (i->src2.value == value) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    use = use->next;
+  }
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
@@ -0,0 +1,39 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_COMPILER_PASSES_ADDRESS_NARROWING_PASS_H_
+#define ALLOY_COMPILER_PASSES_ADDRESS_NARROWING_PASS_H_
+
+#include "alloy/compiler/compiler_pass.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// Marks 64bit values that only ever hold 32 bits (guest addresses, mostly) with
+// VALUE_IS_ZERO_EXTENDED so that backends can use them as addresses without
+// zero extending them first. Must run after all passes that change values.
+class AddressNarrowingPass : public CompilerPass {
+ public:
+  AddressNarrowingPass();
+  ~AddressNarrowingPass() override;
+
+  int Run(hir::HIRBuilder* builder) override;
+
+ private:
+  bool IsZeroExtended(const hir::Instr* i);
+  bool IsZeroExtended(const hir::Value* value);
+  bool IsOnlyUsedAsAddress(const hir::Value* value);
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
+
+#endif  // ALLOY_COMPILER_PASSES_ADDRESS_NARROWING_PASS_H_
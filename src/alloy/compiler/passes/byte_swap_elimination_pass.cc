@@ -0,0 +1,343 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/compiler/passes/byte_swap_elimination_pass.h"
+
+#include "alloy/compiler/compiler.h"
+#include "xenia/profiling.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace alloy::hir;
+
+using alloy::hir::HIRBuilder;
+using alloy::hir::Instr;
+using alloy::hir::Value;
+
+namespace {
+
+// Types BYTE_SWAP and the fused loads/stores support. Vectors are swapped
+// per 32bit element.
+bool IsSwappableType(TypeName type) {
+  return type == INT16_TYPE || type == INT32_TYPE || type == INT64_TYPE ||
+         type == VEC128_TYPE;
+}
+
+// Bounds how far ahead SinkByteSwap looks through chains of bitwise ops.
+const size_t kMaxSinkDepth = 4;
+
+bool HasSingleUse(const Value* value) {
+  return value->use_head && !value->use_head->next;
+}
+
+Value* LoadSwappedConstant(HIRBuilder* builder, Value* value) {
+  // Constants are shared, so the swap can't be done in place.
+  switch (value->type) {
+    case INT16_TYPE:
+      return builder->LoadConstant(poly::byte_swap(value->constant.i16));
+    case INT32_TYPE:
+      return builder->LoadConstant(poly::byte_swap(value->constant.i32));
+    case INT64_TYPE:
+      return builder->LoadConstant(poly::byte_swap(value->constant.i64));
+    case VEC128_TYPE: {
+      vec128_t swapped = value->constant.v128;
+      for (int n = 0; n < 4; n++) {
+        swapped.u32[n] = poly::byte_swap(swapped.u32[n]);
+      }
+      return builder->LoadConstant(swapped);
+    }
+    default:
+      assert_unhandled_case(value->type);
+      return value;
+  }
+}
+
+}  // namespace
+
+ByteSwapEliminationPass::ByteSwapEliminationPass()
+    : CompilerPass("ByteSwapElimination") {}
+
+ByteSwapEliminationPass::~ByteSwapEliminationPass() {}
+
+int ByteSwapEliminationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("alloy");
+
+  // Example (lwz, ori, stw of the same word):
+  //   v1.i32 = load v0.i64
+  //   v2.i32 = byte_swap v1.i32
+  //   v3.i32 = or v2.i32, 1
+  //   v4.i32 = byte_swap v3.i32
+  //   store v0.i64, v4.i32
+  // becomes (after DCE):
+  //   v1.i32 = load v0.i64
+  //   v5.i32 = or v1.i32, 01000000
+  //   store v0.i64, v5.i32
+  //
+  // Instructions are visited in order, so a swap sunk below a bitwise op is
+  // seen again by whatever uses its result and may cancel there.
+  size_t swap_count = 0;
+  size_t fused_count = 0;
+  auto block = builder->first_block();
+  while (block) {
+    auto i = block->instr_head;
+    while (i) {
+      if (i->opcode == &OPCODE_BYTE_SWAP_info) {
+        ++swap_count;
+        if (CancelByteSwap(i)) {
+          set_changed();
+        }
+      } else if (i->opcode == &OPCODE_AND_info ||
+                 i->opcode == &OPCODE_OR_info ||
+                 i->opcode == &OPCODE_XOR_info) {
+        if (SinkByteSwap(builder, i)) {
+          set_changed();
+        }
+      } else if (i->opcode == &OPCODE_COMPARE_EQ_info ||
+                 i->opcode == &OPCODE_COMPARE_NE_info) {
+        if (UnswapCompare(builder, i)) {
+          set_changed();
+        }
+      } else if (i->opcode == &OPCODE_STORE_info) {
+        if (FuseStore(i)) {
+          ++fused_count;
+          set_changed();
+        }
+      }
+      i = i->next;
+    }
+    block = block->next;
+  }
+
+  // Loads are fused last, as the swap is no longer visible to the rewrites
+  // above once it is folded into the load.
+  size_t remaining_count = 0;
+  block = builder->first_block();
+  while (block) {
+    auto i = block->instr_head;
+    while (i) {
+      if (i->opcode == &OPCODE_BYTE_SWAP_info && i->dest->use_head) {
+        if (FuseLoad(i)) {
+          ++fused_count;
+          set_changed();
+        } else {
+          ++remaining_count;
+        }
+      }
+      i = i->next;
+    }
+    block = block->next;
+  }
+
+  auto stats = compiler_->mutable_stats();
+  stats->byte_swap_count += swap_count;
+  if (swap_count > remaining_count) {
+    stats->byte_swap_removed_count += swap_count - remaining_count;
+  }
+  stats->byte_swap_fused_count += fused_count;
+
+  return 0;
+}
+
+Value* ByteSwapEliminationPass::GetSwappedSource(Value* value) {
+  // Walk backward up the chain looking for a byte swap. We may have
+  // assigns, so skip those.
+  auto def = value->def;
+  while (def && def->opcode == &OPCODE_ASSIGN_info) {
+    def = def->src1.value->def;
+  }
+  if (def && def->opcode == &OPCODE_BYTE_SWAP_info) {
+    return def->src1.value;
+  }
+  return nullptr;
+}
+
+bool ByteSwapEliminationPass::CancelByteSwap(Instr* i) {
+  // v1 = byte_swap v0
+  // v2 = byte_swap v1    <-- v2 = v0
+  auto source = GetSwappedSource(i->src1.value);
+  if (!source) {
+    return false;
+  }
+  i->Replace(&OPCODE_ASSIGN_info, 0);
+  i->set_src1(source);
+  return true;
+}
+
+bool ByteSwapEliminationPass::SinkByteSwap(HIRBuilder* builder, Instr* i) {
+  // v2 = and (byte_swap v0), (byte_swap v1)
+  // becomes:
+  // v3 = and v0, v1
+  // v2 = byte_swap v3
+  // Either operand may instead be a constant, which is swapped in place.
+  auto src1 = i->src1.value;
+  auto src2 = i->src2.value;
+  if (!IsSwappableType(i->dest->type) || src1 == src2) {
+    return false;
+  }
+  if (src1->IsConstantZero() || src2->IsConstantZero()) {
+    // Left for constant propagation.
+    return false;
+  }
+  auto source1 = src1->IsConstant() ? nullptr : GetSwappedSource(src1);
+  auto source2 = src2->IsConstant() ? nullptr : GetSwappedSource(src2);
+  if ((!source1 && !src1->IsConstant()) || (!source2 && !src2->IsConstant()) ||
+      (!source1 && !source2) || source1 == source2) {
+    return false;
+  }
+
+  // Swapped operands only used here go away, but a new swap is added for the
+  // result unless all its users absorb it. Only go ahead if that's a win.
+  size_t removed_count = 0;
+  if (source1 && src1->def->opcode == &OPCODE_BYTE_SWAP_info &&
+      HasSingleUse(src1)) {
+    ++removed_count;
+  }
+  if (source2 && src2->def->opcode == &OPCODE_BYTE_SWAP_info &&
+      HasSingleUse(src2)) {
+    ++removed_count;
+  }
+  if (IsSwapAbsorbed(i->dest, 0)) {
+    ++removed_count;
+  }
+  if (removed_count < 2) {
+    return false;
+  }
+
+  if (!source1) {
+    source1 = LoadSwappedConstant(builder, src1);
+  }
+  if (!source2) {
+    source2 = LoadSwappedConstant(builder, src2);
+  }
+  Value* value;
+  if (i->opcode == &OPCODE_AND_info) {
+    value = builder->And(source1, source2);
+  } else if (i->opcode == &OPCODE_OR_info) {
+    value = builder->Or(source1, source2);
+  } else {
+    value = builder->Xor(source1, source2);
+  }
+  builder->last_instr()->MoveBefore(i);
+  i->Replace(&OPCODE_BYTE_SWAP_info, 0);
+  i->set_src1(value);
+  return true;
+}
+
+bool ByteSwapEliminationPass::UnswapCompare(HIRBuilder* builder, Instr* i) {
+  // v1 = byte_swap v0
+  // v2 = compare_eq v1, 0x1234
+  // becomes:
+  // v2 = compare_eq v0, 0x3412
+  // Only equality survives the swap; ordering does not.
+  auto src1 = i->src1.value;
+  auto src2 = i->src2.value;
+  if (!IsSwappableType(src1->type)) {
+    return false;
+  }
+  auto source1 = src1->IsConstant() ? nullptr : GetSwappedSource(src1);
+  auto source2 = src2->IsConstant() ? nullptr : GetSwappedSource(src2);
+  if ((!source1 && !src1->IsConstant()) || (!source2 && !src2->IsConstant()) ||
+      (!source1 && !source2)) {
+    return false;
+  }
+  if (!source1) {
+    source1 = LoadSwappedConstant(builder, src1);
+  }
+  if (!source2) {
+    source2 = LoadSwappedConstant(builder, src2);
+  }
+  i->set_src1(source1);
+  i->set_src2(source2);
+  return true;
+}
+
+bool ByteSwapEliminationPass::FuseLoad(Instr* i) {
+  // v1 = load v0
+  // v2 = byte_swap v1
+  // becomes:
+  // v1 = load v0, LOAD_BYTE_SWAP
+  // v2 = v1
+  auto value = i->src1.value;
+  auto def = value->def;
+  if (!def || def->opcode != &OPCODE_LOAD_info ||
+      (def->flags & LOAD_BYTE_SWAP) || !HasSingleUse(value) ||
+      !IsSwappableType(value->type)) {
+    return false;
+  }
+  def->flags |= LOAD_BYTE_SWAP;
+  i->Replace(&OPCODE_ASSIGN_info, 0);
+  i->set_src1(value);
+  return true;
+}
+
+bool ByteSwapEliminationPass::FuseStore(Instr* i) {
+  // v1 = byte_swap v0
+  // store ..., v1
+  // becomes:
+  // store ..., v0, STORE_BYTE_SWAP
+  if (i->flags & STORE_BYTE_SWAP) {
+    return false;
+  }
+  auto value = i->src2.value;
+  if (!IsSwappableType(value->type)) {
+    return false;
+  }
+  auto source = GetSwappedSource(value);
+  if (!source) {
+    return false;
+  }
+  i->set_src2(source);
+  i->flags |= STORE_BYTE_SWAP;
+  return true;
+}
+
+bool ByteSwapEliminationPass::IsSwapAbsorbed(Value* value, size_t depth) {
+  // Whether a swap of the value would be removed again by all its users.
+  auto use = value->use_head;
+  if (!use) {
+    return false;
+  }
+  while (use) {
+    auto i = use->instr;
+    if (i->opcode == &OPCODE_BYTE_SWAP_info) {
+      // Cancels.
+    } else if (i->opcode == &OPCODE_STORE_info) {
+      if (i->src1.value == value || (i->flags & STORE_BYTE_SWAP)) {
+        return false;
+      }
+    } else if (i->opcode == &OPCODE_COMPARE_EQ_info ||
+               i->opcode == &OPCODE_COMPARE_NE_info) {
+      auto other = i->src1.value == value ? i->src2.value : i->src1.value;
+      if (other != value && !other->IsConstant() &&
+          !GetSwappedSource(other)) {
+        return false;
+      }
+    } else if (i->opcode == &OPCODE_AND_info || i->opcode == &OPCODE_OR_info ||
+               i->opcode == &OPCODE_XOR_info) {
+      // Chains of bitwise ops are sunk through one at a time.
+      auto other = i->src1.value == value ? i->src2.value : i->src1.value;
+      if (other == value ||
+          (!other->IsConstant() && !GetSwappedSource(other)) ||
+          depth >= kMaxSinkDepth || !IsSwapAbsorbed(i->dest, depth + 1)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    use = use->next;
+  }
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
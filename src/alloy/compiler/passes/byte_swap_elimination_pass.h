@@ -0,0 +1,46 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_COMPILER_PASSES_BYTE_SWAP_ELIMINATION_PASS_H_
+#define ALLOY_COMPILER_PASSES_BYTE_SWAP_ELIMINATION_PASS_H_
+
+#include "alloy/compiler/compiler_pass.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// Removes the byte swaps the frontend wraps around guest memory accesses
+// where it can: swaps of swaps cancel, bitwise ops with swapped operands are
+// done on the unswapped values and equality compares are made against
+// swapped constants. Swaps that remain next to a load or store are folded
+// into it with LOAD_BYTE_SWAP/STORE_BYTE_SWAP.
+// Leaves dead swaps and assignments for DeadCodeEliminationPass.
+class ByteSwapEliminationPass : public CompilerPass {
+ public:
+  ByteSwapEliminationPass();
+  ~ByteSwapEliminationPass() override;
+
+  int Run(hir::HIRBuilder* builder) override;
+
+ private:
+  hir::Value* GetSwappedSource(hir::Value* value);
+  bool CancelByteSwap(hir::Instr* i);
+  bool SinkByteSwap(hir::HIRBuilder* builder, hir::Instr* i);
+  bool UnswapCompare(hir::HIRBuilder* builder, hir::Instr* i);
+  bool FuseLoad(hir::Instr* i);
+  bool FuseStore(hir::Instr* i);
+  bool IsSwapAbsorbed(hir::Value* value, size_t depth);
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
+
+#endif  // ALLOY_COMPILER_PASSES_BYTE_SWAP_ELIMINATION_PASS_H_
@@ -21,10 +21,12 @@ namespace passes {
 using namespace alloy::hir;
 
 using alloy::hir::HIRBuilder;
+using alloy::hir::Instr;
 using alloy::hir::TypeName;
 using alloy::hir::Value;
 
-ConstantPropagationPass::ConstantPropagationPass() : CompilerPass() {}
+ConstantPropagationPass::ConstantPropagationPass()
+    : CompilerPass("ConstantPropagation") {}
 
 ConstantPropagationPass::~ConstantPropagationPass() {}
 
@@ -63,6 +65,12 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
     auto i = block->instr_head;
     while (i) {
       auto v = i->dest;
+      // Every fold rewrites, replaces or removes the instruction.
+      auto opcode = i->opcode;
+      auto flags = i->flags;
+      auto src1 = i->src1.value;
+      auto src2 = i->src2.value;
+      auto src3 = i->src3.value;
       switch (i->opcode->num) {
         case OPCODE_DEBUG_BREAK_TRUE:
           if (i->src1.value->IsConstant()) {
@@ -140,6 +148,19 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
             }
           }
           break;
+        case OPCODE_BRANCH_TABLE:
+          if (i->src1.value->IsConstant()) {
+            auto table = i->src2.table;
+            uint32_t n = i->src1.value->constant.i32;
+            if (n < table->count && table->labels[n]) {
+              auto label = table->labels[n];
+              i->Replace(&OPCODE_BRANCH_info, i->flags);
+              i->src1.label = label;
+            } else {
+              i->Remove();
+            }
+          }
+          break;
 
         case OPCODE_CAST:
           if (i->src1.value->IsConstant()) {
@@ -205,7 +226,6 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
           }
           break;
 
-        // TODO(benvanik): compares
         case OPCODE_COMPARE_EQ:
           if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
             bool value = i->src1.value->IsConstantEQ(i->src2.value);
@@ -277,6 +297,28 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
           }
           break;
 
+        case OPCODE_VECTOR_COMPARE_EQ:
+        case OPCODE_VECTOR_COMPARE_SGT:
+        case OPCODE_VECTOR_COMPARE_SGE:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorCompare(i->opcode->num, i->src2.value,
+                             TypeName(i->flags));
+            i->Remove();
+          }
+          break;
+        case OPCODE_VECTOR_COMPARE_UGT:
+        case OPCODE_VECTOR_COMPARE_UGE:
+          // The backend biases floats as if they were ints; leave those be.
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              i->flags != FLOAT32_TYPE) {
+            v->set_from(i->src1.value);
+            v->VectorCompare(i->opcode->num, i->src2.value,
+                             TypeName(i->flags));
+            i->Remove();
+          }
+          break;
+
         case OPCODE_DID_CARRY:
           assert_true(!i->src1.value->IsConstant());
           break;
@@ -300,9 +342,20 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
             }
           }
           break;
-        // TODO(benvanik): ADD_CARRY (w/ ARITHMETIC_SET_CARRY)
         case OPCODE_ADD_CARRY:
-          if (i->src1.value->IsConstantZero() && i->src2.value->IsConstantZero()) {
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              i->src3.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            bool did_carry = v->AddWithCarry(
+                i->src2.value, !i->src3.value->IsConstantZero());
+            bool propagate_carry = !!(i->flags & ARITHMETIC_SET_CARRY);
+            i->Remove();
+
+            // If carry is set find the DID_CARRY and fix it.
+            if (propagate_carry) {
+              PropagateCarry(v, did_carry);
+            }
+          } else if (i->src1.value->IsConstantZero() && i->src2.value->IsConstantZero()) {
             Value* ca = i->src3.value;
             // If carry is set find the DID_CARRY and fix it.
             if (!!(i->flags & ARITHMETIC_SET_CARRY)) {
@@ -339,6 +392,22 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
             }
           }
           break;
+        case OPCODE_VECTOR_ADD:
+        case OPCODE_VECTOR_SUB:
+          // Saturating ops are left alone as they may be paired with a
+          // DID_SATURATE.
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              !((i->flags >> 8) & ARITHMETIC_SATURATE)) {
+            TypeName part_type = TypeName(i->flags & 0xFF);
+            v->set_from(i->src1.value);
+            if (i->opcode == &OPCODE_VECTOR_ADD_info) {
+              v->VectorAdd(i->src2.value, part_type);
+            } else {
+              v->VectorSub(i->src2.value, part_type);
+            }
+            i->Remove();
+          }
+          break;
         case OPCODE_MUL:
           if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -419,7 +488,13 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
             i->Remove();
           }
           break;
-        // TODO(benvanik): VECTOR_SHL
+        case OPCODE_VECTOR_SHL:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorShl(i->src2.value, TypeName(i->flags));
+            i->Remove();
+          }
+          break;
         case OPCODE_SHR:
           if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -427,6 +502,13 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
             i->Remove();
           }
           break;
+        case OPCODE_VECTOR_SHR:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorShr(i->src2.value, TypeName(i->flags));
+            i->Remove();
+          }
+          break;
         case OPCODE_SHA:
           if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -434,7 +516,27 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
             i->Remove();
           }
           break;
-        // TODO(benvanik): ROTATE_LEFT
+        case OPCODE_VECTOR_SHA:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorSha(i->src2.value, TypeName(i->flags));
+            i->Remove();
+          }
+          break;
+        case OPCODE_ROTATE_LEFT:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->RotateLeft(i->src2.value);
+            i->Remove();
+          }
+          break;
+        case OPCODE_VECTOR_ROTATE_LEFT:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorRotateLeft(i->src2.value, TypeName(i->flags));
+            i->Remove();
+          }
+          break;
         case OPCODE_BYTE_SWAP:
           if (i->src1.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -449,11 +551,47 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
             i->Remove();
           }
           break;
-        // TODO(benvanik): INSERT/EXTRACT
-        // TODO(benvanik): SPLAT/PERMUTE/SWIZZLE
+        case OPCODE_INSERT:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              i->src3.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->Insert(i->src2.value, i->src3.value);
+            i->Remove();
+          }
+          break;
+        case OPCODE_EXTRACT:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_zero(v->type);
+            v->Extract(i->src1.value, i->src2.value);
+            i->Remove();
+          }
+          break;
         case OPCODE_SPLAT:
+          // Quite a few of these, from building vec128s.
+          if (i->src1.value->IsConstant()) {
+            v->set_zero(v->type);
+            v->Splat(i->src1.value);
+            i->Remove();
+          }
+          break;
+        case OPCODE_PERMUTE:
+          if (i->src1.value->IsConstant()) {
+            if (i->src2.value->IsConstant() && i->src3.value->IsConstant()) {
+              v->set_zero(v->type);
+              v->Permute(i->src1.value, i->src2.value, i->src3.value,
+                         TypeName(i->flags));
+              i->Remove();
+            } else {
+              SimplifyPermute(builder, i);
+            }
+          }
+          break;
+        case OPCODE_SWIZZLE:
           if (i->src1.value->IsConstant()) {
-            // Quite a few of these, from building vec128s.
+            v->set_from(i->src1.value);
+            v->Swizzle(static_cast<uint32_t>(i->src2.offset),
+                       TypeName(i->flags));
+            i->Remove();
           }
           break;
 
@@ -461,6 +599,11 @@ int ConstantPropagationPass::Run(HIRBuilder* builder) {
           // Ignored.
           break;
       }
+      if (i->opcode != opcode || i->flags != flags ||
+          i->src1.value != src1 || i->src2.value != src2 ||
+          i->src3.value != src3) {
+        set_changed();
+      }
       i = i->next;
     }
 
@@ -483,6 +626,72 @@ void ConstantPropagationPass::PropagateCarry(Value* v, bool did_carry) {
   }
 }
 
+void ConstantPropagationPass::SimplifyPermute(HIRBuilder* builder, Instr* i) {
+  // Permutes with a constant control are rewritten to the narrowest form the
+  // backend has a fast path for:
+  //   halfword permute -> byte permute (halfwords are emulated)
+  //   byte permute moving whole words -> word permute (pshufd + blend)
+  //   word permute from a single source -> swizzle (pshufd)
+  Value* control = i->src1.value;
+  if (i->flags == INT16_TYPE) {
+    vec128_t byte_control;
+    for (size_t n = 0; n < 8; ++n) {
+      uint32_t sel = (control->constant.v128.u16[n] & 0xF) ^ 0x1;
+      uint32_t base = ((sel & 0x8) << 1) | ((sel & 0x7) << 1);
+      byte_control.u8[n * 2 + 0] = uint8_t((base + 0) ^ 0x3);
+      byte_control.u8[n * 2 + 1] = uint8_t((base + 1) ^ 0x3);
+    }
+    control = builder->LoadConstant(byte_control);
+    i->set_src1(control);
+    i->flags = INT8_TYPE;
+  }
+  if (i->flags == INT8_TYPE) {
+    uint32_t word_control = 0;
+    for (size_t n = 0; n < 4; ++n) {
+      uint32_t first = (control->constant.v128.u8[n * 4] ^ 0x3) & 0x1F;
+      if (first & 0x3) {
+        return;
+      }
+      for (size_t m = 1; m < 4; ++m) {
+        uint32_t sel = (control->constant.v128.u8[n * 4 + m] ^ 0x3) & 0x1F;
+        if (sel != first + m) {
+          return;
+        }
+      }
+      // Word index in the low 2 bits, source select in bit 2.
+      word_control |= (first >> 2) << (n * 8);
+    }
+    control = builder->LoadConstant(word_control);
+    i->set_src1(control);
+    i->flags = INT32_TYPE;
+  }
+  if (i->flags == INT32_TYPE) {
+    uint32_t word_control = static_cast<uint32_t>(control->constant.i32);
+    uint32_t select = word_control & 0x04040404;
+    if (select && select != 0x04040404) {
+      // Needs both sources.
+      return;
+    }
+    Value* src = select ? i->src3.value : i->src2.value;
+    uint32_t swizzle_mask = 0;
+    for (size_t n = 0; n < 4; ++n) {
+      swizzle_mask |= ((word_control >> (n * 8)) & 0x3) << (n * 2);
+    }
+    if (src->IsConstant()) {
+      i->dest->set_from(src);
+      i->dest->Swizzle(swizzle_mask, INT32_TYPE);
+      i->Remove();
+    } else if (swizzle_mask == SWIZZLE_XYZW_TO_XYZW) {
+      i->Replace(&OPCODE_ASSIGN_info, 0);
+      i->set_src1(src);
+    } else {
+      i->Replace(&OPCODE_SWIZZLE_info, INT32_TYPE);
+      i->set_src1(src);
+      i->src2.offset = swizzle_mask;
+    }
+  }
+}
+
 }  // namespace passes
 }  // namespace compiler
 }  // namespace alloy
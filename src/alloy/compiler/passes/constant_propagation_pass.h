@@ -25,6 +25,7 @@ class ConstantPropagationPass : public CompilerPass {
 
  private:
   void PropagateCarry(hir::Value* v, bool did_carry);
+  void SimplifyPermute(hir::HIRBuilder* builder, hir::Instr* i);
 };
 
 }  // namespace passes
@@ -17,6 +17,9 @@
 
 DEFINE_bool(store_all_context_values, false,
             "Don't strip dead context stores to aid in debugging.");
+DEFINE_bool(drop_call_clobbered_context, false,
+            "Assume direct callees follow the guest ABI and drop stores to "
+            "context they may clobber (most CR fields) before calling them.");
 
 namespace alloy {
 namespace compiler {
@@ -31,7 +34,8 @@ using alloy::hir::HIRBuilder;
 using alloy::hir::Instr;
 using alloy::hir::Value;
 
-ContextPromotionPass::ContextPromotionPass() : CompilerPass() {}
+ContextPromotionPass::ContextPromotionPass()
+    : CompilerPass("ContextPromotion") {}
 
 ContextPromotionPass::~ContextPromotionPass() {}
 
@@ -44,6 +48,12 @@ int ContextPromotionPass::Initialize(Compiler* compiler) {
   ContextInfo* context_info = runtime_->frontend()->context_info();
   context_values_.resize(context_info->size());
   context_validity_.resize(static_cast<uint32_t>(context_info->size()));
+  call_preserved_.resize(static_cast<uint32_t>(context_info->size()));
+  call_preserved_.set();
+  for (auto& range : context_info->call_clobbered_ranges()) {
+    uint32_t offset = static_cast<uint32_t>(range.offset);
+    call_preserved_.reset(offset, offset + static_cast<uint32_t>(range.size));
+  }
 
   return 0;
 }
@@ -59,15 +69,19 @@ int ContextPromotionPass::Run(HIRBuilder* builder) {
   //   v1 = load_context +100  <-- replace with v1 = v0
   //   store_context +200, v1
   //
-  // It'd be possible in this stage to also remove redundant context stores:
-  // Example of dead store elimination:
-  //   store_context +100, v0  <-- removed due to following store
-  //   store_context +100, v1
-  // This is more generally done by DSE, however if it could be done here
-  // instead as it may be faster (at least on the block-level).
+  // Dead stores are removed across the whole function:
+  //   store_context +100, v0  <-- removed as +100 is overwritten on all paths
+  //   branch_true v1, label0
+  //   store_context +100, v2
+  //   ...
+  // label0:
+  //   store_context +100, v3
 
   // Promote loads to values.
-  // Process each block independently, for now.
+  // Only within a block: the x64 backend frees every register at a block
+  // boundary, so a value reused in another block would have to be parked in
+  // a local and reloaded from the stack, which is no cheaper than the context
+  // load it replaces.
   auto block = builder->first_block();
   while (block) {
     PromoteBlock(block);
@@ -76,11 +90,7 @@ int ContextPromotionPass::Run(HIRBuilder* builder) {
 
   // Remove all dead stores.
   if (!FLAGS_store_all_context_values) {
-    block = builder->first_block();
-    while (block) {
-      RemoveDeadStoresBlock(block);
-      block = block->next;
-    }
+    RemoveDeadStores(builder);
   }
 
   return 0;
@@ -119,32 +129,137 @@ void ContextPromotionPass::PromoteBlock(Block* block) {
   }
 }
 
-void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
-  auto& validity = context_validity_;
-  validity.reset();
+void ContextPromotionPass::RemoveDeadStores(HIRBuilder* builder) {
+  // Backwards liveness of each context byte over the CFG. A store is dead if
+  // none of the bytes it writes are read again on any path before they are
+  // overwritten. Anything that can observe the context (calls, returns,
+  // traps/etc) makes all bytes live, except that with
+  // --drop_call_clobbered_context direct calls leave the bytes the guest ABI
+  // doesn't preserve (most CR fields) dead.
+  uint32_t block_count = 0;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = static_cast<uint16_t>(block_count++);
+    block = block->next;
+  }
+  uint32_t context_size = static_cast<uint32_t>(context_validity_.size());
+  if (block_live_in_.size() < block_count) {
+    block_live_in_.resize(block_count);
+  }
+  for (uint32_t n = 0; n < block_count; ++n) {
+    block_live_in_[n].resize(context_size);
+    block_live_in_[n].reset();
+  }
 
-  // Walk backwards and mark offsets that are written to.
-  // If the offset was written to earlier, ignore the store.
-  Instr* i = block->instr_tail;
+  // Live-in sets only ever grow so this terminates. Walking in reverse
+  // converges fastest as most edges go forward.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    block = builder->last_block();
+    while (block) {
+      ComputeLiveness(block, false);
+      if (context_validity_ != block_live_in_[block->ordinal]) {
+        block_live_in_[block->ordinal] = context_validity_;
+        changed = true;
+      }
+      block = block->prev;
+    }
+  }
+
+  block = builder->first_block();
+  while (block) {
+    ComputeLiveness(block, true);
+    block = block->next;
+  }
+}
+
+void ContextPromotionPass::ComputeLiveness(Block* block,
+                                           bool remove_dead_stores) {
+  auto& live = context_validity_;
+  live.reset();
+
+  // This runs before FinalizationPass makes fall-throughs explicit, so any
+  // block not ending in an unconditional jump (empty blocks and conditional
+  // branches included) continues into the next block in layout order.
+  Instr* tail = block->instr_tail;
+  if (!tail || !IsUnconditionalJump(tail)) {
+    if (block->next) {
+      live = block_live_in_[block->next->ordinal];
+    } else {
+      live.set();
+    }
+  }
+
+  // Walk backwards tracking which bytes will be read.
+  Instr* i = tail;
   while (i) {
     Instr* prev = i->prev;
-    if (i->opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
+    if (i->opcode == &OPCODE_BRANCH_info) {
+      live |= block_live_in_[i->src1.label->block->ordinal];
+    } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+               i->opcode == &OPCODE_BRANCH_FALSE_info) {
+      live |= block_live_in_[i->src2.label->block->ordinal];
+    } else if (i->opcode == &OPCODE_BRANCH_TABLE_info) {
+      auto table = i->src2.table;
+      for (uint32_t n = 0; n < table->count; ++n) {
+        if (table->labels[n]) {
+          live |= block_live_in_[table->labels[n]->block->ordinal];
+        }
+      }
+    } else if (IsCallBoundary(i)) {
+      live |= call_preserved_;
+    } else if (i->opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
       // Volatile instruction - requires all context values be flushed.
-      validity.reset();
+      live.set();
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->dest->type));
+      live.set(offset, offset + size);
     } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
-      size_t offset = i->src1.offset;
-      if (!validity.test(static_cast<uint32_t>(offset))) {
-        // Offset not yet written, mark and continue.
-        validity.set(static_cast<uint32_t>(offset));
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+      bool any_live = false;
+      for (uint32_t n = offset; n < offset + size; ++n) {
+        if (live.test(n)) {
+          any_live = true;
+          break;
+        }
+      }
+      if (!any_live) {
+        // Never read before being overwritten. Remove this store.
+        if (remove_dead_stores) {
+          i->Remove();
+        }
       } else {
-        // Already written to. Remove this store.
-        i->Remove();
+        live.reset(offset, offset + size);
       }
     }
     i = prev;
   }
 }
 
+bool ContextPromotionPass::IsUnconditionalJump(Instr* i) {
+  if (i->opcode == &OPCODE_CALL_info ||
+      i->opcode == &OPCODE_CALL_INDIRECT_info) {
+    return (i->flags & CALL_TAIL) != 0;
+  }
+  return i->opcode == &OPCODE_BRANCH_info || i->opcode == &OPCODE_RETURN_info;
+}
+
+bool ContextPromotionPass::IsCallBoundary(Instr* i) {
+  if (!FLAGS_drop_call_clobbered_context) {
+    return false;
+  }
+  // Only calls to known functions. Tail calls may just be jumps into code
+  // shared between functions, and hand written code (or the caller of a
+  // function we return to) may well read CR fields the ABI says are dead.
+  // The same goes for whatever an indirect branch ends up at.
+  return (i->opcode == &OPCODE_CALL_info ||
+          i->opcode == &OPCODE_CALL_TRUE_info) &&
+         !(i->flags & CALL_TAIL);
+}
+
 }  // namespace passes
 }  // namespace compiler
 }  // namespace alloy
@@ -38,11 +38,22 @@ class ContextPromotionPass : public CompilerPass {
 
  private:
   void PromoteBlock(hir::Block* block);
-  void RemoveDeadStoresBlock(hir::Block* block);
+  void RemoveDeadStores(hir::HIRBuilder* builder);
+  // Computes the context bytes live on entry to the block into
+  // context_validity_, optionally removing stores to bytes that aren't live.
+  void ComputeLiveness(hir::Block* block, bool remove_dead_stores);
+  bool IsUnconditionalJump(hir::Instr* i);
+  // Whether the guest ABI can be relied on at the instruction, i.e. it is a
+  // real call to a known function and not just a jump to some other code.
+  bool IsCallBoundary(hir::Instr* i);
 
  private:
   std::vector<hir::Value*> context_values_;
   llvm::BitVector context_validity_;
+  // Context bytes the guest ABI preserves across calls.
+  llvm::BitVector call_preserved_;
+  // Context bytes live on entry to each block, by block ordinal.
+  std::vector<llvm::BitVector> block_live_in_;
 };
 
 }  // namespace passes
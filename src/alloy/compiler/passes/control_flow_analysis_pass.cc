@@ -24,7 +24,8 @@ using namespace alloy::hir;
 using alloy::hir::Edge;
 using alloy::hir::HIRBuilder;
 
-ControlFlowAnalysisPass::ControlFlowAnalysisPass() : CompilerPass() {}
+ControlFlowAnalysisPass::ControlFlowAnalysisPass()
+    : CompilerPass("ControlFlowAnalysis") {}
 
 ControlFlowAnalysisPass::~ControlFlowAnalysisPass() {}
 
@@ -56,6 +57,22 @@ int ControlFlowAnalysisPass::Run(HIRBuilder* builder) {
                  instr->opcode == &OPCODE_BRANCH_FALSE_info) {
         auto label = instr->src2.label;
         builder->AddEdge(block, label->block, 0);
+      } else if (instr->opcode == &OPCODE_BRANCH_TABLE_info) {
+        // One edge per distinct target.
+        auto table = instr->src2.table;
+        for (uint32_t n = 0; n < table->count; ++n) {
+          auto label = table->labels[n];
+          if (!label) {
+            continue;
+          }
+          auto edge = block->outgoing_edge_head;
+          while (edge && edge->dest != label->block) {
+            edge = edge->outgoing_next;
+          }
+          if (!edge) {
+            builder->AddEdge(block, label->block, 0);
+          }
+        }
       }
       instr = instr->prev;
     }
@@ -25,7 +25,7 @@ using alloy::hir::Edge;
 using alloy::hir::HIRBuilder;
 
 ControlFlowSimplificationPass::ControlFlowSimplificationPass()
-    : CompilerPass() {}
+    : CompilerPass("ControlFlowSimplification") {}
 
 ControlFlowSimplificationPass::~ControlFlowSimplificationPass() {}
 
@@ -35,7 +35,8 @@ using alloy::hir::HIRBuilder;
 using alloy::hir::OpcodeSignatureType;
 using alloy::hir::Value;
 
-DataFlowAnalysisPass::DataFlowAnalysisPass() : CompilerPass() {}
+DataFlowAnalysisPass::DataFlowAnalysisPass()
+    : CompilerPass("DataFlowAnalysis") {}
 
 DataFlowAnalysisPass::~DataFlowAnalysisPass() {}
 
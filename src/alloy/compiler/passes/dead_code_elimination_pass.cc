@@ -22,7 +22,8 @@ using alloy::hir::HIRBuilder;
 using alloy::hir::Instr;
 using alloy::hir::Value;
 
-DeadCodeEliminationPass::DeadCodeEliminationPass() : CompilerPass() {}
+DeadCodeEliminationPass::DeadCodeEliminationPass()
+    : CompilerPass("DeadCodeElimination") {}
 
 DeadCodeEliminationPass::~DeadCodeEliminationPass() {}
 
@@ -84,6 +85,7 @@ int DeadCodeEliminationPass::Run(HIRBuilder* builder) {
         // Assignment. These are useless, so just try to remove by completely
         // replacing the value.
         ReplaceAssignment(i);
+        set_changed();
       }
 
       i = prev;
@@ -112,6 +114,10 @@ int DeadCodeEliminationPass::Run(HIRBuilder* builder) {
     block = block->next;
   }
 
+  if (any_instr_removed || any_locals_removed) {
+    set_changed();
+  }
+
   // Remove all nops.
   if (any_instr_removed) {
     block = builder->first_block();
@@ -0,0 +1,161 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/compiler/passes/dead_store_elimination_pass.h"
+
+#include <algorithm>
+
+#include "alloy/compiler/compiler.h"
+#include "alloy/runtime/runtime.h"
+#include "xenia/profiling.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace alloy::hir;
+
+using alloy::hir::Block;
+using alloy::hir::HIRBuilder;
+using alloy::hir::Instr;
+using alloy::hir::Value;
+
+DeadStoreEliminationPass::DeadStoreEliminationPass()
+    : CompilerPass("DeadStoreElimination") {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() {}
+
+int DeadStoreEliminationPass::Initialize(Compiler* compiler) {
+  if (CompilerPass::Initialize(compiler)) {
+    return 1;
+  }
+
+  alias_analysis_.Initialize(runtime_->frontend()->context_info());
+
+  return 0;
+}
+
+int DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("alloy");
+
+  // Example (v0 and v2 are stack slots):
+  //   store v0, v1         <-- removed, same address is stored below
+  //   store v2, v3
+  //   store v0, v4
+  //   v5 = load v2
+  //   store v2, v5         <-- kept, the load may observe it
+  //
+  // Guest memory is only tracked within a block as we don't know what
+  // happens in other blocks (or other threads, after a barrier). Only stores
+  // to stack slots and constant addresses outside of device memory are
+  // removed: through any other pointer the first store may be a write to an
+  // MMIO register that the device must see. Stores that partially overlap
+  // are left alone.
+  auto block = builder->first_block();
+  while (block) {
+    ProcessBlock(block);
+    block = block->next;
+  }
+
+  return 0;
+}
+
+void DeadStoreEliminationPass::ProcessBlock(Block* block) {
+  pending_stores_.clear();
+  pending_locals_.clear();
+
+  // Walk backwards remembering what will be overwritten.
+  Instr* i = block->instr_tail;
+  while (i) {
+    Instr* prev = i->prev;
+    if (i->opcode == &OPCODE_STORE_info) {
+      auto address = alias_analysis_.GetAddress(i->src1.value);
+      size_t size = GetTypeSize(i->src2.value->type);
+      bool overwritten = false;
+      for (auto& pending : pending_stores_) {
+        if (pending.address.base == address.base &&
+            pending.address.offset == address.offset && pending.size >= size) {
+          overwritten = true;
+          break;
+        }
+      }
+      if (i->flags & STORE_VOLATILE) {
+        pending_stores_.clear();
+      } else if (overwritten) {
+        i->Remove();
+        set_changed();
+      } else if (alias_analysis_.IsPlainMemory(address)) {
+        pending_stores_.push_back({address, size});
+      }
+    } else if (i->opcode == &OPCODE_LOAD_info) {
+      if (i->flags & LOAD_VOLATILE) {
+        pending_stores_.clear();
+      } else {
+        ForgetAliases(alias_analysis_.GetAddress(i->src1.value),
+                      GetTypeSize(i->dest->type));
+      }
+    } else if (i->opcode == &OPCODE_STORE_LOCAL_info) {
+      Value* slot = i->src1.value;
+      if (!IsLocalRead(slot) ||
+          std::find(pending_locals_.begin(), pending_locals_.end(), slot) !=
+              pending_locals_.end()) {
+        // Never reloaded, or reloaded only after being overwritten.
+        i->Remove();
+        set_changed();
+      } else {
+        pending_locals_.push_back(slot);
+      }
+    } else if (i->opcode == &OPCODE_LOAD_LOCAL_info) {
+      Value* slot = i->src1.value;
+      pending_locals_.erase(
+          std::remove(pending_locals_.begin(), pending_locals_.end(), slot),
+          pending_locals_.end());
+    } else if (IsBarrier(i)) {
+      // Locals are private to the function so only memory is flushed.
+      pending_stores_.clear();
+    }
+    i = prev;
+  }
+}
+
+void DeadStoreEliminationPass::ForgetAliases(
+    const MemoryAliasAnalysis::Address& address, size_t size) {
+  pending_stores_.erase(
+      std::remove_if(pending_stores_.begin(), pending_stores_.end(),
+                     [&](const PendingStore& pending) {
+                       return alias_analysis_.MayAlias(
+                           pending.address, pending.size, address, size);
+                     }),
+      pending_stores_.end());
+}
+
+bool DeadStoreEliminationPass::IsLocalRead(Value* slot) {
+  auto use = slot->use_head;
+  while (use) {
+    if (use->instr->opcode == &OPCODE_LOAD_LOCAL_info) {
+      return true;
+    }
+    use = use->next;
+  }
+  return false;
+}
+
+bool DeadStoreEliminationPass::IsBarrier(Instr* i) {
+  if (i->opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
+    // Calls, traps, atomics, etc.
+    return true;
+  }
+  // eieio/sync/etc must keep MMIO writes ordered.
+  return i->opcode == &OPCODE_MEMORY_BARRIER_info;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
@@ -0,0 +1,56 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define ALLOY_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "alloy/compiler/compiler_pass.h"
+#include "alloy/compiler/memory_alias_analysis.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// Removes guest memory and local stores that are overwritten before they can
+// be observed. Context stores are handled (across blocks) by
+// ContextPromotionPass.
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  int Initialize(Compiler* compiler) override;
+
+  int Run(hir::HIRBuilder* builder) override;
+
+ private:
+  void ProcessBlock(hir::Block* block);
+  // Drops pending stores a read of the address may observe.
+  void ForgetAliases(const MemoryAliasAnalysis::Address& address, size_t size);
+  bool IsLocalRead(hir::Value* slot);
+  bool IsBarrier(hir::Instr* i);
+
+ private:
+  struct PendingStore {
+    MemoryAliasAnalysis::Address address;
+    size_t size;
+  };
+  MemoryAliasAnalysis alias_analysis_;
+  // Stores later in the block that haven't been observed yet.
+  std::vector<PendingStore> pending_stores_;
+  std::vector<hir::Value*> pending_locals_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
+
+#endif  // ALLOY_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
@@ -23,7 +23,7 @@ using namespace alloy::hir;
 
 using alloy::hir::HIRBuilder;
 
-FinalizationPass::FinalizationPass() : CompilerPass() {}
+FinalizationPass::FinalizationPass() : CompilerPass("Finalization") {}
 
 FinalizationPass::~FinalizationPass() {}
 
@@ -61,6 +61,19 @@ int FinalizationPass::Run(HIRBuilder* builder) {
         // Jumping to subsequent block. Remove.
         tail->Remove();
       }
+    } else if (tail && tail->opcode == &OPCODE_BRANCH_TABLE_info) {
+      // Resolve entries without a target to the next block so that the table
+      // can be emitted as a plain list of labels.
+      auto table = tail->src2.table;
+      for (uint32_t n = 0; n < table->count; ++n) {
+        if (!table->labels[n]) {
+          assert_not_null(block->next);
+          if (!block->next->label_head) {
+            builder->MarkLabel(builder->NewLabel(), block->next);
+          }
+          table->labels[n] = block->next->label_head;
+        }
+      }
     }
 
     block = block->next;
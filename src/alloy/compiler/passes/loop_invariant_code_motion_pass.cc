@@ -0,0 +1,308 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/compiler/passes/loop_invariant_code_motion_pass.h"
+
+#include "alloy/compiler/compiler.h"
+#include "alloy/runtime/runtime.h"
+#include "xenia/profiling.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace alloy::hir;
+
+using alloy::hir::Block;
+using alloy::hir::HIRBuilder;
+using alloy::hir::Instr;
+using alloy::hir::Label;
+using alloy::hir::Value;
+
+LoopInvariantCodeMotionPass::LoopInvariantCodeMotionPass()
+    : CompilerPass("LoopInvariantCodeMotion"), context_stable_(false) {}
+
+LoopInvariantCodeMotionPass::~LoopInvariantCodeMotionPass() {}
+
+int LoopInvariantCodeMotionPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("alloy");
+
+  // Example:
+  //   preheader:
+  //     branch loop
+  //   loop:
+  //     v0 = load_context +400         <-- hoisted
+  //     v1 = shl v0, 2                 <-- hoisted
+  //     v2 = load_context +104
+  //     v3 = add v2, v1
+  //     ...
+  // becomes:
+  //   preheader:
+  //     v0 = load_context +400
+  //     v1 = shl v0, 2
+  //     store_local l0, v1
+  //     branch loop
+  //   loop:
+  //     v4 = load_local l0
+  //     v2 = load_context +104
+  //     v3 = add v2, v4
+  //     ...
+  //
+  // Hoisted values that are still needed in the loop are passed through a
+  // local, as the backend only keeps a value in a register within the block
+  // that defines it.
+  // Only innermost loops are processed; they're where the time goes and
+  // preheaders of outer loops would need the same treatment again.
+  if (loop_analysis_.Analyze(builder)) {
+    return 1;
+  }
+  for (auto& loop : loop_analysis_.loops()) {
+    if (loop->is_innermost) {
+      ProcessLoop(builder, loop.get());
+    }
+  }
+
+  return 0;
+}
+
+void LoopInvariantCodeMotionPass::ProcessLoop(HIRBuilder* builder,
+                                              LoopAnalysis::Loop* loop) {
+  // Context loads can only move if nothing in the loop may write the same
+  // bytes. Calls and anything else volatile may touch any of it.
+  context_stable_ = true;
+  context_stores_.clear();
+  for (auto block : loop->blocks) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        context_stores_.push_back(
+            {i->src1.offset, GetTypeSize(i->src2.value->type)});
+      } else if ((i->opcode->flags & OPCODE_FLAG_VOLATILE) &&
+                 i->opcode != &OPCODE_BRANCH_TRUE_info &&
+                 i->opcode != &OPCODE_BRANCH_FALSE_info &&
+                 i->opcode != &OPCODE_BRANCH_TABLE_info) {
+        context_stable_ = false;
+      }
+    }
+  }
+
+  // The preheader is only created once something is worth hoisting.
+  Block* preheader = nullptr;
+  for (auto block : loop->blocks) {
+    ProcessBlock(builder, loop, block, &preheader);
+  }
+}
+
+void LoopInvariantCodeMotionPass::ProcessBlock(HIRBuilder* builder,
+                                               LoopAnalysis::Loop* loop,
+                                               Block* block,
+                                               Block** preheader) {
+  hoisted_.clear();
+  hoisted_set_.clear();
+  for (auto i = block->instr_head; i; i = i->next) {
+    if (IsInvariant(i)) {
+      hoisted_.push_back(i);
+      hoisted_set_.insert(i);
+    }
+  }
+
+  // Each root (hoisted value still used in the loop) costs a reload, so only
+  // move things if that leaves less work behind.
+  std::vector<Instr*> roots;
+  size_t work_count = 0;
+  for (auto i : hoisted_) {
+    if (i->opcode != &OPCODE_ASSIGN_info) {
+      ++work_count;
+    }
+    if (IsRoot(i)) {
+      roots.push_back(i);
+    }
+  }
+  if (work_count <= roots.size()) {
+    return;
+  }
+
+  if (!*preheader) {
+    *preheader = GetPreheader(builder, loop);
+  }
+  auto terminator = (*preheader)->instr_tail;
+
+  std::vector<Instr*> stores;
+  for (auto root : roots) {
+    auto slot = builder->AllocLocal(root->dest->type);
+    auto value = builder->LoadLocal(slot);
+    builder->last_instr()->MoveBefore(root);
+
+    // Point everything staying in the loop at the reloaded value.
+    auto use = root->dest->use_head;
+    while (use) {
+      auto next = use->next;
+      auto use_instr = use->instr;
+      if (!hoisted_set_.count(use_instr)) {
+        if (use_instr->src1_use == use) {
+          use_instr->set_src1(value);
+        } else if (use_instr->src2_use == use) {
+          use_instr->set_src2(value);
+        } else if (use_instr->src3_use == use) {
+          use_instr->set_src3(value);
+        }
+      }
+      use = next;
+    }
+
+    builder->StoreLocal(slot, root->dest);
+    stores.push_back(builder->last_instr());
+  }
+
+  for (auto i : hoisted_) {
+    i->MoveBefore(terminator);
+  }
+  for (auto store : stores) {
+    store->MoveBefore(terminator);
+  }
+  set_changed();
+}
+
+bool LoopInvariantCodeMotionPass::IsInvariant(Instr* i) {
+  if (!i->dest) {
+    return false;
+  }
+  if (i->opcode->flags &
+      (OPCODE_FLAG_BRANCH | OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE |
+       OPCODE_FLAG_IGNORE | OPCODE_FLAG_PAIRED_PREV)) {
+    return false;
+  }
+  // The host flags the following instruction reads are only set by the
+  // instruction itself.
+  if (i->next && (i->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV)) {
+    return false;
+  }
+  // Division may fault, and the loop may only divide when it's safe to.
+  if (i->opcode == &OPCODE_LOAD_LOCAL_info ||
+      i->opcode == &OPCODE_LOAD_CLOCK_info || i->opcode == &OPCODE_DIV_info) {
+    return false;
+  }
+  if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+    if (!context_stable_) {
+      return false;
+    }
+    uint64_t offset = i->src1.offset;
+    size_t size = GetTypeSize(i->dest->type);
+    for (auto& store : context_stores_) {
+      if (offset < store.offset + store.size &&
+          store.offset < offset + size) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // All value operands must be constant or computed by something hoisted.
+  auto signature = i->opcode->signature;
+  Instr::Op* ops[] = {&i->src1, &i->src2, &i->src3};
+  uint32_t sig_types[] = {
+      GET_OPCODE_SIG_TYPE_SRC1(signature), GET_OPCODE_SIG_TYPE_SRC2(signature),
+      GET_OPCODE_SIG_TYPE_SRC3(signature),
+  };
+  for (size_t n = 0; n < 3; ++n) {
+    if (sig_types[n] != OPCODE_SIG_TYPE_V) {
+      continue;
+    }
+    Value* value = ops[n]->value;
+    if (!value->IsConstant() && !hoisted_set_.count(value->def)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LoopInvariantCodeMotionPass::IsRoot(Instr* i) {
+  for (auto use = i->dest->use_head; use; use = use->next) {
+    if (!hoisted_set_.count(use->instr)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Block* LoopInvariantCodeMotionPass::GetPreheader(HIRBuilder* builder,
+                                                 LoopAnalysis::Loop* loop) {
+  auto header = loop->header;
+
+  // Reuse the only way into the loop if all it does at the end is jump to the
+  // header.
+  Block* entry = nullptr;
+  size_t entry_count = 0;
+  for (auto edge = header->incoming_edge_head; edge;
+       edge = edge->incoming_next) {
+    if (!loop_analysis_.Contains(loop, edge->src)) {
+      entry = edge->src;
+      ++entry_count;
+    }
+  }
+  if (entry_count == 1) {
+    auto tail = entry->instr_tail;
+    if (tail && tail->opcode == &OPCODE_BRANCH_info &&
+        tail->src1.label->block == header &&
+        (!tail->prev || !(tail->prev->opcode->flags & OPCODE_FLAG_BRANCH))) {
+      return entry;
+    }
+  }
+
+  // Otherwise add a block right before the header and send every entry into
+  // the loop through it. A block of the loop laid out right before the header
+  // would now fall into the preheader instead, so it gets a block of its own
+  // that jumps over it.
+  auto layout_prev = header->prev;
+  bool needs_bridge = false;
+  if (layout_prev && loop_analysis_.Contains(loop, layout_prev)) {
+    auto tail = layout_prev->instr_tail;
+    needs_bridge = !tail || (tail->opcode != &OPCODE_BRANCH_info &&
+                             tail->opcode != &OPCODE_RETURN_info);
+  }
+  auto preheader = builder->InsertBlock(header);
+  builder->Branch(header);
+  if (needs_bridge) {
+    builder->InsertBlock(preheader);
+    builder->Branch(header);
+  }
+  Label* label = builder->NewLabel();
+  builder->MarkLabel(label, preheader);
+  for (auto edge = header->incoming_edge_head; edge;
+       edge = edge->incoming_next) {
+    if (loop_analysis_.Contains(loop, edge->src)) {
+      continue;
+    }
+    for (auto i = edge->src->instr_tail;
+         i && (i->opcode->flags & OPCODE_FLAG_BRANCH); i = i->prev) {
+      if (i->opcode == &OPCODE_BRANCH_info) {
+        if (i->src1.label->block == header) {
+          i->src1.label = label;
+        }
+      } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+                 i->opcode == &OPCODE_BRANCH_FALSE_info) {
+        if (i->src2.label->block == header) {
+          i->src2.label = label;
+        }
+      } else if (i->opcode == &OPCODE_BRANCH_TABLE_info) {
+        auto table = i->src2.table;
+        for (uint32_t n = 0; n < table->count; ++n) {
+          if (table->labels[n] && table->labels[n]->block == header) {
+            table->labels[n] = label;
+          }
+        }
+      }
+    }
+  }
+  return preheader;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
@@ -0,0 +1,60 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+#define ALLOY_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+
+#include <unordered_set>
+#include <vector>
+
+#include "alloy/compiler/compiler_pass.h"
+#include "alloy/compiler/loop_analysis.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// Hoists pure computations and context loads that don't change across
+// iterations of an innermost loop into a preheader block.
+// Requires an up-to-date CFG (ControlFlowAnalysisPass) and leaves it stale.
+class LoopInvariantCodeMotionPass : public CompilerPass {
+ public:
+  LoopInvariantCodeMotionPass();
+  ~LoopInvariantCodeMotionPass() override;
+
+  int Run(hir::HIRBuilder* builder) override;
+
+ private:
+  struct ContextRange {
+    uint64_t offset;
+    size_t size;
+  };
+
+  void ProcessLoop(hir::HIRBuilder* builder, LoopAnalysis::Loop* loop);
+  void ProcessBlock(hir::HIRBuilder* builder, LoopAnalysis::Loop* loop,
+                    hir::Block* block, hir::Block** preheader);
+  bool IsInvariant(hir::Instr* i);
+  bool IsRoot(hir::Instr* i);
+  hir::Block* GetPreheader(hir::HIRBuilder* builder, LoopAnalysis::Loop* loop);
+
+ private:
+  LoopAnalysis loop_analysis_;
+  // Whether context loads may be hoisted out of the current loop at all.
+  bool context_stable_;
+  // Context ranges stored to within the current loop.
+  std::vector<ContextRange> context_stores_;
+  std::vector<hir::Instr*> hoisted_;
+  std::unordered_set<hir::Instr*> hoisted_set_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
+
+#endif  // ALLOY_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
@@ -0,0 +1,209 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/compiler/passes/memory_redundancy_elimination_pass.h"
+
+#include <gflags/gflags.h>
+
+#include "alloy/compiler/compiler.h"
+#include "alloy/runtime/runtime.h"
+#include "xenia/profiling.h"
+
+#if XE_DEBUG
+#define DEFAULT_VALIDATE_MEMORY_FORWARDING true
+#else
+#define DEFAULT_VALIDATE_MEMORY_FORWARDING false
+#endif  // XE_DEBUG
+
+DEFINE_bool(validate_memory_forwarding, DEFAULT_VALIDATE_MEMORY_FORWARDING,
+            "Reload memory values the compiler forwards and int3 if they "
+            "don't match what it assumed.");
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace alloy::hir;
+
+using alloy::hir::Block;
+using alloy::hir::HIRBuilder;
+using alloy::hir::Instr;
+using alloy::hir::Value;
+
+namespace {
+
+// Bounds the number of values remembered per block. Lookups are linear.
+const size_t kMaxEntries = 32;
+
+}  // namespace
+
+MemoryRedundancyEliminationPass::MemoryRedundancyEliminationPass()
+    : CompilerPass("MemoryRedundancyElimination") {}
+
+MemoryRedundancyEliminationPass::~MemoryRedundancyEliminationPass() {}
+
+int MemoryRedundancyEliminationPass::Initialize(Compiler* compiler) {
+  if (CompilerPass::Initialize(compiler)) {
+    return 1;
+  }
+
+  alias_analysis_.Initialize(runtime_->frontend()->context_info());
+
+  return 0;
+}
+
+int MemoryRedundancyEliminationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("alloy");
+
+  // Example (slots of the stack frame):
+  //   v1.i64 = load_context +r1
+  //   v2.i64 = add v1.i64, 16
+  //   v3.i32 = load v2.i64
+  //   v4.i64 = add v1.i64, 20
+  //   store v4.i64, v3.i32
+  //   v5.i32 = load v2.i64           <-- v5 = v3, v1+20 doesn't alias v1+16
+  //   v6.i32 = load v4.i64           <-- v6 = v3, forwarded from the store
+  //
+  // Like DeadStoreEliminationPass this only tracks memory within a block, as
+  // calls, other threads and devices may change anything between them.
+  // Only stack slots and constant addresses outside of device memory are
+  // remembered. Any other pointer may be an MMIO register, where each read
+  // must happen. Stores through such pointers still forget everything they
+  // may alias.
+  auto block = builder->first_block();
+  while (block) {
+    ProcessBlock(builder, block);
+    block = block->next;
+  }
+
+  return 0;
+}
+
+void MemoryRedundancyEliminationPass::ProcessBlock(HIRBuilder* builder,
+                                                   Block* block) {
+  entries_.clear();
+
+  auto stats = compiler_->mutable_stats();
+  auto i = block->instr_head;
+  while (i) {
+    if (i->opcode == &OPCODE_LOAD_info) {
+      if (i->flags & LOAD_VOLATILE) {
+        entries_.clear();
+        i = i->next;
+        continue;
+      }
+      Address address = alias_analysis_.GetAddress(i->src1.value);
+      TypeName type = i->dest->type;
+      bool byte_swap = (i->flags & LOAD_BYTE_SWAP) != 0;
+      if (!alias_analysis_.IsPlainMemory(address)) {
+        i = i->next;
+        continue;
+      }
+      Entry* match = nullptr;
+      for (auto& entry : entries_) {
+        // The swap flags must match, as a swapped store and an unswapped load
+        // see the same memory as different values.
+        if (entry.address.base == address.base &&
+            entry.address.offset == address.offset && entry.type == type &&
+            entry.byte_swap == byte_swap) {
+          match = &entry;
+          break;
+        }
+      }
+      if (match) {
+        if (FLAGS_validate_memory_forwarding) {
+          EmitValidation(builder, i, match->value);
+        }
+        if (match->stored) {
+          ++stats->memory_forwarded_count;
+        } else {
+          ++stats->memory_reused_count;
+        }
+        i->Replace(&OPCODE_ASSIGN_info, 0);
+        i->set_src1(match->value);
+        set_changed();
+      } else {
+        AddEntry(address, type, byte_swap, i->dest, false);
+      }
+    } else if (i->opcode == &OPCODE_STORE_info) {
+      if (i->flags & STORE_VOLATILE) {
+        entries_.clear();
+        i = i->next;
+        continue;
+      }
+      Address address = alias_analysis_.GetAddress(i->src1.value);
+      Value* value = i->src2.value;
+      KillAliases(address, GetTypeSize(value->type));
+      if (alias_analysis_.IsPlainMemory(address)) {
+        AddEntry(address, value->type, (i->flags & STORE_BYTE_SWAP) != 0,
+                 value, true);
+      }
+    } else if (IsBarrier(i)) {
+      entries_.clear();
+    }
+    i = i->next;
+  }
+}
+
+void MemoryRedundancyEliminationPass::KillAliases(const Address& address,
+                                                  size_t size) {
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (alias_analysis_.MayAlias(it->address, GetTypeSize(it->type), address,
+                                 size)) {
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void MemoryRedundancyEliminationPass::AddEntry(const Address& address,
+                                               TypeName type, bool byte_swap,
+                                               Value* value, bool stored) {
+  if (entries_.size() >= kMaxEntries) {
+    entries_.erase(entries_.begin());
+  }
+  entries_.push_back({address, type, byte_swap, value, stored});
+}
+
+bool MemoryRedundancyEliminationPass::IsBarrier(Instr* i) {
+  if (i->opcode->flags &
+      (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH | OPCODE_FLAG_MEMORY)) {
+    // Calls, traps, compare exchanges, eieio/sync, etc.
+    return true;
+  }
+  return i->opcode == &OPCODE_MEMORY_BARRIER_info ||
+         i->opcode == &OPCODE_ATOMIC_ADD_info ||
+         i->opcode == &OPCODE_ATOMIC_SUB_info;
+}
+
+void MemoryRedundancyEliminationPass::EmitValidation(HIRBuilder* builder,
+                                                     Instr* i, Value* value) {
+  // v1 = load v0         <-- forwarded value
+  // becomes:
+  // v2 = load v0
+  // v3 = compare_ne v2, value
+  // debug_break_true v3
+  // v1 = value
+  // Floats (where NaNs never compare equal) and vectors are not checked.
+  if (value->type > INT64_TYPE) {
+    return;
+  }
+  auto reloaded = builder->Load(i->src1.value, value->type, i->flags);
+  builder->last_instr()->MoveBefore(i);
+  auto mismatch = builder->CompareNE(reloaded, value);
+  builder->last_instr()->MoveBefore(i);
+  builder->DebugBreakTrue(mismatch);
+  builder->last_instr()->MoveBefore(i);
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
@@ -0,0 +1,65 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_COMPILER_PASSES_MEMORY_REDUNDANCY_ELIMINATION_PASS_H_
+#define ALLOY_COMPILER_PASSES_MEMORY_REDUNDANCY_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "alloy/compiler/compiler_pass.h"
+#include "alloy/compiler/memory_alias_analysis.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// Replaces guest memory loads with the value last stored to or loaded from
+// the same address within the block, as long as no store in between may
+// alias it and no call/barrier was crossed. Only stack slots and constant
+// addresses outside of device memory are tracked (see MemoryAliasAnalysis).
+// Leaves the replaced loads as assignments for later passes to clean up.
+class MemoryRedundancyEliminationPass : public CompilerPass {
+ public:
+  MemoryRedundancyEliminationPass();
+  ~MemoryRedundancyEliminationPass() override;
+
+  int Initialize(Compiler* compiler) override;
+
+  int Run(hir::HIRBuilder* builder) override;
+
+ private:
+  typedef MemoryAliasAnalysis::Address Address;
+  // A value known to be in memory at the address.
+  struct Entry {
+    Address address;
+    hir::TypeName type;
+    bool byte_swap;
+    hir::Value* value;
+    // Whether the value was stored, rather than loaded.
+    bool stored;
+  };
+
+  void ProcessBlock(hir::HIRBuilder* builder, hir::Block* block);
+  void KillAliases(const Address& address, size_t size);
+  void AddEntry(const Address& address, hir::TypeName type, bool byte_swap,
+                hir::Value* value, bool stored);
+  bool IsBarrier(hir::Instr* i);
+  void EmitValidation(hir::HIRBuilder* builder, hir::Instr* i,
+                      hir::Value* value);
+
+ private:
+  MemoryAliasAnalysis alias_analysis_;
+  std::vector<Entry> entries_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
+
+#endif  // ALLOY_COMPILER_PASSES_MEMORY_REDUNDANCY_ELIMINATION_PASS_H_
@@ -31,7 +31,11 @@ using alloy::hir::Value;
 #define ASSERT_NO_CYCLES 0
 
 RegisterAllocationPass::RegisterAllocationPass(const MachineInfo* machine_info)
-    : CompilerPass() {
+    : RegisterAllocationPass(machine_info, Options()) {}
+
+RegisterAllocationPass::RegisterAllocationPass(const MachineInfo* machine_info,
+                                               const Options& options)
+    : CompilerPass("RegisterAllocation"), options_(options) {
   // Initialize register sets.
   // TODO(benvanik): rewrite in a way that makes sense - this is terrible.
   auto mi_sets = machine_info->register_sets;
@@ -68,299 +72,190 @@ RegisterAllocationPass::~RegisterAllocationPass() {
 int RegisterAllocationPass::Run(HIRBuilder* builder) {
   SCOPE_profile_cpu_f("alloy");
 
-  // Simple per-block allocator that operates on SSA form.
-  // Registers do not move across blocks, though this could be
-  // optimized with some intra-block analysis (dominators/etc).
-  // Really, it'd just be nice to have someone who knew what they
-  // were doing lower SSA and do this right.
-
-  uint32_t block_ordinal = 0;
-  uint32_t instr_ordinal = 0;
-  auto block = builder->first_block();
-  while (block) {
-    // Sequential block ordinals.
-    block->ordinal = block_ordinal++;
-
-    // Reset all state.
-    PrepareBlockState();
-
-    // Renumber all instructions in the block. This is required so that
-    // we can sort the usage pointers below.
-    auto instr = block->instr_head;
-    while (instr) {
-      // Sequential global instruction ordinals.
-      instr->ordinal = instr_ordinal++;
-      instr = instr->next;
-    }
-
-    instr = block->instr_head;
-    while (instr) {
-      const auto info = instr->opcode;
-      uint32_t signature = info->signature;
-
-      // Update the register use heaps.
-      AdvanceUses(instr);
-
-      // Check sources for retirement. If any are unused after this instruction
-      // we can eagerly evict them to speed up register allocation.
-      // Since X64 (and other platforms) can often take advantage of dest==src1
-      // register mappings we track retired src1 so that we can attempt to
-      // reuse it.
-      // NOTE: these checks require that the usage list be sorted!
-      bool has_preferred_reg = false;
-      RegAssignment preferred_reg = {0};
-      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
-          !instr->src1.value->IsConstant()) {
-        if (!instr->src1_use->next) {
-          // Pull off preferred register. We will try to reuse this for the
-          // dest.
-          // NOTE: set may be null if this is a store local.
-          if (preferred_reg.set) {
-            has_preferred_reg = true;
-            preferred_reg = instr->src1.value->reg;
-          }
-        }
+  // Linear scan allocator that operates on SSA form.
+  // Every value gets an interval over the instructions of all blocks laid out
+  // in order, and intervals are handed registers by increasing start. Those
+  // that ended by then give theirs back first. When a set runs out one of the
+  // active intervals is split before its next use: the value is stored to a
+  // local (once) and the rest of it becomes a new interval, starting at a
+  // reload right before that use, that is allocated when the scan gets there.
+  BuildIntervals(builder);
+
+  while (!unhandled_.empty()) {
+    auto interval = unhandled_.top();
+    unhandled_.pop();
+    ExpireIntervals(interval->start);
+
+    if (!TryAllocateRegister(interval)) {
+      // Failed to allocate register -- need to split one and try again.
+      if (!SplitOneInterval(builder, interval)) {
+        // Unable to split anything - this shouldn't happen.
+        PLOGE("Unable to spill any registers");
+        assert_always();
+        return 1;
       }
 
-      if (GET_OPCODE_SIG_TYPE_DEST(signature) == OPCODE_SIG_TYPE_V) {
-        // Must not have been set already.
-        assert_null(instr->dest->reg.set);
-
-        // Sort the usage list. We depend on this in future uses of this
-        // variable.
-        SortUsageList(instr->dest);
-
-        // If we have a preferred register, use that.
-        // This way we can help along the stupid X86 two opcode instructions.
-        bool allocated;
-        if (has_preferred_reg) {
-          // Allocate with the given preferred register. If the register is in
-          // the wrong set it will not be reused.
-          allocated = TryAllocateRegister(instr->dest, preferred_reg);
-        } else {
-          // Allocate a register. This will either reserve a free one or
-          // spill and reuse an active one.
-          allocated = TryAllocateRegister(instr->dest);
-        }
-        if (!allocated) {
-          // Failed to allocate register -- need to spill and try again.
-          // We spill only those registers we aren't using.
-          if (!SpillOneRegister(builder, block, instr->dest->type)) {
-            // Unable to spill anything - this shouldn't happen.
-            PLOGE("Unable to spill any registers");
-            assert_always();
-            return 1;
-          }
-
-          // Demand allocation.
-          if (!TryAllocateRegister(instr->dest)) {
-            // Boned.
-            PLOGE("Register allocation failed");
-            assert_always();
-            return 1;
-          }
-        }
+      // Demand allocation.
+      if (!TryAllocateRegister(interval)) {
+        // Boned.
+        PLOGE("Register allocation failed");
+        assert_always();
+        return 1;
       }
-
-      instr = instr->next;
     }
-    block = block->next;
   }
 
+  intervals_.clear();
   return 0;
 }
 
-void RegisterAllocationPass::DumpUsage(const char* name) {
-#if 0
-  fprintf(stdout, "\n%s:\n", name);
+void RegisterAllocationPass::BuildIntervals(HIRBuilder* builder) {
   for (size_t i = 0; i < poly::countof(usage_sets_.all_sets); ++i) {
     auto usage_set = usage_sets_.all_sets[i];
     if (usage_set) {
-      fprintf(stdout, "set %s:\n", usage_set->set->name);
-      fprintf(stdout, "  avail: %s\n", usage_set->availability.to_string().c_str());
-      fprintf(stdout, "  upcoming uses:\n");
-      for (auto it = usage_set->upcoming_uses.begin();
-           it != usage_set->upcoming_uses.end(); ++it) {
-        fprintf(stdout, "    v%d, used at %d\n",
-                it->value->ordinal,
-                it->use->instr->ordinal);
-      }
+      usage_set->availability.set();
+      usage_set->active.clear();
     }
   }
-  fflush(stdout);
-#endif
-}
+  intervals_.clear();
+  unhandled_ = decltype(unhandled_)();
 
-void RegisterAllocationPass::PrepareBlockState() {
-  for (size_t i = 0; i < poly::countof(usage_sets_.all_sets); ++i) {
-    auto usage_set = usage_sets_.all_sets[i];
-    if (usage_set) {
-      usage_set->availability.set();
-      usage_set->upcoming_uses.clear();
+  // Number all instructions in layout order. This is required so that we can
+  // sort the usage lists below. Positions are even so that reloads can go in
+  // between.
+  uint32_t block_ordinal = 0;
+  uint32_t position = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    // Sequential block ordinals.
+    block->ordinal = block_ordinal++;
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      instr->ordinal = position;
+      position += 2;
+    }
+  }
+
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      if (GET_OPCODE_SIG_TYPE_DEST(instr->opcode->signature) !=
+          OPCODE_SIG_TYPE_V) {
+        continue;
+      }
+      // Must not have been set already.
+      assert_null(instr->dest->reg.set);
+      // Sort the usage list. We depend on this to find next uses and ends.
+      SortUsageList(instr->dest);
+      Interval interval;
+      interval.value = instr->dest;
+      interval.start = instr->ordinal;
+      interval.end = instr->dest->use_head ? instr->dest->last_use->ordinal
+                                           : instr->ordinal;
+      intervals_.push_back(interval);
+      unhandled_.push(&intervals_.back());
     }
   }
-  DumpUsage("PrepareBlockState");
 }
 
-void RegisterAllocationPass::AdvanceUses(Instr* instr) {
+void RegisterAllocationPass::ExpireIntervals(uint32_t position) {
+  // Intervals ending at the position are done with their register: it's
+  // their last use and the instruction reads its sources before writing its
+  // dest.
   for (size_t i = 0; i < poly::countof(usage_sets_.all_sets); ++i) {
     auto usage_set = usage_sets_.all_sets[i];
     if (!usage_set) {
       break;
     }
-    auto& upcoming_uses = usage_set->upcoming_uses;
-    for (auto it = upcoming_uses.begin(); it != upcoming_uses.end();) {
-      if (!it->use) {
-        // No uses at all - we can remove right away.
-        // This comes up from instructions where the dest is never used,
-        // like the ATOMIC ops.
-        MarkRegAvailable(it->value->reg);
-        it = upcoming_uses.erase(it);
-        continue;
-      }
-      if (it->use->instr != instr) {
-        // Not yet at this instruction.
-        ++it;
-        continue;
-      }
-      // The use is from this instruction.
-      if (!it->use->next) {
-        // Last use of the value. We can retire it now.
-        MarkRegAvailable(it->value->reg);
-        it = upcoming_uses.erase(it);
+    auto& active = usage_set->active;
+    for (auto it = active.begin(); it != active.end();) {
+      if ((*it)->end <= position) {
+        usage_set->availability.set((*it)->value->reg.index, true);
+        it = active.erase(it);
       } else {
-        // Used again. Push back the next use.
-        // Note that we may be used multiple times this instruction, so
-        // eat those.
-        auto next_use = it->use->next;
-        while (next_use->next && next_use->instr == instr) {
-          next_use = next_use->next;
-        }
-        // Remove the iterator.
-        auto value = it->value;
-        it = upcoming_uses.erase(it);
-        assert_true(next_use->instr->block == instr->block);
-        assert_true(value->def->block == instr->block);
-        upcoming_uses.emplace_back(value, next_use);
+        ++it;
       }
     }
   }
-  DumpUsage("AdvanceUses");
-}
-
-bool RegisterAllocationPass::IsRegInUse(const RegAssignment& reg) {
-  RegisterSetUsage* usage_set;
-  if (reg.set == usage_sets_.int_set->set) {
-    usage_set = usage_sets_.int_set;
-  } else if (reg.set == usage_sets_.float_set->set) {
-    usage_set = usage_sets_.float_set;
-  } else {
-    usage_set = usage_sets_.vec_set;
-  }
-  return !usage_set->availability.test(reg.index);
 }
 
-RegisterAllocationPass::RegisterSetUsage* RegisterAllocationPass::MarkRegUsed(
-    const RegAssignment& reg, Value* value, Value::Use* use) {
-  auto usage_set = RegisterSetForValue(value);
-  usage_set->availability.set(reg.index, false);
-  usage_set->upcoming_uses.emplace_back(value, use);
-  DumpUsage("MarkRegUsed");
-  return usage_set;
-}
-
-RegisterAllocationPass::RegisterSetUsage*
-RegisterAllocationPass::MarkRegAvailable(const hir::RegAssignment& reg) {
-  RegisterSetUsage* usage_set;
-  if (reg.set == usage_sets_.int_set->set) {
-    usage_set = usage_sets_.int_set;
-  } else if (reg.set == usage_sets_.float_set->set) {
-    usage_set = usage_sets_.float_set;
+bool RegisterAllocationPass::TryAllocateRegister(Interval* interval) {
+  auto value = interval->value;
+  auto usage_set = RegisterSetForType(value->type);
+
+  // If src1 dies at the def its register was just given back. Reusing it
+  // helps along the stupid X86 two opcode instructions.
+  // NOTE: set may be null if this is a store local.
+  auto def = value->def;
+  if (options_.prefer_src1_register &&
+      GET_OPCODE_SIG_TYPE_SRC1(def->opcode->signature) == OPCODE_SIG_TYPE_V &&
+      !def->src1.value->IsConstant() &&
+      def->src1.value->reg.set == usage_set->set &&
+      def->src1.value->last_use == def &&
+      usage_set->availability.test(def->src1.value->reg.index)) {
+    value->reg = def->src1.value->reg;
   } else {
-    usage_set = usage_sets_.vec_set;
-  }
-  usage_set->availability.set(reg.index, true);
-  return usage_set;
-}
-
-bool RegisterAllocationPass::TryAllocateRegister(
-    Value* value, const RegAssignment& preferred_reg) {
-  // If the preferred register matches type and is available, use it.
-  auto usage_set = RegisterSetForValue(value);
-  if (usage_set->set == preferred_reg.set) {
-    // Check if available.
-    if (!IsRegInUse(preferred_reg)) {
-      // Mark as in-use and return. Best case.
-      MarkRegUsed(preferred_reg, value, value->use_head);
-      value->reg = preferred_reg;
-      return true;
+    // Find the first free register, if any.
+    // We have to ensure it's a valid one (in our count).
+    uint32_t first_unused = 0;
+    bool none_used = poly::bit_scan_forward(
+        static_cast<uint32_t>(usage_set->availability.to_ulong()),
+        &first_unused);
+    if (!none_used || first_unused >= usage_set->count) {
+      // None available! Split required.
+      return false;
     }
-  }
-
-  // Otherwise, fallback to allocating like normal.
-  return TryAllocateRegister(value);
-}
-
-bool RegisterAllocationPass::TryAllocateRegister(Value* value) {
-  // Get the set this register is in.
-  RegisterSetUsage* usage_set = RegisterSetForValue(value);
-
-  // Find the first free register, if any.
-  // We have to ensure it's a valid one (in our count).
-  uint32_t first_unused = 0;
-  bool none_used = poly::bit_scan_forward(
-      static_cast<uint32_t>(usage_set->availability.to_ulong()), &first_unused);
-  if (none_used && first_unused < usage_set->count) {
-    // Available! Use it!
     value->reg.set = usage_set->set;
     value->reg.index = first_unused;
-    MarkRegUsed(value->reg, value, value->use_head);
-    return true;
   }
-
-  // None available! Spill required.
-  return false;
+  usage_set->availability.set(value->reg.index, false);
+  usage_set->active.push_back(interval);
+  return true;
 }
 
-bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
-                                              TypeName required_type) {
-  // Get the set that we will be picking from.
-  RegisterSetUsage* usage_set;
-  if (required_type <= INT64_TYPE) {
-    usage_set = usage_sets_.int_set;
-  } else if (required_type <= FLOAT64_TYPE) {
-    usage_set = usage_sets_.float_set;
-  } else {
-    usage_set = usage_sets_.vec_set;
+bool RegisterAllocationPass::SplitOneInterval(HIRBuilder* builder,
+                                              Interval* interval) {
+  auto usage_set = RegisterSetForType(interval->value->type);
+  uint32_t position = interval->start;
+
+  // Pick the one that frees a register for longest per instruction added.
+  // Splitting costs a reload before the next use, plus a store if the value
+  // doesn't already live in a local from a previous split. With equal costs
+  // this is the one with the furthest next use.
+  // The reload must come after the position so that the scan moves on, which
+  // rules out values used by the instruction a reload at the position is for.
+  Interval* split_interval = nullptr;
+  Value::Use* next_use = nullptr;
+  uint32_t best_weight = 0;
+  for (auto active : usage_set->active) {
+    auto use = active->value->use_head;
+    while (use && use->instr->ordinal <= position) {
+      use = use->next;
+    }
+    if (!use || use->instr->ordinal <= position + 1) {
+      continue;
+    }
+    uint32_t distance = use->instr->ordinal - position + 1;
+    uint32_t weight = distance;
+    if (options_.weigh_spill_cost) {
+      uint32_t cost = active->value->local_slot ? 1 : 2;
+      weight = (distance << 1) / cost;
+    }
+    if (!split_interval || weight > best_weight) {
+      split_interval = active;
+      next_use = use;
+      best_weight = weight;
+    }
+  }
+  if (!split_interval) {
+    return false;
   }
+  auto spill_value = split_interval->value;
+  Value::Use* prev_use = next_use->prev;
+  assert_true(spill_value->def->block == next_use->instr->block);
 
-  DumpUsage("SpillOneRegister (pre)");
-  // Pick the one with the furthest next use.
-  assert_true(!usage_set->upcoming_uses.empty());
-  auto furthest_usage = std::max_element(usage_set->upcoming_uses.begin(),
-                                         usage_set->upcoming_uses.end(),
-                                         RegisterUsage::Comparer());
-  assert_true(furthest_usage->value->def->block == block);
-  assert_true(furthest_usage->use->instr->block == block);
-  auto spill_value = furthest_usage->value;
-  Value::Use* prev_use = furthest_usage->use->prev;
-  Value::Use* next_use = furthest_usage->use;
-  assert_not_null(next_use);
-  usage_set->upcoming_uses.erase(furthest_usage);
-  DumpUsage("SpillOneRegister (post)");
-  const auto reg = spill_value->reg;
-
-  // We know the spill_value use list is sorted, so we can cut it right now.
-  // This makes it easier down below.
-  auto new_head_use = next_use;
-
-  // Allocate local.
+  // Store to a local.
   if (spill_value->local_slot) {
     // Value is already assigned a slot. Since we allocate in order and this is
     // all SSA we know the stored value will be exactly what we want. Yay,
     // we can prevent the redundant store!
-    // In fact, we may even want to pin this spilled value so that we always
-    // use the spilled value and prevent the need for more locals.
   } else {
     // Allocate a local slot.
     spill_value->local_slot = builder->AllocLocal(spill_value->type);
@@ -368,32 +263,21 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
     // Add store.
     builder->StoreLocal(spill_value->local_slot, spill_value);
     auto spill_store = builder->last_instr();
-    auto spill_store_use = spill_store->src2_use;
-    assert_null(spill_store_use->prev);
+    spill_store->ordinal =
+        prev_use ? prev_use->instr->ordinal : spill_value->def->ordinal;
     if (prev_use && prev_use->instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
       // Instruction is paired. This is bad. We will insert the spill after the
       // paired instruction.
       assert_not_null(prev_use->instr->next);
       spill_store->MoveBefore(prev_use->instr->next);
-
-      // Update last use.
-      spill_value->last_use = spill_store;
     } else if (prev_use) {
-      // We insert the store immediately before the previous use.
-      // If we were smarter we could then re-run allocation and reuse the
-      // register
-      // once dropped.
+      // We insert the store immediately before the previous use, while the
+      // value is still in its register.
       spill_store->MoveBefore(prev_use->instr);
-
-      // Update last use.
-      spill_value->last_use = prev_use->instr;
     } else {
       // This is the first use, so the only thing we have is the define.
       // Move the store to right after that.
       spill_store->MoveBefore(spill_value->def->next);
-
-      // Update last use.
-      spill_value->last_use = spill_store;
     }
   }
 
@@ -403,14 +287,12 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
 #endif  // ASSERT_NO_CYCLES
 
   // Add load.
-  // Inserted immediately before the next use. Since by definition the next
-  // use is after the instruction requesting the spill we know we haven't
-  // done allocation for that code yet and can let that be handled
-  // automatically when we get to it.
+  // Inserted immediately before the next use, which is after the position,
+  // so the scan gets to its interval later on.
   auto new_value = builder->LoadLocal(spill_value->local_slot);
   auto spill_load = builder->last_instr();
+  spill_load->ordinal = next_use->instr->ordinal - 1;
   spill_load->MoveBefore(next_use->instr);
-// Note: implicit first use added.
 
 #if ASSERT_NO_CYCLES
   builder->AssertNoCycles();
@@ -423,10 +305,7 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
 
   // Rename all future uses of the SSA value to the new value as loaded
   // from the local.
-  // We can quickly do this by walking the use list. Because the list is
-  // already sorted we know we are going to end up with a sorted list.
-  auto walk_use = new_head_use;
-  auto new_use_tail = walk_use;
+  auto walk_use = next_use;
   while (walk_use) {
     auto next_walk_use = walk_use->next;
     auto instr = walk_use->instr;
@@ -449,23 +328,30 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
     }
 
     walk_use = next_walk_use;
-    if (walk_use) {
-      new_use_tail = walk_use;
-    }
   }
-  new_value->last_use = new_use_tail->instr;
-
-  // Update tracking.
-  MarkRegAvailable(reg);
-
+  SortUsageList(new_value);
+  SortUsageList(spill_value);
+
+  // The split off part waits its turn like any other interval, and the rest
+  // gives up its register right away.
+  Interval new_interval;
+  new_interval.value = new_value;
+  new_interval.start = spill_load->ordinal;
+  new_interval.end = new_value->last_use->ordinal;
+  intervals_.push_back(new_interval);
+  unhandled_.push(&intervals_.back());
+
+  auto& active = usage_set->active;
+  active.erase(std::find(active.begin(), active.end(), split_interval));
+  usage_set->availability.set(spill_value->reg.index, true);
   return true;
 }
 
 RegisterAllocationPass::RegisterSetUsage*
-RegisterAllocationPass::RegisterSetForValue(const Value* value) {
-  if (value->type <= INT64_TYPE) {
+RegisterAllocationPass::RegisterSetForType(TypeName type) {
+  if (type <= INT64_TYPE) {
     return usage_sets_.int_set;
-  } else if (value->type <= FLOAT64_TYPE) {
+  } else if (type <= FLOAT64_TYPE) {
     return usage_sets_.float_set;
   } else {
     return usage_sets_.vec_set;
@@ -10,8 +10,9 @@
 #ifndef ALLOY_COMPILER_PASSES_REGISTER_ALLOCATION_PASS_H_
 #define ALLOY_COMPILER_PASSES_REGISTER_ALLOCATION_PASS_H_
 
-#include <algorithm>
 #include <bitset>
+#include <deque>
+#include <queue>
 #include <vector>
 
 #include "alloy/backend/machine_info.h"
@@ -23,59 +24,68 @@ namespace passes {
 
 class RegisterAllocationPass : public CompilerPass {
  public:
+  // Choices of the allocator that can be turned off, so that alloy-bench can
+  // compare against how it used to allocate.
+  struct Options {
+    // Weigh the cost of a spill against the distance to the next use, rather
+    // than always spilling the value with the furthest next use.
+    bool weigh_spill_cost = true;
+    // Give the dest the register of a src1 that dies at the instruction.
+    bool prefer_src1_register = true;
+  };
+
   RegisterAllocationPass(const backend::MachineInfo* machine_info);
+  RegisterAllocationPass(const backend::MachineInfo* machine_info,
+                         const Options& options);
   ~RegisterAllocationPass() override;
 
   int Run(hir::HIRBuilder* builder) override;
 
  private:
-  // TODO(benvanik): rewrite all this set shit -- too much indirection, the
-  // complexity is not needed.
-  struct RegisterUsage {
+  // Where a value needs a register: from the instruction defining it to its
+  // last use, as positions in the order the blocks are laid out. Values never
+  // live across blocks, so neither does an interval.
+  struct Interval {
     hir::Value* value;
-    hir::Value::Use* use;
-    RegisterUsage() : value(nullptr), use(nullptr) {}
-    RegisterUsage(hir::Value* value_, hir::Value::Use* use_)
-        : value(value_), use(use_) {}
-    struct Comparer : std::binary_function<RegisterUsage, RegisterUsage, bool> {
-      bool operator()(const RegisterUsage& a, const RegisterUsage& b) const {
-        return a.use->instr->ordinal < b.use->instr->ordinal;
-      }
-    };
+    uint32_t start;
+    uint32_t end;
+  };
+  struct IntervalStartGreater {
+    bool operator()(const Interval* a, const Interval* b) const {
+      return a->start > b->start;
+    }
   };
   struct RegisterSetUsage {
     const backend::MachineInfo::RegisterSet* set = nullptr;
     uint32_t count = 0;
     std::bitset<32> availability = 0;
-    // TODO(benvanik): another data type.
-    std::vector<RegisterUsage> upcoming_uses;
+    // Intervals currently holding a register of the set.
+    std::vector<Interval*> active;
   };
 
-  void DumpUsage(const char* name);
-  void PrepareBlockState();
-  void AdvanceUses(hir::Instr* instr);
-  bool IsRegInUse(const hir::RegAssignment& reg);
-  RegisterSetUsage* MarkRegUsed(const hir::RegAssignment& reg,
-                                hir::Value* value, hir::Value::Use* use);
-  RegisterSetUsage* MarkRegAvailable(const hir::RegAssignment& reg);
-
-  bool TryAllocateRegister(hir::Value* value,
-                           const hir::RegAssignment& preferred_reg);
-  bool TryAllocateRegister(hir::Value* value);
-  bool SpillOneRegister(hir::HIRBuilder* builder, hir::Block* block,
-                        hir::TypeName required_type);
+  void BuildIntervals(hir::HIRBuilder* builder);
+  void ExpireIntervals(uint32_t position);
+  bool TryAllocateRegister(Interval* interval);
+  bool SplitOneInterval(hir::HIRBuilder* builder, Interval* interval);
 
-  RegisterSetUsage* RegisterSetForValue(const hir::Value* value);
+  RegisterSetUsage* RegisterSetForType(hir::TypeName type);
 
   void SortUsageList(hir::Value* value);
 
  private:
+  Options options_;
   struct {
     RegisterSetUsage* int_set = nullptr;
     RegisterSetUsage* float_set = nullptr;
     RegisterSetUsage* vec_set = nullptr;
     RegisterSetUsage* all_sets[3];
   } usage_sets_;
+  // All intervals of the function. A deque so that splitting one doesn't move
+  // the others.
+  std::deque<Interval> intervals_;
+  // Intervals yet to be given a register, by increasing start.
+  std::priority_queue<Interval*, std::vector<Interval*>, IntervalStartGreater>
+      unhandled_;
 };
 
 }  // namespace passes
@@ -22,7 +22,7 @@ using alloy::hir::HIRBuilder;
 using alloy::hir::Instr;
 using alloy::hir::Value;
 
-SimplificationPass::SimplificationPass() : CompilerPass() {}
+SimplificationPass::SimplificationPass() : CompilerPass("Simplification") {}
 
 SimplificationPass::~SimplificationPass() {}
 
@@ -81,6 +81,7 @@ void SimplificationPass::CheckTruncate(Instr* i) {
         // Types match, use original by turning this into an assign.
         i->Replace(&OPCODE_ASSIGN_info, 0);
         i->set_src1(def->src1.value);
+        set_changed();
       }
     } else if (def->opcode == &OPCODE_ZERO_EXTEND_info) {
       // Value comes from a zero extend.
@@ -88,6 +89,7 @@ void SimplificationPass::CheckTruncate(Instr* i) {
         // Types match, use original by turning this into an assign.
         i->Replace(&OPCODE_ASSIGN_info, 0);
         i->set_src1(def->src1.value);
+        set_changed();
       }
     }
   }
@@ -108,6 +110,7 @@ void SimplificationPass::CheckByteSwap(Instr* i) {
       // Types match, use original by turning this into an assign.
       i->Replace(&OPCODE_ASSIGN_info, 0);
       i->set_src1(def->src1.value);
+      set_changed();
     }
   }
 }
@@ -136,13 +139,25 @@ void SimplificationPass::SimplifyAssignments(HIRBuilder* builder) {
     while (i) {
       uint32_t signature = i->opcode->signature;
       if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
-        i->set_src1(CheckValue(i->src1.value));
+        auto value = CheckValue(i->src1.value);
+        if (value != i->src1.value) {
+          i->set_src1(value);
+          set_changed();
+        }
       }
       if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
-        i->set_src2(CheckValue(i->src2.value));
+        auto value = CheckValue(i->src2.value);
+        if (value != i->src2.value) {
+          i->set_src2(value);
+          set_changed();
+        }
       }
       if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
-        i->set_src3(CheckValue(i->src3.value));
+        auto value = CheckValue(i->src3.value);
+        if (value != i->src3.value) {
+          i->set_src3(value);
+          set_changed();
+        }
       }
       i = i->next;
     }
@@ -27,7 +27,7 @@ using alloy::hir::Instr;
 using alloy::hir::OpcodeSignatureType;
 using alloy::hir::Value;
 
-ValidationPass::ValidationPass() : CompilerPass() {}
+ValidationPass::ValidationPass() : CompilerPass("Validation") {}
 
 ValidationPass::~ValidationPass() {}
 
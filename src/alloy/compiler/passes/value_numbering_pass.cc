@@ -0,0 +1,231 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/compiler/passes/value_numbering_pass.h"
+
+#include <cstring>
+#include <utility>
+
+#include "alloy/compiler/compiler.h"
+#include "alloy/runtime/runtime.h"
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/profiling.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace alloy::hir;
+
+using alloy::hir::Block;
+using alloy::hir::HIRBuilder;
+using alloy::hir::Instr;
+using alloy::hir::OpcodeInfo;
+using alloy::hir::Value;
+
+namespace {
+
+// Initial size of the value table. Must be a power of two.
+const size_t kInitialTableSize = 64;
+
+}  // namespace
+
+ValueNumberingPass::ValueNumberingPass()
+    : CompilerPass("ValueNumbering"),
+      table_(kInitialTableSize),
+      table_count_(0),
+      block_id_(0) {}
+
+ValueNumberingPass::~ValueNumberingPass() {}
+
+int ValueNumberingPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("alloy");
+
+  // Example:
+  //   v1 = add v0, 4
+  //   v2 = load v1
+  //   v3 = add v0, 4       <-- v3 = v1
+  //   store v3, v2
+  //
+  // This only looks within each block. Reusing a value from a dominating
+  // block would need a store_local/load_local pair to carry it over, which
+  // costs more than the add or mask it saves. Most redundancy comes from the
+  // frontend recomputing effective addresses and masks for each guest
+  // instruction, which is almost always within a block anyway.
+  size_t removed_count = 0;
+  auto block = builder->first_block();
+  while (block) {
+    removed_count += ProcessBlock(block);
+    block = block->next;
+  }
+  compiler_->mutable_stats()->value_numbering_removed_count += removed_count;
+  if (removed_count) {
+    set_changed();
+  }
+
+  return 0;
+}
+
+size_t ValueNumberingPass::ProcessBlock(Block* block) {
+  // Empties the table. Ids start at 1 so that zeroed slots are empty, and on
+  // wrap around the slots are zeroed again.
+  if (++block_id_ == 0) {
+    for (auto& entry : table_) {
+      entry.block_id = 0;
+    }
+    block_id_ = 1;
+  }
+  table_count_ = 0;
+
+  size_t removed_count = 0;
+  Key key;
+  auto i = block->instr_head;
+  while (i) {
+    if (IsCandidate(i)) {
+      MakeKey(i, &key);
+      auto existing_instr = FindOrInsert(key, i);
+      if (existing_instr) {
+        // Already computed - reuse the existing value.
+        Value* existing = existing_instr->dest;
+        i->Replace(&OPCODE_ASSIGN_info, 0);
+        i->set_src1(existing);
+        ++removed_count;
+      }
+    }
+    i = i->next;
+  }
+  return removed_count;
+}
+
+bool ValueNumberingPass::IsCandidate(Instr* i) {
+  if (!i->dest) {
+    return false;
+  }
+  // Anything that reads state that may change between two otherwise identical
+  // instructions is out.
+  if (i->opcode->flags &
+      (OPCODE_FLAG_BRANCH | OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE |
+       OPCODE_FLAG_IGNORE | OPCODE_FLAG_PAIRED_PREV)) {
+    return false;
+  }
+  if (i->opcode == &OPCODE_ASSIGN_info ||
+      i->opcode == &OPCODE_LOAD_CONTEXT_info ||
+      i->opcode == &OPCODE_LOAD_LOCAL_info ||
+      i->opcode == &OPCODE_LOAD_CLOCK_info) {
+    return false;
+  }
+  // The host flags the following instruction reads are only set by the
+  // instruction itself.
+  if (i->next && (i->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV)) {
+    return false;
+  }
+  return true;
+}
+
+void ValueNumberingPass::MakeKey(Instr* i, Key* out_key) {
+  // Keys are hashed and compared as raw bytes, so padding must be zeroed.
+  std::memset(out_key, 0, sizeof(Key));
+  out_key->opcode = i->opcode;
+  out_key->flags = i->flags;
+  out_key->dest_type = i->dest->type;
+  uint32_t signature = i->opcode->signature;
+  MakeOperand(GET_OPCODE_SIG_TYPE_SRC1(signature), i->src1,
+              &out_key->operands[0]);
+  MakeOperand(GET_OPCODE_SIG_TYPE_SRC2(signature), i->src2,
+              &out_key->operands[1]);
+  MakeOperand(GET_OPCODE_SIG_TYPE_SRC3(signature), i->src3,
+              &out_key->operands[2]);
+  if (i->opcode->flags & OPCODE_FLAG_COMMUNATIVE) {
+    // Canonicalize so that add a, b and add b, a match.
+    if (std::memcmp(&out_key->operands[0], &out_key->operands[1],
+                    sizeof(Operand)) > 0) {
+      std::swap(out_key->operands[0], out_key->operands[1]);
+    }
+  }
+}
+
+void ValueNumberingPass::MakeOperand(uint32_t sig_type, const Instr::Op& op,
+                                     Operand* out_operand) {
+  out_operand->kind = sig_type;
+  switch (sig_type) {
+    case OPCODE_SIG_TYPE_X:
+      break;
+    case OPCODE_SIG_TYPE_L:
+      out_operand->bits[0] = reinterpret_cast<uint64_t>(op.label);
+      break;
+    case OPCODE_SIG_TYPE_O:
+      out_operand->bits[0] = op.offset;
+      break;
+    case OPCODE_SIG_TYPE_S:
+      out_operand->bits[0] = reinterpret_cast<uint64_t>(op.symbol_info);
+      break;
+    case OPCODE_SIG_TYPE_V: {
+      // Look through assignments (including the ones we've added) so that
+      // uses of a replaced value match uses of the original.
+      Value* value = op.value;
+      while (value->def && value->def->opcode == &OPCODE_ASSIGN_info) {
+        value = value->def->src1.value;
+      }
+      out_operand->kind |= value->type << 8;
+      if (value->IsConstant()) {
+        // Only the bytes of the type are meaningful.
+        out_operand->kind |= 1 << 16;
+        std::memcpy(out_operand->bits, &value->constant,
+                    GetTypeSize(value->type));
+      } else {
+        out_operand->bits[0] = reinterpret_cast<uint64_t>(value);
+      }
+      break;
+    }
+  }
+}
+
+Instr* ValueNumberingPass::FindOrInsert(const Key& key, Instr* i) {
+  // Linear probing, kept at most half full.
+  if ((table_count_ + 1) * 2 > table_.size()) {
+    GrowTable();
+  }
+  size_t mask = table_.size() - 1;
+  size_t index = static_cast<size_t>(XXH64(&key, sizeof(Key), 0)) & mask;
+  while (table_[index].block_id == block_id_) {
+    auto& entry = table_[index];
+    if (std::memcmp(&entry.key, &key, sizeof(Key)) == 0) {
+      return entry.instr;
+    }
+    index = (index + 1) & mask;
+  }
+  auto& entry = table_[index];
+  entry.key = key;
+  entry.instr = i;
+  entry.block_id = block_id_;
+  ++table_count_;
+  return nullptr;
+}
+
+void ValueNumberingPass::GrowTable() {
+  std::vector<Entry> old_table(table_.size() * 2);
+  old_table.swap(table_);
+  size_t mask = table_.size() - 1;
+  for (auto& old_entry : old_table) {
+    if (old_entry.block_id != block_id_) {
+      continue;
+    }
+    size_t index =
+        static_cast<size_t>(XXH64(&old_entry.key, sizeof(Key), 0)) & mask;
+    while (table_[index].block_id == block_id_) {
+      index = (index + 1) & mask;
+    }
+    table_[index] = old_entry;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
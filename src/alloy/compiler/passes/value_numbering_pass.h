@@ -0,0 +1,74 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_COMPILER_PASSES_VALUE_NUMBERING_PASS_H_
+#define ALLOY_COMPILER_PASSES_VALUE_NUMBERING_PASS_H_
+
+#include <vector>
+
+#include "alloy/compiler/compiler_pass.h"
+
+namespace alloy {
+namespace compiler {
+namespace passes {
+
+// Finds instructions that recompute a value already available earlier in the
+// same block and replaces them with an assignment of that value. The
+// assignments are folded away by DeadCodeEliminationPass.
+class ValueNumberingPass : public CompilerPass {
+ public:
+  ValueNumberingPass();
+  ~ValueNumberingPass() override;
+
+  int Run(hir::HIRBuilder* builder) override;
+
+ private:
+  struct Operand {
+    uint64_t bits[2];
+    uint32_t kind;
+    uint32_t reserved;
+  };
+  struct Key {
+    const hir::OpcodeInfo* opcode;
+    uint32_t flags;
+    uint32_t dest_type;
+    Operand operands[3];
+  };
+  // Slots of a previous block are empty, which saves clearing the table for
+  // every block.
+  struct Entry {
+    Key key;
+    hir::Instr* instr;
+    uint32_t block_id;
+  };
+
+  size_t ProcessBlock(hir::Block* block);
+  bool IsCandidate(hir::Instr* i);
+  void MakeKey(hir::Instr* i, Key* out_key);
+  void MakeOperand(uint32_t sig_type, const hir::Instr::Op& op,
+                   Operand* out_operand);
+  // Returns the instruction computing the key in the block, or records i as
+  // that instruction and returns null.
+  hir::Instr* FindOrInsert(const Key& key, hir::Instr* i);
+  void GrowTable();
+
+ private:
+  // Open addressing table of the values computed in the current block. It
+  // keeps its size across blocks and functions, so the pass doesn't allocate
+  // once it's warm.
+  std::vector<Entry> table_;
+  size_t table_count_;
+  uint32_t block_id_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace alloy
+
+#endif  // ALLOY_COMPILER_PASSES_VALUE_NUMBERING_PASS_H_
@@ -35,7 +35,7 @@ using alloy::hir::HIRBuilder;
 using alloy::hir::OpcodeInfo;
 using alloy::hir::Value;
 
-ValueReductionPass::ValueReductionPass() : CompilerPass() {}
+ValueReductionPass::ValueReductionPass() : CompilerPass("ValueReduction") {}
 
 ValueReductionPass::~ValueReductionPass() {}
 
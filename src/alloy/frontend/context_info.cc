@@ -16,7 +16,9 @@ ContextInfo::ContextInfo(size_t size, uintptr_t thread_state_offset,
                          uintptr_t thread_id_offset)
     : size_(size),
       thread_state_offset_(thread_state_offset),
-      thread_id_offset_(thread_id_offset) {}
+      thread_id_offset_(thread_id_offset),
+      has_stack_pointer_(false),
+      stack_pointer_offset_(0) {}
 
 ContextInfo::~ContextInfo() {}
 
@@ -12,6 +12,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 namespace alloy {
 namespace frontend {
@@ -27,10 +28,36 @@ class ContextInfo {
   uintptr_t thread_state_offset() const { return thread_state_offset_; }
   uintptr_t thread_id_offset() const { return thread_id_offset_; }
 
+  // Ranges of the context the guest ABI doesn't preserve across calls.
+  // Functions never read them on entry and callers never read them after a
+  // call returns without first writing them.
+  struct Range {
+    uintptr_t offset;
+    size_t size;
+  };
+  const std::vector<Range>& call_clobbered_ranges() const {
+    return call_clobbered_ranges_;
+  }
+  void AddCallClobberedRange(uintptr_t offset, size_t size) {
+    call_clobbered_ranges_.push_back({offset, size});
+  }
+
+  // Offset of the guest stack pointer register, if the guest has one. Memory
+  // addressed relative to it is assumed to never alias absolute addresses.
+  bool has_stack_pointer() const { return has_stack_pointer_; }
+  uintptr_t stack_pointer_offset() const { return stack_pointer_offset_; }
+  void set_stack_pointer_offset(uintptr_t offset) {
+    has_stack_pointer_ = true;
+    stack_pointer_offset_ = offset;
+  }
+
  private:
   size_t size_;
   uintptr_t thread_state_offset_;
   uintptr_t thread_id_offset_;
+  std::vector<Range> call_clobbered_ranges_;
+  bool has_stack_pointer_;
+  uintptr_t stack_pointer_offset_;
 };
 
 }  // namespace frontend
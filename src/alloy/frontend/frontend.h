@@ -11,6 +11,7 @@
 #define ALLOY_FRONTEND_FRONTEND_H_
 
 #include <memory>
+#include <vector>
 
 #include "alloy/frontend/context_info.h"
 #include "alloy/memory.h"
@@ -40,8 +41,14 @@ class Frontend {
   virtual int DeclareFunction(runtime::FunctionInfo* symbol_info) = 0;
   virtual int DefineFunction(runtime::FunctionInfo* symbol_info,
                              uint32_t debug_info_flags, uint32_t trace_flags,
+                             runtime::FunctionTier tier,
                              runtime::Function** out_function) = 0;
 
+  // Finds the guest addresses of all functions directly called (or tail
+  // called) from the given function. The function extents must be known.
+  virtual int FindCallees(runtime::FunctionInfo* symbol_info,
+                          std::vector<uint64_t>* out_callees) = 0;
+
  protected:
   runtime::Runtime* runtime_;
   std::unique_ptr<ContextInfo> context_info_;
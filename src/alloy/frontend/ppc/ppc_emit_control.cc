@@ -25,6 +25,12 @@ using alloy::hir::Value;
 int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
                      Value* nia, bool lk, Value* cond = NULL,
                      bool expect_true = true, bool nia_is_lr = false) {
+  // Small leaf functions are spliced in instead of being called.
+  if (!cond && nia->IsConstant() &&
+      f.EmitInlinedLeaf(cia, nia->AsUint64() & 0xFFFFFFFF, lk)) {
+    return 0;
+  }
+
   uint32_t call_flags = 0;
 
   // TODO(benvanik): this may be wrong and overwrite LRs when not desired!
@@ -262,6 +268,12 @@ XEEMITTER(bcctrx, 0x4C000420, XL)(PPCHIRBuilder& f, InstrData& i) {
     }
   }
 
+  if (!cond_ok && !i.XL.LK) {
+    // Switches jump straight to their cases rather than resolving the target
+    // as a function.
+    f.EmitJumpTableBranches(i.address);
+  }
+
   bool expect_true = !not_cond_ok;
   return InstrEmit_branch(f, "bcctrx", i.address, f.LoadCTR(), i.XL.LK, cond_ok,
                           expect_true);
@@ -657,20 +657,17 @@ XEEMITTER(stswx, 0x7C00052A, X)(PPCHIRBuilder& f, InstrData& i) {
 // Memory synchronization (A-18)
 
 XEEMITTER(eieio, 0x7C0006AC, X)(PPCHIRBuilder& f, InstrData& i) {
-  // XEINSTRNOTIMPLEMENTED();
-  f.Nop();
+  f.Barrier();
   return 0;
 }
 
 XEEMITTER(sync, 0x7C0004AC, X)(PPCHIRBuilder& f, InstrData& i) {
-  // XEINSTRNOTIMPLEMENTED();
-  f.Nop();
+  f.Barrier();
   return 0;
 }
 
 XEEMITTER(isync, 0x4C00012C, XL)(PPCHIRBuilder& f, InstrData& i) {
-  // XEINSTRNOTIMPLEMENTED();
-  f.Nop();
+  f.Barrier();
   return 0;
 }
 
@@ -9,9 +9,12 @@
 
 #include "alloy/frontend/ppc/ppc_frontend.h"
 
+#include "alloy/alloy-private.h"
+#include "alloy/compiler/compiler.h"
 #include "alloy/frontend/ppc/ppc_context.h"
 #include "alloy/frontend/ppc/ppc_disasm.h"
 #include "alloy/frontend/ppc/ppc_emit.h"
+#include "alloy/frontend/ppc/ppc_scanner.h"
 #include "alloy/frontend/ppc/ppc_translator.h"
 #include "alloy/runtime/runtime.h"
 
@@ -19,8 +22,10 @@ namespace alloy {
 namespace frontend {
 namespace ppc {
 
+using alloy::compiler::Compiler;
 using alloy::runtime::Function;
 using alloy::runtime::FunctionInfo;
+using alloy::runtime::Module;
 using alloy::runtime::Runtime;
 
 void InitializeIfNeeded();
@@ -50,6 +55,16 @@ PPCFrontend::PPCFrontend(Runtime* runtime) : Frontend(runtime) {
   std::unique_ptr<ContextInfo> context_info(
       new ContextInfo(sizeof(PPCContext), offsetof(PPCContext, thread_state),
                       offsetof(PPCContext, thread_id)));
+  // CR0, CR1 and CR5-7 are volatile in the PPC ABI. With
+  // --drop_call_clobbered_context this lets the compiler drop the CR bits
+  // most compares and record forms compute but only the next branch reads.
+  context_info->AddCallClobberedRange(offsetof(PPCContext, cr0), 4);
+  context_info->AddCallClobberedRange(offsetof(PPCContext, cr1), 4);
+  context_info->AddCallClobberedRange(offsetof(PPCContext, cr5), 4);
+  context_info->AddCallClobberedRange(offsetof(PPCContext, cr6), 4);
+  context_info->AddCallClobberedRange(offsetof(PPCContext, cr7), 4);
+  // r1 is the stack pointer.
+  context_info->set_stack_pointer_offset(offsetof(PPCContext, r) + 1 * 8);
   // Add fields/etc.
   context_info_ = std::move(context_info);
 }
@@ -57,6 +72,12 @@ PPCFrontend::PPCFrontend(Runtime* runtime) : Frontend(runtime) {
 PPCFrontend::~PPCFrontend() {
   // Force cleanup now before we deinit.
   translator_pool_.Reset();
+
+  // All translators (and their compilers) are gone so the totals are final.
+  if (FLAGS_log_compiler_pass_stats) {
+    Compiler::LogTotalPassStats();
+    LogModuleStats();
+  }
 }
 
 void CheckGlobalLock(PPCContext* ppc_state, void* arg0, void* arg1) {
@@ -104,15 +125,45 @@ int PPCFrontend::DeclareFunction(FunctionInfo* symbol_info) {
 
 int PPCFrontend::DefineFunction(FunctionInfo* symbol_info,
                                 uint32_t debug_info_flags,
-                                uint32_t trace_flags,
+                                uint32_t trace_flags, FunctionTier tier,
                                 Function** out_function) {
   PPCTranslator* translator = translator_pool_.Allocate(this);
-  int result =
-      translator->Translate(symbol_info, debug_info_flags, trace_flags, out_function);
+  int result = translator->Translate(symbol_info, debug_info_flags,
+                                     trace_flags, tier, out_function);
   translator_pool_.Release(translator);
   return result;
 }
 
+int PPCFrontend::FindCallees(FunctionInfo* symbol_info,
+                             std::vector<uint64_t>* out_callees) {
+  PPCScanner scanner(this);
+  *out_callees = scanner.FindCallees(symbol_info);
+  return 0;
+}
+
+void PPCFrontend::AddModuleStats(Module* module,
+                                 const Compiler::Stats& stats) {
+  std::lock_guard<std::mutex> guard(module_stats_lock_);
+  auto& module_stats = module_stats_[module->name()];
+  ++module_stats.function_count;
+  module_stats.byte_swap_count += stats.byte_swap_count;
+  module_stats.byte_swap_removed_count += stats.byte_swap_removed_count;
+  module_stats.byte_swap_fused_count += stats.byte_swap_fused_count;
+}
+
+void PPCFrontend::LogModuleStats() {
+  std::lock_guard<std::mutex> guard(module_stats_lock_);
+  PLOGI("%-26s %10s %12s %12s %12s", "module", "functions", "byte swaps",
+        "removed", "fused");
+  for (auto& it : module_stats_) {
+    auto& module_stats = it.second;
+    PLOGI("%-26s %10zu %12zu %12zu %12zu", it.first.c_str(),
+          module_stats.function_count, module_stats.byte_swap_count,
+          module_stats.byte_swap_removed_count,
+          module_stats.byte_swap_fused_count);
+  }
+}
+
 }  // namespace ppc
 }  // namespace frontend
 }  // namespace alloy
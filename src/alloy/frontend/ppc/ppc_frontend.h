@@ -10,8 +10,11 @@
 #ifndef ALLOY_FRONTEND_PPC_PPC_FRONTEND_H_
 #define ALLOY_FRONTEND_PPC_PPC_FRONTEND_H_
 
+#include <map>
 #include <mutex>
+#include <string>
 
+#include "alloy/compiler/compiler.h"
 #include "alloy/frontend/frontend.h"
 #include "alloy/type_pool.h"
 
@@ -40,11 +43,31 @@ class PPCFrontend : public Frontend {
   int DeclareFunction(runtime::FunctionInfo* symbol_info) override;
   int DefineFunction(runtime::FunctionInfo* symbol_info,
                      uint32_t debug_info_flags, uint32_t trace_flags,
+                     runtime::FunctionTier tier,
                      runtime::Function** out_function) override;
+  int FindCallees(runtime::FunctionInfo* symbol_info,
+                  std::vector<uint64_t>* out_callees) override;
+
+  // Adds the stats of a function compiled from the module to its totals,
+  // which are logged at shutdown with --log_compiler_pass_stats.
+  void AddModuleStats(runtime::Module* module,
+                      const compiler::Compiler::Stats& stats);
 
  private:
+  struct ModuleStats {
+    size_t function_count;
+    size_t byte_swap_count;
+    size_t byte_swap_removed_count;
+    size_t byte_swap_fused_count;
+  };
+  void LogModuleStats();
+
   TypePool<PPCTranslator, PPCFrontend*> translator_pool_;
   PPCBuiltins builtins_;
+
+  std::mutex module_stats_lock_;
+  // By module name, as modules may be gone by the time these are logged.
+  std::map<std::string, ModuleStats> module_stats_;
 };
 
 }  // namespace ppc
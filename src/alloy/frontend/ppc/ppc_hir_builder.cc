@@ -9,11 +9,14 @@
 
 #include "alloy/frontend/ppc/ppc_hir_builder.h"
 
+#include <algorithm>
+
 #include "alloy/alloy-private.h"
 #include "alloy/frontend/ppc/ppc_context.h"
 #include "alloy/frontend/ppc/ppc_disasm.h"
 #include "alloy/frontend/ppc/ppc_frontend.h"
 #include "alloy/frontend/ppc/ppc_instr.h"
+#include "alloy/frontend/ppc/ppc_scanner.h"
 #include "alloy/hir/label.h"
 #include "alloy/runtime/runtime.h"
 #include "xenia/profiling.h"
@@ -31,6 +34,14 @@ using alloy::hir::Value;
 using alloy::runtime::Runtime;
 using alloy::runtime::FunctionInfo;
 
+// Jump tables with this many distinct cases or fewer compare against each in
+// turn. Larger ones branch through a table indexed by the target.
+const size_t kMaxJumpTableCompares = 4;
+// The indexed table has an entry for every instruction from the lowest case
+// to the highest. Cases spread further apart than this are left to the
+// indirect branch.
+const uint64_t kMaxJumpTableSpan = 1024;
+
 PPCHIRBuilder::PPCHIRBuilder(PPCFrontend* frontend)
     : HIRBuilder(), frontend_(frontend), comment_buffer_(4096) {}
 
@@ -41,6 +52,7 @@ void PPCHIRBuilder::Reset() {
   instr_offset_list_ = NULL;
   label_list_ = NULL;
   with_debug_info_ = false;
+  emit_flags_ = 0;
   HIRBuilder::Reset();
 }
 
@@ -54,6 +66,7 @@ int PPCHIRBuilder::Emit(FunctionInfo* symbol_info, uint32_t flags) {
   start_address_ = symbol_info->address();
   instr_count_ = (symbol_info->end_address() - symbol_info->address()) / 4 + 1;
 
+  emit_flags_ = flags;
   with_debug_info_ = (flags & EMIT_DEBUG_COMMENTS) == EMIT_DEBUG_COMMENTS;
   if (with_debug_info_) {
     Comment("%s fn %.8X-%.8X %s", symbol_info->module()->name().c_str(),
@@ -85,7 +98,6 @@ int PPCHIRBuilder::Emit(FunctionInfo* symbol_info, uint32_t flags) {
     i.code = poly::load_and_swap<uint32_t>(p + address);
     // TODO(benvanik): find a way to avoid using the opcode tables.
     i.type = GetInstrType(i.code);
-    trace_info_.dest_count = 0;
 
     // Mark label, if we were assigned one earlier on in the walk.
     // We may still get a label, but it'll be inserted by LookupLabel
@@ -116,56 +128,180 @@ int PPCHIRBuilder::Emit(FunctionInfo* symbol_info, uint32_t flags) {
     // Stash instruction offset. It's either the SOURCE_OFFSET or the COMMENT.
     instr_offset_list_[offset] = first_instr;
 
-    if (!i.type) {
-      PLOGE("Invalid instruction %.8llX %.8X", i.address, i.code);
-      Comment("INVALID!");
-      // TraceInvalidInstruction(i);
-      continue;
+    EmitInstr(i);
+  }
+
+  return Finalize();
+}
+
+void PPCHIRBuilder::EmitInstr(InstrData& i) {
+  trace_info_.dest_count = 0;
+
+  if (!i.type) {
+    PLOGE("Invalid instruction %.8llX %.8X", i.address, i.code);
+    Comment("INVALID!");
+    // TraceInvalidInstruction(i);
+    return;
+  }
+  ++i.type->translation_count;
+
+  typedef int (*InstrEmitter)(PPCHIRBuilder& f, InstrData& i);
+  InstrEmitter emit = (InstrEmitter)i.type->emit;
+
+  if (i.address == FLAGS_break_on_instruction) {
+    Comment("--break-on-instruction target");
+    DebugBreak();
+  }
+
+  if (!i.type->emit || emit(*this, i)) {
+    PLOGE("Unimplemented instr %.8llX %.8X %s", i.address, i.code,
+          i.type->name);
+    Comment("UNIMPLEMENTED!");
+    // DebugBreak();
+    // TraceInvalidInstruction(i);
+  }
+
+  if (emit_flags_ & EMIT_TRACE_SOURCE) {
+    if (emit_flags_ & EMIT_TRACE_SOURCE_VALUES) {
+      switch (trace_info_.dest_count) {
+        case 0:
+          TraceSource(i.address);
+          break;
+        case 1:
+          TraceSource(i.address, trace_info_.dests[0].reg,
+                      trace_info_.dests[0].value);
+          break;
+        case 2:
+          TraceSource(i.address, trace_info_.dests[0].reg,
+                      trace_info_.dests[0].value, trace_info_.dests[1].reg,
+                      trace_info_.dests[1].value);
+          break;
+        default:
+          assert_unhandled_case(trace_info_.dest_count);
+          break;
+      }
+    } else {
+      TraceSource(i.address);
     }
-    ++i.type->translation_count;
+  }
+}
 
-    typedef int (*InstrEmitter)(PPCHIRBuilder& f, InstrData& i);
-    InstrEmitter emit = (InstrEmitter)i.type->emit;
+bool PPCHIRBuilder::EmitInlinedLeaf(uint64_t cia, uint64_t address, bool lk) {
+  if (FLAGS_inline_max_instructions <= 0) {
+    return false;
+  }
+  if (address >= start_address_ &&
+      address < start_address_ + instr_count_ * 4) {
+    // Local branch or recursion.
+    return false;
+  }
+  FunctionInfo* callee;
+  if (frontend_->runtime()->LookupFunctionInfo(address, &callee) ||
+      callee->behavior() == FunctionInfo::BEHAVIOR_EXTERN) {
+    return false;
+  }
 
-    if (i.address == FLAGS_break_on_instruction) {
-      Comment("--break-on-instruction target");
-      DebugBreak();
+  // Only straight-line code ending in a blr is inlined. That covers getters,
+  // small vector helpers and the __savegprlr/__restgprlr stubs and means no
+  // labels or branches need remapping.
+  const uint8_t* p = frontend_->memory()->membase();
+  uint64_t max_count = static_cast<uint64_t>(FLAGS_inline_max_instructions);
+  uint64_t count = 0;
+  InstrData i;
+  while (true) {
+    i.address = address + count * 4;
+    i.code = poly::load_and_swap<uint32_t>(p + i.address);
+    if (i.code == 0x4E800020) {
+      break;
     }
+    i.type = GetInstrType(i.code);
+    if (count == max_count || !i.type || !i.type->emit ||
+        (i.type->type & (kXEPPCInstrTypeBranch | kXEPPCInstrTypeSyscall))) {
+      return false;
+    }
+    if (lk && i.type->opcode == 0x7C0003A6 &&
+        (((i.XFX.spr & 0x1F) << 5) | ((i.XFX.spr >> 5) & 0x1F)) == 8) {
+      // mtlr: the blr would no longer return to the call site.
+      return false;
+    }
+    ++count;
+  }
 
-    if (!i.type->emit || emit(*this, i)) {
-      PLOGE("Unimplemented instr %.8llX %.8X %s", i.address, i.code,
-            i.type->name);
-      Comment("UNIMPLEMENTED!");
-      // DebugBreak();
-      // TraceInvalidInstruction(i);
+  if (with_debug_info_) {
+    Comment("inlined %s %.8X-%.8X", callee->name().c_str(), address,
+            address + count * 4);
+  }
+  // Nothing else ties the callee to this code, so have writes to it (blr
+  // included) invalidate this function.
+  symbol_info_->AddInlinedRange(address, address + count * 4 + 4);
+  if (lk) {
+    StoreLR(LoadConstant(cia + 4));
+  } else {
+    // A tail call. Its blr returns from the caller, so emit it too.
+    ++count;
+  }
+  // Each instruction keeps its own source offset so that the debugger can
+  // still map code back to the callee.
+  for (uint64_t n = 0; n < count; ++n) {
+    i.address = address + n * 4;
+    i.code = poly::load_and_swap<uint32_t>(p + i.address);
+    i.type = GetInstrType(i.code);
+    if (with_debug_info_) {
+      comment_buffer_.Reset();
+      DisasmPPC(i, &comment_buffer_);
+      Comment("%.8X %.8X %s", i.address, i.code, comment_buffer_.GetString());
     }
+    SourceOffset(i.address);
+    EmitInstr(i);
+  }
+  // The call site traces nothing of its own.
+  trace_info_.dest_count = 0;
+  return true;
+}
 
-    if (flags & EMIT_TRACE_SOURCE) {
-      if (flags & EMIT_TRACE_SOURCE_VALUES) {
-        switch (trace_info_.dest_count) {
-          case 0:
-            TraceSource(i.address);
-            break;
-          case 1:
-            TraceSource(i.address, trace_info_.dests[0].reg,
-                        trace_info_.dests[0].value);
-            break;
-          case 2:
-            TraceSource(i.address, trace_info_.dests[0].reg,
-                        trace_info_.dests[0].value, trace_info_.dests[1].reg,
-                        trace_info_.dests[1].value);
-            break;
-          default:
-            assert_unhandled_case(trace_info_.dest_count);
-            break;
-        }
-      } else {
-        TraceSource(i.address);
-      }
+void PPCHIRBuilder::EmitJumpTableBranches(uint64_t address) {
+  PPCScanner scanner(frontend_);
+  std::vector<uint64_t> targets;
+  if (!scanner.FindJumpTable(symbol_info_, address, &targets)) {
+    return;
+  }
+  std::sort(targets.begin(), targets.end());
+  targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+  // FindExtents includes all the cases in the function, but the extents may
+  // have come from somewhere else.
+  for (auto target : targets) {
+    if (target < start_address_ ||
+        target >= start_address_ + instr_count_ * 4) {
+      return;
     }
   }
 
-  return Finalize();
+  if (targets.size() <= kMaxJumpTableCompares) {
+    for (auto target : targets) {
+      // CTR is reloaded for each case as values don't live across blocks.
+      Value* ctr = Truncate(LoadCTR(), INT32_TYPE);
+      BranchTrue(CompareEQ(ctr, LoadConstant(static_cast<uint32_t>(target))),
+                 LookupLabel(target));
+    }
+    return;
+  }
+
+  // Index by the target itself rather than trusting the index register to
+  // still hold what the table was read with. Anything that isn't a case
+  // (including the low bits bcctr ignores) falls through.
+  uint64_t base = targets.front();
+  uint64_t span = (targets.back() - base) / 4 + 1;
+  if (span > kMaxJumpTableSpan) {
+    return;
+  }
+  std::vector<Label*> labels(static_cast<size_t>(span));
+  for (auto target : targets) {
+    labels[(target - base) / 4] = LookupLabel(target);
+  }
+  Value* offset = Sub(Truncate(LoadCTR(), INT32_TYPE),
+                      LoadConstant(static_cast<uint32_t>(base)));
+  BranchTable(Shr(offset, int8_t(2)), labels.data(),
+              static_cast<uint32_t>(span));
 }
 
 void PPCHIRBuilder::AnnotateLabel(uint64_t address, Label* label) {
@@ -182,6 +318,12 @@ FunctionInfo* PPCHIRBuilder::LookupFunction(uint64_t address) {
   if (runtime->LookupFunctionInfo(address, &symbol_info)) {
     return NULL;
   }
+  // Start translating the callee in the background so that it's likely ready
+  // by the time we first call it.
+  if (!symbol_info->function() &&
+      symbol_info->behavior() != FunctionInfo::BEHAVIOR_EXTERN) {
+    runtime->compile_queue()->EnqueueSpeculative(address);
+  }
   return symbol_info;
 }
 
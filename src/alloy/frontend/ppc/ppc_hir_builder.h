@@ -10,6 +10,7 @@
 #ifndef ALLOY_FRONTEND_PPC_PPC_HIR_BUILDER_H_
 #define ALLOY_FRONTEND_PPC_PPC_HIR_BUILDER_H_
 
+#include "alloy/frontend/ppc/ppc_instr.h"
 #include "alloy/hir/hir_builder.h"
 #include "alloy/runtime/function.h"
 #include "alloy/runtime/symbol_info.h"
@@ -45,6 +46,14 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   runtime::FunctionInfo* symbol_info() const { return symbol_info_; }
   runtime::FunctionInfo* LookupFunction(uint64_t address);
   Label* LookupLabel(uint64_t address);
+  // Emits the body of the small leaf function at address in place of a call
+  // (or tail call if !lk) to it from cia. Returns false, having emitted
+  // nothing, if the function isn't one.
+  bool EmitInlinedLeaf(uint64_t cia, uint64_t address, bool lk);
+  // Branches straight to the cases of the jump table the bctr at address
+  // dispatches through, if it is one with cases close enough together.
+  // Anything else is left for the indirect branch emitted after.
+  void EmitJumpTableBranches(uint64_t address);
 
   Value* LoadLR();
   void StoreLR(Value* value);
@@ -85,6 +94,7 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   Value* StoreRelease(Value* address, Value* value, uint32_t store_flags = 0);
 
  private:
+  void EmitInstr(InstrData& i);
   void AnnotateLabel(uint64_t address, Label* label);
 
  private:
@@ -94,6 +104,7 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   StringBuffer comment_buffer_;
 
   // Reset each Emit:
+  uint32_t emit_flags_;
   bool with_debug_info_;
   runtime::FunctionInfo* symbol_info_;
   uint64_t start_address_;
@@ -31,6 +31,11 @@ namespace ppc {
 
 using alloy::runtime::FunctionInfo;
 
+// How far back from a bctr to look for the jump table setup.
+const uint32_t kMaxJumpTableWindow = 16;
+// Bigger tables are assumed to be misdecoded.
+const uint32_t kMaxJumpTableEntries = 512;
+
 PPCScanner::PPCScanner(PPCFrontend* frontend) : frontend_(frontend) {}
 
 PPCScanner::~PPCScanner() {}
@@ -118,8 +123,16 @@ int PPCScanner::FindExtents(FunctionInfo* symbol_info) {
     } else if (i.code == 0x4E800420) {
       // bctr -- unconditional branch to CTR.
       // This is generally a jump to a function pointer (non-return).
-      // This is almost always a jump table.
-      // TODO(benvanik): decode jump tables.
+      // This is almost always a jump table. Its cases are part of this
+      // function even though they may come after the bctr.
+      std::vector<uint64_t> targets;
+      if (FindJumpTable(symbol_info, address, &targets)) {
+        LOGPPC("jump table %.8X (%zu entries)", address, targets.size());
+        for (auto target : targets) {
+          furthest_target =
+              std::max(furthest_target, static_cast<uint32_t>(target));
+        }
+      }
       if (furthest_target > address) {
         // Remaining targets within function, not end.
         LOGPPC("ignoring bctr %.8X (branch to %.8X)", address, furthest_target);
@@ -293,6 +306,20 @@ std::vector<BlockInfo> PPCScanner::FindBlocks(FunctionInfo* symbol_info) {
 
   uint64_t start_address = symbol_info->address();
   uint64_t end_address = symbol_info->end_address();
+
+  // Jump table cases start blocks of their own.
+  std::vector<uint64_t> case_addresses;
+  for (uint64_t address = start_address; address <= end_address; address += 4) {
+    if (poly::load_and_swap<uint32_t>(p + address) == 0x4E800420) {
+      std::vector<uint64_t> targets;
+      if (FindJumpTable(symbol_info, address, &targets)) {
+        case_addresses.insert(case_addresses.end(), targets.begin(),
+                              targets.end());
+      }
+    }
+  }
+  std::sort(case_addresses.begin(), case_addresses.end());
+
   bool in_block = false;
   uint64_t block_start = 0;
   InstrData i;
@@ -303,6 +330,14 @@ std::vector<BlockInfo> PPCScanner::FindBlocks(FunctionInfo* symbol_info) {
       continue;
     }
 
+    if (in_block && std::binary_search(case_addresses.begin(),
+                                       case_addresses.end(), address)) {
+      block_map[block_start] = {
+          block_start, address - 4,
+      };
+      in_block = false;
+    }
+
     // TODO(benvanik): find a way to avoid using the opcode tables.
     // This lookup is *expensive* and should be avoided when scanning.
     i.type = GetInstrType(i.code);
@@ -321,7 +356,6 @@ std::vector<BlockInfo> PPCScanner::FindBlocks(FunctionInfo* symbol_info) {
     } else if (i.code == 0x4E800420) {
       // bctr -- unconditional branch to CTR.
       // This is almost always a jump table.
-      // TODO(benvanik): decode jump tables.
       ends_block = true;
     } else if (i.type->opcode == 0x48000000) {
       // b/ba/bl/bla
@@ -362,6 +396,146 @@ std::vector<BlockInfo> PPCScanner::FindBlocks(FunctionInfo* symbol_info) {
   return blocks;
 }
 
+std::vector<uint64_t> PPCScanner::FindCallees(FunctionInfo* symbol_info) {
+  SCOPE_profile_cpu_f("alloy");
+
+  Memory* memory = frontend_->memory();
+  const uint8_t* p = memory->membase();
+
+  uint64_t start_address = symbol_info->address();
+  uint64_t end_address = symbol_info->end_address();
+  std::vector<uint64_t> callees;
+  InstrData i;
+  for (uint64_t address = start_address; address <= end_address; address += 4) {
+    i.address = address;
+    i.code = poly::load_and_swap<uint32_t>(p + address);
+    // Only b/ba/bl/bla are interesting, so skip the opcode table lookup.
+    if ((i.code >> 26) != 18) {
+      continue;
+    }
+    uint64_t target = (uint32_t)XEEXTS26(i.I.LI << 2) +
+                      (i.I.AA ? 0 : (int32_t)address);
+    if (i.I.LK) {
+      callees.push_back(target);
+    } else if (target < start_address || target > end_address) {
+      // Tail call.
+      callees.push_back(target);
+    }
+  }
+
+  std::sort(callees.begin(), callees.end());
+  callees.erase(std::unique(callees.begin(), callees.end()), callees.end());
+  return callees;
+}
+
+bool PPCScanner::FindJumpTable(FunctionInfo* symbol_info, uint64_t address,
+                               std::vector<uint64_t>* out_targets) {
+  // Matches the bounded switch dispatch the compiler emits, in any order and
+  // with unrelated instructions mixed in:
+  //   cmplwi    crN, rX, count - 1
+  //   bgt       crN, default
+  //   lis       rA, table@ha
+  //   addi      rA, rA, table@l
+  //   rlwinm    rB, rX, 2, 0, 29
+  //   lwzx      rS, rA, rB
+  //   mtctr     rS
+  //   bctr
+  // Walks backwards from the bctr filling in the registers as it goes.
+  Memory* memory = frontend_->memory();
+  const uint8_t* p = memory->membase();
+  auto module = symbol_info->module();
+
+  uint32_t ctr_reg = UINT32_MAX;
+  uint32_t table_regs[2] = {UINT32_MAX, UINT32_MAX};
+  uint32_t base_reg = UINT32_MAX;
+  uint32_t index_reg = UINT32_MAX;
+  uint32_t scaled_reg = UINT32_MAX;
+  uint32_t base_lo_reg = UINT32_MAX;
+  int32_t base_lo = 0;
+  uint32_t base_hi_reg = UINT32_MAX;
+  int32_t base_hi = 0;
+  uint32_t bgt_crs = 0;
+  uint32_t entry_count = 0;
+  InstrData i;
+  for (uint32_t n = 1; n <= kMaxJumpTableWindow && !entry_count; ++n) {
+    i.address = address - n * 4;
+    if (i.address < symbol_info->address()) {
+      break;
+    }
+    i.code = poly::load_and_swap<uint32_t>(p + i.address);
+    uint32_t opcode = i.code & 0xFC0007FE;
+    if (ctr_reg == UINT32_MAX) {
+      // mtctr rS
+      if ((i.code & 0xFC1FFFFF) == 0x7C0903A6) {
+        ctr_reg = i.XFX.RT;
+      }
+    } else if (table_regs[0] == UINT32_MAX) {
+      // lwzx rS, rA, rB
+      if (opcode == 0x7C00002E && i.X.RT == ctr_reg) {
+        table_regs[0] = i.X.RA;
+        table_regs[1] = i.X.RB;
+      }
+    } else if ((i.code >> 26) == 21 && i.M.SH == 2 && i.M.MB == 0 &&
+               i.M.ME == 29 && scaled_reg == UINT32_MAX &&
+               (i.M.RA == table_regs[0] || i.M.RA == table_regs[1])) {
+      // rlwinm rB, rX, 2, 0, 29
+      scaled_reg = i.M.RA;
+      index_reg = i.M.RT;
+      base_reg = table_regs[0] == scaled_reg ? table_regs[1] : table_regs[0];
+    } else if ((i.code >> 26) == 14 && base_lo_reg == UINT32_MAX &&
+               i.D.RT == i.D.RA && i.D.RT != 0 &&
+               (i.D.RT == table_regs[0] || i.D.RT == table_regs[1])) {
+      // addi rA, rA, table@l
+      base_lo_reg = i.D.RT;
+      base_lo = static_cast<int32_t>(XEEXTS16(i.D.DS));
+    } else if ((i.code >> 26) == 15 && base_hi_reg == UINT32_MAX &&
+               i.D.RA == 0 &&
+               (i.D.RT == table_regs[0] || i.D.RT == table_regs[1])) {
+      // lis rA, table@ha
+      base_hi_reg = i.D.RT;
+      base_hi = static_cast<int32_t>(XEEXTS16(i.D.DS) << 16);
+    } else if ((i.code >> 26) == 16 && (i.B.BO & 0x1E) == 12 && !i.B.LK &&
+               (i.B.BI & 3) == 1) {
+      // bgt crN, default
+      bgt_crs |= 1 << (i.B.BI >> 2);
+    } else if ((i.code >> 26) == 10 && index_reg != UINT32_MAX &&
+               i.D.RA == index_reg && !(i.D.RT & 1) &&
+               (bgt_crs & (1 << (i.D.RT >> 2)))) {
+      // cmplwi crN, rX, count - 1
+      entry_count = i.D.DS + 1;
+    }
+  }
+  // The lis/addi must have built the base register, not the index.
+  if (!entry_count || entry_count > kMaxJumpTableEntries ||
+      base_lo_reg != base_reg || base_hi_reg != base_reg) {
+    return false;
+  }
+
+  uint32_t table_address = static_cast<uint32_t>(base_hi + base_lo);
+  if (!module->ContainsAddress(table_address) ||
+      !module->ContainsAddress(table_address + (entry_count - 1) * 4)) {
+    return false;
+  }
+  uint64_t low_address = symbol_info->address();
+  uint64_t high_address = 0;
+  if (!module->GetCodeRange(&low_address, &high_address)) {
+    high_address = UINT64_MAX;
+  }
+  low_address = std::max(low_address, symbol_info->address());
+  std::vector<uint64_t> targets(entry_count);
+  for (uint32_t n = 0; n < entry_count; ++n) {
+    uint64_t target =
+        poly::load_and_swap<uint32_t>(p + table_address + n * 4);
+    if ((target & 3) || target < low_address || target >= high_address ||
+        !module->ContainsAddress(target)) {
+      return false;
+    }
+    targets[n] = target;
+  }
+  *out_targets = std::move(targets);
+  return true;
+}
+
 }  // namespace ppc
 }  // namespace frontend
 }  // namespace alloy
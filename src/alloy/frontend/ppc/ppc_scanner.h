@@ -34,6 +34,14 @@ class PPCScanner {
 
   std::vector<BlockInfo> FindBlocks(runtime::FunctionInfo* symbol_info);
 
+  // Returns the targets of all bl/bla and of b/ba out of the function.
+  std::vector<uint64_t> FindCallees(runtime::FunctionInfo* symbol_info);
+
+  // Decodes the jump table dispatched through by the bctr at address, if it
+  // is one. The targets are returned in table order and may repeat.
+  bool FindJumpTable(runtime::FunctionInfo* symbol_info, uint64_t address,
+                     std::vector<uint64_t>* out_targets);
+
  private:
   bool IsRestGprLr(uint64_t address);
 
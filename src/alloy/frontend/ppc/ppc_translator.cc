@@ -10,7 +10,7 @@
 #include "alloy/frontend/ppc/ppc_translator.h"
 
 #include "alloy/alloy-private.h"
-#include "alloy/compiler/compiler_passes.h"
+#include "alloy/compiler/compiler_pipelines.h"
 #include "alloy/frontend/ppc/ppc_disasm.h"
 #include "alloy/frontend/ppc/ppc_frontend.h"
 #include "alloy/frontend/ppc/ppc_hir_builder.h"
@@ -28,10 +28,11 @@ namespace ppc {
 using namespace alloy::runtime;
 
 using alloy::backend::Backend;
+using alloy::compiler::AddBaselinePasses;
+using alloy::compiler::AddOptimizingPasses;
 using alloy::compiler::Compiler;
 using alloy::runtime::Function;
 using alloy::runtime::FunctionInfo;
-namespace passes = alloy::compiler::passes;
 
 PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   Backend* backend = frontend->runtime()->backend();
@@ -42,57 +43,27 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   assembler_ = std::move(backend->CreateAssembler());
   assembler_->Initialize();
 
-  bool validate = FLAGS_validate_hir;
-
-  // Merge blocks early. This will let us use more context in other passes.
-  // The CFG is required for simplification and dirtied by it.
-  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
-  compiler_->AddPass(std::make_unique<passes::ControlFlowSimplificationPass>());
-  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
-
-  // Passes are executed in the order they are added. Multiple of the same
-  // pass type may be used.
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::ConstantPropagationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-
-  //// Removes all unneeded variables. Try not to add new ones after this.
-  // compiler_->AddPass(new passes::ValueReductionPass());
-  // if (validate) compiler_->AddPass(new passes::ValidationPass());
-
-  // Register allocation for the target backend.
-  // Will modify the HIR to add loads/stores.
-  // This should be the last pass before finalization, as after this all
-  // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-
-  // Must come last. The HIR is not really HIR after this.
-  compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+  AddOptimizingPasses(compiler_.get(), backend->machine_info(),
+                      FLAGS_validate_hir);
+  baseline_compiler_.reset(new Compiler(frontend->runtime()));
+  AddBaselinePasses(baseline_compiler_.get(), backend->machine_info(),
+                    FLAGS_validate_hir);
 }
 
 PPCTranslator::~PPCTranslator() = default;
 
 int PPCTranslator::Translate(FunctionInfo* symbol_info,
                              uint32_t debug_info_flags, uint32_t trace_flags,
-                             Function** out_function) {
+                             FunctionTier tier, Function** out_function) {
   SCOPE_profile_cpu_f("alloy");
 
+  Compiler* compiler = tier == FUNCTION_TIER_BASELINE
+                           ? baseline_compiler_.get()
+                           : compiler_.get();
+
   // Reset() all caching when we leave.
   make_reset_scope(builder_);
-  make_reset_scope(compiler_);
+  make_reset_scope(compiler);
   make_reset_scope(assembler_);
   make_reset_scope(&string_buffer_);
 
@@ -151,10 +122,23 @@ int PPCTranslator::Translate(FunctionInfo* symbol_info,
   }
 
   // Compile/optimize/etc.
-  result = compiler_->Compile(builder_.get());
+  result = compiler->Compile(builder_.get());
   if (result) {
     return result;
   }
+  if (FLAGS_log_compiler_stats) {
+    auto& stats = compiler->stats();
+    PLOGI("%.8llX: %zu -> %zu HIR instrs (%zu removed by value numbering, "
+          "%zu/%zu byte swaps removed, %zu fused, %zu loads forwarded, "
+          "%zu reused)",
+          symbol_info->address(), stats.instr_count_in, stats.instr_count_out,
+          stats.value_numbering_removed_count, stats.byte_swap_removed_count,
+          stats.byte_swap_count, stats.byte_swap_fused_count,
+          stats.memory_forwarded_count, stats.memory_reused_count);
+  }
+  if (FLAGS_log_compiler_pass_stats) {
+    frontend_->AddModuleStats(symbol_info->module(), compiler->stats());
+  }
 
   // Stash optimized HIR.
   if (debug_info_flags & DEBUG_INFO_HIR_DISASM) {
@@ -166,7 +150,8 @@ int PPCTranslator::Translate(FunctionInfo* symbol_info,
   // Assemble to backend machine code.
   result =
       assembler_->Assemble(symbol_info, builder_.get(), debug_info_flags,
-                           std::move(debug_info), trace_flags, out_function);
+                           std::move(debug_info), trace_flags, tier,
+                           out_function);
   if (result) {
     return result;
   }
@@ -14,6 +14,7 @@
 
 #include "alloy/backend/assembler.h"
 #include "alloy/compiler/compiler.h"
+#include "alloy/runtime/function.h"
 #include "alloy/runtime/symbol_info.h"
 #include "alloy/string_buffer.h"
 
@@ -31,7 +32,8 @@ class PPCTranslator {
   ~PPCTranslator();
 
   int Translate(runtime::FunctionInfo* symbol_info, uint32_t debug_info_flags,
-                uint32_t trace_flags, runtime::Function** out_function);
+                uint32_t trace_flags, runtime::FunctionTier tier,
+                runtime::Function** out_function);
 
  private:
   void DumpSource(runtime::FunctionInfo* symbol_info,
@@ -42,6 +44,8 @@ class PPCTranslator {
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Minimal pipeline for FUNCTION_TIER_BASELINE.
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
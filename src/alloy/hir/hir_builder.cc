@@ -9,6 +9,8 @@
 
 #include "alloy/hir/hir_builder.h"
 
+#include <algorithm>
+
 #include "alloy/hir/block.h"
 #include "alloy/hir/instr.h"
 #include "alloy/hir/label.h"
@@ -21,6 +23,25 @@ namespace hir {
 
 using alloy::runtime::FunctionInfo;
 
+namespace {
+
+// Initial size of the constant pool. Must be a power of two.
+const size_t kConstantPoolSize = 256;
+
+Value::ConstantValue ZeroConstant() {
+  Value::ConstantValue constant;
+  constant.v128.low = constant.v128.high = 0;
+  return constant;
+}
+
+size_t HashConstant(TypeName type, const Value::ConstantValue& constant) {
+  uint64_t hash = (constant.v128.low ^ (constant.v128.high * 31) ^ type) *
+                  0x9E3779B97F4A7C15ull;
+  return static_cast<size_t>(hash >> 32);
+}
+
+}  // namespace
+
 #define ASSERT_ADDRESS_TYPE(value)
 #define ASSERT_INTEGER_TYPE(value)
 #define ASSERT_FLOAT_TYPE(value)
@@ -31,6 +52,7 @@ using alloy::runtime::FunctionInfo;
 
 HIRBuilder::HIRBuilder() {
   arena_ = new Arena();
+  constant_pool_.resize(kConstantPoolSize);
   Reset();
 }
 
@@ -44,6 +66,9 @@ void HIRBuilder::Reset() {
   next_label_id_ = 0;
   next_value_ordinal_ = 0;
   locals_.clear();
+  // Keeps its size, as the next function likely needs as many constants.
+  std::fill(constant_pool_.begin(), constant_pool_.end(), nullptr);
+  constant_pool_count_ = 0;
   block_head_ = block_tail_ = NULL;
   current_block_ = NULL;
 #if XE_DEBUG
@@ -254,7 +279,23 @@ void HIRBuilder::Dump(StringBuffer* str) {
         str->Append(" ");
         DumpOp(str, src1_type, &i->src1);
       }
-      if (src2_type) {
+      if (i->opcode == &OPCODE_BRANCH_TABLE_info) {
+        auto table = i->src2.table;
+        str->Append(", [");
+        for (uint32_t n = 0; n < table->count; ++n) {
+          if (n) {
+            str->Append(", ");
+          }
+          if (table->labels[n]) {
+            Instr::Op op;
+            op.label = table->labels[n];
+            DumpOp(str, OPCODE_SIG_TYPE_L, &op);
+          } else {
+            str->Append("-");
+          }
+        }
+        str->Append("]");
+      } else if (src2_type) {
         str->Append(", ");
         DumpOp(str, src2_type, &i->src2);
       }
@@ -539,6 +580,24 @@ Block* HIRBuilder::AppendBlock() {
   return block;
 }
 
+Block* HIRBuilder::InsertBlock(Block* next_block) {
+  Block* block = arena_->Alloc<Block>();
+  block->arena = arena_;
+  block->next = next_block;
+  block->prev = next_block->prev;
+  if (block->prev) {
+    block->prev->next = block;
+  } else {
+    block_head_ = block;
+  }
+  next_block->prev = block;
+  current_block_ = block;
+  block->label_head = block->label_tail = NULL;
+  block->incoming_edge_head = block->outgoing_edge_head = NULL;
+  block->instr_head = block->instr_tail = NULL;
+  return block;
+}
+
 void HIRBuilder::EndBlock() {
   if (current_block_ && !current_block_->instr_tail) {
     // Block never had anything added to it. Since it likely has an
@@ -601,7 +660,6 @@ Value* HIRBuilder::AllocValue(TypeName type) {
   value->use_head = NULL;
   value->last_use = NULL;
   value->local_slot = NULL;
-  value->tag = NULL;
   value->reg.set = NULL;
   value->reg.index = -1;
   return value;
@@ -617,7 +675,6 @@ Value* HIRBuilder::CloneValue(Value* source) {
   value->use_head = NULL;
   value->last_use = NULL;
   value->local_slot = NULL;
-  value->tag = NULL;
   value->reg.set = NULL;
   value->reg.index = -1;
   return value;
@@ -841,6 +898,29 @@ void HIRBuilder::BranchFalse(Value* cond, Label* label, uint32_t branch_flags) {
   EndBlock();
 }
 
+void HIRBuilder::BranchTable(Value* index, Label* const* labels,
+                             uint32_t count, uint32_t branch_flags) {
+  assert_true(index->type == INT32_TYPE);
+  if (index->IsConstant()) {
+    uint32_t n = index->constant.i32;
+    if (n < count && labels[n]) {
+      Branch(labels[n], branch_flags);
+    }
+    return;
+  }
+
+  JumpTable* table = arena_->Alloc<JumpTable>();
+  table->count = count;
+  table->labels = (Label**)arena_->Alloc(sizeof(Label*) * count);
+  memcpy(table->labels, labels, sizeof(Label*) * count);
+
+  Instr* i = AppendInstr(OPCODE_BRANCH_TABLE_info, branch_flags);
+  i->set_src1(index);
+  i->src2.table = table;
+  i->src3.value = NULL;
+  EndBlock();
+}
+
 // phi type_name, Block* b1, Value* v1, Block* b2, Value* v2, etc
 
 Value* HIRBuilder::Assign(Value* value) {
@@ -970,77 +1050,108 @@ Value* HIRBuilder::VectorConvertF2I(Value* value, uint32_t arithmetic_flags) {
   return i->dest;
 }
 
-Value* HIRBuilder::LoadZero(TypeName type) {
-  // TODO(benvanik): cache zeros per block/fn? Prevents tons of dupes.
-  Value* dest = AllocValue();
-  dest->set_zero(type);
+Value* HIRBuilder::InternConstant(TypeName type,
+                                  const Value::ConstantValue& constant) {
+  // Open addressing with linear probing, kept at most half full. Constants
+  // are compared bitwise so that -0/+0 and NaNs stay distinct.
+  if ((constant_pool_count_ + 1) * 2 > constant_pool_.size()) {
+    std::vector<Value*> old_pool(constant_pool_.size() * 2, nullptr);
+    old_pool.swap(constant_pool_);
+    size_t mask = constant_pool_.size() - 1;
+    for (auto value : old_pool) {
+      if (value) {
+        size_t index = HashConstant(value->type, value->constant) & mask;
+        while (constant_pool_[index]) {
+          index = (index + 1) & mask;
+        }
+        constant_pool_[index] = value;
+      }
+    }
+  }
+  size_t mask = constant_pool_.size() - 1;
+  size_t index = HashConstant(type, constant) & mask;
+  while (Value* value = constant_pool_[index]) {
+    if (value->type == type && value->constant.v128 == constant.v128) {
+      return value;
+    }
+    index = (index + 1) & mask;
+  }
+  Value* dest = AllocValue(type);
+  dest->flags = VALUE_IS_CONSTANT;
+  dest->constant.v128 = constant.v128;
+  constant_pool_[index] = dest;
+  ++constant_pool_count_;
   return dest;
 }
 
+Value* HIRBuilder::LoadZero(TypeName type) {
+  return InternConstant(type, ZeroConstant());
+}
+
 Value* HIRBuilder::LoadConstant(int8_t value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.i8 = value;
+  return InternConstant(INT8_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(uint8_t value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.i8 = value;
+  return InternConstant(INT8_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(int16_t value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.i16 = value;
+  return InternConstant(INT16_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(uint16_t value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.i16 = value;
+  return InternConstant(INT16_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(int32_t value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.i32 = value;
+  return InternConstant(INT32_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(uint32_t value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.i32 = value;
+  return InternConstant(INT32_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(int64_t value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.i64 = value;
+  return InternConstant(INT64_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(uint64_t value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.i64 = value;
+  return InternConstant(INT64_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(float value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.f32 = value;
+  return InternConstant(FLOAT32_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(double value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.f64 = value;
+  return InternConstant(FLOAT64_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadConstant(const vec128_t& value) {
-  Value* dest = AllocValue();
-  dest->set_constant(value);
-  return dest;
+  auto constant = ZeroConstant();
+  constant.v128 = value;
+  return InternConstant(VEC128_TYPE, constant);
 }
 
 Value* HIRBuilder::LoadVectorShl(Value* sh) {
@@ -1126,6 +1237,11 @@ void HIRBuilder::Prefetch(Value* address, size_t length,
   i->src3.value = NULL;
 }
 
+void HIRBuilder::Barrier() {
+  Instr* i = AppendInstr(OPCODE_MEMORY_BARRIER_info, 0);
+  i->src1.value = i->src2.value = i->src3.value = NULL;
+}
+
 Value* HIRBuilder::Max(Value* value1, Value* value2) {
   ASSERT_TYPES_EQUAL(value1, value2);
 
@@ -61,6 +61,8 @@ class HIRBuilder {
 
   void AddEdge(Block* src, Block* dest, uint32_t flags);
   void MergeAdjacentBlocks(Block* left, Block* right);
+  // Inserts a new empty block before next_block and makes it current.
+  Block* InsertBlock(Block* next_block);
 
   // static allocations:
   // Value* AllocStatic(size_t length);
@@ -96,6 +98,10 @@ class HIRBuilder {
   void Branch(Block* block, uint32_t branch_flags = 0);
   void BranchTrue(Value* cond, Label* label, uint32_t branch_flags = 0);
   void BranchFalse(Value* cond, Label* label, uint32_t branch_flags = 0);
+  // Branches to labels[index]. Null labels and indices past count continue on
+  // to the next instruction.
+  void BranchTable(Value* index, Label* const* labels, uint32_t count,
+                   uint32_t branch_flags = 0);
 
   // phi type_name, Block* b1, Value* v1, Block* b2, Value* v2, etc
 
@@ -138,6 +144,8 @@ class HIRBuilder {
   Value* Load(Value* address, TypeName type, uint32_t load_flags = 0);
   void Store(Value* address, Value* value, uint32_t store_flags = 0);
   void Prefetch(Value* address, size_t length, uint32_t prefetch_flags = 0);
+  // Guest loads and stores must not be moved, merged or removed across this.
+  void Barrier();
 
   Value* Max(Value* value1, Value* value2);
   Value* VectorMax(Value* value1, Value* value2, TypeName part_type,
@@ -235,6 +243,8 @@ class HIRBuilder {
 
   Value* AllocValue(TypeName type = INT64_TYPE);
   Value* CloneValue(Value* source);
+  // Returns the function-wide value of the constant, creating it if needed.
+  Value* InternConstant(TypeName type, const Value::ConstantValue& constant);
 
  private:
   Block* AppendBlock();
@@ -254,6 +264,9 @@ class HIRBuilder {
   uint32_t next_value_ordinal_;
 
   std::vector<Value*> locals_;
+  // Hash table of the constants loaded so far, by type and bits.
+  std::vector<Value*> constant_pool_;
+  size_t constant_pool_count_;
 
   Block* block_head_;
   Block* block_tail_;
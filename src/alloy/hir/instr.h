@@ -23,6 +23,7 @@ namespace alloy {
 namespace hir {
 
 class Block;
+class JumpTable;
 class Label;
 
 class Instr {
@@ -38,6 +39,7 @@ class Instr {
   typedef union {
     runtime::FunctionInfo* symbol_info;
     Label* label;
+    JumpTable* table;
     Value* value;
     uint64_t offset;
   } Op;
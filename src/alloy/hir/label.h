@@ -27,6 +27,14 @@ class Label {
   void* tag;
 };
 
+// Targets of a BRANCH_TABLE, indexed by its source value. Entries without a
+// label, like indices past the end, continue on to the next instruction.
+class JumpTable {
+ public:
+  uint32_t count;
+  Label** labels;
+};
+
 }  // namespace hir
 }  // namespace alloy
 
@@ -35,12 +35,16 @@ enum LoadFlags {
   LOAD_ALIGNED = (1 << 2),
   LOAD_UNALIGNED = (1 << 3),
   LOAD_VOLATILE = (1 << 4),
+  // The loaded value is byte swapped (as if followed by a BYTE_SWAP).
+  LOAD_BYTE_SWAP = (1 << 5),
 };
 enum StoreFlags {
   STORE_NO_ALIAS = (1 << 1),
   STORE_ALIGNED = (1 << 2),
   STORE_UNALIGNED = (1 << 3),
   STORE_VOLATILE = (1 << 4),
+  // The value is byte swapped before being stored.
+  STORE_BYTE_SWAP = (1 << 5),
 };
 enum PrefetchFlags {
   PREFETCH_LOAD = (1 << 1),
@@ -126,6 +130,7 @@ enum Opcode {
   OPCODE_BRANCH,
   OPCODE_BRANCH_TRUE,
   OPCODE_BRANCH_FALSE,
+  OPCODE_BRANCH_TABLE,
   OPCODE_ASSIGN,
   OPCODE_CAST,
   OPCODE_ZERO_EXTEND,
@@ -145,6 +150,7 @@ enum Opcode {
   OPCODE_LOAD,
   OPCODE_STORE,
   OPCODE_PREFETCH,
+  OPCODE_MEMORY_BARRIER,
   OPCODE_MAX,
   OPCODE_VECTOR_MAX,
   OPCODE_MIN,
@@ -122,6 +122,12 @@ DEFINE_OPCODE(
     OPCODE_SIG_X_V_L,
     OPCODE_FLAG_BRANCH | OPCODE_FLAG_VOLATILE)
 
+DEFINE_OPCODE(
+    OPCODE_BRANCH_TABLE,
+    "branch_table",
+    OPCODE_SIG_X_V_O,
+    OPCODE_FLAG_BRANCH | OPCODE_FLAG_VOLATILE)
+
 DEFINE_OPCODE(
     OPCODE_ASSIGN,
     "assign",
@@ -236,6 +242,12 @@ DEFINE_OPCODE(
     OPCODE_SIG_X_V_O,
     0)
 
+DEFINE_OPCODE(
+    OPCODE_MEMORY_BARRIER,
+    "memory_barrier",
+    OPCODE_SIG_X,
+    OPCODE_FLAG_MEMORY)
+
 DEFINE_OPCODE(
     OPCODE_MAX,
     "max",
@@ -10,6 +10,8 @@
 #include "alloy/hir/value.h"
 
 #include <cmath>
+#include <cstring>
+#include <type_traits>
 
 namespace alloy {
 namespace hir {
@@ -391,10 +393,10 @@ void Value::Abs() {
 void Value::Sqrt() {
   switch (type) {
     case FLOAT32_TYPE:
-      constant.f32 = 1.0f / sqrtf(constant.f32);
+      constant.f32 = sqrtf(constant.f32);
       break;
     case FLOAT64_TYPE:
-      constant.f64 = 1.0 / sqrt(constant.f64);
+      constant.f64 = sqrt(constant.f64);
       break;
     default:
       assert_unhandled_case(type);
@@ -405,10 +407,10 @@ void Value::Sqrt() {
 void Value::RSqrt() {
   switch (type) {
     case FLOAT32_TYPE:
-      constant.f32 = sqrt(constant.f32);
+      constant.f32 = 1.0f / sqrtf(constant.f32);
       break;
     case FLOAT64_TYPE:
-      constant.f64 = sqrt(constant.f64);
+      constant.f64 = 1.0 / sqrt(constant.f64);
       break;
     default:
       assert_unhandled_case(type);
@@ -537,7 +539,7 @@ void Value::Shr(Value* other) {
       constant.i32 = (uint32_t)constant.i32 >> other->constant.i8;
       break;
     case INT64_TYPE:
-      constant.i64 = (uint16_t)constant.i64 >> other->constant.i8;
+      constant.i64 = (uint64_t)constant.i64 >> other->constant.i8;
       break;
     default:
       assert_unhandled_case(type);
@@ -594,21 +596,92 @@ void Value::ByteSwap() {
 void Value::CountLeadingZeros(const Value* other) {
   switch (other->type) {
     case INT8_TYPE:
-      constant.i8 = poly::lzcnt(constant.i8);
+      constant.i8 = poly::lzcnt(other->constant.i8);
+      break;
+    case INT16_TYPE:
+      constant.i8 = poly::lzcnt(other->constant.i16);
+      break;
+    case INT32_TYPE:
+      constant.i8 = poly::lzcnt(other->constant.i32);
+      break;
+    case INT64_TYPE:
+      constant.i8 = poly::lzcnt(other->constant.i64);
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
+template <typename T>
+T RotateLeftT(T value, uint32_t amount) {
+  amount &= sizeof(T) * 8 - 1;
+  return amount ? poly::rotate_left<T>(value, uint8_t(amount)) : value;
+}
+
+void Value::RotateLeft(Value* other) {
+  assert_true(other->type == INT8_TYPE);
+  uint32_t amount = uint8_t(other->constant.i8);
+  switch (type) {
+    case INT8_TYPE:
+      constant.i8 = RotateLeftT<uint8_t>(constant.i8, amount);
       break;
     case INT16_TYPE:
-      constant.i8 = poly::lzcnt(constant.i16);
+      constant.i16 = RotateLeftT<uint16_t>(constant.i16, amount);
       break;
     case INT32_TYPE:
-      constant.i8 = poly::lzcnt(constant.i32);
+      constant.i32 = RotateLeftT<uint32_t>(constant.i32, amount);
       break;
     case INT64_TYPE:
-      constant.i8 = poly::lzcnt(constant.i64);
+      constant.i64 = RotateLeftT<uint64_t>(constant.i64, amount);
+      break;
+    default:
+      assert_unhandled_case(type);
       break;
+  }
+}
+
+template <typename T>
+bool AddWithCarryT(T& value, T other, bool carry) {
+  T sum = value + other;
+  bool did_carry = sum < value;
+  value = sum + (carry ? 1 : 0);
+  return did_carry || value < sum;
+}
+
+bool Value::AddWithCarry(Value* other, bool carry) {
+  assert_true(type == other->type);
+  bool did_carry = false;
+  switch (type) {
+    case INT8_TYPE: {
+      uint8_t value = constant.i8;
+      did_carry = AddWithCarryT<uint8_t>(value, other->constant.i8, carry);
+      constant.i8 = value;
+      break;
+    }
+    case INT16_TYPE: {
+      uint16_t value = constant.i16;
+      did_carry = AddWithCarryT<uint16_t>(value, other->constant.i16, carry);
+      constant.i16 = value;
+      break;
+    }
+    case INT32_TYPE: {
+      uint32_t value = constant.i32;
+      did_carry = AddWithCarryT<uint32_t>(value, other->constant.i32, carry);
+      constant.i32 = value;
+      break;
+    }
+    case INT64_TYPE: {
+      uint64_t value = constant.i64;
+      did_carry = AddWithCarryT<uint64_t>(value, other->constant.i64, carry);
+      constant.i64 = value;
+      break;
+    }
     default:
       assert_unhandled_case(type);
       break;
   }
+  return did_carry;
 }
 
 bool Value::Compare(Opcode opcode, Value* other) {
@@ -617,5 +690,294 @@ bool Value::Compare(Opcode opcode, Value* other) {
   return false;
 }
 
+// Lane-wise helpers. Lanes are processed in host order; that doesn't matter
+// for any of the element-wise ops.
+template <typename T, typename F>
+void VectorBinaryOpT(vec128_t& a, const vec128_t& b, F op) {
+  T* x = reinterpret_cast<T*>(&a);
+  const T* y = reinterpret_cast<const T*>(&b);
+  for (size_t n = 0; n < sizeof(vec128_t) / sizeof(T); ++n) {
+    x[n] = op(x[n], y[n]);
+  }
+}
+
+template <typename S, typename U>
+void VectorCompareT(Opcode opcode, vec128_t& a, const vec128_t& b) {
+  for (size_t n = 0; n < sizeof(vec128_t) / sizeof(S); ++n) {
+    S sx = reinterpret_cast<const S*>(&a)[n];
+    S sy = reinterpret_cast<const S*>(&b)[n];
+    U ux = reinterpret_cast<const U*>(&a)[n];
+    U uy = reinterpret_cast<const U*>(&b)[n];
+    bool result = false;
+    switch (opcode) {
+      case OPCODE_VECTOR_COMPARE_EQ:
+        result = sx == sy;
+        break;
+      case OPCODE_VECTOR_COMPARE_SGT:
+        result = sx > sy;
+        break;
+      case OPCODE_VECTOR_COMPARE_SGE:
+        result = sx >= sy;
+        break;
+      case OPCODE_VECTOR_COMPARE_UGT:
+        result = ux > uy;
+        break;
+      case OPCODE_VECTOR_COMPARE_UGE:
+        result = ux >= uy;
+        break;
+      default:
+        assert_unhandled_case(opcode);
+        break;
+    }
+    std::memset(a.u8 + n * sizeof(S), result ? 0xFF : 0x00, sizeof(S));
+  }
+}
+
+void Value::VectorCompare(Opcode opcode, Value* other, TypeName part_type) {
+  assert_true(type == VEC128_TYPE && other->type == VEC128_TYPE);
+  switch (part_type) {
+    case INT8_TYPE:
+      VectorCompareT<int8_t, uint8_t>(opcode, constant.v128,
+                                      other->constant.v128);
+      break;
+    case INT16_TYPE:
+      VectorCompareT<int16_t, uint16_t>(opcode, constant.v128,
+                                        other->constant.v128);
+      break;
+    case INT32_TYPE:
+      VectorCompareT<int32_t, uint32_t>(opcode, constant.v128,
+                                        other->constant.v128);
+      break;
+    case FLOAT32_TYPE:
+      // Unsigned float compares are not folded.
+      assert_true(opcode != OPCODE_VECTOR_COMPARE_UGT &&
+                  opcode != OPCODE_VECTOR_COMPARE_UGE);
+      VectorCompareT<float, float>(opcode, constant.v128,
+                                   other->constant.v128);
+      break;
+    default:
+      assert_unhandled_case(part_type);
+      break;
+  }
+}
+
+void Value::VectorAdd(Value* other, TypeName part_type) {
+  assert_true(type == VEC128_TYPE && other->type == VEC128_TYPE);
+  switch (part_type) {
+    case INT8_TYPE:
+      VectorBinaryOpT<uint8_t>(constant.v128, other->constant.v128,
+                               [](uint8_t a, uint8_t b) { return a + b; });
+      break;
+    case INT16_TYPE:
+      VectorBinaryOpT<uint16_t>(constant.v128, other->constant.v128,
+                                [](uint16_t a, uint16_t b) { return a + b; });
+      break;
+    case INT32_TYPE:
+      VectorBinaryOpT<uint32_t>(constant.v128, other->constant.v128,
+                                [](uint32_t a, uint32_t b) { return a + b; });
+      break;
+    case FLOAT32_TYPE:
+      VectorBinaryOpT<float>(constant.v128, other->constant.v128,
+                             [](float a, float b) { return a + b; });
+      break;
+    default:
+      assert_unhandled_case(part_type);
+      break;
+  }
+}
+
+void Value::VectorSub(Value* other, TypeName part_type) {
+  assert_true(type == VEC128_TYPE && other->type == VEC128_TYPE);
+  switch (part_type) {
+    case INT8_TYPE:
+      VectorBinaryOpT<uint8_t>(constant.v128, other->constant.v128,
+                               [](uint8_t a, uint8_t b) { return a - b; });
+      break;
+    case INT16_TYPE:
+      VectorBinaryOpT<uint16_t>(constant.v128, other->constant.v128,
+                                [](uint16_t a, uint16_t b) { return a - b; });
+      break;
+    case INT32_TYPE:
+      VectorBinaryOpT<uint32_t>(constant.v128, other->constant.v128,
+                                [](uint32_t a, uint32_t b) { return a - b; });
+      break;
+    case FLOAT32_TYPE:
+      VectorBinaryOpT<float>(constant.v128, other->constant.v128,
+                             [](float a, float b) { return a - b; });
+      break;
+    default:
+      assert_unhandled_case(part_type);
+      break;
+  }
+}
+
+// Shift amounts are taken modulo the lane width, as with the guest
+// instructions.
+template <typename T>
+void VectorShiftT(Opcode opcode, vec128_t& a, const vec128_t& b) {
+  typedef typename std::make_unsigned<T>::type U;
+  const uint32_t mask = sizeof(T) * 8 - 1;
+  VectorBinaryOpT<T>(a, b, [opcode, mask](T x, T y) {
+    uint32_t amount = U(y) & mask;
+    switch (opcode) {
+      case OPCODE_VECTOR_SHL:
+        return T(U(x) << amount);
+      case OPCODE_VECTOR_SHR:
+        return T(U(x) >> amount);
+      case OPCODE_VECTOR_SHA:
+        return T(x >> amount);
+      case OPCODE_VECTOR_ROTATE_LEFT:
+        return T(RotateLeftT<U>(U(x), amount));
+      default:
+        assert_unhandled_case(opcode);
+        return x;
+    }
+  });
+}
+
+static void VectorShift(Opcode opcode, vec128_t& a, const vec128_t& b,
+                        TypeName part_type) {
+  switch (part_type) {
+    case INT8_TYPE:
+      VectorShiftT<int8_t>(opcode, a, b);
+      break;
+    case INT16_TYPE:
+      VectorShiftT<int16_t>(opcode, a, b);
+      break;
+    case INT32_TYPE:
+      VectorShiftT<int32_t>(opcode, a, b);
+      break;
+    default:
+      assert_unhandled_case(part_type);
+      break;
+  }
+}
+
+void Value::VectorShl(Value* other, TypeName part_type) {
+  assert_true(type == VEC128_TYPE && other->type == VEC128_TYPE);
+  VectorShift(OPCODE_VECTOR_SHL, constant.v128, other->constant.v128,
+              part_type);
+}
+
+void Value::VectorShr(Value* other, TypeName part_type) {
+  assert_true(type == VEC128_TYPE && other->type == VEC128_TYPE);
+  VectorShift(OPCODE_VECTOR_SHR, constant.v128, other->constant.v128,
+              part_type);
+}
+
+void Value::VectorSha(Value* other, TypeName part_type) {
+  assert_true(type == VEC128_TYPE && other->type == VEC128_TYPE);
+  VectorShift(OPCODE_VECTOR_SHA, constant.v128, other->constant.v128,
+              part_type);
+}
+
+void Value::VectorRotateLeft(Value* other, TypeName part_type) {
+  assert_true(type == VEC128_TYPE && other->type == VEC128_TYPE);
+  VectorShift(OPCODE_VECTOR_ROTATE_LEFT, constant.v128, other->constant.v128,
+              part_type);
+}
+
+void Value::Extract(Value* vec, Value* index) {
+  assert_true(vec->type == VEC128_TYPE && index->type == INT8_TYPE);
+  uint32_t n = uint8_t(index->constant.i8);
+  switch (type) {
+    case INT8_TYPE:
+      constant.i8 = vec->constant.v128.i8[(n & 0xF) ^ 0x3];
+      break;
+    case INT16_TYPE:
+      constant.i16 = vec->constant.v128.i16[(n & 0x7) ^ 0x1];
+      break;
+    case INT32_TYPE:
+      constant.i32 = vec->constant.v128.i32[n & 0x3];
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
+void Value::Insert(Value* index, Value* part) {
+  assert_true(type == VEC128_TYPE && index->type == INT8_TYPE);
+  uint32_t n = uint8_t(index->constant.i8);
+  switch (part->type) {
+    case INT8_TYPE:
+      constant.v128.i8[(n & 0xF) ^ 0x3] = part->constant.i8;
+      break;
+    case INT16_TYPE:
+      constant.v128.i16[(n & 0x7) ^ 0x1] = part->constant.i16;
+      break;
+    case INT32_TYPE:
+      constant.v128.i32[n & 0x3] = part->constant.i32;
+      break;
+    default:
+      assert_unhandled_case(part->type);
+      break;
+  }
+}
+
+void Value::Splat(Value* other) {
+  assert_true(type == VEC128_TYPE);
+  switch (other->type) {
+    case INT8_TYPE:
+      constant.v128 = vec128b(other->constant.i8);
+      break;
+    case INT16_TYPE:
+      constant.v128 = vec128s(other->constant.i16);
+      break;
+    case INT32_TYPE:
+      constant.v128 = vec128i(other->constant.i32);
+      break;
+    case FLOAT32_TYPE:
+      constant.v128 = vec128f(other->constant.f32);
+      break;
+    default:
+      assert_unhandled_case(other->type);
+      break;
+  }
+}
+
+void Value::Permute(Value* control, Value* src1, Value* src2,
+                    TypeName part_type) {
+  assert_true(type == VEC128_TYPE);
+  const vec128_t& a = src1->constant.v128;
+  const vec128_t& b = src2->constant.v128;
+  vec128_t result;
+  switch (part_type) {
+    case INT8_TYPE:
+      for (size_t n = 0; n < 16; ++n) {
+        uint8_t sel = (control->constant.v128.u8[n] ^ 0x3) & 0x1F;
+        result.u8[n] = sel < 16 ? a.u8[sel] : b.u8[sel - 16];
+      }
+      break;
+    case INT16_TYPE:
+      for (size_t n = 0; n < 8; ++n) {
+        uint16_t sel = (control->constant.v128.u16[n] & 0xF) ^ 0x1;
+        result.u16[n] = sel < 8 ? a.u16[sel] : b.u16[sel - 8];
+      }
+      break;
+    case INT32_TYPE:
+      assert_true(control->type == INT32_TYPE);
+      for (size_t n = 0; n < 4; ++n) {
+        uint32_t sel = (uint32_t(control->constant.i32) >> (n * 8)) & 0x7;
+        result.u32[n] = sel < 4 ? a.u32[sel] : b.u32[sel - 4];
+      }
+      break;
+    default:
+      assert_unhandled_case(part_type);
+      break;
+  }
+  constant.v128 = result;
+}
+
+void Value::Swizzle(uint32_t swizzle_mask, TypeName part_type) {
+  assert_true(type == VEC128_TYPE);
+  assert_true(part_type == INT32_TYPE || part_type == FLOAT32_TYPE);
+  vec128_t result;
+  for (size_t n = 0; n < 4; ++n) {
+    result.u32[n] = constant.v128.u32[(swizzle_mask >> (n * 2)) & 0x3];
+  }
+  constant.v128 = result;
+}
+
 }  // namespace hir
 }  // namespace alloy
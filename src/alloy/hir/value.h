@@ -58,6 +58,9 @@ inline size_t GetTypeSize(TypeName type_name) {
 enum ValueFlags {
   VALUE_IS_CONSTANT = (1 << 1),
   VALUE_IS_ALLOCATED = (1 << 2),  // Used by backends. Do not set.
+  // 64bit value whose upper 32 bits are zero (or unused, for addresses) and
+  // are kept zero by the backend. See AddressNarrowingPass.
+  VALUE_IS_ZERO_EXTENDED = (1 << 3),
 };
 
 struct RegAssignment {
@@ -83,22 +86,23 @@ class Value {
   } ConstantValue;
 
  public:
+  // Ordered so that what every pass looks at shares a cache line, with the
+  // register allocation state last.
   uint32_t ordinal;
   TypeName type;
-
   uint32_t flags;
-  RegAssignment reg;
-  ConstantValue constant;
 
   Instr* def;
   Use* use_head;
+  // Constants are shared within a function (see HIRBuilder::LoadConstant)
+  // and must not be modified once created.
+  ConstantValue constant;
+
+  RegAssignment reg;
   // NOTE: for performance reasons this is not maintained during construction.
   Instr* last_use;
   Value* local_slot;
 
-  // TODO(benvanik): remove to shrink size.
-  void* tag;
-
   Use* AddUse(Arena* arena, Instr* instr);
   void RemoveUse(Use* use);
 
@@ -398,7 +402,24 @@ class Value {
   void Sha(Value* other);
   void ByteSwap();
   void CountLeadingZeros(const Value* other);
+  void RotateLeft(Value* other);
+  bool AddWithCarry(Value* other, bool carry);
   bool Compare(Opcode opcode, Value* other);
+
+  // Vector ops operate on the part_type lanes of this VEC128 value.
+  void VectorCompare(Opcode opcode, Value* other, TypeName part_type);
+  void VectorAdd(Value* other, TypeName part_type);
+  void VectorSub(Value* other, TypeName part_type);
+  void VectorShl(Value* other, TypeName part_type);
+  void VectorShr(Value* other, TypeName part_type);
+  void VectorSha(Value* other, TypeName part_type);
+  void VectorRotateLeft(Value* other, TypeName part_type);
+  // Element indices are in guest (big endian) order, as with the opcodes.
+  void Extract(Value* vec, Value* index);
+  void Insert(Value* index, Value* part);
+  void Splat(Value* other);
+  void Permute(Value* control, Value* src1, Value* src2, TypeName part_type);
+  void Swizzle(uint32_t swizzle_mask, TypeName part_type);
 };
 
 }  // namespace hir
@@ -0,0 +1,228 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/runtime/compile_queue.h"
+
+#include <gflags/gflags.h>
+
+#include "alloy/runtime/runtime.h"
+#include "poly/poly.h"
+#include "xenia/profiling.h"
+
+DEFINE_int32(speculative_compile_depth, 2,
+             "How many levels of direct callees to translate ahead of time "
+             "in the background.");
+
+namespace alloy {
+namespace runtime {
+
+namespace {
+// Speculation depth of the function being translated on this thread.
+// Guest threads demanding code are at depth 0.
+thread_local uint32_t current_depth_ = 0;
+// Whether this thread is currently processing a precompile request.
+thread_local bool current_precompile_ = false;
+}  // namespace
+
+CompileQueue::CompileQueue(Runtime* runtime)
+    : runtime_(runtime),
+      next_sequence_(0),
+      active_count_(0),
+      shutting_down_(false) {
+  precompile_stats_ = PrecompileStats();
+}
+
+CompileQueue::~CompileQueue() { Shutdown(); }
+
+int CompileQueue::Initialize(size_t worker_count) {
+  for (size_t n = 0; n < worker_count; ++n) {
+    workers_.emplace_back(&CompileQueue::WorkerMain, this, n);
+  }
+  return 0;
+}
+
+void CompileQueue::Shutdown() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    shutting_down_ = true;
+  }
+  request_cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+CompileQueue::PrecompileStats CompileQueue::precompile_stats() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return precompile_stats_;
+}
+
+void CompileQueue::Enqueue(uint64_t address, Priority priority) {
+  Enqueue(address, priority, 0);
+}
+
+void CompileQueue::EnqueueSpeculative(uint64_t address) {
+  if (current_precompile_) {
+    // Callees are queued by the precompile request itself.
+    return;
+  }
+  uint32_t depth = current_depth_ + 1;
+  if (depth > static_cast<uint32_t>(FLAGS_speculative_compile_depth)) {
+    return;
+  }
+  Enqueue(address, PRIORITY_SPECULATIVE, depth);
+}
+
+void CompileQueue::EnqueueOptimize(uint64_t address) {
+  if (workers_.empty()) {
+    runtime_->OptimizeFunction(address);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (shutting_down_) {
+      return;
+    }
+    // Not deduplicated; callers only request this once per function and
+    // OptimizeFunction no-ops if it's already done.
+    Request request;
+    request.address = address;
+    request.priority = PRIORITY_HIGH;
+    request.depth = 0;
+    request.optimize = true;
+    request.sequence = next_sequence_++;
+    queue_.push(request);
+  }
+  request_cond_.notify_one();
+}
+
+void CompileQueue::Enqueue(uint64_t address, Priority priority,
+                           uint32_t depth) {
+  if (workers_.empty() && priority != PRIORITY_PRECOMPILE) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (shutting_down_) {
+      return;
+    }
+    // Only ever queue a function once per priority. If it was already queued
+    // at a lower priority it's queued again so it gets done sooner; the
+    // duplicate request will no-op.
+    auto it = seen_.find(address);
+    if (it != seen_.end() && it->second >= priority) {
+      return;
+    }
+    seen_[address] = priority;
+    if (priority == PRIORITY_PRECOMPILE) {
+      ++precompile_stats_.found_count;
+    }
+    Request request;
+    request.address = address;
+    request.priority = priority;
+    request.depth = depth;
+    request.optimize = false;
+    request.sequence = next_sequence_++;
+    queue_.push(request);
+  }
+  request_cond_.notify_one();
+}
+
+void CompileQueue::WaitForIdle() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (!queue_.empty() || active_count_) {
+    idle_cond_.wait(lock);
+  }
+}
+
+void CompileQueue::Drain() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    if (!queue_.empty()) {
+      ProcessRequest(lock);
+    } else if (active_count_) {
+      idle_cond_.wait(lock);
+    } else {
+      break;
+    }
+  }
+}
+
+void CompileQueue::ProcessRequest(std::unique_lock<std::mutex>& lock) {
+  Request request = queue_.top();
+  queue_.pop();
+  ++active_count_;
+  lock.unlock();
+
+  bool precompile = request.priority == PRIORITY_PRECOMPILE;
+  int result;
+  if (request.optimize) {
+    SCOPE_profile_cpu_i("alloy", "CompileQueue::Optimize");
+    result = runtime_->OptimizeFunction(request.address);
+  } else {
+    SCOPE_profile_cpu_i("alloy", "CompileQueue::Request");
+    // This will no-op if the function is already translated and block if
+    // another thread is translating it.
+    current_depth_ = request.depth;
+    current_precompile_ = precompile;
+    Function* fn;
+    result = runtime_->ResolveFunction(request.address, &fn);
+    current_depth_ = 0;
+    current_precompile_ = false;
+
+    FunctionInfo* symbol_info = nullptr;
+    if (!result && precompile &&
+        !runtime_->LookupFunctionInfo(request.address, &symbol_info)) {
+      // Follow direct calls from the guest code rather than relying on the
+      // translator discovering them so that functions loaded from the code
+      // cache are followed too. fn may already be invalidated and freed, so
+      // go by the symbol.
+      Module* module = symbol_info->module();
+      std::vector<uint64_t> callees;
+      runtime_->frontend()->FindCallees(symbol_info, &callees);
+      for (uint64_t callee : callees) {
+        if (module->ContainsAddress(callee)) {
+          Enqueue(callee, PRIORITY_PRECOMPILE, 0);
+        }
+      }
+    }
+  }
+
+  lock.lock();
+  if (precompile) {
+    if (result) {
+      ++precompile_stats_.failed_count;
+    } else {
+      ++precompile_stats_.compiled_count;
+    }
+  }
+  --active_count_;
+  if (queue_.empty() && !active_count_) {
+    idle_cond_.notify_all();
+  }
+}
+
+void CompileQueue::WorkerMain(size_t index) {
+  poly::threading::set_name("Alloy Compiler " + std::to_string(index));
+
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    while (queue_.empty() && !shutting_down_) {
+      request_cond_.wait(lock);
+    }
+    if (shutting_down_) {
+      break;
+    }
+    ProcessRequest(lock);
+  }
+}
+
+}  // namespace runtime
+}  // namespace alloy
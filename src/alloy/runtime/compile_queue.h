@@ -0,0 +1,124 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef ALLOY_RUNTIME_COMPILE_QUEUE_H_
+#define ALLOY_RUNTIME_COMPILE_QUEUE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace alloy {
+namespace runtime {
+
+class Runtime;
+
+// Prioritized queue of functions to translate on background worker threads.
+// Workers resolve functions through the normal Runtime::ResolveFunction path,
+// so each gets its own translator from the frontend pool and guest threads
+// only block (on Entry::STATUS_COMPILING) if they need a function a worker is
+// in the middle of translating. Functions nobody has started on yet are
+// translated inline by the guest thread that demands them.
+//
+// Precompile requests additionally queue the direct callees of each function
+// they resolve, so queueing a few roots covers their whole static call graph.
+class CompileQueue {
+ public:
+  enum Priority {
+    // Callees discovered while translating another function.
+    PRIORITY_SPECULATIVE = 0,
+    // Whole-module precompilation.
+    PRIORITY_PRECOMPILE = 1,
+    // Something is likely to need this soon, or it's hot and being
+    // reoptimized.
+    PRIORITY_HIGH = 2,
+  };
+
+  struct PrecompileStats {
+    // Unique functions queued for precompilation, including callees.
+    size_t found_count;
+    size_t compiled_count;
+    size_t failed_count;
+  };
+
+  CompileQueue(Runtime* runtime);
+  ~CompileQueue();
+
+  size_t worker_count() const { return workers_.size(); }
+  PrecompileStats precompile_stats();
+
+  int Initialize(size_t worker_count);
+  void Shutdown();
+
+  // Queues the function at the given guest address for translation.
+  // Requests for functions already queued at the same or higher priority are
+  // ignored. Without workers only precompile requests are queued and they
+  // only run when someone calls Drain.
+  void Enqueue(uint64_t address, Priority priority);
+  // Queues a callee of the function currently being translated on this
+  // thread. Bounded by --speculative_compile_depth.
+  void EnqueueSpeculative(uint64_t address);
+  // Queues a hot baseline function for retranslation at full optimization.
+  // Runs inline if there are no workers.
+  void EnqueueOptimize(uint64_t address);
+
+  // Blocks until the queue is empty and all workers are idle.
+  void WaitForIdle();
+  // Like WaitForIdle but the calling thread also processes requests.
+  void Drain();
+
+ private:
+  struct Request {
+    uint64_t address;
+    Priority priority;
+    uint32_t depth;
+    bool optimize;
+    uint64_t sequence;
+    bool operator<(const Request& other) const {
+      // std::priority_queue pops the largest element.
+      if (priority != other.priority) {
+        return priority < other.priority;
+      }
+      if (depth != other.depth) {
+        return depth > other.depth;
+      }
+      return sequence > other.sequence;
+    }
+  };
+
+  void Enqueue(uint64_t address, Priority priority, uint32_t depth);
+  // Pops and processes the top request. lock must be held and is released
+  // while the function is being translated.
+  void ProcessRequest(std::unique_lock<std::mutex>& lock);
+  void WorkerMain(size_t index);
+
+ private:
+  Runtime* runtime_;
+
+  std::mutex lock_;
+  std::condition_variable request_cond_;
+  std::condition_variable idle_cond_;
+  std::priority_queue<Request> queue_;
+  // Highest priority each address has been queued at.
+  std::unordered_map<uint64_t, Priority> seen_;
+  uint64_t next_sequence_;
+  size_t active_count_;
+  bool shutting_down_;
+  PrecompileStats precompile_stats_;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace runtime
+}  // namespace alloy
+
+#endif  // ALLOY_RUNTIME_COMPILE_QUEUE_H_
@@ -9,6 +9,8 @@
 
 #include "alloy/runtime/entry_table.h"
 
+#include "alloy/runtime/function.h"
+#include "alloy/runtime/symbol_info.h"
 #include "poly/poly.h"
 #include "xenia/profiling.h"
 
@@ -58,6 +60,10 @@ Entry::Status EntryTable::GetOrCreate(uint64_t address, Entry** out_entry) {
       } while (entry->status == Entry::STATUS_COMPILING);
     }
     status = entry->status;
+    if (status == Entry::STATUS_NEW) {
+      // Invalidated since it was last generated; claim it to regenerate.
+      entry->status = Entry::STATUS_COMPILING;
+    }
   } else {
     // Create and return for initialization.
     entry = new Entry();
@@ -88,5 +94,32 @@ std::vector<Function*> EntryTable::FindWithAddress(uint64_t address) {
   return fns;
 }
 
+size_t EntryTable::Invalidate(uint64_t address, uint64_t end_address,
+                              std::function<bool(Entry*)> reset) {
+  SCOPE_profile_cpu_f("alloy");
+  std::lock_guard<std::mutex> guard(lock_);
+  size_t count = 0;
+  for (auto& it : map_) {
+    Entry* entry = it.second;
+    if (entry->status != Entry::STATUS_READY) {
+      continue;
+    }
+    // end_address is that of the last instruction. Code inlined from other
+    // functions counts as well.
+    if ((entry->address >= end_address ||
+         entry->end_address + 4 <= address) &&
+        !entry->function->symbol_info()->InlinesCodeIn(address, end_address)) {
+      continue;
+    }
+    if (reset(entry)) {
+      entry->status = Entry::STATUS_NEW;
+      entry->function = nullptr;
+      entry->end_address = 0;
+      ++count;
+    }
+  }
+  return count;
+}
+
 }  // namespace runtime
 }  // namespace alloy
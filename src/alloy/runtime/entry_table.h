@@ -10,6 +10,7 @@
 #ifndef ALLOY_RUNTIME_ENTRY_TABLE_H_
 #define ALLOY_RUNTIME_ENTRY_TABLE_H_
 
+#include <functional>
 #include <mutex>
 #include <unordered_map>
 #include <vector>
@@ -21,6 +22,7 @@ class Function;
 
 typedef struct Entry_t {
   typedef enum {
+    // Not yet generated, or invalidated since.
     STATUS_NEW = 0,
     STATUS_COMPILING,
     STATUS_READY,
@@ -43,6 +45,13 @@ class EntryTable {
 
   std::vector<Function*> FindWithAddress(uint64_t address);
 
+  // Resets ready entries with code in [address, end_address) so that they
+  // are regenerated on next use. reset is called for each under the table
+  // lock, before any other thread can claim the entry again, and may return
+  // false to leave the entry as is. Returns the number of entries reset.
+  size_t Invalidate(uint64_t address, uint64_t end_address,
+                    std::function<bool(Entry*)> reset);
+
  private:
   // TODO(benvanik): replace with a better data structure.
   std::mutex lock_;
@@ -10,6 +10,7 @@
 #include "alloy/runtime/function.h"
 
 #include "alloy/runtime/debugger.h"
+#include "alloy/runtime/runtime.h"
 #include "alloy/runtime/symbol_info.h"
 #include "alloy/runtime/thread_state.h"
 #include "xdb/protocol.h"
@@ -18,7 +19,9 @@ namespace alloy {
 namespace runtime {
 
 Function::Function(FunctionInfo* symbol_info)
-    : address_(symbol_info->address()), symbol_info_(symbol_info) {}
+    : address_(symbol_info->address()),
+      symbol_info_(symbol_info),
+      tier_(FUNCTION_TIER_OPTIMIZED) {}
 
 Function::~Function() = default;
 
@@ -72,6 +75,10 @@ int Function::Call(ThreadState* thread_state, uint64_t return_address) {
     ThreadState::Bind(thread_state);
   }
 
+  // Keeps retired code from being released while this may still use it.
+  Runtime* runtime = thread_state->runtime();
+  runtime->BeginGuestCall(thread_state);
+
   int result = 0;
 
   uint64_t trace_base = thread_state->memory()->trace_base();
@@ -109,7 +116,17 @@ int Function::Call(ThreadState* thread_state, uint64_t return_address) {
       ev->address = static_cast<uint32_t>(symbol_info_->address());
     }
 
-    CallImpl(thread_state, return_address);
+    // The function may have been replaced or invalidated since the caller
+    // looked it up, and invalidated code may already be gone.
+    Function* function = this;
+    if (symbol_info_->function() != this) {
+      result = runtime->ResolveFunction(address_, &function);
+    }
+    if (!result) {
+      thread_state->EnterGuestCode();
+      function->CallImpl(thread_state, return_address);
+      thread_state->ExitGuestCode();
+    }
 
     if (trace_base && true) {
       auto ev = xdb::protocol::UserCallReturnEvent::Append(trace_base);
@@ -118,6 +135,8 @@ int Function::Call(ThreadState* thread_state, uint64_t return_address) {
     }
   }
 
+  runtime->EndGuestCall(thread_state);
+
   if (original_thread_state != thread_state) {
     ThreadState::Bind(original_thread_state);
   }
@@ -23,6 +23,15 @@ class Breakpoint;
 class FunctionInfo;
 class ThreadState;
 
+// Optimization level a function was translated at.
+enum FunctionTier {
+  // Quick to translate. Counts entries and loop iterations so hot functions
+  // can be found and retranslated.
+  FUNCTION_TIER_BASELINE = 0,
+  // The full pass pipeline.
+  FUNCTION_TIER_OPTIMIZED = 1,
+};
+
 class Function {
  public:
   Function(FunctionInfo* symbol_info);
@@ -31,6 +40,9 @@ class Function {
   uint64_t address() const { return address_; }
   FunctionInfo* symbol_info() const { return symbol_info_; }
 
+  FunctionTier tier() const { return tier_; }
+  void set_tier(FunctionTier value) { tier_ = value; }
+
   DebugInfo* debug_info() const { return debug_info_.get(); }
   void set_debug_info(std::unique_ptr<DebugInfo> debug_info) {
     debug_info_ = std::move(debug_info);
@@ -50,6 +62,7 @@ class Function {
  protected:
   uint64_t address_;
   FunctionInfo* symbol_info_;
+  FunctionTier tier_;
   std::unique_ptr<DebugInfo> debug_info_;
 
   // TODO(benvanik): move elsewhere? DebugData?
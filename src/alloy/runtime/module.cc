@@ -26,6 +26,11 @@ Module::~Module() = default;
 
 bool Module::ContainsAddress(uint64_t address) { return true; }
 
+bool Module::GetCodeRange(uint64_t* out_low_address,
+                          uint64_t* out_high_address) {
+  return false;
+}
+
 SymbolInfo* Module::LookupSymbol(uint64_t address, bool wait) {
   lock_.lock();
   const auto it = map_.find(address);
@@ -35,6 +35,10 @@ class Module {
   virtual const std::string& name() const = 0;
 
   virtual bool ContainsAddress(uint64_t address);
+  // Gets the [low, high) range of guest code in the module, if it is known
+  // and contiguous.
+  virtual bool GetCodeRange(uint64_t* out_low_address,
+                            uint64_t* out_high_address);
 
   SymbolInfo* LookupSymbol(uint64_t address, bool wait = true);
   virtual SymbolInfo::Status DeclareFunction(uint64_t address,
@@ -56,5 +56,12 @@ bool RawModule::ContainsAddress(uint64_t address) {
   return address >= low_address_ && address < high_address_;
 }
 
+bool RawModule::GetCodeRange(uint64_t* out_low_address,
+                             uint64_t* out_high_address) {
+  *out_low_address = low_address_;
+  *out_high_address = high_address_;
+  return true;
+}
+
 }  // namespace runtime
 }  // namespace alloy
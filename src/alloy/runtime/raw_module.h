@@ -27,6 +27,8 @@ class RawModule : public Module {
   const std::string& name() const override { return name_; }
 
   bool ContainsAddress(uint64_t address) override;
+  bool GetCodeRange(uint64_t* out_low_address,
+                    uint64_t* out_high_address) override;
 
  private:
   std::string name_;
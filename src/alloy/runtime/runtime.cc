@@ -11,14 +11,27 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <thread>
+
 #include "alloy/runtime/module.h"
 #include "poly/poly.h"
 #include "xdb/protocol.h"
+#include "xenia/profiling.h"
 
 // TODO(benvanik): based on compiler support
 #include "alloy/backend/x64/x64_backend.h"
 
 DEFINE_string(runtime_backend, "any", "Runtime backend [any, x64].");
+DEFINE_int32(compile_threads, -1,
+             "Number of background compilation threads. -1 picks based on "
+             "the host core count, 0 compiles only on demand.");
+DEFINE_bool(tiered_compilation, false,
+            "Translate functions with a minimal pass pipeline first and "
+            "retranslate them with full optimization once they get hot.");
+DEFINE_int32(tier_up_threshold, 1000,
+             "Number of calls plus loop iterations before a baseline function "
+             "is retranslated with full optimization.");
 
 namespace alloy {
 namespace runtime {
@@ -43,10 +56,22 @@ Runtime::Runtime(Memory* memory, uint32_t debug_info_flags,
     : memory_(memory),
       debug_info_flags_(debug_info_flags),
       trace_flags_(trace_flags),
+      epoch_(0),
+      has_retired_code_(false),
       builtin_module_(nullptr),
-      next_builtin_address_(0x100000000ull) {}
+      next_builtin_address_(0x100000000ull) {
+  invalidation_stats_ = InvalidationStats();
+}
 
 Runtime::~Runtime() {
+  // Workers call into everything else, so stop them first.
+  compile_queue_.reset();
+
+  for (auto& retired : retired_functions_) {
+    delete retired.function;
+  }
+  retired_functions_.clear();
+
   {
     std::lock_guard<std::mutex> guard(modules_lock_);
     modules_.clear();
@@ -105,6 +130,17 @@ int Runtime::Initialize(std::unique_ptr<Frontend> frontend,
   backend_ = std::move(backend);
   frontend_ = std::move(frontend);
 
+  int compile_threads = FLAGS_compile_threads;
+  if (compile_threads < 0) {
+    // Leave room for the guest threads.
+    compile_threads = std::max(1, int(std::thread::hardware_concurrency()) / 2);
+  }
+  compile_queue_.reset(new CompileQueue(this));
+  result = compile_queue_->Initialize(compile_threads);
+  if (result) {
+    return result;
+  }
+
   return 0;
 }
 
@@ -133,6 +169,14 @@ std::vector<Module*> Runtime::GetModules() {
   return clone;
 }
 
+int Runtime::OpenCodeCache(Module* module, const std::string& cache_key) {
+  // Cached code has no debug info and doesn't trace.
+  if (debug_info_flags_ || trace_flags_) {
+    return 1;
+  }
+  return backend_->OpenCodeCache(module, cache_key);
+}
+
 FunctionInfo* Runtime::DefineBuiltin(const std::string& name,
                                      FunctionInfo::ExternHandler handler,
                                      void* arg0, void* arg1) {
@@ -243,9 +287,19 @@ int Runtime::DemandFunction(FunctionInfo* symbol_info,
   SymbolInfo::Status symbol_status = module->DefineFunction(symbol_info);
   if (symbol_status == SymbolInfo::STATUS_NEW) {
     // Symbol is undefined, so define now.
+    // Try the persistent code cache first and translate if it misses.
     Function* function = nullptr;
-    int result = frontend_->DefineFunction(symbol_info, debug_info_flags_,
-                                           trace_flags_, &function);
+    int result = backend_->LoadCachedFunction(symbol_info, &function);
+    if (result) {
+      FunctionTier tier = FUNCTION_TIER_OPTIMIZED;
+      if (FLAGS_tiered_compilation &&
+          symbol_info->behavior() == FunctionInfo::BEHAVIOR_DEFAULT) {
+        tier = FUNCTION_TIER_BASELINE;
+        *symbol_info->tier_up_counter() = FLAGS_tier_up_threshold;
+      }
+      result = frontend_->DefineFunction(symbol_info, debug_info_flags_,
+                                         trace_flags_, tier, &function);
+    }
     if (result) {
       symbol_info->set_status(SymbolInfo::STATUS_FAILED);
       return result;
@@ -262,6 +316,8 @@ int Runtime::DemandFunction(FunctionInfo* symbol_info,
           static_cast<uint32_t>(symbol_info->end_address() - ev->address);
     }
 
+    WatchFunctionCode(symbol_info);
+
     // Before we give the symbol back to the rest, let the debugger know.
     debugger_->OnFunctionDefined(symbol_info, function);
 
@@ -279,5 +335,206 @@ int Runtime::DemandFunction(FunctionInfo* symbol_info,
   return 0;
 }
 
+int Runtime::OptimizeFunction(uint64_t address) {
+  SCOPE_profile_cpu_f("alloy");
+
+  Entry* entry = entry_table_.Get(address);
+  if (!entry) {
+    return 1;
+  }
+  // Invalidated functions are freed, so only look at the function under the
+  // lock and bail if anything was invalidated by the time we swap.
+  Function* old_function;
+  FunctionInfo* symbol_info;
+  size_t invalidation_count;
+  {
+    std::lock_guard<std::mutex> guard(tier_lock_);
+    if (entry->status != Entry::STATUS_READY) {
+      return 1;
+    }
+    old_function = entry->function;
+    if (old_function->tier() != FUNCTION_TIER_BASELINE) {
+      // Already done.
+      return 0;
+    }
+    symbol_info = old_function->symbol_info();
+    invalidation_count = invalidation_stats_.request_count;
+  }
+
+  Function* function = nullptr;
+  int result =
+      frontend_->DefineFunction(symbol_info, debug_info_flags_, trace_flags_,
+                                FUNCTION_TIER_OPTIMIZED, &function);
+  if (result) {
+    return result;
+  }
+
+  // Swap in the new code. The backend redirects the old code to the new so
+  // that anything still pointing at it (call sites, caches, frames that have
+  // yet to return) picks up the new code. The old function is retired along
+  // with its code.
+  std::unique_lock<std::mutex> guard(tier_lock_);
+  if (invalidation_stats_.request_count != invalidation_count ||
+      entry->status != Entry::STATUS_READY ||
+      entry->function != old_function) {
+    // Raced with another optimization or with an invalidation.
+    return 0;
+  }
+  result = backend_->ReplaceFunction(old_function, function);
+  if (result) {
+    return result;
+  }
+  symbol_info->set_function(function);
+  entry->function = function;
+  retired_functions_.push_back({epoch_, old_function});
+  ++epoch_;
+  has_retired_code_ = true;
+  guard.unlock();
+
+  ReclaimCode();
+  return 0;
+}
+
+size_t Runtime::InvalidateCode(uint64_t address, size_t length) {
+  SCOPE_profile_cpu_f("alloy");
+
+  std::unique_lock<std::mutex> guard(tier_lock_);
+  uint64_t epoch = epoch_;
+  size_t count = entry_table_.Invalidate(
+      address, address + length, [this, epoch](Entry* entry) {
+        Function* function = entry->function;
+        if (backend_->InvalidateFunction(function)) {
+          return false;
+        }
+        // The function may not even end in the same place anymore, so have
+        // the frontend scan it again.
+        FunctionInfo* symbol_info = function->symbol_info();
+        symbol_info->set_function(nullptr);
+        symbol_info->set_end_address(0);
+        symbol_info->ClearInlinedRanges();
+        symbol_info->set_status(SymbolInfo::STATUS_DECLARED);
+        // Frames may still be running it, so it's freed along with its code.
+        retired_functions_.push_back({epoch, function});
+        return true;
+      });
+
+  ++invalidation_stats_.request_count;
+  invalidation_stats_.function_count += count;
+  COUNT_profile_cpu("Invalidated functions", count);
+  if (count) {
+    ++epoch_;
+    has_retired_code_ = true;
+  }
+  guard.unlock();
+
+  // Usually nothing can be freed yet, as threads still have to quiesce. Code
+  // retired earlier may be though.
+  if (count) {
+    ReclaimCode();
+  }
+  return count;
+}
+
+void Runtime::BeginGuestCall(ThreadState* thread_state) {
+  if (thread_state->guest_call_depth_) {
+    ++thread_state->guest_call_depth_;
+    return;
+  }
+  // Outside of a call the thread holds nothing, so it starts out quiescent
+  // as of now. That must be visible before the depth is.
+  {
+    std::lock_guard<std::mutex> guard(thread_states_lock_);
+    thread_state->quiescent_epoch_ = epoch_;
+    thread_state->pinned_code_.clear();
+  }
+  ++thread_state->guest_call_depth_;
+}
+
+void Runtime::EndGuestCall(ThreadState* thread_state) {
+  if (--thread_state->guest_call_depth_ == 0 && has_retired_code_) {
+    ReclaimCode();
+  }
+}
+
+bool Runtime::ShouldQuiesce(ThreadState* thread_state) const {
+  // Only the thread itself changes its own quiescence state, so it can look
+  // at it without the lock. As long as nothing new was retired, and none of
+  // what's retired is on its stack, there's nothing new to report.
+  return thread_state->guest_entry_depth_ == 1 &&
+         (thread_state->quiescent_epoch_ != epoch_ ||
+          !thread_state->pinned_code_.empty());
+}
+
+void Runtime::Quiesce(ThreadState* thread_state, uint64_t epoch,
+                      std::vector<void*> pinned_code) {
+  bool progressed;
+  {
+    std::lock_guard<std::mutex> guard(thread_states_lock_);
+    progressed = epoch != thread_state->quiescent_epoch_ ||
+                 pinned_code.size() < thread_state->pinned_code_.size();
+    thread_state->quiescent_epoch_ = epoch;
+    thread_state->pinned_code_ = std::move(pinned_code);
+  }
+  // The thread may be the one everything was waiting on.
+  if (progressed && has_retired_code_) {
+    ReclaimCode();
+  }
+}
+
+void Runtime::AddThreadState(ThreadState* thread_state) {
+  std::lock_guard<std::mutex> guard(thread_states_lock_);
+  thread_states_.push_back(thread_state);
+}
+
+void Runtime::RemoveThreadState(ThreadState* thread_state) {
+  std::lock_guard<std::mutex> guard(thread_states_lock_);
+  thread_states_.erase(
+      std::remove(thread_states_.begin(), thread_states_.end(), thread_state),
+      thread_states_.end());
+}
+
+void Runtime::ReclaimCode() {
+  SCOPE_profile_cpu_f("alloy");
+
+  // Everything retired before the oldest epoch a thread in a call quiesced at
+  // can go, except for code still on the stack of one. Threads that begin a
+  // call after this can only find what's current, as retiring happens first.
+  uint64_t epoch = epoch_;
+  std::vector<void*> pinned_code;
+  {
+    std::lock_guard<std::mutex> guard(thread_states_lock_);
+    for (auto thread_state : thread_states_) {
+      if (!thread_state->guest_call_depth_) {
+        continue;
+      }
+      epoch = std::min(epoch, thread_state->quiescent_epoch_);
+      pinned_code.insert(pinned_code.end(),
+                         thread_state->pinned_code_.begin(),
+                         thread_state->pinned_code_.end());
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(tier_lock_);
+  invalidation_stats_.reclaimed_size +=
+      backend_->ReclaimCode(epoch, pinned_code);
+  // The runtime itself never runs a retired function, and Function::Call
+  // doesn't touch it once its code runs, so only the epoch matters.
+  auto it = std::remove_if(retired_functions_.begin(), retired_functions_.end(),
+                           [epoch](const RetiredFunction& retired) {
+                             if (retired.epoch >= epoch) {
+                               return false;
+                             }
+                             delete retired.function;
+                             return true;
+                           });
+  retired_functions_.erase(it, retired_functions_.end());
+  has_retired_code_ = !retired_functions_.empty();
+}
+
+Runtime::InvalidationStats Runtime::invalidation_stats() {
+  std::lock_guard<std::mutex> guard(tier_lock_);
+  return invalidation_stats_;
+}
+
 }  // namespace runtime
 }  // namespace alloy
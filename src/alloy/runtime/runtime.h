@@ -10,6 +10,7 @@
 #ifndef ALLOY_RUNTIME_RUNTIME_H_
 #define ALLOY_RUNTIME_RUNTIME_H_
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -17,6 +18,7 @@
 #include "alloy/backend/backend.h"
 #include "alloy/frontend/frontend.h"
 #include "alloy/memory.h"
+#include "alloy/runtime/compile_queue.h"
 #include "alloy/runtime/debugger.h"
 #include "alloy/runtime/entry_table.h"
 #include "alloy/runtime/module.h"
@@ -28,6 +30,15 @@ namespace runtime {
 
 class Runtime {
  public:
+  struct InvalidationStats {
+    // InvalidateCode requests.
+    size_t request_count;
+    // Functions discarded to be regenerated.
+    size_t function_count;
+    // Bytes of generated code released since.
+    size_t reclaimed_size;
+  };
+
   explicit Runtime(Memory* memory, uint32_t debug_info_flags = 0,
                    uint32_t trace_flags = 0);
   virtual ~Runtime();
@@ -36,6 +47,7 @@ class Runtime {
   Debugger* debugger() const { return debugger_.get(); }
   frontend::Frontend* frontend() const { return frontend_.get(); }
   backend::Backend* backend() const { return backend_.get(); }
+  CompileQueue* compile_queue() const { return compile_queue_.get(); }
 
   int Initialize(std::unique_ptr<frontend::Frontend> frontend,
                  std::unique_ptr<backend::Backend> backend = 0);
@@ -45,6 +57,10 @@ class Runtime {
   Module* GetModule(const std::string& name) { return GetModule(name.c_str()); }
   std::vector<Module*> GetModules();
 
+  // Opens the backend persistent code cache for the module, if enabled.
+  // cache_key must uniquely identify the guest code of the module.
+  int OpenCodeCache(Module* module, const std::string& cache_key);
+
   Module* builtin_module() const { return builtin_module_; }
   FunctionInfo* DefineBuiltin(const std::string& name,
                               FunctionInfo::ExternHandler handler, void* arg0,
@@ -56,11 +72,52 @@ class Runtime {
   int LookupFunctionInfo(Module* module, uint64_t address,
                          FunctionInfo** out_symbol_info);
   int ResolveFunction(uint64_t address, Function** out_function);
+  // Retranslates a baseline function at full optimization and swaps it in.
+  // The function must already be resolved.
+  int OptimizeFunction(uint64_t address);
+
+  // Discards the generated code of all functions overlapping the given guest
+  // range, as it has been (or is about to be) overwritten. They are
+  // regenerated on their next use. Returns the number of functions discarded.
+  size_t InvalidateCode(uint64_t address, size_t length);
+  InvalidationStats invalidation_stats();
+
+  // Advanced each time code or functions are retired (invalidated or
+  // replaced by tier-up). Retired things are stamped with the epoch before
+  // the advance.
+  uint64_t epoch() const { return epoch_; }
+
+  // Bracket every call from the host into guest code on the thread. Host code
+  // must not hold on to a Function outside of a call. Retired code (and its
+  // Function) is released once each thread in a call has quiesced after its
+  // retirement and has no frame left that returns into it.
+  void BeginGuestCall(ThreadState* thread_state);
+  void EndGuestCall(ThreadState* thread_state);
+
+  // Whether the thread, now calling from guest code into the host, should
+  // walk its guest frames and report them with Quiesce. Cheap, as it's asked
+  // on every call out of guest code.
+  bool ShouldQuiesce(ThreadState* thread_state) const;
+  // Records that the thread holds nothing retired before the given epoch
+  // apart from pinned_code, the retired code its guest frames return into,
+  // and releases whatever that frees up. Called by the backend.
+  void Quiesce(ThreadState* thread_state, uint64_t epoch,
+               std::vector<void*> pinned_code);
+
+  // Called by ThreadState.
+  void AddThreadState(ThreadState* thread_state);
+  void RemoveThreadState(ThreadState* thread_state);
 
   // uint32_t CreateCallback(void (*callback)(void* data), void* data);
 
+ protected:
+  // Called once a function has been generated, before it is first run.
+  // Subclasses can watch the guest code for writes and call InvalidateCode.
+  virtual void WatchFunctionCode(FunctionInfo* symbol_info) {}
+
  private:
   int DemandFunction(FunctionInfo* symbol_info, Function** out_function);
+  void ReclaimCode();
 
  protected:
   Memory* memory_;
@@ -72,8 +129,25 @@ class Runtime {
 
   std::unique_ptr<frontend::Frontend> frontend_;
   std::unique_ptr<backend::Backend> backend_;
+  std::unique_ptr<CompileQueue> compile_queue_;
 
   EntryTable entry_table_;
+  // Held while swapping or discarding the function of an entry.
+  std::mutex tier_lock_;
+  InvalidationStats invalidation_stats_;
+  // Only advanced under tier_lock_.
+  std::atomic<uint64_t> epoch_;
+  // Whether anything retired is waiting to be released.
+  std::atomic<bool> has_retired_code_;
+  struct RetiredFunction {
+    uint64_t epoch;
+    Function* function;
+  };
+  // Invalidated and replaced functions, deleted along with their code.
+  std::vector<RetiredFunction> retired_functions_;
+  // Guards the quiescence state of all threads.
+  std::mutex thread_states_lock_;
+  std::vector<ThreadState*> thread_states_;
   std::mutex modules_lock_;
   std::vector<std::unique_ptr<Module>> modules_;
   Module* builtin_module_;
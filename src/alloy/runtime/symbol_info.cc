@@ -9,6 +9,8 @@
 
 #include "alloy/runtime/symbol_info.h"
 
+#include <algorithm>
+
 namespace alloy {
 namespace runtime {
 
@@ -25,12 +27,43 @@ FunctionInfo::FunctionInfo(Module* module, uint64_t address)
     : SymbolInfo(SymbolInfo::TYPE_FUNCTION, module, address),
       end_address_(0),
       behavior_(BEHAVIOR_DEFAULT),
-      function_(0) {
+      function_(0),
+      tier_up_counter_(0) {
   memset(&extern_info_, 0, sizeof(extern_info_));
 }
 
 FunctionInfo::~FunctionInfo() = default;
 
+void FunctionInfo::AddInlinedRange(uint64_t address, uint64_t end_address) {
+  std::lock_guard<std::mutex> guard(inlined_ranges_lock_);
+  auto range = std::make_pair(address, end_address);
+  // Each tier inlines the same callees.
+  if (std::find(inlined_ranges_.begin(), inlined_ranges_.end(), range) ==
+      inlined_ranges_.end()) {
+    inlined_ranges_.push_back(range);
+  }
+}
+
+bool FunctionInfo::HasInlinedCode() {
+  std::lock_guard<std::mutex> guard(inlined_ranges_lock_);
+  return !inlined_ranges_.empty();
+}
+
+bool FunctionInfo::InlinesCodeIn(uint64_t address, uint64_t end_address) {
+  std::lock_guard<std::mutex> guard(inlined_ranges_lock_);
+  for (auto& range : inlined_ranges_) {
+    if (range.first < end_address && address < range.second) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FunctionInfo::ClearInlinedRanges() {
+  std::lock_guard<std::mutex> guard(inlined_ranges_lock_);
+  inlined_ranges_.clear();
+}
+
 void FunctionInfo::SetupExtern(ExternHandler handler, void* arg0, void* arg1) {
   behavior_ = BEHAVIOR_EXTERN;
   extern_info_.handler = handler;
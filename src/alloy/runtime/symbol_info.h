@@ -11,7 +11,10 @@
 #define ALLOY_RUNTIME_SYMBOL_INFO_H_
 
 #include <cstdint>
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace alloy {
 namespace runtime {
@@ -80,6 +83,17 @@ class FunctionInfo : public SymbolInfo {
   Function* function() const { return function_; }
   void set_function(Function* value) { function_ = value; }
 
+  // Decremented by baseline code on entry and on loop back-edges. The function
+  // is retranslated with full optimization when it goes negative.
+  volatile int32_t* tier_up_counter() { return &tier_up_counter_; }
+
+  // Guest code of other functions inlined into the code of this one, as
+  // [address, end_address) ranges. Writes to it invalidate this function too.
+  void AddInlinedRange(uint64_t address, uint64_t end_address);
+  bool HasInlinedCode();
+  bool InlinesCodeIn(uint64_t address, uint64_t end_address);
+  void ClearInlinedRanges();
+
   typedef void (*ExternHandler)(void* context, void* arg0, void* arg1);
   void SetupExtern(ExternHandler handler, void* arg0, void* arg1);
   ExternHandler extern_handler() const { return extern_info_.handler; }
@@ -90,6 +104,9 @@ class FunctionInfo : public SymbolInfo {
   uint64_t end_address_;
   Behavior behavior_;
   Function* function_;
+  volatile int32_t tier_up_counter_;
+  std::mutex inlined_ranges_lock_;
+  std::vector<std::pair<uint64_t, uint64_t>> inlined_ranges_;
   struct {
     ExternHandler handler;
     void* arg0;
@@ -9,7 +9,8 @@
 
 #include "alloy/runtime/test_module.h"
 
-#include "alloy/compiler/compiler_passes.h"
+#include "alloy/alloy-private.h"
+#include "alloy/compiler/compiler_pipelines.h"
 #include "alloy/reset_scope.h"
 #include "alloy/runtime/runtime.h"
 #include "poly/platform.h"
@@ -19,11 +20,11 @@ namespace alloy {
 namespace runtime {
 
 using alloy::backend::Backend;
+using alloy::compiler::AddOptimizingPasses;
 using alloy::compiler::Compiler;
 using alloy::hir::HIRBuilder;
 using alloy::runtime::Function;
 using alloy::runtime::FunctionInfo;
-namespace passes = alloy::compiler::passes;
 
 TestModule::TestModule(Runtime* runtime, const std::string& name,
                        std::function<bool(uint64_t)> contains_address,
@@ -37,33 +38,8 @@ TestModule::TestModule(Runtime* runtime, const std::string& name,
   assembler_ = std::move(runtime->backend()->CreateAssembler());
   assembler_->Initialize();
 
-  // Merge blocks early. This will let us use more context in other passes.
-  // The CFG is required for simplification and dirtied by it.
-  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
-  compiler_->AddPass(std::make_unique<passes::ControlFlowSimplificationPass>());
-  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
-
-  // Passes are executed in the order they are added. Multiple of the same
-  // pass type may be used.
-  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
-  compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  compiler_->AddPass(std::make_unique<passes::ConstantPropagationPass>());
-  compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
-
-  //// Removes all unneeded variables. Try not to add new ones after this.
-  // compiler_->AddPass(new passes::ValueReductionPass());
-
-  // Register allocation for the target backend.
-  // Will modify the HIR to add loads/stores.
-  // This should be the last pass before finalization, as after this all
-  // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      runtime->backend()->machine_info()));
-
-  // Must come last. The HIR is not really HIR after this.
-  compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+  AddOptimizingPasses(compiler_.get(), runtime->backend()->machine_info(),
+                      FLAGS_validate_hir);
 }
 
 TestModule::~TestModule() = default;
@@ -90,7 +66,8 @@ SymbolInfo::Status TestModule::DeclareFunction(uint64_t address,
     compiler_->Compile(builder_.get());
 
     Function* fn = nullptr;
-    assembler_->Assemble(symbol_info, builder_.get(), 0, nullptr, 0, &fn);
+    assembler_->Assemble(symbol_info, builder_.get(), 0, nullptr, 0,
+                         FUNCTION_TIER_OPTIMIZED, &fn);
 
     symbol_info->set_function(fn);
     status = SymbolInfo::STATUS_DEFINED;
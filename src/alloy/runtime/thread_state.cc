@@ -23,7 +23,10 @@ ThreadState::ThreadState(Runtime* runtime, uint32_t thread_id)
       thread_id_(thread_id),
       name_(""),
       backend_data_(0),
-      raw_context_(0) {
+      raw_context_(0),
+      guest_entry_depth_(0),
+      guest_call_depth_(0),
+      quiescent_epoch_(0) {
   if (thread_id_ == UINT_MAX) {
     // System thread. Assign the system thread ID with a high bit
     // set so people know what's up.
@@ -31,9 +34,11 @@ ThreadState::ThreadState(Runtime* runtime, uint32_t thread_id)
     thread_id_ = 0x80000000 | system_thread_handle;
   }
   backend_data_ = runtime->backend()->AllocThreadData();
+  runtime->AddThreadState(this);
 }
 
 ThreadState::~ThreadState() {
+  runtime_->RemoveThreadState(this);
   if (backend_data_) {
     runtime_->backend()->FreeThreadData(backend_data_);
   }
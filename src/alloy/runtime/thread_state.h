@@ -10,7 +10,9 @@
 #ifndef ALLOY_RUNTIME_THREAD_STATE_H_
 #define ALLOY_RUNTIME_THREAD_STATE_H_
 
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "alloy/memory.h"
 
@@ -32,6 +34,13 @@ class ThreadState {
   void* backend_data() const { return backend_data_; }
   void* raw_context() const { return raw_context_; }
 
+  // Bracket each call from the host into guest code. Only the innermost run
+  // of guest frames on the stack can be walked, so the thread only quiesces
+  // (see Runtime::Quiesce) while there's just one.
+  void EnterGuestCode() { ++guest_entry_depth_; }
+  void ExitGuestCode() { --guest_entry_depth_; }
+  uint32_t guest_entry_depth() const { return guest_entry_depth_; }
+
   int Suspend() { return Suspend(~0); }
   virtual int Suspend(uint32_t timeout_ms) { return 1; }
   virtual int Resume(bool force = false) { return 1; }
@@ -47,6 +56,18 @@ class ThreadState {
   std::string name_;
   void* backend_data_;
   void* raw_context_;
+  uint32_t guest_entry_depth_;
+
+ private:
+  // Quiescence state, owned by the runtime.
+  friend class Runtime;
+  // Runtime::BeginGuestCall nesting. Read by other threads.
+  std::atomic<uint32_t> guest_call_depth_;
+  // Runtime::epoch() when the thread was last seen in host code. It held
+  // nothing retired before that except for pinned_code_, which its guest
+  // frames return into. Both are guarded by the runtime.
+  uint64_t quiescent_epoch_;
+  std::vector<void*> pinned_code_;
 };
 
 }  // namespace runtime
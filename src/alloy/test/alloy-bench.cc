@@ -0,0 +1,495 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "alloy/alloy.h"
+#include "alloy/alloy-private.h"
+#include "alloy/backend/x64/x64_backend.h"
+#include "alloy/backend/x64/x64_call_site_ic.h"
+#include "alloy/compiler/compiler.h"
+#include "alloy/compiler/compiler_pipelines.h"
+#include "alloy/frontend/ppc/ppc_context.h"
+#include "alloy/frontend/ppc/ppc_frontend.h"
+#include "alloy/hir/hir_builder.h"
+#include "alloy/runtime/test_module.h"
+#include "alloy/runtime/thread_state.h"
+#include "poly/main.h"
+#include "poly/poly.h"
+
+namespace alloy {
+namespace bench {
+
+using alloy::backend::MachineInfo;
+using alloy::backend::x64::X64Backend;
+using alloy::backend::x64::X64ICStats;
+using alloy::compiler::AddOptimizingPasses;
+using alloy::compiler::Compiler;
+using alloy::frontend::ppc::PPCContext;
+using alloy::hir::HIRBuilder;
+using alloy::hir::OpcodeSignatureType;
+using alloy::hir::Value;
+using alloy::runtime::FunctionInfo;
+using alloy::runtime::Runtime;
+using alloy::runtime::SymbolInfo;
+namespace passes = alloy::compiler::passes;
+
+struct BenchFunction {
+  std::string name;
+  std::function<void(HIRBuilder& b)> generator;
+};
+
+Value* LoadGPR(HIRBuilder& b, int reg) {
+  return b.LoadContext(offsetof(PPCContext, r) + reg * 8, hir::INT64_TYPE);
+}
+void StoreGPR(HIRBuilder& b, int reg, Value* value) {
+  b.StoreContext(offsetof(PPCContext, r) + reg * 8, value);
+}
+Value* LoadFPR(HIRBuilder& b, int reg) {
+  return b.LoadContext(offsetof(PPCContext, f) + reg * 8, hir::FLOAT64_TYPE);
+}
+void StoreFPR(HIRBuilder& b, int reg, Value* value) {
+  b.StoreContext(offsetof(PPCContext, f) + reg * 8, value);
+}
+Value* LoadVR(HIRBuilder& b, int reg) {
+  return b.LoadContext(offsetof(PPCContext, v) + reg * 16, hir::VEC128_TYPE);
+}
+void StoreVR(HIRBuilder& b, int reg, Value* value) {
+  b.StoreContext(offsetof(PPCContext, v) + reg * 16, value);
+}
+
+// Keeps 2 * width values live at once: every input and every pairwise
+// combination of neighbors.
+std::vector<BenchFunction> GetBenchFunctions() {
+  std::vector<BenchFunction> functions;
+  for (int width : {4, 6, 8, 12, 16}) {
+    functions.push_back(
+        {"gpr_" + std::to_string(width), [width](HIRBuilder& b) {
+           std::vector<Value*> v, t;
+           for (int n = 0; n < width; ++n) {
+             v.push_back(LoadGPR(b, n));
+           }
+           for (int n = 0; n < width; ++n) {
+             t.push_back(b.Add(v[n], v[(n + 1) % width]));
+           }
+           for (int n = 0; n < width; ++n) {
+             StoreGPR(b, n, b.Mul(t[n], v[(n + width - 1) % width]));
+           }
+           b.Return();
+         }});
+    functions.push_back(
+        {"fpr_" + std::to_string(width), [width](HIRBuilder& b) {
+           std::vector<Value*> v, t;
+           for (int n = 0; n < width; ++n) {
+             v.push_back(LoadFPR(b, n));
+           }
+           for (int n = 0; n < width; ++n) {
+             t.push_back(b.Add(v[n], v[(n + 1) % width]));
+           }
+           for (int n = 0; n < width; ++n) {
+             StoreFPR(b, n, b.Mul(t[n], v[(n + width - 1) % width]));
+           }
+           b.Return();
+         }});
+    functions.push_back(
+        {"vr_" + std::to_string(width), [width](HIRBuilder& b) {
+           std::vector<Value*> v, t;
+           for (int n = 0; n < width; ++n) {
+             v.push_back(LoadVR(b, n));
+           }
+           for (int n = 0; n < width; ++n) {
+             t.push_back(b.Xor(v[n], v[(n + 1) % width]));
+           }
+           for (int n = 0; n < width; ++n) {
+             StoreVR(b, n, b.And(t[n], v[(n + width - 1) % width]));
+           }
+           b.Return();
+         }});
+  }
+  return functions;
+}
+
+struct AllocationCounts {
+  size_t spill_count;
+  size_t reload_count;
+  // Two-operand instructions whose dest didn't get the register of src1, so
+  // that x64 needs a mov before them.
+  size_t move_count;
+};
+
+// Runs the optimizing pipeline with the given allocator setup and counts the
+// spill stores/reloads and moves it left.
+AllocationCounts CountAllocations(
+    Runtime* runtime, const MachineInfo* machine_info,
+    const passes::RegisterAllocationPass::Options& options,
+    const BenchFunction& function) {
+  Compiler compiler(runtime);
+  AddOptimizingPasses(&compiler, machine_info, false, options);
+
+  HIRBuilder builder;
+  function.generator(builder);
+  AllocationCounts counts = {0, 0, 0};
+  if (compiler.Compile(&builder)) {
+    PLOGE("Unable to compile %s", function.name.c_str());
+    return counts;
+  }
+
+  for (auto block = builder.first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &hir::OPCODE_STORE_LOCAL_info) {
+        ++counts.spill_count;
+      } else if (i->opcode == &hir::OPCODE_LOAD_LOCAL_info) {
+        ++counts.reload_count;
+      } else if (GET_OPCODE_SIG_TYPE_DEST(i->opcode->signature) ==
+                     hir::OPCODE_SIG_TYPE_V &&
+                 GET_OPCODE_SIG_TYPE_SRC1(i->opcode->signature) ==
+                     hir::OPCODE_SIG_TYPE_V &&
+                 GET_OPCODE_SIG_TYPE_SRC2(i->opcode->signature) ==
+                     hir::OPCODE_SIG_TYPE_V &&
+                 !i->src1.value->IsConstant() &&
+                 i->src1.value->reg.set == i->dest->reg.set &&
+                 i->src1.value->reg.index != i->dest->reg.index) {
+        ++counts.move_count;
+      }
+    }
+  }
+  return counts;
+}
+
+int BenchRegisterAllocation(Runtime* runtime) {
+  // The allocator before rbp/rsi/rdi/r11 and xmm3-5 were made available and
+  // before spill costs and the dest=src1 register preference were added.
+  const MachineInfo* current_info = runtime->backend()->machine_info();
+  MachineInfo baseline_info = *current_info;
+  baseline_info.register_sets[0].count = 5;
+  baseline_info.register_sets[1].count = 10;
+  passes::RegisterAllocationPass::Options baseline_options;
+  baseline_options.weigh_spill_cost = false;
+  baseline_options.prefer_src1_register = false;
+  passes::RegisterAllocationPass::Options current_options;
+
+  // The middle column gives the old heuristics the new registers, so that
+  // both changes show on their own.
+  struct Config {
+    const char* name;
+    const MachineInfo* machine_info;
+    const passes::RegisterAllocationPass::Options* options;
+  } configs[] = {
+      {"baseline", &baseline_info, &baseline_options},
+      {"+registers", current_info, &baseline_options},
+      {"+heuristics", current_info, &current_options},
+  };
+
+  printf("Register allocation (spills/reloads/moves per function)\n");
+  printf("%-12s", "function");
+  for (auto& config : configs) {
+    printf(" %18s", config.name);
+  }
+  printf("\n");
+  AllocationCounts totals[poly::countof(configs)] = {};
+  auto print_counts = [](const AllocationCounts& counts) {
+    printf(" %6zu/%5zu/%5zu", counts.spill_count, counts.reload_count,
+           counts.move_count);
+  };
+  for (auto& function : GetBenchFunctions()) {
+    printf("%-12s", function.name.c_str());
+    for (size_t n = 0; n < poly::countof(configs); ++n) {
+      auto counts = CountAllocations(runtime, configs[n].machine_info,
+                                     *configs[n].options, function);
+      print_counts(counts);
+      totals[n].spill_count += counts.spill_count;
+      totals[n].reload_count += counts.reload_count;
+      totals[n].move_count += counts.move_count;
+    }
+    printf("\n");
+  }
+  printf("%-12s", "total");
+  for (auto& total : totals) {
+    print_counts(total);
+  }
+  printf("\n");
+  return 0;
+}
+
+// Mimics typical guest code: fields of a structure are read, updated with
+// constants and written back, with a compare and branch every few of them.
+BenchFunction GetMixedBenchFunction(int field_count) {
+  return {"mixed_" + std::to_string(field_count), [field_count](HIRBuilder& b) {
+    for (int n = 0; n < field_count; ++n) {
+      auto address = b.Add(LoadGPR(b, 3), b.LoadConstant(uint64_t(n * 4)));
+      auto value = b.ByteSwap(b.Load(address, hir::INT32_TYPE));
+      value = b.Add(value, b.LoadConstant(uint32_t(n & 7)));
+      b.Store(address, b.ByteSwap(value));
+      if (n % 4 == 3) {
+        auto label = b.NewLabel();
+        b.BranchTrue(b.CompareEQ(value, b.LoadZero(hir::INT32_TYPE)), label);
+        StoreGPR(b, 4, b.LoadConstant(uint64_t(n)));
+        b.MarkLabel(label);
+      }
+    }
+    b.Return();
+  }};
+}
+
+const int kCompileCount = 1000;
+
+int BenchCompileThroughput(Runtime* runtime) {
+  auto functions = GetBenchFunctions();
+  for (int field_count : {16, 64, 256}) {
+    functions.push_back(GetMixedBenchFunction(field_count));
+  }
+
+  // Warm reuses one builder (and its arena) like PPCTranslator does, cold
+  // starts from a fresh one for every function.
+  printf("\nCompile throughput (%d compiles per row)\n", kCompileCount);
+  printf("%-12s %10s %10s %10s %12s\n", "function", "instrs", "warm us",
+         "cold us", "arena bytes");
+  Compiler compiler(runtime);
+  AddOptimizingPasses(&compiler, runtime->backend()->machine_info(), false);
+  double total_warm_us = 0;
+  double total_cold_us = 0;
+  for (auto& function : functions) {
+    HIRBuilder warm_builder;
+    uint64_t start_ticks = poly::threading::ticks();
+    for (int n = 0; n < kCompileCount; ++n) {
+      warm_builder.Reset();
+      function.generator(warm_builder);
+      warm_builder.Finalize();
+      if (compiler.Compile(&warm_builder)) {
+        PLOGE("Unable to compile %s", function.name.c_str());
+        return 1;
+      }
+    }
+    uint64_t warm_ticks = poly::threading::ticks() - start_ticks;
+    size_t instr_count = compiler.stats().instr_count_in;
+    size_t arena_size = warm_builder.arena()->used_size();
+
+    start_ticks = poly::threading::ticks();
+    for (int n = 0; n < kCompileCount; ++n) {
+      HIRBuilder cold_builder;
+      function.generator(cold_builder);
+      cold_builder.Finalize();
+      if (compiler.Compile(&cold_builder)) {
+        PLOGE("Unable to compile %s", function.name.c_str());
+        return 1;
+      }
+    }
+    uint64_t cold_ticks = poly::threading::ticks() - start_ticks;
+
+    auto to_us = [](uint64_t ticks) {
+      return ticks * 1000000.0 / poly::threading::ticks_per_second() /
+             kCompileCount;
+    };
+    total_warm_us += to_us(warm_ticks);
+    total_cold_us += to_us(cold_ticks);
+    printf("%-12s %10zu %10.2f %10.2f %12zu\n", function.name.c_str(),
+           instr_count, to_us(warm_ticks), to_us(cold_ticks), arena_size);
+  }
+  printf("%-12s %10s %10.2f %10.2f\n", "total", "", total_warm_us,
+         total_cold_us);
+  return 0;
+}
+
+// Functions of the indirect call benchmark. Reports its address range so that
+// it gets a dispatch table like a real module does.
+class BenchModule : public alloy::runtime::TestModule {
+ public:
+  BenchModule(Runtime* runtime, uint64_t low_address, uint64_t high_address,
+              std::function<void(uint64_t address, HIRBuilder& b)> generate)
+      : TestModule(runtime, "Bench",
+                   [low_address, high_address](uint64_t address) {
+                     return address >= low_address && address < high_address;
+                   },
+                   [this](HIRBuilder& b) {
+                     generate_(declaring_address_, b);
+                     return true;
+                   }),
+        low_address_(low_address),
+        high_address_(high_address),
+        generate_(generate),
+        declaring_address_(0) {}
+
+  bool GetCodeRange(uint64_t* out_low_address,
+                    uint64_t* out_high_address) override {
+    *out_low_address = low_address_;
+    *out_high_address = high_address_;
+    return true;
+  }
+
+  SymbolInfo::Status DeclareFunction(uint64_t address,
+                                     FunctionInfo** out_symbol_info) override {
+    // Functions are generated from in here, one at a time.
+    declaring_address_ = address;
+    return TestModule::DeclareFunction(address, out_symbol_info);
+  }
+
+ private:
+  uint64_t low_address_;
+  uint64_t high_address_;
+  std::function<void(uint64_t address, HIRBuilder& b)> generate_;
+  uint64_t declaring_address_;
+};
+
+class BenchThreadState : public alloy::runtime::ThreadState {
+ public:
+  BenchThreadState(Runtime* runtime)
+      : alloy::runtime::ThreadState(runtime, 0x100) {
+    // Allocate with 64b alignment.
+    context_ = reinterpret_cast<PPCContext*>(calloc(1, sizeof(PPCContext)));
+    assert_true((reinterpret_cast<uint64_t>(context_) & 0xF) == 0);
+    context_->reserve_address = memory_->reserve_address();
+    context_->reserve_value = memory_->reserve_value();
+    context_->membase = memory_->membase();
+    context_->runtime = runtime;
+    context_->thread_state = this;
+    raw_context_ = context_;
+    runtime_->debugger()->OnThreadCreated(this);
+  }
+  ~BenchThreadState() override {
+    runtime_->debugger()->OnThreadDestroyed(this);
+    free(context_);
+  }
+
+  PPCContext* context() const { return context_; }
+
+ private:
+  PPCContext* context_;
+};
+
+// Each caller loops over a table of targets, calling them indirectly in turn
+// like a virtual call over a list of objects of mixed types would. Every
+// target adds its index to r4 so the result can be checked.
+const uint64_t kCallerAddress = 0x8000;
+const uint64_t kTargetAddress = 0x10000;
+const uint64_t kTargetTableAddress = 0x100000;
+const uint32_t kMaxTargetCount = 1024;
+const uint32_t kCallCount = 4 * 1024 * 1024;
+
+void GenerateIndirectCallFunction(uint64_t address, HIRBuilder& b) {
+  if (address >= kTargetAddress) {
+    uint64_t index = (address - kTargetAddress) / 4;
+    StoreGPR(b, 4, b.Add(LoadGPR(b, 4), b.LoadConstant(index)));
+    b.Return();
+    return;
+  }
+
+  // r3 = index mask, r5 = iteration, r6 = iteration count.
+  auto loop = b.NewLabel();
+  b.MarkLabel(loop);
+  auto index = b.And(LoadGPR(b, 5), LoadGPR(b, 3));
+  auto entry_address = b.Add(b.Shl(index, int8_t(2)),
+                             b.LoadConstant(kTargetTableAddress));
+  auto target =
+      b.ZeroExtend(b.Load(entry_address, hir::INT32_TYPE), hir::INT64_TYPE);
+  b.CallIndirect(target);
+  auto next = b.Add(LoadGPR(b, 5), b.LoadConstant(uint64_t(1)));
+  StoreGPR(b, 5, next);
+  b.BranchTrue(b.CompareULT(next, LoadGPR(b, 6)), loop);
+  b.Return();
+}
+
+int BenchIndirectCalls(Runtime* runtime) {
+  auto backend = static_cast<X64Backend*>(runtime->backend());
+  auto memory = runtime->memory();
+  runtime->AddModule(std::make_unique<BenchModule>(
+      runtime, kCallerAddress, kTargetAddress + kMaxTargetCount * 4,
+      GenerateIndirectCallFunction));
+  auto target_table = reinterpret_cast<uint32_t*>(
+      memory->Translate(kTargetTableAddress));
+  for (uint32_t n = 0; n < kMaxTargetCount; ++n) {
+    target_table[n] = static_cast<uint32_t>(kTargetAddress + n * 4);
+  }
+
+  printf("\nIndirect calls (%u calls per row)\n", kCallCount);
+  printf("%-8s %10s %8s %8s %8s %8s %8s\n", "targets", "ns/call", "inline",
+         "table", "dispatch", "resolver", "state");
+  BenchThreadState thread_state(runtime);
+  auto ctx = thread_state.context();
+  uint64_t caller_address = kCallerAddress;
+  for (uint32_t target_count : {1, 2, 4, 8, 32, 128, 1024}) {
+    // A fresh caller for each row so that every row starts with a cold IC.
+    alloy::runtime::Function* fn;
+    if (runtime->ResolveFunction(caller_address, &fn)) {
+      PLOGE("Unable to generate indirect call benchmark");
+      return 1;
+    }
+    caller_address += 4;
+
+    auto before = backend->GetICStats();
+    ctx->r[3] = target_count - 1;
+    ctx->r[4] = 0;
+    ctx->r[5] = 0;
+    ctx->r[6] = kCallCount;
+    uint64_t start_ticks = poly::threading::ticks();
+    fn->Call(&thread_state, 0xBEBEBEBE);
+    uint64_t end_ticks = poly::threading::ticks();
+    auto after = backend->GetICStats();
+
+    uint64_t expected = uint64_t(kCallCount) / target_count *
+                        (uint64_t(target_count) * (target_count - 1) / 2);
+    if (ctx->r[4] != expected) {
+      PLOGE("Indirect call benchmark computed %llu, expected %llu", ctx->r[4],
+            expected);
+      return 1;
+    }
+
+    double ns_per_call = (end_ticks - start_ticks) * 1000000000.0 /
+                         poly::threading::ticks_per_second() / kCallCount;
+    const char* state = after.megamorphic_count > before.megamorphic_count
+                            ? "mega"
+                            : after.polymorphic_count > before.polymorphic_count
+                                  ? "poly"
+                                  : "mono";
+    auto percent = [](uint64_t after_count, uint64_t before_count) {
+      return 100.0 * (after_count - before_count) / kCallCount;
+    };
+    printf("%-8u %10.2f %7.2f%% %7.2f%% %7.2f%% %7.2f%% %8s\n", target_count,
+           ns_per_call, percent(after.inline_hit_count, before.inline_hit_count),
+           percent(after.table_hit_count, before.table_hit_count),
+           percent(after.dispatch_hit_count, before.dispatch_hit_count),
+           percent(after.miss_count, before.miss_count), state);
+  }
+  return 0;
+}
+
+int main(std::vector<std::wstring>& args) {
+  // Hit rates are what the indirect call benchmark is after.
+  FLAGS_ic_stats = true;
+
+  size_t memory_size = 16 * 1024 * 1024;
+  auto memory = std::make_unique<SimpleMemory>(memory_size);
+  auto runtime = std::make_unique<Runtime>(memory.get());
+  auto frontend =
+      std::make_unique<alloy::frontend::ppc::PPCFrontend>(runtime.get());
+  auto backend =
+      std::make_unique<alloy::backend::x64::X64Backend>(runtime.get());
+  if (runtime->Initialize(std::move(frontend), std::move(backend))) {
+    PLOGE("Unable to initialize runtime");
+    return 1;
+  }
+
+  int result = BenchRegisterAllocation(runtime.get());
+  if (!result) {
+    result = BenchCompileThroughput(runtime.get());
+  }
+  if (!result) {
+    result = BenchIndirectCalls(runtime.get());
+  }
+
+  runtime.reset();
+  memory.reset();
+  return result;
+}
+
+}  // namespace bench
+}  // namespace alloy
+
+DEFINE_ENTRY_POINT(L"alloy-bench", L"alloy-bench", alloy::bench::main);
@@ -550,3 +550,50 @@ TEST_CASE("ADD_F64", "[instr]") {
              REQUIRE(result == DBL_MAX);
            });
 }
+
+TEST_CASE("ADD_REDUNDANT", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto v4 = LoadGPR(b, 4);
+    auto v5 = LoadGPR(b, 5);
+    StoreGPR(b, 3, b.Add(v4, v5));
+    StoreGPR(b, 6, b.Add(v5, v4));
+    StoreGPR(b, 7, b.ZeroExtend(b.Add(b.Truncate(v4, INT32_TYPE),
+                                      b.Truncate(v5, INT32_TYPE)),
+                                INT64_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0xFFFFFFFF;
+             ctx->r[5] = 1;
+           },
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->r[3] == 0x100000000ull);
+             REQUIRE(ctx->r[6] == 0x100000000ull);
+             REQUIRE(ctx->r[7] == 0);
+           });
+}
+
+TEST_CASE("ADD_LOOP_INVARIANT", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto loop = b.NewLabel();
+    b.MarkLabel(loop);
+    // r4 + r5 is the same every iteration and gets hoisted.
+    auto step = b.Add(LoadGPR(b, 4), LoadGPR(b, 5));
+    StoreGPR(b, 3, b.Add(LoadGPR(b, 3), step));
+    auto count = b.Sub(LoadGPR(b, 6), b.LoadConstant(int64_t(1)));
+    StoreGPR(b, 6, count);
+    b.BranchTrue(count, loop);
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[3] = 1;
+             ctx->r[4] = 2;
+             ctx->r[5] = 3;
+             ctx->r[6] = 10;
+           },
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->r[3] == 51);
+             REQUIRE(ctx->r[4] == 2);
+             REQUIRE(ctx->r[6] == 0);
+           });
+}
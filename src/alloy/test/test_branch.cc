@@ -0,0 +1,207 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/test/util.h"
+
+using namespace alloy;
+using namespace alloy::hir;
+using namespace alloy::runtime;
+using namespace alloy::test;
+using alloy::frontend::ppc::PPCContext;
+
+TEST_CASE("BRANCH_TRUE_COMPARE", "[instr]") {
+  // The compare and branch are adjacent so they are emitted as cmp/jcc.
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto skip = b.NewLabel();
+    StoreGPR(b, 3, b.LoadZero(INT64_TYPE));
+    b.BranchTrue(b.CompareSLT(LoadGPR(b, 4), LoadGPR(b, 5)), skip);
+    StoreGPR(b, 3, b.LoadConstant(uint64_t(1)));
+    b.MarkLabel(skip);
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = static_cast<uint64_t>(-1);
+             ctx->r[5] = 1;
+           },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 0); });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 1;
+             ctx->r[5] = 1;
+           },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 1); });
+}
+
+TEST_CASE("BRANCH_FALSE_COMPARE", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto skip = b.NewLabel();
+    StoreGPR(b, 3, b.LoadZero(INT64_TYPE));
+    b.BranchFalse(b.CompareUGE(LoadGPR(b, 4), LoadGPR(b, 5)), skip);
+    StoreGPR(b, 3, b.LoadConstant(uint64_t(1)));
+    b.MarkLabel(skip);
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 1;
+             ctx->r[5] = static_cast<uint64_t>(-1);
+           },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 0); });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 2;
+             ctx->r[5] = 2;
+           },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 1); });
+}
+
+TEST_CASE("BRANCH_TRUE_COMPARE_CONSTANT", "[instr]") {
+  // A constant first operand is compared as the second, flipping the
+  // condition.
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto skip = b.NewLabel();
+    StoreGPR(b, 3, b.LoadZero(INT64_TYPE));
+    b.BranchTrue(b.CompareSLT(b.LoadConstant(int64_t(5)), LoadGPR(b, 4)),
+                 skip);
+    StoreGPR(b, 3, b.LoadConstant(uint64_t(1)));
+    b.MarkLabel(skip);
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 6; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 0); });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 5; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 1); });
+}
+
+TEST_CASE("BRANCH_CONTEXT_STORE_FALL_THROUGH", "[instr]") {
+  // The first store is only read after falling through into the next block,
+  // which has no explicit branch yet when dead stores are removed.
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto next = b.NewLabel();
+    auto skip = b.NewLabel();
+    StoreGPR(b, 3, b.LoadConstant(uint64_t(1)));
+    b.MarkLabel(next);
+    b.BranchTrue(b.IsTrue(LoadGPR(b, 4)), skip);
+    StoreGPR(b, 3, b.Add(LoadGPR(b, 3), b.LoadConstant(uint64_t(2))));
+    b.MarkLabel(skip);
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 1; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 1); });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 0; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 3); });
+}
+
+TEST_CASE("BRANCH_LOOP_PREHEADER_FALL_THROUGH", "[instr]") {
+  // The latch is laid out right before the loop header and falls into it, so
+  // it must not fall into the preheader added between them.
+  TestPasses passes([](compiler::Compiler& c) {
+    c.AddPass(std::make_unique<compiler::passes::ControlFlowAnalysisPass>());
+    c.AddPass(
+        std::make_unique<compiler::passes::LoopInvariantCodeMotionPass>());
+  });
+  Label* header = nullptr;
+  Label* latch = nullptr;
+  Instr* hoisted = nullptr;
+  passes.Run([&](hir::HIRBuilder& b) {
+               header = b.NewLabel();
+               latch = b.NewLabel();
+               auto done = b.NewLabel();
+               b.BranchTrue(b.IsTrue(LoadGPR(b, 3)), header);
+               b.Branch(done);
+               b.MarkLabel(latch);
+               StoreGPR(b, 5,
+                        b.Add(LoadGPR(b, 5), b.LoadConstant(uint64_t(1))));
+               b.BranchTrue(b.IsTrue(LoadGPR(b, 7)), header);
+               b.MarkLabel(header);
+               auto base = LoadGPR(b, 4);
+               hoisted = b.last_instr();
+               StoreGPR(b, 6, b.Add(b.Shl(base, int8_t(2)),
+                                    b.LoadConstant(uint64_t(8))));
+               b.BranchTrue(b.IsTrue(LoadGPR(b, 5)), latch);
+               b.MarkLabel(done);
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               auto preheader = hoisted->block;
+               REQUIRE(preheader != header->block);
+               REQUIRE(preheader->next == header->block);
+               auto bridge = preheader->prev;
+               REQUIRE(bridge != latch->block);
+               REQUIRE(bridge->prev == latch->block);
+               REQUIRE(bridge->instr_tail->opcode == &OPCODE_BRANCH_info);
+               REQUIRE(bridge->instr_tail->src1.label->block == header->block);
+             });
+}
+
+TEST_CASE("BRANCH_TABLE", "[instr]") {
+  // Indices without a case, or past the end, fall through.
+  TestFunction test([](hir::HIRBuilder& b) {
+    Label* labels[4] = {b.NewLabel(), nullptr, b.NewLabel()};
+    labels[3] = labels[0];
+    b.BranchTable(b.Truncate(LoadGPR(b, 4), INT32_TYPE), labels, 4);
+    StoreGPR(b, 3, b.LoadConstant(uint64_t(9)));
+    b.Return();
+    b.MarkLabel(labels[0]);
+    StoreGPR(b, 3, b.LoadConstant(uint64_t(10)));
+    b.Return();
+    b.MarkLabel(labels[2]);
+    StoreGPR(b, 3, b.LoadConstant(uint64_t(12)));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 0; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 10); });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 1; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 9); });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 2; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 12); });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 3; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 10); });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 4; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 9); });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = static_cast<uint64_t>(-1); },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[3] == 9); });
+}
+
+TEST_CASE("BRANCH_TABLE_EDGES", "[instr]") {
+  // An edge to each distinct case, and entries without one are sent to the
+  // next block once finalized.
+  TestPasses passes([](compiler::Compiler& c) {
+    c.AddPass(std::make_unique<compiler::passes::ControlFlowAnalysisPass>());
+    c.AddPass(std::make_unique<compiler::passes::FinalizationPass>());
+  });
+  Label* labels[4] = {};
+  Instr* branch = nullptr;
+  passes.Run([&](hir::HIRBuilder& b) {
+               labels[0] = b.NewLabel();
+               labels[2] = b.NewLabel();
+               labels[3] = labels[0];
+               b.BranchTable(b.Truncate(LoadGPR(b, 4), INT32_TYPE), labels,
+                             4);
+               branch = b.last_instr();
+               StoreGPR(b, 3, b.LoadConstant(uint64_t(9)));
+               b.Return();
+               b.MarkLabel(labels[0]);
+               b.Return();
+               b.MarkLabel(labels[2]);
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               size_t edge_count = 0;
+               for (auto edge = branch->block->outgoing_edge_head; edge;
+                    edge = edge->outgoing_next) {
+                 REQUIRE((edge->dest == labels[0]->block ||
+                          edge->dest == labels[2]->block));
+                 ++edge_count;
+               }
+               REQUIRE(edge_count == 2);
+               auto table = branch->src2.table;
+               REQUIRE(table->labels[1]->block == branch->block->next);
+               for (uint32_t n = 0; n < table->count; ++n) {
+                 REQUIRE(table->labels[n]->name);
+               }
+             });
+}
@@ -40,3 +40,89 @@ TEST_CASE("BYTE_SWAP_V128", "[instr]") {
                         REQUIRE(result == vec128i(0x0F10130C, 0x0B0C0D0E, 0x0000000A, 0x00000000));
                       });
 }
+
+TEST_CASE("LOAD_BYTE_SWAP", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto address = LoadGPR(b, 4);
+    StoreGPR(b, 3, b.ZeroExtend(b.Load(address, INT16_TYPE, LOAD_BYTE_SWAP),
+                                INT64_TYPE));
+    StoreGPR(b, 5, b.ZeroExtend(b.Load(address, INT32_TYPE, LOAD_BYTE_SWAP),
+                                INT64_TYPE));
+    StoreGPR(b, 6, b.Load(address, INT64_TYPE, LOAD_BYTE_SWAP));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0x2000;
+             *reinterpret_cast<uint64_t*>(ctx->membase + 0x2000) =
+                 0x0807060504030201ull;
+           },
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->r[3] == 0x0102);
+             REQUIRE(ctx->r[5] == 0x01020304);
+             REQUIRE(ctx->r[6] == 0x0102030405060708ull);
+           });
+}
+
+TEST_CASE("STORE_BYTE_SWAP", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    b.Store(LoadGPR(b, 4), b.Truncate(LoadGPR(b, 5), INT16_TYPE),
+            STORE_BYTE_SWAP);
+    b.Store(LoadGPR(b, 6), b.Truncate(LoadGPR(b, 5), INT32_TYPE),
+            STORE_BYTE_SWAP);
+    b.Store(LoadGPR(b, 7), LoadGPR(b, 5), STORE_BYTE_SWAP);
+    b.Store(LoadGPR(b, 8), b.LoadConstant(0x01020304u), STORE_BYTE_SWAP);
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0x2000;
+             ctx->r[5] = 0x0102030405060708ull;
+             ctx->r[6] = 0x2010;
+             ctx->r[7] = 0x2020;
+             ctx->r[8] = 0x2030;
+           },
+           [](PPCContext* ctx) {
+             auto p = ctx->membase;
+             REQUIRE(*reinterpret_cast<uint16_t*>(p + 0x2000) == 0x0807);
+             REQUIRE(*reinterpret_cast<uint32_t*>(p + 0x2010) == 0x08070605);
+             REQUIRE(*reinterpret_cast<uint64_t*>(p + 0x2020) ==
+                     0x0807060504030201ull);
+             REQUIRE(*reinterpret_cast<uint32_t*>(p + 0x2030) == 0x04030201);
+           });
+}
+
+TEST_CASE("BYTE_SWAP_ELIMINATION", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    // Read-modify-write with constants; all swaps cancel out.
+    auto address = LoadGPR(b, 4);
+    auto value = b.ByteSwap(b.Load(address, INT32_TYPE));
+    value = b.Or(b.And(value, b.LoadConstant(0xFFFF00FFu)),
+                 b.LoadConstant(0x00001100u));
+    b.Store(address, b.ByteSwap(value));
+    // Op of two swapped values.
+    auto address2 = b.Add(address, b.LoadConstant(uint64_t(8)));
+    auto value2 = b.Xor(b.ByteSwap(b.Load(address, INT64_TYPE)),
+                        b.ByteSwap(b.Load(address2, INT64_TYPE)));
+    StoreGPR(b, 5, value2);
+    // Equality against constants only needs the constant swapped.
+    StoreGPR(b, 6, b.ZeroExtend(b.CompareEQ(value, b.LoadConstant(
+                                                       0x01021104u)),
+                                INT64_TYPE));
+    StoreGPR(b, 7, b.ZeroExtend(b.CompareNE(value, b.LoadConstant(
+                                                       0x01021104u)),
+                                INT64_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0x2000;
+             auto p = ctx->membase;
+             *reinterpret_cast<uint64_t*>(p + 0x2000) = 0x0807060504030201ull;
+             *reinterpret_cast<uint64_t*>(p + 0x2008) = 0xFF000000000000FFull;
+           },
+           [](PPCContext* ctx) {
+             auto p = ctx->membase;
+             REQUIRE(*reinterpret_cast<uint32_t*>(p + 0x2000) == 0x04110201);
+             REQUIRE(ctx->r[5] == 0xFE021104050607F7ull);
+             REQUIRE(ctx->r[6] == 1);
+             REQUIRE(ctx->r[7] == 0);
+           });
+}
@@ -0,0 +1,68 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/alloy-private.h"
+#include "alloy/test/util.h"
+
+using namespace alloy;
+using namespace alloy::hir;
+using namespace alloy::runtime;
+using namespace alloy::test;
+using alloy::frontend::ppc::PPCContext;
+
+namespace {
+
+const uint32_t kBLR = 0x4E800020;
+// li r3, 1
+const uint32_t kLoadR3 = 0x38600001;
+// addi r3, r3, 1
+const uint32_t kIncrementR3 = 0x38630001;
+// mtlr r3
+const uint32_t kMoveR3ToLR = 0x7C6803A6;
+
+uint32_t EncodeBL(uint64_t address, uint64_t target) {
+  return 0x48000001 | (static_cast<uint32_t>(target - address) & 0x03FFFFFC);
+}
+
+// Compiles a caller of the leaf at 0x2000 with --inline_max_instructions=4.
+void TestInlining(std::initializer_list<uint32_t> leaf, bool expect_inlined) {
+  TestGuestCode code;
+  code.Write(0x1000, {EncodeBL(0x1000, 0x2000), kBLR});
+  code.Write(0x2000, leaf);
+  Function* fn = nullptr;
+  {
+    ScopedFlag<int32_t> max_flag(&FLAGS_inline_max_instructions, 4);
+    REQUIRE(code.runtime->ResolveFunction(0x1000, &fn) == 0);
+  }
+
+  auto leaf_end = 0x2000 + leaf.size() * 4;
+  REQUIRE(fn->symbol_info()->InlinesCodeIn(0x2000, leaf_end) ==
+          expect_inlined);
+  // Writes to an inlined leaf must invalidate the caller too. Otherwise
+  // the leaf was never compiled, so there's nothing to invalidate.
+  REQUIRE(code.runtime->InvalidateCode(leaf_end - 4, 4) ==
+          (expect_inlined ? 1 : 0));
+}
+
+}  // namespace
+
+TEST_CASE("INLINE_LEAF", "[instr]") {
+  TestInlining({kLoadR3, kIncrementR3, kBLR}, true);
+}
+
+TEST_CASE("INLINE_LEAF_TOO_LARGE", "[instr]") {
+  TestInlining({kLoadR3, kIncrementR3, kIncrementR3, kIncrementR3,
+                kIncrementR3, kBLR},
+               false);
+}
+
+TEST_CASE("INLINE_LEAF_SETS_LR", "[instr]") {
+  // The blr would go wherever r3 says rather than back to the call site.
+  TestInlining({kLoadR3, kMoveR3ToLR, kBLR}, false);
+}
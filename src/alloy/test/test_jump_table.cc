@@ -0,0 +1,90 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/frontend/ppc/ppc_scanner.h"
+#include "alloy/test/util.h"
+
+using namespace alloy;
+using namespace alloy::runtime;
+using namespace alloy::test;
+using alloy::frontend::ppc::PPCScanner;
+
+namespace {
+
+// cmplwi cr6, r3, 2
+const uint32_t kCompareCR6 = 0x2B030002;
+// bgt cr6, +0x6C
+const uint32_t kBranchGreaterCR6 = 0x4199006C;
+// lis r11, 0
+const uint32_t kLoadTableHigh = 0x3D600000;
+// addi r11, r11, 0x3000
+const uint32_t kAddTableLow = 0x396B3000;
+// rlwinm r12, r3, 2, 0, 29
+const uint32_t kScaleIndex = 0x546C103A;
+// lwzx r0, r11, r12
+const uint32_t kLoadTarget = 0x7C0B602E;
+// mtctr r0
+const uint32_t kMoveToCTR = 0x7C0903A6;
+const uint32_t kBCTR = 0x4E800420;
+
+bool FindJumpTable(TestGuestCode& code, uint64_t bctr_address,
+                   std::vector<uint64_t>* out_targets) {
+  FunctionInfo* symbol_info = nullptr;
+  REQUIRE(code.runtime->LookupFunctionInfo(0x1000, &symbol_info) == 0);
+  PPCScanner scanner(code.frontend());
+  return scanner.FindJumpTable(symbol_info, bctr_address, out_targets);
+}
+
+}  // namespace
+
+TEST_CASE("JUMP_TABLE_LWZX", "[instr]") {
+  TestGuestCode code;
+  code.Write(0x1000, {kCompareCR6, kBranchGreaterCR6, kLoadTableHigh,
+                      kAddTableLow, kScaleIndex, kLoadTarget, kMoveToCTR,
+                      kBCTR});
+  code.Write(0x3000, {0x1020, 0x1030, 0x1020});
+  std::vector<uint64_t> targets;
+  REQUIRE(FindJumpTable(code, 0x101C, &targets));
+  REQUIRE(targets == std::vector<uint64_t>({0x1020, 0x1030, 0x1020}));
+}
+
+TEST_CASE("JUMP_TABLE_RLWINM_SCALED", "[instr]") {
+  // The index is scaled first, the table operands of the lwzx are swapped
+  // and unrelated instructions are mixed in. cr7 and a 5 entry table.
+  TestGuestCode code;
+  code.Write(0x1000, {
+                         0x2B830004,  // cmplwi cr7, r3, 4
+                         0x419D0080,  // bgt cr7, +0x80
+                         kScaleIndex,
+                         0x38800000,  // li r4, 0
+                         kLoadTableHigh,
+                         kAddTableLow,
+                         0x7C0C582E,  // lwzx r0, r12, r11
+                         0x38A00001,  // li r5, 1
+                         kMoveToCTR,
+                         kBCTR,
+                     });
+  code.Write(0x3000, {0x1040, 0x1048, 0x1050, 0x1058, 0x1060});
+  std::vector<uint64_t> targets;
+  REQUIRE(FindJumpTable(code, 0x1024, &targets));
+  REQUIRE(targets ==
+          std::vector<uint64_t>({0x1040, 0x1048, 0x1050, 0x1058, 0x1060}));
+}
+
+TEST_CASE("JUMP_TABLE_UNBOUNDED", "[instr]") {
+  // Without the bounds check nothing says how big the table is, so the bctr
+  // is left alone.
+  TestGuestCode code;
+  code.Write(0x1000, {kLoadTableHigh, kAddTableLow, kScaleIndex, kLoadTarget,
+                      kMoveToCTR, kBCTR});
+  code.Write(0x3000, {0x1020, 0x1030, 0x1020});
+  std::vector<uint64_t> targets;
+  REQUIRE(!FindJumpTable(code, 0x1014, &targets));
+  REQUIRE(targets.empty());
+}
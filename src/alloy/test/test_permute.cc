@@ -137,3 +137,122 @@ TEST_CASE("PERMUTE_V128_BY_V128", "[instr]") {
                                        21, 20, 19, 18, 17, 16));
            });
 }
+
+TEST_CASE("PERMUTE_V128_BY_INT32_CONSTANT_SOURCES", "[instr]") {
+  uint32_t mask = PERMUTE_MASK(1, 3, 0, 2, 1, 1, 0, 0);
+  TestFunction([mask](hir::HIRBuilder& b) {
+                 StoreVR(b, 3, b.Permute(b.LoadConstant(mask),
+                                         b.LoadConstant(vec128i(0, 1, 2, 3)),
+                                         b.LoadConstant(vec128i(4, 5, 6, 7)),
+                                         INT32_TYPE));
+                 b.Return();
+               }).Run([](PPCContext* ctx) {},
+                      [](PPCContext* ctx) {
+                        auto result = ctx->v[3];
+                        REQUIRE(result == vec128i(7, 2, 5, 0));
+                      });
+}
+
+TEST_CASE("PERMUTE_V128_BY_INT8_CONSTANT", "[instr]") {
+  // Whole words from one source; becomes a swizzle.
+  TestFunction([](hir::HIRBuilder& b) {
+                 StoreVR(b, 3, b.Permute(b.LoadConstant(vec128b(
+                                             4, 5, 6, 7, 0, 1, 2, 3, 12, 13,
+                                             14, 15, 8, 9, 10, 11)),
+                                         LoadVR(b, 4), LoadVR(b, 5),
+                                         INT8_TYPE));
+                 b.Return();
+               }).Run([](PPCContext* ctx) {
+                        ctx->v[4] = vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                            11, 12, 13, 14, 15);
+                        ctx->v[5] = vec128b(16, 17, 18, 19, 20, 21, 22, 23, 24,
+                                            25, 26, 27, 28, 29, 30, 31);
+                      },
+                      [](PPCContext* ctx) {
+                        auto result = ctx->v[3];
+                        REQUIRE(result == vec128b(4, 5, 6, 7, 0, 1, 2, 3, 12,
+                                                  13, 14, 15, 8, 9, 10, 11));
+                      });
+  // Whole words from both sources; becomes a word permute.
+  TestFunction([](hir::HIRBuilder& b) {
+                 StoreVR(b, 3, b.Permute(b.LoadConstant(vec128b(
+                                             0, 1, 2, 3, 16, 17, 18, 19, 8, 9,
+                                             10, 11, 28, 29, 30, 31)),
+                                         LoadVR(b, 4), LoadVR(b, 5),
+                                         INT8_TYPE));
+                 b.Return();
+               }).Run([](PPCContext* ctx) {
+                        ctx->v[4] = vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                            11, 12, 13, 14, 15);
+                        ctx->v[5] = vec128b(16, 17, 18, 19, 20, 21, 22, 23, 24,
+                                            25, 26, 27, 28, 29, 30, 31);
+                      },
+                      [](PPCContext* ctx) {
+                        auto result = ctx->v[3];
+                        REQUIRE(result == vec128b(0, 1, 2, 3, 16, 17, 18, 19, 8,
+                                                  9, 10, 11, 28, 29, 30, 31));
+                      });
+  // Arbitrary bytes with a zero src3; a single pshufb.
+  TestFunction([](hir::HIRBuilder& b) {
+                 StoreVR(b, 3, b.Permute(b.LoadConstant(vec128b(
+                                             15, 16, 1, 17, 3, 3, 31, 0, 8, 9,
+                                             20, 7, 6, 5, 4, 30)),
+                                         LoadVR(b, 4), b.LoadZero(VEC128_TYPE),
+                                         INT8_TYPE));
+                 b.Return();
+               }).Run([](PPCContext* ctx) {
+                        ctx->v[4] = vec128b(100, 101, 102, 103, 104, 105, 106,
+                                            107, 108, 109, 110, 111, 112, 113,
+                                            114, 115);
+                      },
+                      [](PPCContext* ctx) {
+                        auto result = ctx->v[3];
+                        REQUIRE(result == vec128b(115, 0, 101, 0, 103, 103, 0,
+                                                  100, 108, 109, 0, 107, 106,
+                                                  105, 104, 0));
+                      });
+}
+
+TEST_CASE("PERMUTE_V128_BY_INT16_CONSTANT", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    StoreVR(b, 3, b.Permute(b.LoadConstant(vec128s(0, 8, 1, 9, 15, 6, 14, 7)),
+                            LoadVR(b, 4), LoadVR(b, 5), INT16_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->v[4] = vec128s(0, 1, 2, 3, 4, 5, 6, 7);
+             ctx->v[5] = vec128s(8, 9, 10, 11, 12, 13, 14, 15);
+           },
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result == vec128s(0, 8, 1, 9, 15, 6, 14, 7));
+           });
+  test.Run([](PPCContext* ctx) {
+             ctx->v[4] = vec128s(100, 101, 102, 103, 104, 105, 106, 107);
+             ctx->v[5] = vec128s(108, 109, 110, 111, 112, 113, 114, 115);
+           },
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result ==
+                     vec128s(100, 108, 101, 109, 115, 106, 114, 107));
+           });
+}
+
+TEST_CASE("PERMUTE_V128_BY_INT16_CONSTANT_SOURCES", "[instr]") {
+  TestFunction([](hir::HIRBuilder& b) {
+                 StoreVR(b, 3, b.Permute(
+                                   b.LoadConstant(
+                                       vec128s(7, 6, 5, 4, 12, 13, 14, 15)),
+                                   b.LoadConstant(
+                                       vec128s(0, 1, 2, 3, 4, 5, 6, 7)),
+                                   b.LoadConstant(
+                                       vec128s(8, 9, 10, 11, 12, 13, 14, 15)),
+                                   INT16_TYPE));
+                 b.Return();
+               }).Run([](PPCContext* ctx) {},
+                      [](PPCContext* ctx) {
+                        auto result = ctx->v[3];
+                        REQUIRE(result ==
+                                vec128s(7, 6, 5, 4, 12, 13, 14, 15));
+                      });
+}
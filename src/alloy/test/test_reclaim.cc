@@ -0,0 +1,70 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/alloy-private.h"
+#include "alloy/test/util.h"
+
+using namespace alloy;
+using namespace alloy::runtime;
+using namespace alloy::test;
+
+namespace {
+
+const uint32_t kBLR = 0x4E800020;
+// li r3, 1
+const uint32_t kLoadR3 = 0x38600001;
+
+// A thread of the guest code runtime, its stack above the code.
+std::unique_ptr<test::ThreadState> CreateThreadState(TestGuestCode& code) {
+  return std::make_unique<test::ThreadState>(code.runtime.get(), 0x100,
+                                             0x9000, 0x4000, 0x8000);
+}
+
+}  // namespace
+
+TEST_CASE("RECLAIM_WAITS_FOR_QUIESCENCE", "[instr]") {
+  TestGuestCode code;
+  code.Write(0x1000, {kLoadR3, kBLR});
+  Function* fn = nullptr;
+  REQUIRE(code.runtime->ResolveFunction(0x1000, &fn) == 0);
+
+  // A thread in a call may still be running the code until it reports in
+  // from host code, which this one never does.
+  auto thread_state = CreateThreadState(code);
+  code.runtime->BeginGuestCall(thread_state.get());
+  REQUIRE(code.runtime->InvalidateCode(0x1000, 4) == 1);
+  REQUIRE(code.runtime->invalidation_stats().reclaimed_size == 0);
+
+  code.runtime->EndGuestCall(thread_state.get());
+  REQUIRE(code.runtime->invalidation_stats().reclaimed_size > 0);
+}
+
+TEST_CASE("RECLAIM_REPLACED_BASELINE", "[instr]") {
+  TestGuestCode code;
+  code.Write(0x1000, {kLoadR3, kBLR});
+  Function* baseline_fn = nullptr;
+  {
+    ScopedFlag<bool> tiered_flag(&FLAGS_tiered_compilation, true);
+    REQUIRE(code.runtime->ResolveFunction(0x1000, &baseline_fn) == 0);
+  }
+  REQUIRE(baseline_fn->tier() == FUNCTION_TIER_BASELINE);
+
+  // Tier-up retires the baseline code rather than keeping it around until
+  // the guest code changes.
+  REQUIRE(code.runtime->OptimizeFunction(0x1000) == 0);
+  auto reclaimed_size = code.runtime->invalidation_stats().reclaimed_size;
+  REQUIRE(reclaimed_size > 0);
+  Function* fn = nullptr;
+  REQUIRE(code.runtime->ResolveFunction(0x1000, &fn) == 0);
+  REQUIRE(fn->tier() == FUNCTION_TIER_OPTIMIZED);
+
+  // Only the optimized code is left to go.
+  REQUIRE(code.runtime->InvalidateCode(0x1000, 4) == 1);
+  REQUIRE(code.runtime->invalidation_stats().reclaimed_size > reclaimed_size);
+}
@@ -0,0 +1,343 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "alloy/alloy-private.h"
+#include "alloy/test/util.h"
+
+using namespace alloy;
+using namespace alloy::hir;
+using namespace alloy::runtime;
+using namespace alloy::test;
+using alloy::frontend::ppc::PPCContext;
+
+TEST_CASE("STORE_OVERWRITTEN", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto address = LoadGPR(b, 4);
+    b.Store(address, b.LoadConstant(0x11111111u));
+    b.Store(address, b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+    StoreGPR(b, 3, b.ZeroExtend(b.Load(address, INT32_TYPE), INT64_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0x2000;
+             ctx->r[5] = 0x22222222;
+           },
+           [](PPCContext* ctx) {
+             auto result = static_cast<uint32_t>(ctx->r[3]);
+             REQUIRE(result == 0x22222222);
+           });
+}
+
+TEST_CASE("STORE_OVERWRITTEN_CONSTANT", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    b.Store(b.LoadConstant(static_cast<uint64_t>(0x2000)),
+            b.LoadConstant(0x11111111u));
+    b.Store(b.LoadConstant(static_cast<uint64_t>(0x2000)),
+            b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->r[5] = 0x22222222; },
+           [](PPCContext* ctx) {
+             auto result = *reinterpret_cast<uint32_t*>(ctx->membase + 0x2000);
+             REQUIRE(result == 0x22222222);
+           });
+}
+
+TEST_CASE("STORE_READ_BEFORE_OVERWRITE", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto address = LoadGPR(b, 4);
+    b.Store(address, b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+    auto value = b.Load(LoadGPR(b, 6), INT32_TYPE);
+    b.Store(address, b.LoadConstant(0x33333333u));
+    StoreGPR(b, 3, b.ZeroExtend(value, INT64_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0x2000;
+             ctx->r[5] = 0x22222222;
+             ctx->r[6] = 0x2000;
+           },
+           [](PPCContext* ctx) {
+             auto result = static_cast<uint32_t>(ctx->r[3]);
+             REQUIRE(result == 0x22222222);
+             result = *reinterpret_cast<uint32_t*>(ctx->membase + 0x2000);
+             REQUIRE(result == 0x33333333);
+           });
+}
+
+TEST_CASE("STORE_PARTIAL_OVERWRITE", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto address = LoadGPR(b, 4);
+    b.Store(address, b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+    b.Store(address, b.LoadConstant(static_cast<uint8_t>(0x33)));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0x2000;
+             ctx->r[5] = 0x22222222;
+           },
+           [](PPCContext* ctx) {
+             auto result = *reinterpret_cast<uint32_t*>(ctx->membase + 0x2000);
+             REQUIRE(result == 0x22222233);
+           });
+}
+
+TEST_CASE("STORE_ADDRESS_UPPER_BITS", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    // Only used as an address, so computed in 32 bits.
+    auto address = b.Add(LoadGPR(b, 4), LoadGPR(b, 5));
+    b.Store(address, b.Truncate(LoadGPR(b, 6), INT32_TYPE));
+    b.Store(b.Add(LoadGPR(b, 4), b.LoadConstant(static_cast<uint64_t>(0x1004))),
+            b.Truncate(LoadGPR(b, 6), INT32_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0xFFFFFFFF00001000ull;
+             ctx->r[5] = 0x1000;
+             ctx->r[6] = 0x22222222;
+           },
+           [](PPCContext* ctx) {
+             auto result = *reinterpret_cast<uint32_t*>(ctx->membase + 0x2000);
+             REQUIRE(result == 0x22222222);
+             result = *reinterpret_cast<uint32_t*>(ctx->membase + 0x2004);
+             REQUIRE(result == 0x22222222);
+           });
+}
+
+TEST_CASE("STORE_ADDRESS_ZERO_EXTENDED", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto address =
+        b.ZeroExtend(b.Truncate(LoadGPR(b, 4), INT32_TYPE), INT64_TYPE);
+    b.Store(address, b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+    StoreGPR(b, 3, b.ZeroExtend(b.Load(address, INT32_TYPE), INT64_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0xFFFFFFFF00002000ull;
+             ctx->r[5] = 0x22222222;
+           },
+           [](PPCContext* ctx) {
+             auto result = static_cast<uint32_t>(ctx->r[3]);
+             REQUIRE(result == 0x22222222);
+             result = *reinterpret_cast<uint32_t*>(ctx->membase + 0x2000);
+             REQUIRE(result == 0x22222222);
+           });
+}
+
+TEST_CASE("STORE_FORWARDED_SAME_BASE", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto address = LoadGPR(b, 4);
+    b.Store(address, b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+    b.Store(b.Add(address, b.LoadConstant(static_cast<uint64_t>(4))),
+            b.LoadConstant(0x33333333u));
+    StoreGPR(b, 3, b.ZeroExtend(b.Load(address, INT32_TYPE), INT64_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0x2000;
+             ctx->r[5] = 0x22222222;
+           },
+           [](PPCContext* ctx) {
+             auto result = static_cast<uint32_t>(ctx->r[3]);
+             REQUIRE(result == 0x22222222);
+           });
+}
+
+TEST_CASE("STORE_FORWARDED_PARTIAL_OVERLAP", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto address = LoadGPR(b, 4);
+    b.Store(address, b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+    b.Store(b.Add(address, b.LoadConstant(static_cast<uint64_t>(1))),
+            b.LoadConstant(static_cast<uint8_t>(0x33)));
+    StoreGPR(b, 3, b.ZeroExtend(b.Load(address, INT32_TYPE), INT64_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0x2000;
+             ctx->r[5] = 0x22222222;
+           },
+           [](PPCContext* ctx) {
+             auto result = static_cast<uint32_t>(ctx->r[3]);
+             REQUIRE(result == 0x22223322);
+           });
+}
+
+TEST_CASE("STORE_FORWARDED_MAY_ALIAS", "[instr]") {
+  TestFunction test([](hir::HIRBuilder& b) {
+    auto address = LoadGPR(b, 4);
+    b.Store(address, b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+    b.Store(LoadGPR(b, 6), b.LoadConstant(0x33333333u));
+    StoreGPR(b, 3, b.ZeroExtend(b.Load(address, INT32_TYPE), INT64_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {
+             ctx->r[4] = 0x2000;
+             ctx->r[5] = 0x22222222;
+             ctx->r[6] = 0x2000;
+           },
+           [](PPCContext* ctx) {
+             auto result = static_cast<uint32_t>(ctx->r[3]);
+             REQUIRE(result == 0x33333333);
+           });
+}
+
+TEST_CASE("STORE_NOT_FORWARDED_ACROSS_BARRIER", "[instr]") {
+  TestPasses passes([](compiler::Compiler& c) {
+    c.AddPass(
+        std::make_unique<compiler::passes::MemoryRedundancyEliminationPass>());
+  });
+  Value* forwarded = nullptr;
+  Value* reloaded = nullptr;
+  passes.Run([&](hir::HIRBuilder& b) {
+               auto address =
+                   b.Add(LoadGPR(b, 1), b.LoadConstant(uint64_t(16)));
+               b.Store(address, b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+               forwarded = b.Load(address, INT32_TYPE);
+               b.Barrier();
+               reloaded = b.Load(address, INT32_TYPE);
+               StoreGPR(b, 3, b.ZeroExtend(b.Add(forwarded, reloaded),
+                                           INT64_TYPE));
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(forwarded->def->opcode == &OPCODE_ASSIGN_info);
+               REQUIRE(reloaded->def->opcode == &OPCODE_LOAD_info);
+             });
+}
+
+TEST_CASE("STORE_NOT_FORWARDED_THROUGH_POINTER", "[instr]") {
+  // The pointer may be an MMIO register, so the reload must happen.
+  TestPasses passes([](compiler::Compiler& c) {
+    c.AddPass(
+        std::make_unique<compiler::passes::MemoryRedundancyEliminationPass>());
+  });
+  Value* reloaded = nullptr;
+  passes.Run([&](hir::HIRBuilder& b) {
+               auto address = LoadGPR(b, 4);
+               b.Store(address, b.Truncate(LoadGPR(b, 5), INT32_TYPE));
+               reloaded = b.Load(address, INT32_TYPE);
+               StoreGPR(b, 3, b.ZeroExtend(reloaded, INT64_TYPE));
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(reloaded->def->opcode == &OPCODE_LOAD_info);
+             });
+}
+
+TEST_CASE("STORE_KEPT_ACROSS_BARRIER", "[instr]") {
+  // eieio between two writes to the same (possibly MMIO) address.
+  TestPasses passes([](compiler::Compiler& c) {
+    c.AddPass(std::make_unique<compiler::passes::DeadStoreEliminationPass>());
+  });
+  Instr* first_store = nullptr;
+  passes.Run([&](hir::HIRBuilder& b) {
+               auto address = b.LoadConstant(uint64_t(0x40002000));
+               b.Store(address, b.LoadConstant(1u));
+               first_store = b.last_instr();
+               b.Barrier();
+               b.Store(address, b.LoadConstant(2u));
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(ContainsInstr(b, first_store));
+             });
+  passes.Run([&](hir::HIRBuilder& b) {
+               auto address = b.LoadConstant(uint64_t(0x40002000));
+               b.Store(address, b.LoadConstant(1u));
+               first_store = b.last_instr();
+               b.Store(address, b.LoadConstant(2u));
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(!ContainsInstr(b, first_store));
+             });
+}
+
+TEST_CASE("STORE_KEPT_TO_MMIO", "[instr]") {
+  TestPasses passes([](compiler::Compiler& c) {
+    c.AddPass(std::make_unique<compiler::passes::DeadStoreEliminationPass>());
+  });
+  Instr* constant_store = nullptr;
+  Instr* pointer_store = nullptr;
+  passes.Run([&](hir::HIRBuilder& b) {
+               auto address = b.LoadConstant(uint64_t(0x7FC80000));
+               b.Store(address, b.LoadConstant(1u));
+               constant_store = b.last_instr();
+               b.Store(address, b.LoadConstant(2u));
+               auto pointer = LoadGPR(b, 4);
+               b.Store(pointer, b.LoadConstant(1u));
+               pointer_store = b.last_instr();
+               b.Store(pointer, b.LoadConstant(2u));
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(ContainsInstr(b, constant_store));
+               REQUIRE(ContainsInstr(b, pointer_store));
+             });
+}
+
+TEST_CASE("STORE_CONTEXT_CR_DROPPED_BEFORE_CALL", "[instr]") {
+  // Only with the flag, and only direct calls are trusted to follow the ABI.
+  // Returns and indirect branches may land in code that reads cr0.
+  ScopedFlag<bool> drop_flag(&FLAGS_drop_call_clobbered_context, true);
+  TestPasses passes([](compiler::Compiler& c) {
+    c.AddPass(std::make_unique<compiler::passes::ContextPromotionPass>());
+  });
+  FunctionInfo callee(nullptr, 0x1000);
+  Instr* cr0_store = nullptr;
+  Instr* cr2_store = nullptr;
+  auto store_crs = [&](hir::HIRBuilder& b) {
+    auto eq = b.IsTrue(LoadGPR(b, 3));
+    b.StoreContext(offsetof(PPCContext, cr0.cr0_eq), eq);
+    cr0_store = b.last_instr();
+    b.StoreContext(offsetof(PPCContext, cr2.cr2_2), eq);
+    cr2_store = b.last_instr();
+  };
+  passes.Run([&](hir::HIRBuilder& b) {
+               store_crs(b);
+               b.Call(&callee);
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(!ContainsInstr(b, cr0_store));
+               REQUIRE(ContainsInstr(b, cr2_store));
+             });
+  passes.Run([&](hir::HIRBuilder& b) {
+               store_crs(b);
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(ContainsInstr(b, cr0_store));
+             });
+  passes.Run([&](hir::HIRBuilder& b) {
+               store_crs(b);
+               b.CallIndirect(LoadGPR(b, 4), CALL_TAIL);
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(ContainsInstr(b, cr0_store));
+             });
+  passes.Run([&](hir::HIRBuilder& b) {
+               store_crs(b);
+               b.CallIndirect(LoadGPR(b, 4));
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(ContainsInstr(b, cr0_store));
+             });
+
+  FLAGS_drop_call_clobbered_context = false;
+  passes.Run([&](hir::HIRBuilder& b) {
+               store_crs(b);
+               b.Call(&callee);
+               b.Return();
+             },
+             [&](hir::HIRBuilder& b) {
+               REQUIRE(ContainsInstr(b, cr0_store));
+             });
+}
@@ -12,6 +12,8 @@
 
 #include "alloy/alloy.h"
 #include "alloy/backend/x64/x64_backend.h"
+#include "alloy/compiler/compiler.h"
+#include "alloy/compiler/compiler_passes.h"
 #include "alloy/frontend/ppc/ppc_context.h"
 #include "alloy/frontend/ppc/ppc_frontend.h"
 #include "alloy/hir/hir_builder.h"
@@ -142,6 +144,124 @@ class TestFunction {
   std::vector<std::unique_ptr<Runtime>> runtimes;
 };
 
+// Runs only the given passes over generated HIR, for tests of what a pass
+// does to the HIR rather than of what the resulting code computes.
+class TestPasses {
+ public:
+  TestPasses(std::function<void(compiler::Compiler& c)> add_passes) {
+    memory.reset(new SimpleMemory(64 * 1024));
+    runtime.reset(new Runtime(memory.get()));
+    runtime->Initialize(
+        std::make_unique<alloy::frontend::ppc::PPCFrontend>(runtime.get()),
+        std::make_unique<alloy::backend::x64::X64Backend>(runtime.get()));
+    compiler.reset(new compiler::Compiler(runtime.get()));
+    add_passes(*compiler);
+  }
+
+  void Run(std::function<void(hir::HIRBuilder& b)> generator,
+           std::function<void(hir::HIRBuilder& b)> check) {
+    hir::HIRBuilder builder;
+    generator(builder);
+    REQUIRE(compiler->Compile(&builder) == 0);
+    check(builder);
+    compiler->Reset();
+  }
+
+  std::unique_ptr<Memory> memory;
+  std::unique_ptr<Runtime> runtime;
+  std::unique_ptr<compiler::Compiler> compiler;
+};
+
+// Runtime with raw PPC code in guest memory, for tests of what the frontend
+// makes of it.
+class TestGuestCode {
+ public:
+  TestGuestCode() {
+    memory.reset(new SimpleMemory(64 * 1024));
+    runtime.reset(new Runtime(memory.get()));
+    runtime->Initialize(
+        std::make_unique<alloy::frontend::ppc::PPCFrontend>(runtime.get()),
+        std::make_unique<alloy::backend::x64::X64Backend>(runtime.get()));
+    runtime->AddModule(std::make_unique<Module>(runtime.get()));
+  }
+
+  // Writes the instructions starting at the address.
+  void Write(uint64_t address, std::initializer_list<uint32_t> code) {
+    for (uint32_t instr : code) {
+      poly::store_and_swap<uint32_t>(memory->Translate(address), instr);
+      address += 4;
+    }
+  }
+
+  alloy::frontend::ppc::PPCFrontend* frontend() const {
+    return static_cast<alloy::frontend::ppc::PPCFrontend*>(
+        runtime->frontend());
+  }
+
+  std::unique_ptr<Memory> memory;
+  std::unique_ptr<Runtime> runtime;
+
+ private:
+  // All code goes in [0x1000, 0x8000).
+  class Module : public alloy::runtime::Module {
+   public:
+    Module(Runtime* runtime)
+        : alloy::runtime::Module(runtime), name_("TestGuestCode") {}
+    const std::string& name() const override { return name_; }
+    bool ContainsAddress(uint64_t address) override {
+      return address >= 0x1000 && address < 0x8000;
+    }
+    bool GetCodeRange(uint64_t* out_low_address,
+                      uint64_t* out_high_address) override {
+      *out_low_address = 0x1000;
+      *out_high_address = 0x8000;
+      return true;
+    }
+
+   private:
+    std::string name_;
+  };
+};
+
+// Sets a flag for the lifetime of the object, so that a failing REQUIRE
+// can't leak the value into later tests.
+template <typename T>
+class ScopedFlag {
+ public:
+  ScopedFlag(T* flag, T value) : flag_(flag), old_value_(*flag) {
+    *flag_ = value;
+  }
+  ~ScopedFlag() { *flag_ = old_value_; }
+
+ private:
+  T* flag_;
+  T old_value_;
+};
+
+// Whether the instruction is still in the function.
+inline bool ContainsInstr(hir::HIRBuilder& b, const hir::Instr* instr) {
+  for (auto block = b.first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i == instr) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+inline size_t CountInstrs(hir::HIRBuilder& b, const hir::OpcodeInfo* opcode) {
+  size_t count = 0;
+  for (auto block = b.first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == opcode) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
 inline hir::Value* LoadGPR(hir::HIRBuilder& b, int reg) {
   return b.LoadContext(offsetof(PPCContext, r) + reg * 8, hir::INT64_TYPE);
 }
@@ -19,6 +19,9 @@ DECLARE_bool(trace_instructions);
 DECLARE_bool(trace_registers);
 DECLARE_string(load_module_map);
 
+DECLARE_bool(precompile_modules);
+DECLARE_bool(invalidate_code_on_write);
+
 DECLARE_string(dump_path);
 DECLARE_bool(dump_module_map);
 
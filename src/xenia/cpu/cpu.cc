@@ -22,6 +22,15 @@ DEFINE_string(
     "Loads a .map for symbol names and to diff with the generated symbol "
     "database.");
 
+// Translation:
+DEFINE_bool(precompile_modules, false,
+            "Translate all functions reachable from the entry point, imports "
+            "and .pdata of each module when it is loaded.");
+DEFINE_bool(invalidate_code_on_write, true,
+            "Write-protect guest module code once translated and retranslate "
+            "it when it is overwritten (overlays, runtime decompression, "
+            "reloads). Every watched page slows down all write faults.");
+
 // Dumping:
 DEFINE_string(dump_path, "build/",
               "Directory that dump files are placed into.");
@@ -107,11 +107,16 @@ int Processor::Setup() {
 int Processor::Execute(XenonThreadState* thread_state, uint64_t address) {
   SCOPE_profile_cpu_f("cpu");
 
+  // Keeps the function from being freed if its code gets invalidated before
+  // the call starts.
+  runtime_->BeginGuestCall(thread_state);
+
   // Attempt to get the function.
   Function* fn;
   if (runtime_->ResolveFunction(address, &fn)) {
     // Symbol not found in any module.
     XELOGCPU("Execute(%.8X): failed to find function", address);
+    runtime_->EndGuestCall(thread_state);
     return 1;
   }
 
@@ -126,6 +131,7 @@ int Processor::Execute(XenonThreadState* thread_state, uint64_t address) {
 
   // Execute the function.
   fn->Call(thread_state, lr);
+  runtime_->EndGuestCall(thread_state);
   return 0;
 }
 
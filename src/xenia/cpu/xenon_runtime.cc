@@ -10,11 +10,19 @@
 #include "xenia/cpu/xenon_runtime.h"
 
 #include "alloy/frontend/ppc/ppc_frontend.h"
+#include "xenia/cpu/cpu-private.h"
 #include "xenia/cpu/xenon_thread_state.h"
 
 using namespace xe;
 using namespace xe::cpu;
 
+using alloy::runtime::FunctionInfo;
+
+namespace {
+// Granularity of write watches (the host page size).
+const uint32_t kCodeWatchPageSize = 4096;
+}  // namespace
+
 XenonRuntime::XenonRuntime(Memory* memory, ExportResolver* export_resolver,
                            uint32_t debug_info_flags, uint32_t trace_flags)
     : Runtime(memory, debug_info_flags, trace_flags),
@@ -33,3 +41,47 @@ int XenonRuntime::Initialize(std::unique_ptr<alloy::backend::Backend> backend) {
 
   return result;
 }
+
+void XenonRuntime::WatchFunctionCode(FunctionInfo* symbol_info) {
+  if (!FLAGS_invalidate_code_on_write ||
+      symbol_info->behavior() == FunctionInfo::BEHAVIOR_EXTERN) {
+    return;
+  }
+  // Only module code is watched. The pages of functions spilling out of it
+  // are likely shared with data that is written all the time.
+  uint64_t low_address;
+  uint64_t high_address;
+  if (!symbol_info->module()->GetCodeRange(&low_address, &high_address) ||
+      symbol_info->address() < low_address ||
+      symbol_info->end_address() + 4 > high_address) {
+    return;
+  }
+  auto memory = static_cast<Memory*>(memory_);
+  uint32_t start_page = static_cast<uint32_t>(symbol_info->address()) &
+                        ~(kCodeWatchPageSize - 1);
+  uint32_t end_address = static_cast<uint32_t>(symbol_info->end_address()) + 4;
+  std::lock_guard<std::mutex> guard(code_watch_lock_);
+  for (uint32_t page = start_page; page < end_address;
+       page += kCodeWatchPageSize) {
+    if (!watched_code_pages_.insert(page).second) {
+      continue;
+    }
+    memory->AddWriteWatch(page, kCodeWatchPageSize, OnCodePageWritten, this,
+                          reinterpret_cast<void*>(uintptr_t(page)));
+  }
+}
+
+void XenonRuntime::OnCodePageWritten(void* context_ptr, void* data_ptr,
+                                     uint32_t address) {
+  auto self = reinterpret_cast<XenonRuntime*>(context_ptr);
+  auto page = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(data_ptr));
+  {
+    // The watch is gone now; functions regenerated from the page add it back.
+    std::lock_guard<std::mutex> guard(self->code_watch_lock_);
+    self->watched_code_pages_.erase(page);
+  }
+  // This runs before the write lands. If another thread regenerates one of
+  // the functions first, the page is watched again and the retried write
+  // invalidates it once more.
+  self->InvalidateCode(page, kCodeWatchPageSize);
+}
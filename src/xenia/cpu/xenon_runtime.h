@@ -10,6 +10,9 @@
 #ifndef XENIA_CPU_XENON_RUNTIME_H_
 #define XENIA_CPU_XENON_RUNTIME_H_
 
+#include <mutex>
+#include <unordered_set>
+
 #include "alloy/runtime/runtime.h"
 #include "xenia/common.h"
 #include "xenia/cpu/xenon_thread_state.h"
@@ -31,8 +34,19 @@ class XenonRuntime : public alloy::runtime::Runtime {
 
   virtual int Initialize(std::unique_ptr<alloy::backend::Backend> backend = 0);
 
+ protected:
+  void WatchFunctionCode(alloy::runtime::FunctionInfo* symbol_info) override;
+
  private:
+  static void OnCodePageWritten(void* context_ptr, void* data_ptr,
+                                uint32_t address);
+
   ExportResolver* export_resolver_;
+
+  // Guest pages holding translated code that are write protected. Watches
+  // are one-shot, so pages drop out of here when written.
+  std::mutex code_watch_lock_;
+  std::unordered_set<uint32_t> watched_code_pages_;
 };
 
 }  // namespace cpu
@@ -12,6 +12,8 @@
 #include <algorithm>
 
 #include "poly/math.h"
+#include "poly/string.h"
+#include "poly/threading.h"
 #include "xenia/cpu/cpu-private.h"
 #include "xenia/cpu/xenon_runtime.h"
 #include "xenia/export_resolver.h"
@@ -83,6 +85,19 @@ int XexModule::Load(const std::string& name, const std::string& path, xe_xex2_re
   path_ = std::string(path);
   // TODO(benvanik): debug info
 
+  // Open the persistent code cache, keyed by the module contents. The header
+  // digest covers the section digests so it identifies the whole image.
+  // This is optional - if it fails we just translate everything.
+  std::string cache_key = poly::find_name_from_path(name_) + "_";
+  char digest_str[3];
+  for (size_t n = 0; n < poly::countof(header->loader_info.header_digest);
+       n++) {
+    snprintf(digest_str, poly::countof(digest_str), "%.2X",
+             header->loader_info.header_digest[n]);
+    cache_key += digest_str;
+  }
+  runtime_->OpenCodeCache(this, cache_key);
+
   // Load a specified module map and diff.
   if (FLAGS_load_module_map.size()) {
     ReadMap(FLAGS_load_module_map.c_str());
@@ -205,10 +220,63 @@ int XexModule::SetupLibraryImports(const xe_xex2_import_library_t* library) {
   return 0;
 }
 
+int XexModule::Precompile() {
+  SCOPE_profile_cpu_f("cpu");
+
+  CompileQueue* compile_queue = runtime_->compile_queue();
+  const xe_xex2_header_t* header = xe_xex2_get_header(xex_);
+  uint64_t start_ticks = poly::threading::ticks();
+
+  // Roots: everything declared so far (import thunks, save/restore helpers,
+  // anything from a module map), the entry point and every function with
+  // unwind info. Direct callees of each are found as they are compiled.
+  std::vector<uint64_t> addresses;
+  ForEachFunction([&](FunctionInfo* symbol_info) {
+    addresses.push_back(symbol_info->address());
+  });
+  if (header->exe_entry_point) {
+    addresses.push_back(header->exe_entry_point);
+  }
+  const PESection* pdata = xe_xex2_get_pe_section(xex_, ".pdata");
+  if (pdata) {
+    // IMAGE_CE_RUNTIME_FUNCTION_ENTRY[]: begin address + packed lengths/flags.
+    const uint8_t* p = memory()->Translate(pdata->address);
+    for (size_t offset = 0; offset + 8 <= pdata->size; offset += 8) {
+      uint32_t begin_address = poly::load_and_swap<uint32_t>(p + offset);
+      if (ContainsAddress(begin_address)) {
+        addresses.push_back(begin_address);
+      }
+    }
+  }
+
+  auto start_stats = compile_queue->precompile_stats();
+  for (uint64_t address : addresses) {
+    compile_queue->Enqueue(address, CompileQueue::PRIORITY_PRECOMPILE);
+  }
+  compile_queue->Drain();
+  auto end_stats = compile_queue->precompile_stats();
+
+  double elapsed = double(poly::threading::ticks() - start_ticks) /
+                   poly::threading::ticks_per_second();
+  XELOGI("Precompiled %s: %d functions found, %d compiled, %d failed in %.3fs",
+         name_.c_str(),
+         int(end_stats.found_count - start_stats.found_count),
+         int(end_stats.compiled_count - start_stats.compiled_count),
+         int(end_stats.failed_count - start_stats.failed_count), elapsed);
+  return 0;
+}
+
 bool XexModule::ContainsAddress(uint64_t address) {
   return address >= low_address_ && address < high_address_;
 }
 
+bool XexModule::GetCodeRange(uint64_t* out_low_address,
+                             uint64_t* out_high_address) {
+  *out_low_address = low_address_;
+  *out_high_address = high_address_;
+  return true;
+}
+
 int XexModule::FindSaveRest() {
   // Special stack save/restore functions.
   // http://research.microsoft.com/en-us/um/redmond/projects/invisible/src/crt/md/ppc/xxx.s.htm
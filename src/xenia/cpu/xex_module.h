@@ -30,9 +30,16 @@ public:
 
   int Load(const std::string& name, const std::string& path, xe_xex2_ref xex);
 
+  // Translates every function that can be found statically, in parallel on
+  // the runtime compile queue. Must be called after the module is added to
+  // the runtime.
+  int Precompile();
+
   const std::string& name() const override { return name_; }
 
   bool ContainsAddress(uint64_t address) override;
+  bool GetCodeRange(uint64_t* out_low_address,
+                    uint64_t* out_high_address) override;
 
 private:
   int SetupImports(xe_xex2_ref xex);
@@ -11,6 +11,7 @@
 
 #include "xenia/emulator.h"
 #include "xenia/cpu/cpu.h"
+#include "xenia/cpu/cpu-private.h"
 #include "xenia/kernel/objects/xfile.h"
 #include "xenia/kernel/objects/xthread.h"
 
@@ -136,10 +137,15 @@ X_STATUS XUserModule::LoadFromMemory(const void* addr, const size_t length) {
   if (xex_module->Load(name_, path_, xex_)) {
     return X_STATUS_UNSUCCESSFUL;
   }
+  XexModule* xex_module_ptr = xex_module.get();
   if (runtime->AddModule(std::move(xex_module))) {
     return X_STATUS_UNSUCCESSFUL;
   }
 
+  if (FLAGS_precompile_modules) {
+    xex_module_ptr->Precompile();
+  }
+
   OnLoad();
 
   return X_STATUS_SUCCESS;
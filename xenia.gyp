@@ -293,6 +293,7 @@
         'gflags',
         'llvm',
         'libpoly',
+        'xxhash',
       ],
 
       'conditions': [
@@ -315,6 +316,7 @@
         'gflags',
         'llvm',
         'libpoly',
+        'xxhash',
       ],
 
       'direct_dependent_settings': {